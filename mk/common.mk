@@ -16,6 +16,7 @@ SED = sed
 INSTALL = install
 INSTALL_SCRIPTS = $(INSTALL) -p -m 0755
 INSTALL_PROGRAMS = $(INSTALL) -p -m 0755
+INSTALL_LIBRARIES = $(INSTALL) -p -m 0755
 INSTALL_DATA = $(INSTALL) -p -m 0644
 MKDIR_P = $(INSTALL) -d -m 0755
 
@@ -53,3 +54,11 @@ $1:	_c_opts = $(foreach O,CPP C LD, $$(AM_$(O)FLAGS) $$($(O)FLAGS) $$($1_$(O)FLA
 $1:	$$($1_SOURCES) $$($1_LDADD)
 	$$(CC) $$(_c_opts) $$(filter %.c,$$^) -o $$@ $$(AM_LIBS) $$(LIBS) $$($1_LDADD)
 endef
+
+## $(call build_c_shlib,<name>); unresolved symbols are allowed because
+## they can be provided by the loading program
+define build_c_shlib
+$1:	_c_opts = $(foreach O,CPP C LD, $$(AM_$(O)FLAGS) $$($(O)FLAGS) $$($1_$(O)FLAGS))
+$1:	$$($1_SOURCES) $$($1_LDADD)
+	$$(CC) $$(_c_opts) -shared -fPIC $$(filter %.c,$$^) -o $$@ $$(AM_LIBS) $$(LIBS) $$($1_LDADD)
+endef
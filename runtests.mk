@@ -4,7 +4,7 @@ PATH := ${pkglibexecdir}:${PATH}
 export pkgdatadir pkglibexecdir pkglibdir TMPDIR
 
 test-%:
-	$(RUNTEST) --id "$(ID)" $(RUNTEST_OPTS) $(TESTDIR)/$* || :
+	$(RUNTEST) --id "$(ID)" $(RUNTEST_GLOBAL_OPTS) $(RUNTEST_OPTS) $(TESTDIR)/$* || :
 
 category_start-%:
 	@echo "========== $* =========="
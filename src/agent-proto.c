@@ -0,0 +1,384 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "agent-proto.h"
+
+#include <assert.h>
+#include <endian.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/uio.h>
+
+#include "util.h"
+
+#define AGENT_RDBUF_CHUNK	(16 * 1024)
+
+struct fletcher16 {
+	uint16_t	a;
+	uint16_t	b;
+};
+
+static void fletcher16_update(struct fletcher16 *f, void const *data,
+			      size_t len)
+{
+	unsigned char const	*p = data;
+	uint32_t		a = f->a;
+	uint32_t		b = f->b;
+
+	while (len > 0) {
+		/* 5802 iterations keep the sums below 2^32 */
+		size_t	n = len > 5802 ? 5802 : len;
+
+		len -= n;
+		while (n-- > 0) {
+			a += *p++;
+			b += a;
+		}
+
+		a %= 255;
+		b %= 255;
+	}
+
+	f->a = a;
+	f->b = b;
+}
+
+static uint16_t agent_csum(struct agent_frame_hdr const *hdr,
+			   void const *payload[], size_t const len[],
+			   size_t cnt)
+{
+	struct agent_frame_hdr	tmp = *hdr;
+	struct fletcher16	f = { 0, 0 };
+	size_t			i;
+
+	tmp.csum = 0;
+	fletcher16_update(&f, &tmp, sizeof tmp);
+	for (i = 0; i < cnt; ++i)
+		fletcher16_update(&f, payload[i], len[i]);
+
+	return (f.b << 8) | f.a;
+}
+
+/* fills 'hdr' and returns the payload length */
+static size_t agent_hdr_init(struct agent_frame_hdr *hdr,
+			     enum agent_frame_type type, unsigned int chan,
+			     void const *payload[], size_t const len[],
+			     size_t cnt)
+{
+	size_t			total = 0;
+	size_t			i;
+
+	for (i = 0; i < cnt; ++i)
+		total += len[i];
+
+	assert(total <= AGENT_MAX_PAYLOAD);
+
+	*hdr = (struct agent_frame_hdr) {
+		.sync	= AGENT_SYNC,
+		.type	= type,
+		.chan	= htole16(chan),
+		.len	= htole32(total),
+	};
+
+	hdr->csum = htole16(agent_csum(hdr, payload, len, cnt));
+
+	return total;
+}
+
+bool agent_sendv(int fd, enum agent_frame_type type, unsigned int chan,
+		 void const *payload[], size_t const len[], size_t cnt)
+{
+	struct agent_frame_hdr	hdr;
+	struct iovec		iov[cnt + 1];
+	size_t			total;
+	size_t			i;
+
+	total = agent_hdr_init(&hdr, type, chan, payload, len, cnt);
+
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len  = sizeof hdr;
+	for (i = 0; i < cnt; ++i) {
+		iov[i + 1].iov_base = (void *)payload[i];
+		iov[i + 1].iov_len  = len[i];
+	}
+
+	total += sizeof hdr;
+	i = 0;
+	while (total > 0) {
+		ssize_t	l = writev(fd, &iov[i], cnt + 1 - i);
+
+		if (l < 0 && errno == EINTR)
+			continue;
+		else if (l < 0) {
+			if (errno != EPIPE)
+				perror("writev(<agent>)");
+			return false;
+		}
+
+		total -= l;
+		while (l > 0) {
+			if ((size_t)l >= iov[i].iov_len) {
+				l -= iov[i].iov_len;
+				++i;
+			} else {
+				iov[i].iov_base += l;
+				iov[i].iov_len  -= l;
+				l = 0;
+			}
+		}
+	}
+
+	return true;
+}
+
+bool agent_send(int fd, enum agent_frame_type type, unsigned int chan,
+		void const *payload, size_t len)
+{
+	return agent_sendv(fd, type, chan, &payload, &len, 1);
+}
+
+void agent_wrbuf_init(struct agent_wrbuf *buf)
+{
+	*buf = (struct agent_wrbuf) { .data = NULL };
+}
+
+void agent_wrbuf_free(struct agent_wrbuf *buf)
+{
+	free(buf->data);
+	buf->data = NULL;
+}
+
+static bool agent_wrbuf_append(struct agent_wrbuf *buf, void const *data,
+			       size_t len)
+{
+	if (buf->sent > 0 && buf->alloc - buf->len < len) {
+		memmove(buf->data, buf->data + buf->sent, buf->len - buf->sent);
+		buf->len -= buf->sent;
+		buf->sent = 0;
+	}
+
+	if (buf->alloc - buf->len < len) {
+		size_t	sz = buf->len + len + AGENT_RDBUF_CHUNK;
+		void	*tmp = realloc(buf->data, sz);
+
+		if (!tmp) {
+			perror("realloc(<wrbuf>)");
+			return false;
+		}
+
+		buf->data  = tmp;
+		buf->alloc = sz;
+	}
+
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+
+	return true;
+}
+
+bool agent_queuev(struct agent_wrbuf *buf, enum agent_frame_type type,
+		  unsigned int chan, void const *payload[],
+		  size_t const len[], size_t cnt)
+{
+	struct agent_frame_hdr	hdr;
+	size_t			i;
+
+	agent_hdr_init(&hdr, type, chan, payload, len, cnt);
+
+	if (!agent_wrbuf_append(buf, &hdr, sizeof hdr))
+		return false;
+
+	for (i = 0; i < cnt; ++i) {
+		if (!agent_wrbuf_append(buf, payload[i], len[i]))
+			return false;
+	}
+
+	return true;
+}
+
+bool agent_queue(struct agent_wrbuf *buf, enum agent_frame_type type,
+		 unsigned int chan, void const *payload, size_t len)
+{
+	return agent_queuev(buf, type, chan, &payload, &len, 1);
+}
+
+bool agent_wrbuf_flush(struct agent_wrbuf *buf, int fd)
+{
+	while (buf->sent < buf->len) {
+		ssize_t	l = write(fd, buf->data + buf->sent,
+				  buf->len - buf->sent);
+
+		if (l < 0 && errno == EINTR)
+			continue;
+		else if (l < 0 && errno == EAGAIN)
+			return true;
+		else if (l < 0) {
+			if (errno != EPIPE)
+				perror("write(<agent>)");
+			return false;
+		}
+
+		buf->sent += l;
+	}
+
+	buf->len  = 0;
+	buf->sent = 0;
+
+	return true;
+}
+
+void agent_rdbuf_init(struct agent_rdbuf *buf)
+{
+	*buf = (struct agent_rdbuf) { .data = NULL };
+}
+
+void agent_rdbuf_free(struct agent_rdbuf *buf)
+{
+	free(buf->data);
+	buf->data = NULL;
+}
+
+ssize_t agent_rdbuf_fill(struct agent_rdbuf *buf, int fd)
+{
+	ssize_t		l;
+
+	if (buf->consumed > 0) {
+		memmove(buf->data, buf->data + buf->consumed,
+			buf->len - buf->consumed);
+		buf->len -= buf->consumed;
+		buf->consumed = 0;
+	}
+
+	if (buf->alloc - buf->len < AGENT_RDBUF_CHUNK) {
+		size_t	sz = buf->alloc + AGENT_RDBUF_CHUNK;
+		void	*tmp = realloc(buf->data, sz);
+
+		if (!tmp) {
+			perror("realloc(<rdbuf>)");
+			return -1;
+		}
+
+		buf->data  = tmp;
+		buf->alloc = sz;
+	}
+
+	do {
+		l = read(fd, buf->data + buf->len, buf->alloc - buf->len);
+	} while (l < 0 && errno == EINTR);
+
+	if (l > 0)
+		buf->len += l;
+
+	return l;
+}
+
+bool agent_rdbuf_next(struct agent_rdbuf *buf, struct agent_frame *frame)
+{
+	for (;;) {
+		unsigned char const	*p = buf->data + buf->consumed;
+		size_t			avail = buf->len - buf->consumed;
+		struct agent_frame_hdr	hdr;
+		void const		*payload;
+		size_t			len;
+
+		if (avail < sizeof hdr)
+			return false;
+
+		memcpy(&hdr, p, sizeof hdr);
+		hdr.chan = le16toh(hdr.chan);
+		hdr.len  = le32toh(hdr.len);
+		hdr.csum = le16toh(hdr.csum);
+
+		if (hdr.sync != AGENT_SYNC || hdr.len > AGENT_MAX_PAYLOAD)
+			goto resync;
+
+		if (avail < sizeof hdr + hdr.len)
+			return false;
+
+		payload = p + sizeof hdr;
+		len = hdr.len;
+
+		{
+			struct agent_frame_hdr	raw;
+
+			memcpy(&raw, p, sizeof raw);
+			if (agent_csum(&raw, &payload, &len, 1) != hdr.csum)
+				goto resync;
+		}
+
+		buf->consumed += sizeof hdr + hdr.len;
+
+		frame->hdr = hdr;
+		frame->payload = payload;
+		return true;
+
+	resync:
+		/* skip to the next sync byte */
+		++buf->num_resync;
+		++buf->consumed;
+		p = memchr(buf->data + buf->consumed, AGENT_SYNC,
+			   buf->len - buf->consumed);
+		buf->consumed = p ? (size_t)(p - buf->data) : buf->len;
+	}
+}
+
+static uint64_t tv_to_us(struct timeval const *tv)
+{
+	return (uint64_t)tv->tv_sec * 1000000u + tv->tv_usec;
+}
+
+static void us_to_tv(struct timeval *tv, uint64_t us)
+{
+	tv->tv_sec  = us / 1000000u;
+	tv->tv_usec = us % 1000000u;
+}
+
+void agent_exit_pack(struct agent_exit *ex, int status,
+		     struct rusage const *ru)
+{
+	*ex = (struct agent_exit) {
+		.status		= htole32(status),
+		.utime_us	= htole64(tv_to_us(&ru->ru_utime)),
+		.stime_us	= htole64(tv_to_us(&ru->ru_stime)),
+		.maxrss_kb	= htole64(ru->ru_maxrss),
+		.minflt		= htole64(ru->ru_minflt),
+		.majflt		= htole64(ru->ru_majflt),
+		.nvcsw		= htole64(ru->ru_nvcsw),
+		.nivcsw		= htole64(ru->ru_nivcsw),
+		.inblock	= htole64(ru->ru_inblock),
+		.oublock	= htole64(ru->ru_oublock),
+	};
+}
+
+void agent_exit_unpack(struct agent_exit const *ex, int *status,
+		       struct rusage *ru)
+{
+	memset(ru, 0, sizeof *ru);
+
+	*status = (int32_t)le32toh(ex->status);
+	us_to_tv(&ru->ru_utime, le64toh(ex->utime_us));
+	us_to_tv(&ru->ru_stime, le64toh(ex->stime_us));
+	ru->ru_maxrss  = le64toh(ex->maxrss_kb);
+	ru->ru_minflt  = le64toh(ex->minflt);
+	ru->ru_majflt  = le64toh(ex->majflt);
+	ru->ru_nvcsw   = le64toh(ex->nvcsw);
+	ru->ru_nivcsw  = le64toh(ex->nivcsw);
+	ru->ru_inblock = le64toh(ex->inblock);
+	ru->ru_oublock = le64toh(ex->oublock);
+}
@@ -0,0 +1,142 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_TESTSUITE_SRC_AGENT_PROTO_H
+#define H_ENSC_TESTSUITE_SRC_AGENT_PROTO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+/* Frames exchanged between runtest, the mux and the target agent.  The
+ * header is protected by a checksum so that a receiver on a serial line
+ * can resynchronize by searching the next AGENT_SYNC byte.  All integers
+ * are little endian.  'chan' identifies a single test; it is chosen by
+ * the sender of AGENT_FRAME_SPAWN and echoed in all frames belonging to
+ * that test. */
+struct agent_frame_hdr {
+	uint8_t			sync;
+	uint8_t			type;
+	uint16_t		chan;
+	uint32_t		len;
+	uint16_t		csum;	/* fletcher16 of header + payload */
+	uint16_t		_rsrv;
+} __attribute__((__packed__));
+
+#define AGENT_SYNC		0xa5u
+#define AGENT_MAX_PAYLOAD	(64 * 1024)
+
+enum agent_frame_type {
+	/* host -> agent */
+	AGENT_FRAME_SPAWN = 1,	/* struct agent_spawn, script, argv */
+	AGENT_FRAME_KILL,	/* u32 signal */
+	AGENT_FRAME_EXTEND,	/* u32 seconds added to the timeout */
+
+	/* agent -> host */
+	AGENT_FRAME_STDOUT = 0x10,
+	AGENT_FRAME_STDERR,
+	AGENT_FRAME_EXIT,	/* struct agent_exit */
+	AGENT_FRAME_ERROR,	/* message */
+	AGENT_FRAME_TIMEOUT,	/* empty; the test is being terminated */
+};
+
+/* followed by 'script_len' bytes of script and 'argc' NUL terminated
+ * strings; a non-empty script replaces argv[0] on the target */
+struct agent_spawn {
+	uint32_t		timeout;
+	uint32_t		script_len;
+	uint32_t		argc;
+} __attribute__((__packed__));
+
+struct agent_exit {
+	int32_t			status;
+	uint64_t		utime_us;
+	uint64_t		stime_us;
+	uint64_t		maxrss_kb;
+	uint64_t		minflt;
+	uint64_t		majflt;
+	uint64_t		nvcsw;
+	uint64_t		nivcsw;
+	uint64_t		inblock;
+	uint64_t		oublock;
+} __attribute__((__packed__));
+
+struct agent_frame {
+	struct agent_frame_hdr	hdr;	/* converted to host byte order */
+	unsigned char const	*payload;
+};
+
+/* reassembles frames from a byte stream */
+struct agent_rdbuf {
+	unsigned char		*data;
+	size_t			len;
+	size_t			alloc;
+	size_t			consumed;
+
+	unsigned long		num_resync;
+};
+
+void agent_rdbuf_init(struct agent_rdbuf *buf);
+void agent_rdbuf_free(struct agent_rdbuf *buf);
+
+/* reads available data from 'fd'; returns 0 on EOF, <0 on errors */
+ssize_t agent_rdbuf_fill(struct agent_rdbuf *buf, int fd);
+
+/* returns the next complete frame; it is valid until the next
+ * agent_rdbuf_fill() */
+bool agent_rdbuf_next(struct agent_rdbuf *buf, struct agent_frame *frame);
+
+/* queue of frames for a non-blocking fd */
+struct agent_wrbuf {
+	unsigned char		*data;
+	size_t			len;
+	size_t			alloc;
+	size_t			sent;
+};
+
+static inline size_t agent_wrbuf_pending(struct agent_wrbuf const *buf)
+{
+	return buf->len - buf->sent;
+}
+
+void agent_wrbuf_init(struct agent_wrbuf *buf);
+void agent_wrbuf_free(struct agent_wrbuf *buf);
+
+/* append a frame to the queue; fail only when out of memory */
+bool agent_queue(struct agent_wrbuf *buf, enum agent_frame_type type,
+		 unsigned int chan, void const *payload, size_t len);
+bool agent_queuev(struct agent_wrbuf *buf, enum agent_frame_type type,
+		  unsigned int chan, void const *payload[],
+		  size_t const len[], size_t cnt);
+
+/* writes as much of the queue as 'fd' accepts without blocking; returns
+ * false on errors other than EAGAIN */
+bool agent_wrbuf_flush(struct agent_wrbuf *buf, int fd);
+
+/* blocking variants for a single writer */
+bool agent_send(int fd, enum agent_frame_type type, unsigned int chan,
+		void const *payload, size_t len);
+bool agent_sendv(int fd, enum agent_frame_type type, unsigned int chan,
+		 void const *payload[], size_t const len[], size_t cnt);
+
+void agent_exit_pack(struct agent_exit *ex, int status,
+		     struct rusage const *ru);
+void agent_exit_unpack(struct agent_exit const *ex, int *status,
+		       struct rusage *ru);
+
+#endif	/* H_ENSC_TESTSUITE_SRC_AGENT_PROTO_H */
@@ -0,0 +1,173 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "baseline.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
+/* absolute slack so that very short or small tests do not trigger on
+ * noise */
+#define BASELINE_MIN_SLACK_MS	20.0
+#define BASELINE_MIN_SLACK_KB	512
+
+bool baseline_parse_tolerance(struct baseline_tolerance *tol,
+			      char const *spec)
+{
+	char		*tmp = strdup(spec);
+	char		*ptr = tmp;
+	char		*tok;
+	bool		rc = true;
+
+	if (!tmp)
+		return false;
+
+	while ((tok = strsep(&ptr, ",")) != NULL) {
+		char		*val = strchr(tok, '=');
+		char		*err;
+		unsigned long	v;
+
+		if (*tok == '\0')
+			continue;
+
+		if (!val) {
+			rc = false;
+			break;
+		}
+
+		*val++ = '\0';
+		v = strtoul(val, &err, 10);
+		if (err == val || (*err != '\0' && strcmp(err, "%") != 0)) {
+			rc = false;
+			break;
+		}
+
+		if (strcmp(tok, "wall") == 0)
+			tol->wall_pct = v;
+		else if (strcmp(tok, "cpu") == 0)
+			tol->cpu_pct = v;
+		else if (strcmp(tok, "rss") == 0)
+			tol->rss_pct = v;
+		else {
+			rc = false;
+			break;
+		}
+	}
+
+	if (!rc)
+		fprintf(stderr, "bad baseline tolerance '%s'\n", spec);
+
+	free(tmp);
+	return rc;
+}
+
+bool baseline_lookup(char const *fname, char const *id,
+		     struct baseline_entry *entry)
+{
+	FILE		*f = fopen(fname, "re");
+	char		*line = NULL;
+	size_t		line_sz = 0;
+	size_t		id_len = strlen(id);
+	bool		found = false;
+
+	if (!f) {
+		if (errno != ENOENT)
+			fprintf(stderr, "fopen(%s): %s\n", fname,
+				strerror(errno));
+		return false;
+	}
+
+	while (getline(&line, &line_sz, f) > 0) {
+		struct baseline_entry	tmp;
+
+		if (strncmp(line, id, id_len) != 0 ||
+		    (line[id_len] != ' ' && line[id_len] != '\t'))
+			continue;
+
+		if (sscanf(line + id_len, "%lf %lf %ld",
+			   &tmp.wall_ms, &tmp.cpu_ms, &tmp.maxrss_kb) != 3)
+			continue;
+
+		*entry = tmp;
+		found = true;
+	}
+
+	free(line);
+	fclose(f);
+
+	return found;
+}
+
+static bool exceeds(double base, double cur, unsigned int pct,
+		    double min_slack)
+{
+	double	slack = base * pct / 100;
+
+	if (slack < min_slack)
+		slack = min_slack;
+
+	return cur > base + slack;
+}
+
+unsigned int baseline_check(struct baseline_entry const *base,
+			    struct baseline_entry const *cur,
+			    struct baseline_tolerance const *tol)
+{
+	unsigned int	flags = 0;
+
+	if (exceeds(base->wall_ms, cur->wall_ms, tol->wall_pct,
+		    BASELINE_MIN_SLACK_MS) ||
+	    exceeds(base->cpu_ms, cur->cpu_ms, tol->cpu_pct,
+		    BASELINE_MIN_SLACK_MS))
+		flags |= BASELINE_SLOW;
+
+	if (exceeds(base->maxrss_kb, cur->maxrss_kb, tol->rss_pct,
+		    BASELINE_MIN_SLACK_KB))
+		flags |= BASELINE_BLOATED;
+
+	return flags;
+}
+
+bool baseline_record(char const *fname, char const *id,
+		     struct baseline_entry const *cur)
+{
+	char	buf[256];
+	int	l;
+	int	fd;
+	bool	rc;
+
+	l = snprintf(buf, sizeof buf, "%s %.3f %.3f %ld\n", id,
+		     cur->wall_ms, cur->cpu_ms, cur->maxrss_kb);
+	if (l < 0 || (size_t)l >= sizeof buf) {
+		fprintf(stderr, "baseline: id '%s' too long\n", id);
+		return false;
+	}
+
+	fd = open(fname, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+	if (fd < 0) {
+		fprintf(stderr, "open(%s): %s\n", fname, strerror(errno));
+		return false;
+	}
+
+	rc = write_all(fd, buf, l);
+	close(fd);
+
+	return rc;
+}
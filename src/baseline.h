@@ -0,0 +1,61 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_TESTSUITE_SRC_BASELINE_H
+#define H_ENSC_TESTSUITE_SRC_BASELINE_H
+
+#include <stdbool.h>
+
+/* A baseline file contains one line per test:
+ *
+ *   <id> <wall-ms> <cpu-ms> <maxrss-kb>
+ *
+ * Empty lines and lines starting with '#' are ignored; when an id
+ * appears several times, the last line wins. */
+struct baseline_entry {
+	double			wall_ms;
+	double			cpu_ms;
+	long			maxrss_kb;
+};
+
+/* allowed increase in percent */
+struct baseline_tolerance {
+	unsigned int		wall_pct;
+	unsigned int		cpu_pct;
+	unsigned int		rss_pct;
+};
+
+#define BASELINE_TOLERANCE_DEFAULT	{ 50, 50, 20 }
+
+enum {
+	BASELINE_SLOW		= (1u << 0),
+	BASELINE_BLOATED	= (1u << 1),
+};
+
+bool baseline_parse_tolerance(struct baseline_tolerance *tol,
+			      char const *spec);
+
+bool baseline_lookup(char const *fname, char const *id,
+		     struct baseline_entry *entry);
+
+unsigned int baseline_check(struct baseline_entry const *base,
+			    struct baseline_entry const *cur,
+			    struct baseline_tolerance const *tol);
+
+bool baseline_record(char const *fname, char const *id,
+		     struct baseline_entry const *cur);
+
+#endif	/* H_ENSC_TESTSUITE_SRC_BASELINE_H */
@@ -0,0 +1,62 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_TESTSUITE_SRC_BASH_ABI_H
+#define H_ENSC_TESTSUITE_SRC_BASH_ABI_H
+
+/* The subset of the bash (>= 4.4) loadable builtin ABI used by
+ * 'builtins.so'.  It is declared here because the bash development
+ * headers are not available on most build hosts. */
+
+typedef struct word_desc {
+	char			*word;
+	int			flags;
+} WORD_DESC;
+
+typedef struct word_list {
+	struct word_list	*next;
+	WORD_DESC		*word;
+} WORD_LIST;
+
+typedef int sh_builtin_func_t(WORD_LIST *);
+
+/* 'enable -f <so> <name>' looks for a symbol '<name>_struct' */
+struct builtin {
+	char			*name;
+	sh_builtin_func_t	*function;
+	int			flags;
+	char * const		*long_doc;
+	char const		*short_doc;
+	char			*handle;	/* set by bash */
+};
+
+#define BUILTIN_ENABLED		0x01
+
+#define EXECUTION_SUCCESS	0
+#define EXECUTION_FAILURE	1
+#define EX_BADUSAGE		2
+
+/* provided by the bash executable */
+struct variable;
+
+extern struct variable	*bind_variable(char const *name, char *value,
+				       int flags);
+extern int		legal_identifier(char const *name);
+extern void		builtin_error(char const *fmt, ...)
+	__attribute__((__format__(printf, 1, 2)));
+extern void		builtin_usage(void);
+
+#endif	/* H_ENSC_TESTSUITE_SRC_BASH_ABI_H */
@@ -0,0 +1,192 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bitdiff.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#  include <immintrin.h>
+#  define HAVE_BITDIFF_X86	1
+#endif
+
+#include "util.h"
+
+typedef size_t (*bitdiff_fn)(unsigned char const *a, unsigned char const *b,
+			     size_t len);
+
+static size_t bitdiff_scalar(unsigned char const *a, unsigned char const *b,
+			     size_t len)
+{
+	size_t		cnt = 0;
+
+	for (; len >= 8; len -= 8, a += 8, b += 8) {
+		uint64_t	va;
+		uint64_t	vb;
+
+		memcpy(&va, a, sizeof va);
+		memcpy(&vb, b, sizeof vb);
+
+		cnt += __builtin_popcountll(va ^ vb);
+	}
+
+	while (len-- > 0)
+		cnt += __builtin_popcount(*a++ ^ *b++);
+
+	return cnt;
+}
+
+#ifdef HAVE_BITDIFF_X86
+/* The SIMD variants count the bits of every byte with a nibble lookup
+ * table (pshufb) and sum the byte counters with psadbw.  A byte counter
+ * grows by at most 8 per iteration, so it must be flushed after 31
+ * iterations. */
+
+__attribute__((__target__("avx2")))
+static size_t bitdiff_avx2(unsigned char const *a, unsigned char const *b,
+			   size_t len)
+{
+	__m256i const	lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3,
+					       1, 2, 2, 3, 2, 3, 3, 4,
+					       0, 1, 1, 2, 1, 2, 2, 3,
+					       1, 2, 2, 3, 2, 3, 3, 4);
+	__m256i const	low = _mm256_set1_epi8(0x0f);
+	__m256i		total = _mm256_setzero_si256();
+	uint64_t	sum[4];
+
+	while (len >= 32) {
+		__m256i		acc = _mm256_setzero_si256();
+		unsigned int	i;
+
+		for (i = 0; i < 31 && len >= 32; ++i, len -= 32, a += 32, b += 32) {
+			__m256i	x = _mm256_xor_si256(
+				_mm256_loadu_si256((void const *)a),
+				_mm256_loadu_si256((void const *)b));
+			__m256i	lo = _mm256_and_si256(x, low);
+			__m256i	hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), low);
+
+			acc = _mm256_add_epi8(acc, _mm256_shuffle_epi8(lut, lo));
+			acc = _mm256_add_epi8(acc, _mm256_shuffle_epi8(lut, hi));
+		}
+
+		total = _mm256_add_epi64(total,
+					 _mm256_sad_epu8(acc, _mm256_setzero_si256()));
+	}
+
+	_mm256_storeu_si256((void *)sum, total);
+
+	return sum[0] + sum[1] + sum[2] + sum[3] + bitdiff_scalar(a, b, len);
+}
+
+__attribute__((__target__("ssse3")))
+static size_t bitdiff_ssse3(unsigned char const *a, unsigned char const *b,
+			    size_t len)
+{
+	__m128i const	lut = _mm_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3,
+					    1, 2, 2, 3, 2, 3, 3, 4);
+	__m128i const	low = _mm_set1_epi8(0x0f);
+	__m128i		total = _mm_setzero_si128();
+	uint64_t	sum[2];
+
+	while (len >= 16) {
+		__m128i		acc = _mm_setzero_si128();
+		unsigned int	i;
+
+		for (i = 0; i < 31 && len >= 16; ++i, len -= 16, a += 16, b += 16) {
+			__m128i	x = _mm_xor_si128(
+				_mm_loadu_si128((void const *)a),
+				_mm_loadu_si128((void const *)b));
+			__m128i	lo = _mm_and_si128(x, low);
+			__m128i	hi = _mm_and_si128(_mm_srli_epi16(x, 4), low);
+
+			acc = _mm_add_epi8(acc, _mm_shuffle_epi8(lut, lo));
+			acc = _mm_add_epi8(acc, _mm_shuffle_epi8(lut, hi));
+		}
+
+		total = _mm_add_epi64(total, _mm_sad_epu8(acc, _mm_setzero_si128()));
+	}
+
+	_mm_storeu_si128((void *)sum, total);
+
+	return sum[0] + sum[1] + bitdiff_scalar(a, b, len);
+}
+#endif	/* HAVE_BITDIFF_X86 */
+
+static struct {
+	char const	*name;
+	bitdiff_fn	fn;
+} const			BITDIFF_IMPLS[] = {
+#ifdef HAVE_BITDIFF_X86
+	{ "avx2",	bitdiff_avx2 },
+	{ "ssse3",	bitdiff_ssse3 },
+#endif
+	{ "scalar",	bitdiff_scalar },
+};
+
+static unsigned int	bitdiff_idx = ARRAY_SIZE(BITDIFF_IMPLS);
+
+static bool bitdiff_is_supported(unsigned int idx)
+{
+#ifdef HAVE_BITDIFF_X86
+	char const	*name = BITDIFF_IMPLS[idx].name;
+
+	__builtin_cpu_init();
+
+	if (strcmp(name, "avx2") == 0)
+		return __builtin_cpu_supports("avx2");
+	if (strcmp(name, "ssse3") == 0)
+		return __builtin_cpu_supports("ssse3");
+#endif
+
+	return true;
+}
+
+bool bitdiff_select(char const *name)
+{
+	unsigned int	i;
+
+	for (i = 0; i < ARRAY_SIZE(BITDIFF_IMPLS); ++i) {
+		if (name && strcmp(name, BITDIFF_IMPLS[i].name) != 0)
+			continue;
+
+		if (bitdiff_is_supported(i)) {
+			bitdiff_idx = i;
+			return true;
+		}
+
+		if (name)
+			break;
+	}
+
+	return false;
+}
+
+char const *bitdiff_impl(void)
+{
+	if (bitdiff_idx == ARRAY_SIZE(BITDIFF_IMPLS))
+		bitdiff_select(NULL);
+
+	return BITDIFF_IMPLS[bitdiff_idx].name;
+}
+
+size_t bitdiff(void const *a, void const *b, size_t len)
+{
+	if (__builtin_expect(bitdiff_idx == ARRAY_SIZE(BITDIFF_IMPLS), 0))
+		bitdiff_select(NULL);
+
+	return BITDIFF_IMPLS[bitdiff_idx].fn(a, b, len);
+}
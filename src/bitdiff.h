@@ -0,0 +1,35 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_TESTSUITE_SRC_BITDIFF_H
+#define H_ENSC_TESTSUITE_SRC_BITDIFF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Counts the bits which differ between 'a' and 'b'.  The implementation
+ * is selected at the first call according to the CPU features; the
+ * results of all implementations are identical. */
+size_t bitdiff(void const *a, void const *b, size_t len);
+
+/* Name of the selected implementation ('avx2', 'ssse3' or 'scalar'). */
+char const *bitdiff_impl(void);
+
+/* Forces an implementation; fails when it is unknown or not supported
+ * by the CPU. */
+bool bitdiff_select(char const *name);
+
+#endif	/* H_ENSC_TESTSUITE_SRC_BITDIFF_H */
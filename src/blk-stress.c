@@ -0,0 +1,949 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Block device and file I/O stress test.  Blocks are written with a
+ * header holding their index, the run seed and a CRC32C over the whole
+ * block, and are verified when they are read back.  Requests are
+ * submitted through io_uring with up to '--qd' requests in flight, or
+ * synchronously when io_uring is not available.  The latency of every
+ * request is recorded in a histogram. */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <linux/fs.h>
+#include <linux/io_uring.h>
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#include "lathist.h"
+#include "util.h"
+
+/* {{{ cli options */
+#define CMD_HELP		0x8000
+#define CMD_VERSION		0x8001
+#define CMD_SIZE		0x8002
+#define CMD_OFFSET		0x8003
+#define CMD_BS			0x8004
+#define CMD_QD			0x8005
+#define CMD_PATTERN		0x8006
+#define CMD_RW			0x8007
+#define CMD_DIRECT		0x8008
+#define CMD_ENGINE		0x8009
+#define CMD_SEED		0x800a
+#define CMD_HISTOGRAM		0x800b
+#define CMD_FORCE		0x800c
+#define CMD_MAX_P99		0x800d
+
+static struct option const	CMDLINE_OPTIONS[] = {
+  { "help",        no_argument,        0, CMD_HELP },
+  { "version",     no_argument,        0, CMD_VERSION },
+  { "size",        required_argument,  0, CMD_SIZE },
+  { "offset",      required_argument,  0, CMD_OFFSET },
+  { "bs",          required_argument,  0, CMD_BS },
+  { "qd",          required_argument,  0, CMD_QD },
+  { "pattern",     required_argument,  0, CMD_PATTERN },
+  { "rw",          required_argument,  0, CMD_RW },
+  { "direct",      no_argument,        0, CMD_DIRECT },
+  { "engine",      required_argument,  0, CMD_ENGINE },
+  { "seed",        required_argument,  0, CMD_SEED },
+  { "histogram",   no_argument,        0, CMD_HISTOGRAM },
+  { "force",       no_argument,        0, CMD_FORCE },
+  { "max-p99",     required_argument,  0, CMD_MAX_P99 },
+  { 0,0,0,0 }
+};
+
+enum rw_mode {
+	RW_WRITE	= (1u << 0),
+	RW_READ		= (1u << 1),
+};
+
+enum engine_type {
+	ENGINE_AUTO,
+	ENGINE_URING,
+	ENGINE_SYNC,
+};
+
+struct cmdline_options {
+	unsigned long long	size;		/* 0 means whole device/file */
+	unsigned long long	offset;
+	unsigned int		bs;
+	unsigned int		qd;
+	bool			is_random;
+	unsigned int		rw;		/* RW_xxx */
+	bool			direct;
+	enum engine_type	engine;
+	uint64_t		seed;
+	bool			histogram;
+	bool			force;
+	double			max_p99_us;	/* 0 means no limit */
+};
+/* }}} cli options */
+
+#define BLOCK_MAGIC		0x4b4c4253u	/* 'SBLK' */
+#define MAX_QD			256
+#define MAX_REPORTED_ERRORS	10
+
+/* at the start of every block; the CRC covers the whole block with
+ * 'crc' set to zero */
+struct block_hdr {
+	uint32_t		magic;
+	uint32_t		crc;
+	uint64_t		lba;		/* block index within the region */
+	uint64_t		seed;
+	uint64_t		_rsrv;
+};
+
+struct io_slot {
+	unsigned char		*buf;
+	uint64_t		lba;
+	bool			is_write;
+	uint64_t		t_submit;
+	int			res;		/* bytes or -errno */
+	struct iovec		iov;
+};
+
+struct engine;
+
+struct engine_ops {
+	char const	*name;
+	bool		(*queue)(struct engine *eng, struct io_slot *slot);
+
+	/* waits for at least one completion; returns the number of
+	 * completed slots stored in 'done' or -1 on errors */
+	int		(*reap)(struct engine *eng, struct io_slot **done,
+				unsigned int max);
+	void		(*close)(struct engine *eng);
+};
+
+struct uring {
+	int			fd;
+
+	void			*sq_ring;
+	size_t			sq_ring_sz;
+	void			*cq_ring;
+	size_t			cq_ring_sz;
+	struct io_uring_sqe	*sqes;
+	size_t			sqes_sz;
+
+	unsigned int		*sq_head;
+	unsigned int		*sq_tail;
+	unsigned int		*sq_mask;
+	unsigned int		*sq_array;
+	unsigned int		*cq_head;
+	unsigned int		*cq_tail;
+	unsigned int		*cq_mask;
+	struct io_uring_cqe	*cqes;
+
+	unsigned int		to_submit;
+};
+
+struct engine {
+	struct engine_ops const	*ops;
+	int			fd;
+	uint64_t		base;		/* byte offset of lba 0 */
+	unsigned int		bs;
+
+	struct uring		ring;
+
+	/* completed but not yet reaped requests of the sync engine */
+	struct io_slot		*sync_done[MAX_QD];
+	unsigned int		num_sync_done;
+};
+
+struct phase_stats {
+	uint64_t		num_ios;
+	uint64_t		duration_ns;
+	uint64_t		num_io_errors;
+	uint64_t		num_verify_errors;
+	struct lat_hist		hist;
+};
+
+static void show_help(void) __attribute__((__noreturn__));
+static void show_help(void)
+{
+	printf("Usage: blk-stress [--size <bytes>] [--offset <bytes>] [--bs <bytes>] [--qd <num>]\n"
+	       "         [--pattern seq|rand] [--rw write|read|rw] [--direct]\n"
+	       "         [--engine auto|uring|sync] [--seed <num>] [--histogram]\n"
+	       "         [--max-p99 <us>] [--force] <device-or-file>\n"
+	       "\n"
+	       "'read' verifies data written before by 'write' with the same seed, size\n"
+	       "and block size.  Writing to block devices requires '--force'.\n"
+	       "Without '--direct', the cached blocks are dropped before the read\n"
+	       "phase so that it reaches the device.\n");
+	exit(0);
+}
+
+static void show_version(void) __attribute__((__noreturn__));
+static void show_version(void)
+{
+	/* \todo */
+	exit(0);
+}
+
+/* {{{ block contents */
+static uint32_t		crc32c_table[8][256];
+
+static void crc32c_init(void)
+{
+	unsigned int	i;
+	unsigned int	j;
+
+	for (i = 0; i < 256; ++i) {
+		uint32_t	crc = i;
+
+		for (j = 0; j < 8; ++j)
+			crc = (crc >> 1) ^ (0x82f63b78u & -(crc & 1));
+
+		crc32c_table[0][i] = crc;
+	}
+
+	for (i = 0; i < 256; ++i) {
+		for (j = 1; j < 8; ++j)
+			crc32c_table[j][i] = ((crc32c_table[j - 1][i] >> 8) ^
+					      crc32c_table[0][crc32c_table[j - 1][i] & 0xff]);
+	}
+}
+
+/* slicing-by-8; 'len' must be a multiple of 8 */
+static uint32_t crc32c(void const *data, size_t len)
+{
+	unsigned char const	*p = data;
+	uint32_t		crc = ~0u;
+
+	for (; len >= 8; len -= 8, p += 8) {
+		uint32_t	lo;
+		uint32_t	hi;
+
+		memcpy(&lo, p, 4);
+		memcpy(&hi, p + 4, 4);
+
+		lo = le32toh(lo) ^ crc;
+		hi = le32toh(hi);
+
+		crc = (crc32c_table[7][lo & 0xff] ^
+		       crc32c_table[6][(lo >> 8) & 0xff] ^
+		       crc32c_table[5][(lo >> 16) & 0xff] ^
+		       crc32c_table[4][lo >> 24] ^
+		       crc32c_table[3][hi & 0xff] ^
+		       crc32c_table[2][(hi >> 8) & 0xff] ^
+		       crc32c_table[1][(hi >> 16) & 0xff] ^
+		       crc32c_table[0][hi >> 24]);
+	}
+
+	return ~crc;
+}
+
+static uint64_t splitmix64(uint64_t *x)
+{
+	uint64_t	z = (*x += 0x9e3779b97f4a7c15ull);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+
+	return z ^ (z >> 31);
+}
+
+static void block_fill(unsigned char *buf, unsigned int bs, uint64_t lba,
+		       uint64_t seed)
+{
+	struct block_hdr	hdr = {
+		.magic	= htole32(BLOCK_MAGIC),
+		.lba	= htole64(lba),
+		.seed	= htole64(seed),
+	};
+	uint64_t		state = seed ^ (lba * 0xd1342543de82ef95ull);
+	unsigned int		i;
+
+	for (i = sizeof hdr; i < bs; i += 8) {
+		uint64_t	v = splitmix64(&state);
+
+		memcpy(buf + i, &v, sizeof v);
+	}
+
+	memcpy(buf, &hdr, sizeof hdr);
+	hdr.crc = htole32(crc32c(buf, bs));
+	memcpy(buf, &hdr, sizeof hdr);
+}
+
+static bool block_verify(unsigned char *buf, unsigned int bs, uint64_t lba,
+			 uint64_t seed, unsigned int *num_reported)
+{
+	struct block_hdr	hdr;
+	uint32_t		crc;
+	char const		*err = NULL;
+
+	memcpy(&hdr, buf, sizeof hdr);
+	crc = le32toh(hdr.crc);
+
+	hdr.crc = 0;
+	memcpy(buf, &hdr, sizeof hdr);
+
+	if (le32toh(hdr.magic) != BLOCK_MAGIC)
+		err = "bad magic";
+	else if (le64toh(hdr.lba) != lba)
+		err = "misplaced block";
+	else if (le64toh(hdr.seed) != seed)
+		err = "stale block (other seed)";
+	else if (crc32c(buf, bs) != crc)
+		err = "CRC mismatch";
+
+	if (err && (*num_reported)++ < MAX_REPORTED_ERRORS)
+		fprintf(stderr, "block %llu: %s (lba %llu, seed %llu)\n",
+			(unsigned long long)lba, err,
+			(unsigned long long)le64toh(hdr.lba),
+			(unsigned long long)le64toh(hdr.seed));
+
+	return err == NULL;
+}
+/* }}} block contents */
+
+/* {{{ sync engine */
+static bool sync_queue(struct engine *eng, struct io_slot *slot)
+{
+	off_t	ofs = eng->base + slot->lba * eng->bs;
+	ssize_t	l;
+
+	do {
+		if (slot->is_write)
+			l = pwrite(eng->fd, slot->buf, eng->bs, ofs);
+		else
+			l = pread(eng->fd, slot->buf, eng->bs, ofs);
+	} while (l < 0 && errno == EINTR);
+
+	slot->res = l < 0 ? -errno : l;
+	eng->sync_done[eng->num_sync_done++] = slot;
+
+	return true;
+}
+
+static int sync_reap(struct engine *eng, struct io_slot **done,
+		     unsigned int max)
+{
+	unsigned int	cnt = eng->num_sync_done < max ? eng->num_sync_done : max;
+
+	memcpy(done, eng->sync_done, cnt * sizeof done[0]);
+	memmove(eng->sync_done, eng->sync_done + cnt,
+		(eng->num_sync_done - cnt) * sizeof done[0]);
+	eng->num_sync_done -= cnt;
+
+	return cnt;
+}
+
+static void sync_close(struct engine *eng)
+{
+}
+
+static struct engine_ops const	SYNC_OPS = {
+	.name	= "sync",
+	.queue	= sync_queue,
+	.reap	= sync_reap,
+	.close	= sync_close,
+};
+/* }}} sync engine */
+
+/* {{{ io_uring engine */
+static int sys_io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned int to_submit,
+			      unsigned int min_complete, unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+		       NULL, 0);
+}
+
+static void uring_close(struct engine *eng)
+{
+	struct uring	*r = &eng->ring;
+
+	if (r->sqes)
+		munmap(r->sqes, r->sqes_sz);
+	if (r->cq_ring && r->cq_ring != r->sq_ring)
+		munmap(r->cq_ring, r->cq_ring_sz);
+	if (r->sq_ring)
+		munmap(r->sq_ring, r->sq_ring_sz);
+
+	xclose(r->fd);
+}
+
+static void *uring_map(int fd, size_t len, off_t ofs)
+{
+	void	*p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, fd, ofs);
+
+	return p == MAP_FAILED ? NULL : p;
+}
+
+/* returns false and sets errno when io_uring is not available */
+static bool uring_open(struct engine *eng, unsigned int qd)
+{
+	struct uring		*r = &eng->ring;
+	struct io_uring_params	p = { .flags = 0 };
+
+	*r = (struct uring) { .fd = -1 };
+
+	r->fd = sys_io_uring_setup(qd, &p);
+	if (r->fd < 0)
+		return false;
+
+	r->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	r->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	r->sqes_sz    = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cq_ring_sz > r->sq_ring_sz)
+			r->sq_ring_sz = r->cq_ring_sz;
+		r->cq_ring_sz = r->sq_ring_sz;
+	}
+
+	r->sq_ring = uring_map(r->fd, r->sq_ring_sz, IORING_OFF_SQ_RING);
+	if (!r->sq_ring)
+		goto err;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		r->cq_ring = r->sq_ring;
+	else
+		r->cq_ring = uring_map(r->fd, r->cq_ring_sz, IORING_OFF_CQ_RING);
+
+	r->sqes = uring_map(r->fd, r->sqes_sz, IORING_OFF_SQES);
+
+	if (!r->cq_ring || !r->sqes)
+		goto err;
+
+	r->sq_head  = r->sq_ring + p.sq_off.head;
+	r->sq_tail  = r->sq_ring + p.sq_off.tail;
+	r->sq_mask  = r->sq_ring + p.sq_off.ring_mask;
+	r->sq_array = r->sq_ring + p.sq_off.array;
+	r->cq_head  = r->cq_ring + p.cq_off.head;
+	r->cq_tail  = r->cq_ring + p.cq_off.tail;
+	r->cq_mask  = r->cq_ring + p.cq_off.ring_mask;
+	r->cqes     = r->cq_ring + p.cq_off.cqes;
+
+	return true;
+
+err:
+	uring_close(eng);
+	return false;
+}
+
+static bool uring_queue(struct engine *eng, struct io_slot *slot)
+{
+	struct uring		*r = &eng->ring;
+	unsigned int		tail = *r->sq_tail;
+	unsigned int		idx = tail & *r->sq_mask;
+	struct io_uring_sqe	*sqe = &r->sqes[idx];
+
+	/* the caller never queues more than 'qd' requests, so the SQ can
+	 * not overflow */
+	slot->iov = (struct iovec) {
+		.iov_base	= slot->buf,
+		.iov_len	= eng->bs,
+	};
+
+	memset(sqe, 0, sizeof *sqe);
+	sqe->opcode    = slot->is_write ? IORING_OP_WRITEV : IORING_OP_READV;
+	sqe->fd        = eng->fd;
+	sqe->off       = eng->base + slot->lba * eng->bs;
+	sqe->addr      = (uintptr_t)&slot->iov;
+	sqe->len       = 1;
+	sqe->user_data = (uintptr_t)slot;
+
+	r->sq_array[idx] = idx;
+	__atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	++r->to_submit;
+
+	return true;
+}
+
+static int uring_reap(struct engine *eng, struct io_slot **done,
+		      unsigned int max)
+{
+	struct uring	*r = &eng->ring;
+	unsigned int	head;
+	unsigned int	cnt = 0;
+
+	for (;;) {
+		int	rc = sys_io_uring_enter(r->fd, r->to_submit, 1,
+						IORING_ENTER_GETEVENTS);
+
+		if (rc >= 0) {
+			r->to_submit -= rc;
+			break;
+		}
+
+		if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+			perror("io_uring_enter()");
+			return -1;
+		}
+	}
+
+	head = *r->cq_head;
+
+	while (cnt < max && head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+		struct io_uring_cqe const	*cqe = &r->cqes[head & *r->cq_mask];
+		struct io_slot			*slot = (void *)(uintptr_t)cqe->user_data;
+
+		slot->res = cqe->res;
+		done[cnt++] = slot;
+		++head;
+	}
+
+	__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+
+	return cnt;
+}
+
+static struct engine_ops const	URING_OPS = {
+	.name	= "io_uring",
+	.queue	= uring_queue,
+	.reap	= uring_reap,
+	.close	= uring_close,
+};
+/* }}} io_uring engine */
+
+static void shuffle(uint64_t *order, uint64_t cnt, uint64_t seed)
+{
+	uint64_t	state = seed;
+	uint64_t	i;
+
+	for (i = cnt; i > 1; --i) {
+		uint64_t	j = splitmix64(&state) % i;
+		uint64_t	tmp = order[i - 1];
+
+		order[i - 1] = order[j];
+		order[j] = tmp;
+	}
+}
+
+/* Without O_DIRECT the read phase would verify the page cache instead of
+ * the device; drop the cached blocks of the region first.  BLKFLSBUF
+ * flushes the buffer cache of a block device but needs CAP_SYS_ADMIN. */
+static void drop_cache(int fd, bool is_blk, uint64_t ofs, uint64_t len)
+{
+	int	rc;
+
+	if (is_blk && ioctl(fd, BLKFLSBUF, 0) < 0 && errno != EPERM &&
+	    errno != EACCES)
+		perror("ioctl(BLKFLSBUF)");
+
+	rc = posix_fadvise(fd, ofs, len, POSIX_FADV_DONTNEED);
+	if (rc != 0)
+		fprintf(stderr, "posix_fadvise(POSIX_FADV_DONTNEED): %s; reads might hit the page cache\n",
+			strerror(rc));
+}
+
+static bool run_phase(struct engine *eng, bool is_write,
+		      uint64_t const *order, uint64_t num_blocks,
+		      struct io_slot *slots, unsigned int qd,
+		      uint64_t seed, struct phase_stats *st)
+{
+	struct io_slot	*free_slots[qd];
+	struct io_slot	*done[qd];
+	unsigned int	num_free = qd;
+	unsigned int	num_reported = 0;
+	uint64_t	next = 0;
+	uint64_t	t0;
+	unsigned int	i;
+
+	for (i = 0; i < qd; ++i)
+		free_slots[i] = &slots[i];
+
+	lat_hist_init(&st->hist);
+	t0 = monotonic_ns();
+
+	while (next < num_blocks || num_free < qd) {
+		int	cnt;
+
+		while (num_free > 0 && next < num_blocks) {
+			struct io_slot	*slot = free_slots[--num_free];
+
+			slot->lba = order[next++];
+			slot->is_write = is_write;
+
+			if (is_write)
+				block_fill(slot->buf, eng->bs, slot->lba, seed);
+
+			slot->t_submit = monotonic_ns();
+			if (!eng->ops->queue(eng, slot))
+				return false;
+		}
+
+		cnt = eng->ops->reap(eng, done, qd);
+		if (cnt < 0)
+			return false;
+
+		for (i = 0; i < (unsigned int)cnt; ++i) {
+			struct io_slot	*slot = done[i];
+
+			lat_hist_add(&st->hist, monotonic_ns() - slot->t_submit);
+			++st->num_ios;
+
+			if (slot->res != (int)eng->bs) {
+				if (st->num_io_errors++ < MAX_REPORTED_ERRORS)
+					fprintf(stderr, "block %llu: %s failed: %s\n",
+						(unsigned long long)slot->lba,
+						is_write ? "write" : "read",
+						slot->res < 0 ? strerror(-slot->res) : "short transfer");
+			} else if (!is_write &&
+				   !block_verify(slot->buf, eng->bs, slot->lba, seed,
+						 &num_reported)) {
+				++st->num_verify_errors;
+			}
+
+			free_slots[num_free++] = slot;
+		}
+	}
+
+	/* written data must reach the device before they are read back */
+	if (is_write && fdatasync(eng->fd) < 0) {
+		perror("fdatasync()");
+		++st->num_io_errors;
+	}
+
+	st->duration_ns = monotonic_ns() - t0;
+
+	return true;
+}
+
+static bool print_phase(char const *name, struct phase_stats const *st,
+			unsigned int bs, struct cmdline_options const *opts)
+{
+	double	secs = st->duration_ns / 1e9 + 1e-9;
+	double	p99 = lat_hist_percentile(&st->hist, 99) / 1e3;
+
+	printf("%-6s %10llu %10.1f %10.0f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+	       name, (unsigned long long)st->num_ios,
+	       (double)st->num_ios * bs / (1024 * 1024) / secs,
+	       st->num_ios / secs,
+	       st->hist.min / 1e3,
+	       lat_hist_percentile(&st->hist, 50) / 1e3, p99,
+	       lat_hist_percentile(&st->hist, 99.9) / 1e3,
+	       st->hist.max / 1e3);
+
+	if (opts->histogram)
+		lat_hist_print(&st->hist, stdout, "    ");
+
+	if (opts->max_p99_us > 0 && p99 > opts->max_p99_us) {
+		fprintf(stderr, "%s: p99 latency %.1f us exceeds %.1f us\n",
+			name, p99, opts->max_p99_us);
+		return false;
+	}
+
+	return true;
+}
+
+static bool parse_size(char const *str, unsigned long long *res)
+{
+	char	*end;
+
+	*res = strtoull(str, &end, 0);
+
+	switch (*end) {
+	case 'k': case 'K':	*res <<= 10; ++end; break;
+	case 'm': case 'M':	*res <<= 20; ++end; break;
+	case 'g': case 'G':	*res <<= 30; ++end; break;
+	}
+
+	if (*str == '\0' || *end != '\0') {
+		fprintf(stderr, "invalid size '%s'\n", str);
+		return false;
+	}
+
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	struct cmdline_options	opts = {
+		.bs	= 4096,
+		.qd	= 8,
+		.rw	= RW_WRITE | RW_READ,
+		.engine	= ENGINE_AUTO,
+		.seed	= 1,
+	};
+	struct engine		eng = { .fd = -1, .ring = { .fd = -1 } };
+	struct io_slot		*slots = NULL;
+	struct phase_stats	*st = NULL;
+	uint64_t		*order = NULL;
+	uint64_t		num_blocks;
+	unsigned long long	dev_size;
+	unsigned long long	tmp;
+	struct stat		sb;
+	bool			exists;
+	char const		*path;
+	unsigned int		i;
+	int			rc = EX_SOFTWARE;
+
+	while (1) {
+		int	c = getopt_long(argc, argv, "", CMDLINE_OPTIONS, 0);
+
+		if (c==-1)
+			break;
+
+		switch (c) {
+		case CMD_HELP		:  show_help();
+		case CMD_VERSION	:  show_version();
+		case CMD_DIRECT		:  opts.direct = true; break;
+		case CMD_SEED		:  opts.seed = strtoull(optarg, NULL, 0); break;
+		case CMD_HISTOGRAM	:  opts.histogram = true; break;
+		case CMD_FORCE		:  opts.force = true; break;
+		case CMD_QD		:  opts.qd = atoi(optarg); break;
+		case CMD_MAX_P99	:  opts.max_p99_us = atof(optarg); break;
+
+		case CMD_SIZE:
+			if (!parse_size(optarg, &opts.size))
+				return EX_USAGE;
+			break;
+
+		case CMD_OFFSET:
+			if (!parse_size(optarg, &opts.offset))
+				return EX_USAGE;
+			break;
+
+		case CMD_BS:
+			if (!parse_size(optarg, &tmp))
+				return EX_USAGE;
+			opts.bs = tmp;
+			break;
+
+		case CMD_PATTERN:
+			if (strcmp(optarg, "seq") == 0)
+				opts.is_random = false;
+			else if (strcmp(optarg, "rand") == 0)
+				opts.is_random = true;
+			else
+				goto bad_arg;
+			break;
+
+		case CMD_RW:
+			if (strcmp(optarg, "write") == 0)
+				opts.rw = RW_WRITE;
+			else if (strcmp(optarg, "read") == 0)
+				opts.rw = RW_READ;
+			else if (strcmp(optarg, "rw") == 0)
+				opts.rw = RW_WRITE | RW_READ;
+			else
+				goto bad_arg;
+			break;
+
+		case CMD_ENGINE:
+			if (strcmp(optarg, "auto") == 0)
+				opts.engine = ENGINE_AUTO;
+			else if (strcmp(optarg, "uring") == 0)
+				opts.engine = ENGINE_URING;
+			else if (strcmp(optarg, "sync") == 0)
+				opts.engine = ENGINE_SYNC;
+			else
+				goto bad_arg;
+			break;
+
+		default:
+		bad_arg:
+			fprintf(stderr, "Try '--help' for more information\n");
+			return EX_USAGE;
+		}
+	}
+
+	if (optind + 1 != argc) {
+		fprintf(stderr, "missing device or file\n");
+		return EX_USAGE;
+	}
+
+	if (opts.bs < 512 || opts.bs % 512 != 0 ||
+	    opts.qd == 0 || opts.qd > MAX_QD) {
+		fprintf(stderr, "block size must be a multiple of 512 and queue depth between 1 and %u\n",
+			MAX_QD);
+		return EX_USAGE;
+	}
+
+	path = argv[optind];
+
+	exists = stat(path, &sb) == 0;
+	if (!exists && errno != ENOENT) {
+		fprintf(stderr, "stat(%s): %s\n", path, strerror(errno));
+		return EX_NOINPUT;
+	}
+
+	if (exists && S_ISBLK(sb.st_mode) &&
+	    (opts.rw & RW_WRITE) && !opts.force) {
+		fprintf(stderr, "%s: refusing to overwrite a block device without '--force'\n",
+			path);
+		return EX_USAGE;
+	}
+
+	eng.fd = open(path, ((opts.rw & RW_WRITE) ? O_RDWR | O_CREAT : O_RDONLY) |
+		      (opts.direct ? O_DIRECT : 0) | O_CLOEXEC, 0666);
+	if (eng.fd < 0) {
+		fprintf(stderr, "open(%s): %s\n", path, strerror(errno));
+		return EX_NOINPUT;
+	}
+
+	if (fstat(eng.fd, &sb) < 0) {
+		perror("fstat()");
+		goto out;
+	}
+
+	if (S_ISBLK(sb.st_mode)) {
+		if (ioctl(eng.fd, BLKGETSIZE64, &dev_size) < 0) {
+			perror("ioctl(BLKGETSIZE64)");
+			goto out;
+		}
+	} else {
+		dev_size = sb.st_size;
+	}
+
+	if (opts.size == 0) {
+		if (dev_size <= opts.offset) {
+			fprintf(stderr, "%s: empty; use '--size'\n", path);
+			rc = EX_USAGE;
+			goto out;
+		}
+		opts.size = dev_size - opts.offset;
+	} else if (opts.offset + opts.size > dev_size) {
+		if (!S_ISREG(sb.st_mode) || !(opts.rw & RW_WRITE)) {
+			fprintf(stderr, "%s: region exceeds the size\n", path);
+			rc = EX_USAGE;
+			goto out;
+		}
+
+		if (ftruncate(eng.fd, opts.offset + opts.size) < 0) {
+			perror("ftruncate()");
+			goto out;
+		}
+	}
+
+	num_blocks = opts.size / opts.bs;
+	if (num_blocks == 0 || opts.offset % 512 != 0) {
+		fprintf(stderr, "region must hold a block and start at a 512 byte boundary\n");
+		rc = EX_USAGE;
+		goto out;
+	}
+
+	eng.base = opts.offset;
+	eng.bs   = opts.bs;
+
+	if (opts.engine != ENGINE_SYNC && uring_open(&eng, opts.qd)) {
+		eng.ops = &URING_OPS;
+	} else if (opts.engine == ENGINE_URING) {
+		fprintf(stderr, "io_uring_setup(): %s\n", strerror(errno));
+		rc = EX_UNAVAILABLE;
+		goto out;
+	} else {
+		eng.ops = &SYNC_OPS;
+	}
+
+	crc32c_init();
+
+	order = malloc(num_blocks * sizeof order[0]);
+	slots = calloc(opts.qd, sizeof slots[0]);
+	st    = calloc(2, sizeof st[0]);
+	if (!order || !slots || !st) {
+		fprintf(stderr, "out of memory\n");
+		goto out;
+	}
+
+	for (i = 0; i < opts.qd; ++i) {
+		/* O_DIRECT needs aligned buffers */
+		if (posix_memalign((void **)&slots[i].buf, 4096, opts.bs) != 0) {
+			fprintf(stderr, "out of memory\n");
+			goto out;
+		}
+	}
+
+	for (tmp = 0; tmp < num_blocks; ++tmp)
+		order[tmp] = tmp;
+
+	printf("%s: %llu blocks of %u bytes, %s, qd %u, %s%s\n", path,
+	       (unsigned long long)num_blocks, opts.bs,
+	       opts.is_random ? "random" : "sequential",
+	       eng.ops == &SYNC_OPS ? 1 : opts.qd, eng.ops->name,
+	       opts.direct ? ", O_DIRECT" : "");
+	printf("%-6s %10s %10s %10s %10s %10s %10s %10s %10s\n", "phase", "ios",
+	       "MiB/s", "IOPS", "min[us]", "p50[us]", "p99[us]", "p999[us]",
+	       "max[us]");
+
+	rc = EX_OK;
+
+	if (opts.rw & RW_WRITE) {
+		if (opts.is_random)
+			shuffle(order, num_blocks, opts.seed);
+
+		if (!run_phase(&eng, true, order, num_blocks, slots,
+			       eng.ops == &SYNC_OPS ? 1 : opts.qd, opts.seed,
+			       &st[0])) {
+			rc = EX_IOERR;
+			goto out;
+		}
+
+		if (!print_phase("write", &st[0], opts.bs, &opts))
+			rc = 1;
+	}
+
+	if (opts.rw & RW_READ) {
+		/* another order than the one used for writing */
+		if (opts.is_random)
+			shuffle(order, num_blocks, opts.seed + 1);
+
+		if (!opts.direct)
+			drop_cache(eng.fd, S_ISBLK(sb.st_mode), opts.offset,
+				   num_blocks * opts.bs);
+
+		if (!run_phase(&eng, false, order, num_blocks, slots,
+			       eng.ops == &SYNC_OPS ? 1 : opts.qd, opts.seed,
+			       &st[1])) {
+			rc = EX_IOERR;
+			goto out;
+		}
+
+		if (!print_phase("read", &st[1], opts.bs, &opts))
+			rc = 1;
+	}
+
+	if (st[0].num_io_errors + st[1].num_io_errors > 0)
+		rc = EX_IOERR;
+	else if (st[1].num_verify_errors > 0) {
+		fprintf(stderr, "%llu blocks failed verification\n",
+			(unsigned long long)st[1].num_verify_errors);
+		rc = EX_DATAERR;
+	}
+
+out:
+	if (eng.ops)
+		eng.ops->close(&eng);
+
+	for (i = 0; slots && i < opts.qd; ++i)
+		free(slots[i].buf);
+
+	free(slots);
+	free(st);
+	free(order);
+	xclose(eng.fd);
+
+	return rc;
+}
@@ -0,0 +1,701 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Loadable bash builtins for the primitives used by test scripts; they
+ * are enabled by the 'functions' library which provides slower shell
+ * implementations with the same interface as a fallback. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bash-abi.h"
+#include "util.h"
+
+#define IO_CHUNK_SZ	(64 * 1024)
+
+/* converts 'list' into 'argv'; returns the number of words */
+static size_t list_to_argv(WORD_LIST const *list, char const *argv[],
+			   size_t max)
+{
+	size_t	cnt = 0;
+
+	for (; list && cnt < max; list = list->next)
+		argv[cnt++] = list->word->word;
+
+	return cnt;
+}
+
+static size_t list_length(WORD_LIST const *list)
+{
+	size_t	cnt = 0;
+
+	for (; list; list = list->next)
+		++cnt;
+
+	return cnt;
+}
+
+static bool parse_ull(char const *str, unsigned long long *res)
+{
+	char	*end;
+
+	errno = 0;
+	*res = strtoull(str, &end, 0);
+
+	if (*str == '\0' || *end != '\0' || errno != 0 || *str == '-') {
+		builtin_error("%s: invalid number", str);
+		return false;
+	}
+
+	return true;
+}
+
+static bool set_var(char const *name, char const *value)
+{
+	if (!legal_identifier(name)) {
+		builtin_error("`%s': not a valid identifier", name);
+		return false;
+	}
+
+	return bind_variable(name, (char *)value, 0) != NULL;
+}
+
+static int open_file(char const *fname, int flags)
+{
+	int	fd = open(fname, flags | O_CLOEXEC, 0666);
+
+	if (fd < 0)
+		builtin_error("%s: %s", fname, strerror(errno));
+
+	return fd;
+}
+
+/* reads up to 'len' bytes; returns less only at EOF or -1 on errors */
+static ssize_t read_full(int fd, void *buf, size_t len, off_t ofs,
+			 char const *fname)
+{
+	size_t	pos = 0;
+
+	while (pos < len) {
+		ssize_t	l = pread(fd, buf + pos, len - pos, ofs + pos);
+
+		if (l == 0)
+			break;
+
+		if (l < 0 && errno == EINTR)
+			continue;
+
+		if (l < 0) {
+			builtin_error("%s: %s", fname, strerror(errno));
+			return -1;
+		}
+
+		pos += l;
+	}
+
+	return pos;
+}
+
+static bool write_full(int fd, void const *buf, size_t len, off_t ofs,
+		       char const *fname)
+{
+	while (len > 0) {
+		ssize_t	l = pwrite(fd, buf, len, ofs);
+
+		if (l < 0 && errno == EINTR)
+			continue;
+
+		if (l <= 0) {
+			builtin_error("%s: %s", fname,
+				      l < 0 ? strerror(errno) : "short write");
+			return false;
+		}
+
+		buf += l;
+		len -= l;
+		ofs += l;
+	}
+
+	return true;
+}
+
+static int flush_stdout(void)
+{
+	if (fflush(stdout) != 0 || ferror(stdout)) {
+		builtin_error("write error: %s", strerror(errno));
+		clearerr(stdout);
+		return EXECUTION_FAILURE;
+	}
+
+	return EXECUTION_SUCCESS;
+}
+
+/* {{{ is_in <key> [<element>]* */
+static int is_in_builtin(WORD_LIST *list)
+{
+	char const	*key;
+
+	if (!list) {
+		builtin_usage();
+		return EX_BADUSAGE;
+	}
+
+	key = list->word->word;
+
+	if (strcmp(key, "ANY") == 0)
+		return EXECUTION_SUCCESS;
+	if (strcmp(key, "NONE") == 0)
+		return EXECUTION_FAILURE;
+
+	for (list = list->next; list; list = list->next) {
+		char const	*w = list->word->word;
+
+		if (strcmp(w, "ALL") == 0 || strcmp(w, key) == 0)
+			return EXECUTION_SUCCESS;
+	}
+
+	return EXECUTION_FAILURE;
+}
+
+static char * const	is_in_doc[] = {
+	"Succeeds when <key> equals one of the elements.",
+	"",
+	"The key ANY matches always and NONE never; an element ALL matches",
+	"every key.",
+	NULL
+};
+/* }}} is_in */
+
+/* {{{ find_file <result-var> <fname> [<directories>]* */
+static int find_file_builtin(WORD_LIST *list)
+{
+	size_t		cnt = list_length(list);
+	char const	*argv[cnt + 1];
+	size_t		i;
+
+	if (cnt < 2) {
+		builtin_usage();
+		return EX_BADUSAGE;
+	}
+
+	list_to_argv(list, argv, cnt);
+
+	for (i = 2; i < cnt; ++i) {
+		size_t	l_dir = strlen(argv[i]);
+		size_t	l_fname = strlen(argv[1]);
+		char	path[l_dir + l_fname + 2];
+
+		memcpy(path, argv[i], l_dir);
+		path[l_dir] = '/';
+		memcpy(path + l_dir + 1, argv[1], l_fname + 1);
+
+		if (access(path, F_OK) == 0)
+			return set_var(argv[0], path) ?
+				EXECUTION_SUCCESS : EXECUTION_FAILURE;
+	}
+
+	/* like 'debug CORE ...'; fd 3 is the debug log of 'runtests' */
+	dprintf(3, "CORE: file '%s' not found in", argv[1]);
+	for (i = 2; i < cnt; ++i)
+		dprintf(3, " %s", argv[i]);
+	dprintf(3, "\n");
+
+	return EXECUTION_FAILURE;
+}
+
+static char * const	find_file_doc[] = {
+	"Stores the first existing <directory>/<fname> in <result-var>.",
+	NULL
+};
+/* }}} find_file */
+
+/* {{{ toggle_bit <file> [<offset>:<bit>]+ */
+static int toggle_bit_builtin(WORD_LIST *list)
+{
+	size_t		cnt = list_length(list);
+	char const	*argv[cnt + 1];
+	int		fd;
+	int		rc = EXECUTION_FAILURE;
+	size_t		i;
+
+	if (cnt < 2) {
+		builtin_usage();
+		return EX_BADUSAGE;
+	}
+
+	list_to_argv(list, argv, cnt);
+
+	fd = open_file(argv[0], O_RDWR);
+	if (fd < 0)
+		return EXECUTION_FAILURE;
+
+	for (i = 1; i < cnt; ++i) {
+		char			tmp[strlen(argv[i]) + 1];
+		char			*sep;
+		unsigned long long	ofs;
+		unsigned long long	bit;
+		unsigned char		b;
+
+		strcpy(tmp, argv[i]);
+		sep = strchr(tmp, ':');
+		if (!sep) {
+			builtin_error("%s: expected <offset>:<bit>", argv[i]);
+			goto out;
+		}
+
+		*sep = '\0';
+		if (!parse_ull(tmp, &ofs) || !parse_ull(sep + 1, &bit))
+			goto out;
+
+		if (bit > 7) {
+			builtin_error("%s: bit out of range", argv[i]);
+			goto out;
+		}
+
+		switch (read_full(fd, &b, 1, ofs, argv[0])) {
+		case 1:
+			break;
+		case 0:
+			builtin_error("%s: offset %llu beyond EOF", argv[0], ofs);
+			/* fallthrough */
+		default:
+			goto out;
+		}
+
+		b ^= 1u << bit;
+
+		if (!write_full(fd, &b, 1, ofs, argv[0]))
+			goto out;
+	}
+
+	rc = EXECUTION_SUCCESS;
+
+out:
+	close(fd);
+	return rc;
+}
+
+static char * const	toggle_bit_doc[] = {
+	"Inverts bit <bit> (0 - 7) of the byte at <offset> in <file>.",
+	NULL
+};
+/* }}} toggle_bit */
+
+/* {{{ cmp_range [-l] [-n <len>] <file1> <file2> [<skip1> [<skip2>]] */
+static int cmp_range_builtin(WORD_LIST *list)
+{
+	size_t			cnt = list_length(list);
+	char const		*argv[cnt + 1];
+	char const		**args = argv;
+	bool			do_list = false;
+	unsigned long long	len = ~0ull;
+	unsigned long long	skip[2] = { 0, 0 };
+	unsigned long long	pos = 0;
+	int			fd[2] = { -1, -1 };
+	unsigned char		*buf = NULL;
+	int			rc = EX_BADUSAGE;
+	size_t			i;
+
+	list_to_argv(list, argv, cnt);
+
+	while (cnt > 0 && args[0][0] == '-' && args[0][1] != '\0') {
+		if (strcmp(args[0], "-l") == 0) {
+			do_list = true;
+		} else if (strcmp(args[0], "-n") == 0 && cnt > 1) {
+			if (!parse_ull(args[1], &len))
+				return EX_BADUSAGE;
+			++args;
+			--cnt;
+		} else if (strcmp(args[0], "--") == 0) {
+			++args;
+			--cnt;
+			break;
+		} else {
+			builtin_usage();
+			return EX_BADUSAGE;
+		}
+
+		++args;
+		--cnt;
+	}
+
+	if (cnt < 2 || cnt > 4) {
+		builtin_usage();
+		return EX_BADUSAGE;
+	}
+
+	for (i = 2; i < cnt; ++i) {
+		if (!parse_ull(args[i], &skip[i - 2]))
+			return EX_BADUSAGE;
+	}
+
+	buf = malloc(2 * IO_CHUNK_SZ);
+	if (!buf) {
+		builtin_error("out of memory");
+		goto out;
+	}
+
+	for (i = 0; i < 2; ++i) {
+		fd[i] = open_file(args[i], O_RDONLY);
+		if (fd[i] < 0)
+			goto out;
+	}
+
+	rc = EXECUTION_SUCCESS;
+
+	while (pos < len) {
+		size_t		want = len - pos < IO_CHUNK_SZ ? len - pos : IO_CHUNK_SZ;
+		ssize_t		l[2];
+		size_t		n;
+
+		for (i = 0; i < 2; ++i) {
+			l[i] = read_full(fd[i], buf + i * IO_CHUNK_SZ, want,
+					 skip[i] + pos, args[i]);
+			if (l[i] < 0) {
+				rc = EX_BADUSAGE;
+				goto out;
+			}
+		}
+
+		n = l[0] < l[1] ? l[0] : l[1];
+
+		if (memcmp(buf, buf + IO_CHUNK_SZ, n) != 0) {
+			rc = EXECUTION_FAILURE;
+
+			if (!do_list)
+				goto out;
+
+			for (i = 0; i < n; ++i) {
+				unsigned char	a = buf[i];
+				unsigned char	b = buf[IO_CHUNK_SZ + i];
+
+				if (a != b)
+					printf("%llu %3o %3o\n", pos + i + 1, a, b);
+			}
+		}
+
+		pos += n;
+
+		if (l[0] != l[1]) {
+			builtin_error("EOF on %s after byte %llu",
+				      args[l[0] < l[1] ? 0 : 1], pos);
+			rc = EXECUTION_FAILURE;
+			break;
+		}
+
+		if ((size_t)l[0] < want)
+			break;
+	}
+
+out:
+	for (i = 0; i < 2; ++i) {
+		if (fd[i] >= 0)
+			close(fd[i]);
+	}
+
+	free(buf);
+
+	if (do_list && flush_stdout() != EXECUTION_SUCCESS)
+		rc = EX_BADUSAGE;
+
+	return rc;
+}
+
+static char * const	cmp_range_doc[] = {
+	"Compares two files like cmp(1) but silently unless -l is given.",
+	"",
+	"Exit status is 0 when the ranges are equal, 1 when they differ and",
+	"2 on errors.",
+	NULL
+};
+/* }}} cmp_range */
+
+/* {{{ fill_pattern <file> <offset> <len> <hex-pattern> */
+static int hexval(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+
+	return -1;
+}
+
+static int fill_pattern_builtin(WORD_LIST *list)
+{
+	size_t			cnt = list_length(list);
+	char const		*argv[4] = { NULL };
+	unsigned long long	ofs;
+	unsigned long long	len;
+	char const		*hex;
+	size_t			pat_len;
+	size_t			chunk;
+	unsigned char		*buf;
+	int			fd;
+	int			rc = EXECUTION_FAILURE;
+	size_t			i;
+
+	if (cnt != 4) {
+		builtin_usage();
+		return EX_BADUSAGE;
+	}
+
+	list_to_argv(list, argv, ARRAY_SIZE(argv));
+
+	if (!parse_ull(argv[1], &ofs) || !parse_ull(argv[2], &len))
+		return EX_BADUSAGE;
+
+	hex = argv[3];
+	if (strncmp(hex, "0x", 2) == 0)
+		hex += 2;
+
+	pat_len = strlen(hex) / 2;
+	if (pat_len == 0 || strlen(hex) % 2 != 0 || pat_len > IO_CHUNK_SZ) {
+		builtin_error("%s: bad pattern", argv[3]);
+		return EX_BADUSAGE;
+	}
+
+	buf = malloc(IO_CHUNK_SZ);
+	if (!buf) {
+		builtin_error("out of memory");
+		return EXECUTION_FAILURE;
+	}
+
+	for (i = 0; i < pat_len; ++i) {
+		int	hi = hexval(hex[2 * i]);
+		int	lo = hexval(hex[2 * i + 1]);
+
+		if (hi < 0 || lo < 0) {
+			builtin_error("%s: bad pattern", argv[3]);
+			free(buf);
+			return EX_BADUSAGE;
+		}
+
+		buf[i] = (hi << 4) | lo;
+	}
+
+	for (i = pat_len; i < IO_CHUNK_SZ; ++i)
+		buf[i] = buf[i - pat_len];
+
+	fd = open_file(argv[0], O_WRONLY | O_CREAT);
+	if (fd < 0)
+		goto out;
+
+	/* the pattern starts at 'ofs'; chunk sizes are multiples of its
+	 * length so that it continues seamlessly */
+	chunk = IO_CHUNK_SZ - IO_CHUNK_SZ % pat_len;
+
+	while (len > 0) {
+		size_t	l = len < chunk ? len : chunk;
+
+		if (!write_full(fd, buf, l, ofs, argv[0]))
+			goto out;
+
+		ofs += l;
+		len -= l;
+	}
+
+	rc = EXECUTION_SUCCESS;
+
+out:
+	if (fd >= 0)
+		close(fd);
+
+	free(buf);
+
+	return rc;
+}
+
+static char * const	fill_pattern_doc[] = {
+	"Writes <len> bytes at <offset> into <file> by repeating the bytes",
+	"of <hex-pattern> (e.g. 'ff' or 'deadbeef').  The file is created",
+	"when it does not exist but never truncated.",
+	NULL
+};
+/* }}} fill_pattern */
+
+/* {{{ hexdump_range <file> [<offset> [<len>]] */
+static void hexdump_line(unsigned long long ofs, unsigned char const *data,
+			 size_t cnt)
+{
+	char	line[80];
+	char	*p = line;
+	size_t	i;
+
+	p += sprintf(p, "%08llx  ", ofs);
+
+	for (i = 0; i < 16; ++i) {
+		if (i < cnt)
+			p += sprintf(p, "%02x ", data[i]);
+		else
+			p += sprintf(p, "   ");
+
+		if (i == 7)
+			*p++ = ' ';
+	}
+
+	*p++ = ' ';
+	*p++ = '|';
+	for (i = 0; i < cnt; ++i)
+		*p++ = (data[i] >= 0x20 && data[i] < 0x7f) ? data[i] : '.';
+	*p++ = '|';
+	*p++ = '\n';
+	*p = '\0';
+
+	fputs(line, stdout);
+}
+
+/* output is the same as of 'hexdump -C -s <offset> -n <len>' */
+static int hexdump_range_builtin(WORD_LIST *list)
+{
+	size_t			cnt = list_length(list);
+	char const		*argv[3] = { NULL };
+	unsigned long long	ofs = 0;
+	unsigned long long	len = ~0ull;
+	unsigned char		prev[16];
+	bool			have_prev = false;
+	bool			is_squeezed = false;
+	unsigned char		*buf;
+	int			fd;
+	int			rc = EXECUTION_FAILURE;
+
+	if (cnt < 1 || cnt > 3) {
+		builtin_usage();
+		return EX_BADUSAGE;
+	}
+
+	list_to_argv(list, argv, ARRAY_SIZE(argv));
+
+	if ((cnt > 1 && !parse_ull(argv[1], &ofs)) ||
+	    (cnt > 2 && !parse_ull(argv[2], &len)))
+		return EX_BADUSAGE;
+
+	buf = malloc(IO_CHUNK_SZ);
+	if (!buf) {
+		builtin_error("out of memory");
+		return EXECUTION_FAILURE;
+	}
+
+	fd = open_file(argv[0], O_RDONLY);
+	if (fd < 0)
+		goto out;
+
+	while (len > 0) {
+		size_t	want = len < IO_CHUNK_SZ ? len : IO_CHUNK_SZ;
+		ssize_t	l = read_full(fd, buf, want, ofs, argv[0]);
+		size_t	i;
+
+		if (l < 0)
+			goto out;
+
+		for (i = 0; i < (size_t)l; i += 16) {
+			size_t	n = (size_t)l - i < 16 ? (size_t)l - i : 16;
+
+			if (have_prev && n == 16 &&
+			    memcmp(prev, buf + i, 16) == 0) {
+				if (!is_squeezed)
+					fputs("*\n", stdout);
+				is_squeezed = true;
+				continue;
+			}
+
+			hexdump_line(ofs + i, buf + i, n);
+			memcpy(prev, buf + i, n);
+			have_prev = n == 16;
+			is_squeezed = false;
+		}
+
+		ofs += l;
+		len -= l;
+
+		if ((size_t)l < want)
+			break;
+	}
+
+	/* no output at all for empty ranges */
+	if (have_prev || is_squeezed || ofs % 16 != 0)
+		printf("%08llx\n", ofs);
+
+	rc = EXECUTION_SUCCESS;
+
+out:
+	if (fd >= 0)
+		close(fd);
+
+	free(buf);
+
+	if (flush_stdout() != EXECUTION_SUCCESS)
+		rc = EXECUTION_FAILURE;
+
+	return rc;
+}
+
+static char * const	hexdump_range_doc[] = {
+	"Prints a range of <file> in the canonical 'hexdump -C' format.",
+	NULL
+};
+/* }}} hexdump_range */
+
+/* {{{ monotime [<result-var>] */
+static int monotime_builtin(WORD_LIST *list)
+{
+	char	buf[24];
+
+	if (list && list->next) {
+		builtin_usage();
+		return EX_BADUSAGE;
+	}
+
+	sprintf(buf, "%llu", (unsigned long long)monotonic_ns());
+
+	if (list)
+		return set_var(list->word->word, buf) ?
+			EXECUTION_SUCCESS : EXECUTION_FAILURE;
+
+	puts(buf);
+	return flush_stdout();
+}
+
+static char * const	monotime_doc[] = {
+	"Prints the CLOCK_MONOTONIC time in nanoseconds or stores it in",
+	"<result-var>.",
+	NULL
+};
+/* }}} monotime */
+
+#define BUILTIN(_name, _usage)				\
+	struct builtin	_name ## _struct = {		\
+		.name		= #_name,		\
+		.function	= _name ## _builtin,	\
+		.flags		= BUILTIN_ENABLED,	\
+		.long_doc	= _name ## _doc,	\
+		.short_doc	= #_name " " _usage,	\
+	}
+
+BUILTIN(is_in,		"<key> [<element>]...");
+BUILTIN(find_file,	"<result-var> <fname> [<directory>]...");
+BUILTIN(toggle_bit,	"<file> <offset>:<bit>...");
+BUILTIN(cmp_range,	"[-l] [-n <len>] <file1> <file2> [<skip1> [<skip2>]]");
+BUILTIN(fill_pattern,	"<file> <offset> <len> <hex-pattern>");
+BUILTIN(hexdump_range,	"<file> [<offset> [<len>]]");
+BUILTIN(monotime,	"[<result-var>]");
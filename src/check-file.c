@@ -14,31 +14,1104 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/* Checks that paths exist and can be opened.  The paths are taken from
+ * the command line or from a manifest ('--manifest', '-' for stdin)
+ * with lines of the form
+ *
+ *   <path> [type=<f|d|l|c|b|p|s>] [mode=<octal>] [owner=<user>[:<group>]]
+ *          [size=<bytes>] [sha256=<hex>]
+ *
+ * Whitespace and backslashes in manifest paths are written as '\ooo'
+ * octal escapes like in mtree files.
+ *
+ * All paths are checked in parallel by '--jobs' threads.  All failures
+ * are reported; the exit code is EX_OSERR when at least one check
+ * failed.
+ *
+ * Opening devices can have side effects (e.g. arming a watchdog), so
+ * character and block devices and sockets are only stat()ed.  A single
+ * path on the command line is still opened whatever its type, like
+ * check-file did before it took manifests.
+ *
+ * Digests of files which passed their check can be kept in a '--cache'
+ * file; they are reused while device, inode, size, mtime and ctime of
+ * the file are unchanged. */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <errno.h>
+#include <getopt.h>
+#include <grp.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <sysexits.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <linux/openat2.h>
 
-int main(int argc, char *argv[])
+#include "sha256.h"
+#include "util.h"
+
+/* {{{ cli options */
+#define CMD_HELP		0x8000
+#define CMD_VERSION		0x8001
+#define CMD_MANIFEST		0x8002
+#define CMD_JOBS		0x8003
+#define CMD_ROOT		0x8004
+#define CMD_QUIET		0x8005
+#define CMD_CACHE		0x8006
+#define CMD_SHA256_IMPL		0x8007
+
+static struct option const	CMDLINE_OPTIONS[] = {
+  { "help",        no_argument,        0, CMD_HELP },
+  { "version",     no_argument,        0, CMD_VERSION },
+  { "manifest",    required_argument,  0, CMD_MANIFEST },
+  { "jobs",        required_argument,  0, CMD_JOBS },
+  { "root",        required_argument,  0, CMD_ROOT },
+  { "quiet",       no_argument,        0, CMD_QUIET },
+  { "cache",       required_argument,  0, CMD_CACHE },
+  { "sha256-impl", required_argument,  0, CMD_SHA256_IMPL },
+  { 0,0,0,0 }
+};
+
+struct cmdline_options {
+	char const	*manifest;
+	unsigned int	jobs;
+	char const	*root;
+	bool		quiet;
+	char const	*cache;
+};
+/* }}} cli options */
+
+#define MAX_JOBS		16
+
+/* read buffer of every worker for hashing */
+#define HASH_BUF_SIZE		(1024 * 1024)
+
+/* symlinks which are followed while resolving a path below '--root';
+ * same as the kernel's limit */
+#define MAX_SYMLINKS		40
+
+enum {
+	CHECK_TYPE	= (1u << 0),
+	CHECK_MODE	= (1u << 1),
+	CHECK_UID	= (1u << 2),
+	CHECK_GID	= (1u << 3),
+	CHECK_SIZE	= (1u << 4),
+	CHECK_SHA256	= (1u << 5),
+};
+
+/* identifies the content of a file for the digest cache */
+struct cache_key {
+	uint64_t	dev;
+	uint64_t	ino;
+	uint64_t	size;
+	int64_t		mtime_ns;
+	int64_t		ctime_ns;
+};
+
+struct cache_entry {
+	struct cache_key	key;
+	unsigned char		digest[SHA256_DIGEST_SIZE];
+};
+
+struct cache {
+	struct cache_entry	*entries;	/* sorted */
+	size_t			num;
+};
+
+struct check_entry {
+	char		*path;
+	unsigned int	checks;		/* CHECK_xxx */
+
+	mode_t		type;		/* S_IFxxx */
+	mode_t		mode;		/* permission bits */
+	uid_t		uid;
+	gid_t		gid;
+	uint64_t	size;
+	unsigned char	sha256[SHA256_DIGEST_SIZE];
+
+	/* set by the workers; NULL when all checks passed */
+	char		*error;
+
+	/* set by the workers when the digest matched */
+	bool		is_verified;
+	bool		is_cached;
+	struct cache_key	key;
+};
+
+struct check_list {
+	struct check_entry	*entries;
+	size_t			num;
+	size_t			alloc;
+
+	int			root_fd;
+
+	/* a single path on the command line; it is opened even when it is
+	 * a device */
+	bool			is_single;
+
+	struct cache		cache;
+
+	/* entries in the order they are checked */
+	size_t			*order;
+
+	/* index of the next entry in 'order' to be checked */
+	size_t			next;
+
+	/* updated atomically by the workers */
+	uint64_t		bytes_hashed;
+};
+
+static void show_help(void) __attribute__((__noreturn__));
+static void show_help(void)
+{
+	printf("Usage: check-file [--jobs <num>] [--root <dir>] [--quiet]\n"
+	       "         [--cache <file>] [--sha256-impl <sha-ni|portable>]\n"
+	       "         [--manifest <file>|-] [<path>]*\n"
+	       "\n"
+	       "Character and block devices and sockets are not opened unless a\n"
+	       "single path is given on the command line.  Paths and absolute\n"
+	       "symlinks are resolved relative to '--root' when given.\n");
+	exit(0);
+}
+
+static void show_version(void) __attribute__((__noreturn__));
+static void show_version(void)
+{
+	/* \todo */
+	exit(0);
+}
+
+static struct {
+	char	c;
+	mode_t	type;
+	char	const *name;
+} const			FILE_TYPES[] = {
+	{ 'f', S_IFREG,  "regular file" },
+	{ 'd', S_IFDIR,  "directory" },
+	{ 'l', S_IFLNK,  "symlink" },
+	{ 'c', S_IFCHR,  "character device" },
+	{ 'b', S_IFBLK,  "block device" },
+	{ 'p', S_IFIFO,  "fifo" },
+	{ 's', S_IFSOCK, "socket" },
+};
+
+static char const *type_name(mode_t type)
+{
+	size_t	i;
+
+	for (i = 0; i < sizeof FILE_TYPES / sizeof FILE_TYPES[0]; ++i) {
+		if (FILE_TYPES[i].type == type)
+			return FILE_TYPES[i].name;
+	}
+
+	return "unknown";
+}
+
+/* {{{ manifest parser */
+static struct check_entry *check_list_add(struct check_list *lst,
+					  char const *path)
+{
+	struct check_entry	*e;
+
+	if (lst->num == lst->alloc) {
+		size_t	alloc = lst->alloc ? lst->alloc * 2 : 64;
+		void	*tmp = realloc(lst->entries, alloc * sizeof lst->entries[0]);
+
+		if (!tmp)
+			return NULL;
+
+		lst->entries = tmp;
+		lst->alloc   = alloc;
+	}
+
+	e = &lst->entries[lst->num];
+	*e = (struct check_entry) {
+		.path	= strdup(path),
+	};
+
+	if (!e->path)
+		return NULL;
+
+	++lst->num;
+	return e;
+}
+
+/* resolves '\ooo' escapes in place */
+static void unescape_path(char *path)
+{
+	char	*dst = path;
+
+	while (*path) {
+		if (path[0] == '\\' &&
+		    path[1] >= '0' && path[1] <= '3' &&
+		    path[2] >= '0' && path[2] <= '7' &&
+		    path[3] >= '0' && path[3] <= '7') {
+			*dst++ = ((path[1] - '0') << 6 |
+				  (path[2] - '0') << 3 |
+				  (path[3] - '0'));
+			path += 4;
+		} else {
+			*dst++ = *path++;
+		}
+	}
+
+	*dst = '\0';
+}
+
+static bool parse_hex(unsigned char *dst, size_t len, char const *str)
+{
+	size_t	i;
+
+	if (strlen(str) != len * 2)
+		return false;
+
+	for (i = 0; i < len; ++i) {
+		unsigned int	v;
+
+		if (sscanf(str + i * 2, "%2x", &v) != 1 ||
+		    !isxdigit(str[i * 2]) || !isxdigit(str[i * 2 + 1]))
+			return false;
+
+		dst[i] = v;
+	}
+
+	return true;
+}
+
+static bool parse_owner(struct check_entry *e, char const *val)
+{
+	char		*tmp = strdupa(val);
+	char		*grp = strchr(tmp, ':');
+	char		*end;
+
+	if (grp)
+		*grp++ = '\0';
+
+	if (*tmp) {
+		struct passwd	*pw;
+
+		e->uid = strtoul(tmp, &end, 10);
+		if (*end != '\0') {
+			pw = getpwnam(tmp);
+			if (!pw)
+				return false;
+			e->uid = pw->pw_uid;
+		}
+
+		e->checks |= CHECK_UID;
+	}
+
+	if (grp && *grp) {
+		struct group	*gr;
+
+		e->gid = strtoul(grp, &end, 10);
+		if (*end != '\0') {
+			gr = getgrnam(grp);
+			if (!gr)
+				return false;
+			e->gid = gr->gr_gid;
+		}
+
+		e->checks |= CHECK_GID;
+	}
+
+	return true;
+}
+
+static bool parse_attr(struct check_entry *e, char *attr)
+{
+	char	*val = strchr(attr, '=');
+	char	*end;
+	size_t	i;
+
+	if (!val)
+		return false;
+
+	*val++ = '\0';
+
+	if (strcmp(attr, "type") == 0) {
+		for (i = 0; i < sizeof FILE_TYPES / sizeof FILE_TYPES[0]; ++i) {
+			if (val[0] == FILE_TYPES[i].c && val[1] == '\0') {
+				e->type = FILE_TYPES[i].type;
+				e->checks |= CHECK_TYPE;
+				return true;
+			}
+		}
+		return false;
+	} else if (strcmp(attr, "mode") == 0) {
+		e->mode = strtoul(val, &end, 8);
+		e->checks |= CHECK_MODE;
+		return *val && *end == '\0' && e->mode <= 07777;
+	} else if (strcmp(attr, "owner") == 0) {
+		return parse_owner(e, val);
+	} else if (strcmp(attr, "size") == 0) {
+		e->size = strtoull(val, &end, 0);
+		e->checks |= CHECK_SIZE;
+		return *val && *end == '\0';
+	} else if (strcmp(attr, "sha256") == 0) {
+		e->checks |= CHECK_SHA256;
+		return parse_hex(e->sha256, sizeof e->sha256, val);
+	}
+
+	return false;
+}
+
+static bool read_manifest(struct check_list *lst, char const *fname)
+{
+	FILE		*f = strcmp(fname, "-") == 0 ? stdin : fopen(fname, "r");
+	char		*line = NULL;
+	size_t		line_len = 0;
+	unsigned int	lineno = 0;
+	bool		rc = false;
+
+	if (!f) {
+		fprintf(stderr, "fopen(%s): %s\n", fname, strerror(errno));
+		return false;
+	}
+
+	while (getline(&line, &line_len, f) > 0) {
+		char			*ptr = line;
+		char			*tok;
+		struct check_entry	*e = NULL;
+
+		++lineno;
+
+		while ((tok = strsep(&ptr, " \t\n")) != NULL) {
+			if (*tok == '\0')
+				continue;
+
+			if (!e && *tok == '#')
+				break;
+
+			if (!e) {
+				unescape_path(tok);
+				e = check_list_add(lst, tok);
+				if (!e) {
+					fprintf(stderr, "out of memory\n");
+					goto out;
+				}
+			} else if (!parse_attr(e, tok)) {
+				fprintf(stderr, "%s:%u: bad attribute '%s'\n",
+					fname, lineno, tok);
+				goto out;
+			}
+		}
+	}
+
+	if (ferror(f)) {
+		fprintf(stderr, "read(%s): %s\n", fname, strerror(errno));
+		goto out;
+	}
+
+	rc = true;
+
+out:
+	free(line);
+	if (f != stdin)
+		fclose(f);
+
+	return rc;
+}
+/* }}} manifest parser */
+
+static void set_error(struct check_entry *e, char const *fmt, ...)
+	__attribute__((__format__(printf, 2, 3)));
+static void set_error(struct check_entry *e, char const *fmt, ...)
+{
+	va_list	ap;
+
+	/* keep the first error only */
+	if (e->error)
+		return;
+
+	va_start(ap, fmt);
+	if (vasprintf(&e->error, fmt, ap) < 0)
+		e->error = NULL;
+	va_end(ap);
+}
+
+/* {{{ digest cache */
+static int cache_key_cmp(void const *a_, void const *b_)
+{
+	struct cache_key const	*a = a_;
+	struct cache_key const	*b = b_;
+
+	return memcmp(a, b, sizeof *a);
+}
+
+static bool cache_load(struct cache *cache, char const *fname)
+{
+	FILE			*f = fopen(fname, "r");
+	struct cache_entry	e;
+	char			hex[SHA256_DIGEST_SIZE * 2 + 1];
+	size_t			alloc = 0;
+
+	/* a missing cache is not an error */
+	if (!f)
+		return errno == ENOENT;
+
+	memset(&e, 0, sizeof e);
+
+	while (fscanf(f, "%" SCNx64 " %" SCNu64 " %" SCNu64 " %" SCNd64
+		      " %" SCNd64 " %64s", &e.key.dev, &e.key.ino,
+		      &e.key.size, &e.key.mtime_ns, &e.key.ctime_ns,
+		      hex) == 6) {
+		if (!parse_hex(e.digest, sizeof e.digest, hex))
+			break;
+
+		if (cache->num == alloc) {
+			void	*tmp;
+
+			alloc = alloc ? alloc * 2 : 1024;
+			tmp = realloc(cache->entries, alloc * sizeof e);
+			if (!tmp)
+				break;
+
+			cache->entries = tmp;
+		}
+
+		cache->entries[cache->num++] = e;
+	}
+
+	fclose(f);
+
+	qsort(cache->entries, cache->num, sizeof cache->entries[0],
+	      cache_key_cmp);
+
+	return true;
+}
+
+static struct cache_entry const *cache_find(struct cache const *cache,
+					    struct cache_key const *key)
+{
+	return bsearch(key, cache->entries, cache->num,
+		       sizeof cache->entries[0], cache_key_cmp);
+}
+
+/* replaces the cache by the verified entries of this run */
+static bool cache_save(struct check_list const *lst, char const *fname)
+{
+	char	*tmp_name;
+	FILE	*f;
+	size_t	i;
+	bool	rc;
+
+	if (asprintf(&tmp_name, "%s.tmp", fname) < 0)
+		return false;
+
+	f = fopen(tmp_name, "w");
+	if (!f) {
+		fprintf(stderr, "fopen(%s): %s\n", tmp_name, strerror(errno));
+		free(tmp_name);
+		return false;
+	}
+
+	for (i = 0; i < lst->num; ++i) {
+		struct check_entry const	*e = &lst->entries[i];
+		unsigned int			j;
+
+		if (!e->is_verified)
+			continue;
+
+		fprintf(f, "%" PRIx64 " %" PRIu64 " %" PRIu64 " %" PRId64 " %" PRId64 " ",
+			e->key.dev, e->key.ino, e->key.size,
+			e->key.mtime_ns, e->key.ctime_ns);
+
+		for (j = 0; j < sizeof e->sha256; ++j)
+			fprintf(f, "%02x", e->sha256[j]);
+
+		fputc('\n', f);
+	}
+
+	rc = fflush(f) == 0 && fsync(fileno(f)) == 0;
+	rc = fclose(f) == 0 && rc;
+
+	if (rc && rename(tmp_name, fname) < 0)
+		rc = false;
+
+	if (!rc) {
+		fprintf(stderr, "failed to write %s: %s\n", fname, strerror(errno));
+		unlink(tmp_name);
+	}
+
+	free(tmp_name);
+	return rc;
+}
+/* }}} digest cache */
+
+static bool hash_fd(int fd, unsigned char digest[SHA256_DIGEST_SIZE],
+		    void *buf, uint64_t *total)
+{
+	struct sha256	ctx;
+
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	sha256_init(&ctx);
+
+	for (;;) {
+		ssize_t	l = read(fd, buf, HASH_BUF_SIZE);
+
+		if (l < 0 && errno == EINTR)
+			continue;
+		if (l < 0)
+			return false;
+		if (l == 0)
+			break;
+
+		sha256_update(&ctx, buf, l);
+		*total += l;
+	}
+
+	sha256_final(&ctx, digest);
+
+	return true;
+}
+
+static void check_digest(struct check_entry *e, struct check_list *lst,
+			 int fd, struct statx const *st, void *buf)
+{
+	struct cache_entry const	*cached;
+	unsigned char			digest[SHA256_DIGEST_SIZE];
+	uint64_t			hashed = 0;
+
+	e->key = (struct cache_key) {
+		.dev		= makedev(st->stx_dev_major, st->stx_dev_minor),
+		.ino		= st->stx_ino,
+		.size		= st->stx_size,
+		.mtime_ns	= (st->stx_mtime.tv_sec * 1000000000ll +
+				   st->stx_mtime.tv_nsec),
+		.ctime_ns	= (st->stx_ctime.tv_sec * 1000000000ll +
+				   st->stx_ctime.tv_nsec),
+	};
+
+	cached = cache_find(&lst->cache, &e->key);
+	if (cached) {
+		memcpy(digest, cached->digest, sizeof digest);
+		e->is_cached = true;
+	} else if (!hash_fd(fd, digest, buf, &hashed)) {
+		set_error(e, "read(%s): %s", e->path, strerror(errno));
+		return;
+	}
+
+	__atomic_add_fetch(&lst->bytes_hashed, hashed, __ATOMIC_RELAXED);
+
+	if (memcmp(digest, e->sha256, sizeof digest) != 0)
+		set_error(e, "%s: sha256 mismatch", e->path);
+	else
+		e->is_verified = true;
+}
+
+/* {{{ path resolution below '--root' */
+/* Resolves 'path' below 'root_fd' into a directory fd and the name of
+ * its last component.  Like chroot(), absolute symlinks and '..' stay
+ * within the root.  The last component is a symlink only when
+ * 'follow_last' is false. */
+static int resolve_in_root(int root_fd, char const *path, bool follow_last,
+			   char **name)
 {
+	char		*rest = strdup(path);
+	char		*p;
+	int		dir = -1;
+	unsigned int	depth = 0;
+	unsigned int	num_links = 0;
+	int		err;
+
+	if (!rest) {
+		err = ENOMEM;
+		goto err;
+	}
+
+	dir = openat(root_fd, ".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+	if (dir < 0) {
+		err = errno;
+		goto err;
+	}
+
+	p = rest;
+	for (;;) {
+		char		*comp;
+		char		*next;
+		bool		is_last;
+		struct stat	st;
+		int		tmp;
+
+		while (*p == '/')
+			++p;
+
+		comp = p;
+		next = strchrnul(p, '/');
+		p = next;
+		while (*p == '/')
+			++p;
+
+		is_last = *p == '\0';
+		*next = '\0';
+
+		if (*comp == '\0')
+			comp = ".";
+
+		if (strcmp(comp, ".") == 0 && !is_last)
+			continue;
+
+		if (strcmp(comp, "..") == 0) {
+			if (depth > 0) {
+				tmp = openat(dir, "..",
+					     O_PATH | O_DIRECTORY | O_CLOEXEC);
+				if (tmp < 0) {
+					err = errno;
+					goto err;
+				}
+
+				close(dir);
+				dir = tmp;
+				--depth;
+			}
+
+			if (!is_last)
+				continue;
+
+			comp = ".";
+		}
+
+		if (fstatat(dir, comp, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+			err = errno;
+			goto err;
+		}
+
+		if (S_ISLNK(st.st_mode) && (follow_last || !is_last)) {
+			char	target[PATH_MAX];
+			ssize_t	l;
+			char	*tmp_rest;
+
+			if (++num_links > MAX_SYMLINKS) {
+				err = ELOOP;
+				goto err;
+			}
+
+			l = readlinkat(dir, comp, target, sizeof target - 1);
+			if (l < 0) {
+				err = errno;
+				goto err;
+			}
+
+			target[l] = '\0';
+
+			if (asprintf(&tmp_rest, "%s/%s", target, p) < 0) {
+				err = ENOMEM;
+				goto err;
+			}
+
+			free(rest);
+			rest = tmp_rest;
+			p = rest;
+
+			if (target[0] == '/') {
+				tmp = openat(root_fd, ".",
+					     O_PATH | O_DIRECTORY | O_CLOEXEC);
+				if (tmp < 0) {
+					err = errno;
+					goto err;
+				}
+
+				close(dir);
+				dir = tmp;
+				depth = 0;
+			}
+
+			continue;
+		}
+
+		if (is_last) {
+			*name = strdup(comp);
+			if (!*name) {
+				err = ENOMEM;
+				goto err;
+			}
+
+			free(rest);
+			return dir;
+		}
+
+		tmp = openat(dir, comp,
+			     O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		if (tmp < 0) {
+			err = errno;
+			goto err;
+		}
+
+		close(dir);
+		dir = tmp;
+		++depth;
+	}
+
+err:
+	xclose(dir);
+	free(rest);
+	errno = err;
+	return -1;
+}
+
+/* openat() for 'path' below 'root_fd'; uses openat2(RESOLVE_IN_ROOT)
+ * and falls back to resolve_in_root() on kernels without it */
+static int open_in_root(int root_fd, char const *path, int flags)
+{
+	int		dir;
+	char		*name;
+	int		fd;
+	int		err;
+
+#ifdef SYS_openat2
+	struct open_how	how = {
+		.flags		= flags,
+		.resolve	= RESOLVE_IN_ROOT,
+	};
+
+	fd = syscall(SYS_openat2, root_fd, path, &how, sizeof how);
+	if (fd >= 0 || (errno != ENOSYS && errno != EPERM))
+		return fd;
+#endif
+
+	dir = resolve_in_root(root_fd, path, !(flags & O_NOFOLLOW), &name);
+	if (dir < 0)
+		return -1;
+
+	/* the last component was resolved already; a symlink at this
+	 * place was created concurrently */
+	fd = openat(dir, name, flags | O_NOFOLLOW);
+	err = errno;
+
+	close(dir);
+	free(name);
+	errno = err;
+
+	return fd;
+}
+/* }}} path resolution below '--root' */
+
+static void check_one(struct check_entry *e, struct check_list *lst,
+		      void *buf)
+{
+	int		root_fd = lst->root_fd;
+	char const	*path = e->path;
+	struct statx	st;
+	int		flags = 0;
+	mode_t		type;
 	int		fd;
-	struct stat	st;
+	int		rc;
+
+	if ((e->checks & CHECK_TYPE) && e->type == S_IFLNK)
+		flags |= AT_SYMLINK_NOFOLLOW;
+
+	/* absolute manifest paths and symlinks are relative to '--root' */
+	if (root_fd != AT_FDCWD) {
+		int	path_fd;
 
-	if (stat(argv[1], &st) < 0) {
-		fprintf(stderr, "stat(%s): %s\n", argv[1], strerror(errno));
-		return EX_OSERR;
+		path_fd = open_in_root(root_fd, path,
+				       O_PATH | O_CLOEXEC |
+				       ((flags & AT_SYMLINK_NOFOLLOW) ?
+					O_NOFOLLOW : 0));
+		if (path_fd < 0) {
+			set_error(e, "stat(%s): %s", e->path, strerror(errno));
+			return;
+		}
+
+		rc = statx(path_fd, "", flags | AT_EMPTY_PATH,
+			   STATX_TYPE | STATX_MODE | STATX_UID | STATX_GID |
+			   STATX_SIZE | STATX_INO | STATX_MTIME | STATX_CTIME,
+			   &st);
+		close(path_fd);
+	} else {
+		rc = statx(AT_FDCWD, path, flags,
+			   STATX_TYPE | STATX_MODE | STATX_UID | STATX_GID |
+			   STATX_SIZE | STATX_INO | STATX_MTIME | STATX_CTIME,
+			   &st);
+	}
+
+	if (rc < 0) {
+		set_error(e, "stat(%s): %s", e->path, strerror(errno));
+		return;
 	}
 
-	fd = open(argv[1], O_RDONLY);
+	type = st.stx_mode & S_IFMT;
+
+	if ((e->checks & CHECK_TYPE) && type != e->type)
+		set_error(e, "%s: is a %s, expected a %s", e->path,
+			  type_name(type), type_name(e->type));
+
+	if ((e->checks & CHECK_MODE) && (st.stx_mode & 07777) != e->mode)
+		set_error(e, "%s: mode is %04o, expected %04o", e->path,
+			  st.stx_mode & 07777, e->mode);
+
+	if ((e->checks & CHECK_UID) && st.stx_uid != e->uid)
+		set_error(e, "%s: owner is %u, expected %u", e->path,
+			  st.stx_uid, e->uid);
+
+	if ((e->checks & CHECK_GID) && st.stx_gid != e->gid)
+		set_error(e, "%s: group is %u, expected %u", e->path,
+			  st.stx_gid, e->gid);
+
+	if ((e->checks & CHECK_SIZE) && st.stx_size != e->size)
+		set_error(e, "%s: size is %llu, expected %llu", e->path,
+			  (unsigned long long)st.stx_size,
+			  (unsigned long long)e->size);
+
+	/* symlinks which are checked as such are not followed */
+	if (flags & AT_SYMLINK_NOFOLLOW)
+		return;
+
+	if (!lst->is_single &&
+	    (type == S_IFCHR || type == S_IFBLK || type == S_IFSOCK))
+		return;
+
+	if (root_fd != AT_FDCWD)
+		fd = open_in_root(root_fd, path,
+				  O_RDONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+	else
+		fd = open(path, O_RDONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
 	if (fd < 0) {
-		fprintf(stderr, "open(%s): %s\n", argv[1], strerror(errno));
-		return EX_OSERR;
+		set_error(e, "open(%s): %s", e->path, strerror(errno));
+		return;
 	}
+
+	if ((e->checks & CHECK_SHA256) && type != S_IFREG)
+		set_error(e, "%s: can not hash a %s", e->path, type_name(type));
+	else if (e->checks & CHECK_SHA256)
+		check_digest(e, lst, fd, &st, buf);
+
 	close(fd);
+}
+
+/* Every worker takes the next unchecked entry, so that idle workers
+ * pick up the remaining work while others hash large files. */
+static void *check_worker(void *lst_)
+{
+	struct check_list	*lst = lst_;
+	void			*buf = malloc(HASH_BUF_SIZE);
+
+	for (;;) {
+		size_t	idx = __atomic_fetch_add(&lst->next, 1, __ATOMIC_RELAXED);
+		struct check_entry	*e;
+
+		if (idx >= lst->num)
+			break;
+
+		e = &lst->entries[lst->order[idx]];
+
+		if (!buf && (e->checks & CHECK_SHA256))
+			set_error(e, "%s: out of memory", e->path);
+		else
+			check_one(e, lst, buf);
+	}
+
+	free(buf);
+
+	return NULL;
+}
+
+static struct check_list const	*sort_list;
+
+/* hashed files with the largest expected size come first so that they
+ * do not end up as stragglers */
+static int check_order_cmp(void const *a_, void const *b_)
+{
+	struct check_entry const	*a = &sort_list->entries[*(size_t const *)a_];
+	struct check_entry const	*b = &sort_list->entries[*(size_t const *)b_];
+	uint64_t			sa = (a->checks & CHECK_SHA256) ? a->size + 1 : 0;
+	uint64_t			sb = (b->checks & CHECK_SHA256) ? b->size + 1 : 0;
+
+	if (sa != sb)
+		return sa > sb ? -1 : +1;
+
+	return a < b ? -1 : a > b;
+}
+
+static bool check_order(struct check_list *lst)
+{
+	size_t	i;
+
+	lst->order = malloc(lst->num * sizeof lst->order[0]);
+	if (!lst->order)
+		return false;
+
+	for (i = 0; i < lst->num; ++i)
+		lst->order[i] = i;
+
+	sort_list = lst;
+	qsort(lst->order, lst->num, sizeof lst->order[0], check_order_cmp);
+	sort_list = NULL;
+
+	return true;
+}
+
+static void check_all(struct check_list *lst, unsigned int jobs)
+{
+	pthread_t	threads[MAX_JOBS];
+	unsigned int	num_threads = 0;
+	unsigned int	i;
+
+	if (jobs > lst->num)
+		jobs = lst->num;
+
+	/* the calling thread is a worker too */
+	for (i = 1; i < jobs; ++i) {
+		int	rc = pthread_create(&threads[num_threads], NULL,
+					    check_worker, lst);
+
+		if (rc != 0) {
+			fprintf(stderr, "pthread_create(): %s\n", strerror(rc));
+			break;
+		}
+
+		++num_threads;
+	}
+
+	check_worker(lst);
+
+	for (i = 0; i < num_threads; ++i)
+		pthread_join(threads[i], NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	struct cmdline_options	opts = {
+		.jobs	= 0,
+	};
+	struct check_list	lst = {
+		.root_fd	= AT_FDCWD,
+	};
+	size_t			num_failed = 0;
+	size_t			num_hashed = 0;
+	size_t			num_cached = 0;
+	uint64_t		t0;
+	uint64_t		t1;
+	size_t			i;
+	int			rc = EX_OSERR;
+
+	while (1) {
+		int	c = getopt_long(argc, argv, "", CMDLINE_OPTIONS, 0);
+
+		if (c==-1)
+			break;
+
+		switch (c) {
+		case CMD_HELP		:  show_help();
+		case CMD_VERSION	:  show_version();
+		case CMD_MANIFEST	:  opts.manifest = optarg; break;
+		case CMD_JOBS		:  opts.jobs = atoi(optarg); break;
+		case CMD_ROOT		:  opts.root = optarg; break;
+		case CMD_QUIET		:  opts.quiet = true; break;
+		case CMD_CACHE		:  opts.cache = optarg; break;
+		case CMD_SHA256_IMPL:
+			if (!sha256_select(optarg)) {
+				fprintf(stderr, "sha256 implementation '%s' not supported\n",
+					optarg);
+				return EX_UNAVAILABLE;
+			}
+			break;
+		default:
+			fprintf(stderr, "Try '--help' for more information\n");
+			return EX_USAGE;
+		}
+	}
+
+	if (opts.jobs == 0) {
+		long	n = sysconf(_SC_NPROCESSORS_ONLN);
+
+		opts.jobs = n > 0 ? n : 1;
+	}
+
+	if (opts.jobs > MAX_JOBS)
+		opts.jobs = MAX_JOBS;
+
+	if (opts.root) {
+		lst.root_fd = open(opts.root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (lst.root_fd < 0) {
+			fprintf(stderr, "open(%s): %s\n", opts.root, strerror(errno));
+			return EX_NOINPUT;
+		}
+	}
+
+	if (opts.manifest && !read_manifest(&lst, opts.manifest)) {
+		rc = EX_DATAERR;
+		goto out;
+	}
+
+	for (i = optind; i < (size_t)argc; ++i) {
+		if (!check_list_add(&lst, argv[i])) {
+			fprintf(stderr, "out of memory\n");
+			goto out;
+		}
+	}
+
+	if (lst.num == 0) {
+		fprintf(stderr, "no paths given\n");
+		rc = EX_USAGE;
+		goto out;
+	}
+
+	lst.is_single = !opts.manifest && lst.num == 1;
+
+	if (opts.cache && !cache_load(&lst.cache, opts.cache))
+		fprintf(stderr, "failed to read %s; ignoring it\n", opts.cache);
+
+	if (!check_order(&lst)) {
+		fprintf(stderr, "out of memory\n");
+		goto out;
+	}
+
+	t0 = monotonic_ns();
+	check_all(&lst, opts.jobs);
+	t1 = monotonic_ns();
+
+	for (i = 0; i < lst.num; ++i) {
+		if (lst.entries[i].checks & CHECK_SHA256)
+			++num_hashed;
+		if (lst.entries[i].is_cached)
+			++num_cached;
+
+		if (!lst.entries[i].error)
+			continue;
+
+		fprintf(stderr, "%s\n", lst.entries[i].error);
+		++num_failed;
+	}
+
+	if (!opts.quiet && lst.num > 1)
+		printf("%zu paths checked, %zu failed\n", lst.num, num_failed);
+
+	if (!opts.quiet && num_hashed > 0)
+		printf("%zu digests checked (%zu from cache), %.1f MiB hashed in %.3f s with %s\n",
+		       num_hashed, num_cached,
+		       lst.bytes_hashed / (1024.0 * 1024.0), (t1 - t0) / 1e9,
+		       sha256_impl());
+
+	if (opts.cache)
+		cache_save(&lst, opts.cache);
+
+	rc = num_failed > 0 ? EX_OSERR : EX_OK;
+
+out:
+	for (i = 0; i < lst.num; ++i) {
+		free(lst.entries[i].path);
+		free(lst.entries[i].error);
+	}
+	free(lst.entries);
+	free(lst.order);
+	free(lst.cache.entries);
+
+	if (lst.root_fd != AT_FDCWD)
+		close(lst.root_fd);
 
-	return EX_OK;
+	return rc;
 }
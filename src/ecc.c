@@ -0,0 +1,545 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ecc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
+/* BCH codes up to GF(2^15); index is 'm' */
+static uint16_t const	BCH_PRIM_POLY[] = {
+	[5]  = 0x25,   [6]  = 0x43,   [7]  = 0x83,   [8]  = 0x11d,
+	[9]  = 0x211,  [10] = 0x409,  [11] = 0x805,  [12] = 0x1053,
+	[13] = 0x201b, [14] = 0x402b, [15] = 0x8003,
+};
+
+#define BCH_MAX_DEGREE	(15 * 64)
+
+static inline bool get_bit(void const *buf, unsigned int idx)
+{
+	return (((unsigned char const *)buf)[idx / 8] >> (idx % 8)) & 1;
+}
+
+static inline void flip_bit(void *buf, unsigned int idx)
+{
+	((unsigned char *)buf)[idx / 8] ^= 1u << (idx % 8);
+}
+
+/* {{{ extended Hamming code
+ *
+ * Data bits are placed at the codeword positions which are no power of
+ * two; the parity value is the XOR of the positions of all set data
+ * bits.  An additional bit holds the overall parity which distinguishes
+ * single (correctable) from double (detectable) errors. */
+
+static bool hamming_init(struct ecc *ecc)
+{
+	unsigned int	nbits = ecc->step * 8;
+	unsigned int	r = 1;
+	unsigned int	pos;
+	unsigned int	i;
+
+	while ((1u << r) < nbits + r + 1)
+		++r;
+
+	if (r > 15)
+		return false;
+
+	ecc->ham_pos = calloc(nbits, sizeof ecc->ham_pos[0]);
+	if (!ecc->ham_pos)
+		return false;
+
+	for (i = 0, pos = 3; i < nbits; ++pos) {
+		if ((pos & (pos - 1)) != 0)
+			ecc->ham_pos[i++] = pos;
+	}
+
+	ecc->num_parity = r;
+	ecc->strength = 1;
+	ecc->bytes = (r + 1 + 7) / 8;
+
+	return true;
+}
+
+static void hamming_syndrome(struct ecc const *ecc, void const *data,
+			     unsigned int *syn, unsigned int *parity)
+{
+	unsigned char const	*p = data;
+	unsigned int		x = 0;
+	unsigned int		cnt = 0;
+	unsigned int		i;
+
+	for (i = 0; i < ecc->step; ++i) {
+		unsigned int	b = p[i];
+		uint16_t const	*pos = &ecc->ham_pos[i * 8];
+
+		cnt += __builtin_popcount(b);
+		for (; b; b &= b - 1)
+			x ^= pos[__builtin_ctz(b)];
+	}
+
+	*syn = x;
+	*parity = cnt & 1;
+}
+
+static unsigned int hamming_get_code(struct ecc const *ecc, void const *code)
+{
+	unsigned int	v = 0;
+	unsigned int	i;
+
+	for (i = 0; i <= ecc->num_parity; ++i)
+		v |= get_bit(code, i) << i;
+
+	return v;
+}
+
+static void hamming_calculate(struct ecc const *ecc, void const *data,
+			      void *code)
+{
+	unsigned int	x;
+	unsigned int	parity;
+	unsigned int	v;
+	unsigned int	i;
+
+	hamming_syndrome(ecc, data, &x, &parity);
+
+	parity ^= __builtin_popcount(x) & 1;
+	v = x | (parity << ecc->num_parity);
+
+	memset(code, 0, ecc->bytes);
+	for (i = 0; i <= ecc->num_parity; ++i) {
+		if (v & (1u << i))
+			flip_bit(code, i);
+	}
+}
+
+static int hamming_correct(struct ecc const *ecc, void *data, void *code)
+{
+	unsigned int	r = ecc->num_parity;
+	unsigned int	stored = hamming_get_code(ecc, code);
+	unsigned int	x;
+	unsigned int	parity;
+	unsigned int	syn;
+	unsigned int	d;
+
+	hamming_syndrome(ecc, data, &x, &parity);
+
+	syn = x ^ (stored & ((1u << r) - 1));
+	parity ^= __builtin_popcount(stored) & 1;
+
+	if (syn == 0 && parity == 0)
+		return 0;
+
+	if (parity == 0)
+		/* even number of errors */
+		return -1;
+
+	if (syn == 0) {
+		/* overall parity bit */
+		flip_bit(code, r);
+		return 1;
+	}
+
+	if ((syn & (syn - 1)) == 0) {
+		/* one of the parity bits */
+		flip_bit(code, __builtin_ctz(syn));
+		return 1;
+	}
+
+	/* position -> data bit; skips the powers of two below 'syn' */
+	d = syn - (31 - __builtin_clz(syn)) - 2;
+	if (d >= ecc->step * 8)
+		return -1;
+
+	flip_bit(data, d);
+	return 1;
+}
+/* }}} extended Hamming code */
+
+/* {{{ BCH code
+ *
+ * The codeword polynomial has the parity bits at x^0 .. x^(deg-1) and
+ * the data bit 'k' at x^(deg + k).  Errors are located with
+ * Berlekamp-Massey and a Chien search over the shortened code. */
+
+static inline unsigned int gf_mul(struct ecc const *ecc, unsigned int a,
+				  unsigned int b)
+{
+	if (a == 0 || b == 0)
+		return 0;
+
+	return ecc->alpha_to[(ecc->index_of[a] + ecc->index_of[b]) % ecc->n];
+}
+
+static inline unsigned int gf_div(struct ecc const *ecc, unsigned int a,
+				  unsigned int b)
+{
+	if (a == 0)
+		return 0;
+
+	return ecc->alpha_to[(ecc->index_of[a] + ecc->n - ecc->index_of[b]) %
+			     ecc->n];
+}
+
+/* alpha^e for any non-negative exponent */
+static inline unsigned int gf_pow(struct ecc const *ecc, unsigned long e)
+{
+	return ecc->alpha_to[e % ecc->n];
+}
+
+static bool bch_init(struct ecc *ecc)
+{
+	unsigned int	t = ecc->strength;
+	unsigned int	nbits = ecc->step * 8;
+	unsigned char	*gen = NULL;
+	unsigned char	*done = NULL;
+	unsigned int	deg = 0;
+	unsigned int	m;
+	unsigned int	i;
+	bool		rc = false;
+
+	if (t == 0)
+		return false;
+
+	for (m = 5; m < ARRAY_SIZE(BCH_PRIM_POLY); ++m) {
+		if ((1u << m) - 1 >= nbits + m * t)
+			break;
+	}
+
+	if (m == ARRAY_SIZE(BCH_PRIM_POLY) || m * t > BCH_MAX_DEGREE)
+		return false;
+
+	ecc->m = m;
+	ecc->n = (1u << m) - 1;
+	ecc->alpha_to = calloc(ecc->n + 1, sizeof ecc->alpha_to[0]);
+	ecc->index_of = calloc(ecc->n + 1, sizeof ecc->index_of[0]);
+	gen  = calloc(m * t + 1, 1);
+	done = calloc(ecc->n, 1);
+
+	if (!ecc->alpha_to || !ecc->index_of || !gen || !done)
+		goto out;
+
+	for (i = 0; i < ecc->n; ++i) {
+		unsigned int	v = i == 0 ? 1 : ecc->alpha_to[i - 1] << 1;
+
+		if (v & (1u << m))
+			v ^= BCH_PRIM_POLY[m];
+
+		ecc->alpha_to[i] = v;
+		ecc->index_of[v] = i;
+	}
+
+	/* g(x) = lcm of the minimal polynomials of alpha^1 .. alpha^2t;
+	 * the even powers share the cyclotomic cosets of the odd ones */
+	gen[0] = 1;
+	for (i = 1; i < 2 * t; i += 2) {
+		unsigned int	minpoly[16] = { 1 };
+		unsigned int	mdeg = 0;
+		unsigned int	j = i;
+		unsigned int	k;
+		unsigned int	l;
+
+		if (done[i])
+			continue;
+
+		/* product of (x + alpha^j) over the coset of 'i' */
+		do {
+			done[j] = 1;
+
+			minpoly[mdeg + 1] = 0;
+			for (k = mdeg + 1; k > 0; --k)
+				minpoly[k] = minpoly[k - 1] ^
+					gf_mul(ecc, minpoly[k], gf_pow(ecc, j));
+			minpoly[0] = gf_mul(ecc, minpoly[0], gf_pow(ecc, j));
+			++mdeg;
+
+			j = (2 * j) % ecc->n;
+		} while (j != i);
+
+		/* the minimal polynomial has binary coefficients */
+		for (k = deg + 1; k-- > 0;) {
+			if (!gen[k])
+				continue;
+
+			gen[k] = 0;
+			for (l = 0; l <= mdeg; ++l)
+				gen[k + l] ^= minpoly[l] & 1;
+		}
+
+		deg += mdeg;
+	}
+
+	ecc->num_parity = deg;
+	ecc->bytes = (deg + 7) / 8;
+	ecc->gen_words = (deg + 63) / 64;
+	ecc->gen = calloc(ecc->gen_words, sizeof ecc->gen[0]);
+	if (!ecc->gen)
+		goto out;
+
+	for (i = 0; i < deg; ++i) {
+		if (gen[i])
+			ecc->gen[i / 64] |= 1ull << (i % 64);
+	}
+
+	rc = true;
+
+out:
+	free(done);
+	free(gen);
+
+	return rc;
+}
+
+static void bch_calculate(struct ecc const *ecc, void const *data, void *code)
+{
+	unsigned int	deg = ecc->num_parity;
+	unsigned int	words = ecc->gen_words;
+	uint64_t	r[BCH_MAX_DEGREE / 64 + 1] = { 0 };
+	uint64_t	top_mask = 1ull << ((deg - 1) % 64);
+	unsigned int	k;
+	unsigned int	w;
+
+	/* remainder of d(x) * x^deg / g(x); highest data bit first */
+	for (k = ecc->step * 8; k-- > 0;) {
+		bool	fb = get_bit(data, k) ^ !!(r[words - 1] & top_mask);
+
+		for (w = words; w-- > 1;)
+			r[w] = (r[w] << 1) | (r[w - 1] >> 63);
+		r[0] <<= 1;
+
+		if (deg % 64)
+			r[words - 1] &= (top_mask << 1) - 1;
+
+		if (fb) {
+			for (w = 0; w < words; ++w)
+				r[w] ^= ecc->gen[w];
+		}
+	}
+
+	memset(code, 0, ecc->bytes);
+	for (k = 0; k < deg; ++k) {
+		if (r[k / 64] & (1ull << (k % 64)))
+			flip_bit(code, k);
+	}
+}
+
+static int bch_correct(struct ecc const *ecc, void *data, void *code)
+{
+	unsigned int	t = ecc->strength;
+	unsigned int	deg = ecc->num_parity;
+	unsigned int	nbits = deg + ecc->step * 8;
+	unsigned int	syn[2 * t + 1];
+	unsigned int	c[2 * t + 1];
+	unsigned int	b[2 * t + 1];
+	unsigned int	err_pos[t];
+	unsigned int	num_err = 0;
+	unsigned int	l = 0;
+	unsigned int	shift = 1;
+	unsigned int	b_disc = 1;
+	bool		is_zero = true;
+	unsigned int	i;
+	unsigned int	p;
+
+	memset(syn, 0, sizeof syn);
+
+	/* odd syndromes; S(2i) = S(i)^2 */
+	for (p = 0; p < nbits; ++p) {
+		bool	bit = (p < deg ? get_bit(code, p) :
+			       get_bit(data, p - deg));
+
+		if (!bit)
+			continue;
+
+		for (i = 1; i < 2 * t; i += 2)
+			syn[i] ^= gf_pow(ecc, (unsigned long)i * p);
+	}
+
+	for (i = 2; i <= 2 * t; i += 2)
+		syn[i] = gf_mul(ecc, syn[i / 2], syn[i / 2]);
+
+	for (i = 1; i <= 2 * t; ++i)
+		is_zero &= syn[i] == 0;
+
+	if (is_zero)
+		return 0;
+
+	/* Berlekamp-Massey */
+	memset(c, 0, sizeof c);
+	memset(b, 0, sizeof b);
+	c[0] = 1;
+	b[0] = 1;
+
+	for (i = 0; i < 2 * t; ++i) {
+		unsigned int	d = syn[i + 1];
+		unsigned int	j;
+
+		for (j = 1; j <= l; ++j)
+			d ^= gf_mul(ecc, c[j], syn[i + 1 - j]);
+
+		if (d == 0) {
+			++shift;
+		} else {
+			unsigned int	coef = gf_div(ecc, d, b_disc);
+			unsigned int	tmp[2 * t + 1];
+
+			memcpy(tmp, c, sizeof tmp);
+			for (j = 0; j + shift <= 2 * t; ++j)
+				c[j + shift] ^= gf_mul(ecc, coef, b[j]);
+
+			if (2 * l <= i) {
+				l = i + 1 - l;
+				memcpy(b, tmp, sizeof b);
+				b_disc = d;
+				shift = 1;
+			} else {
+				++shift;
+			}
+		}
+	}
+
+	if (l > t)
+		return -1;
+
+	/* Chien search; an error at position p is a root alpha^-p */
+	for (p = 0; p < nbits && num_err <= l; ++p) {
+		unsigned int	v = c[0];
+		unsigned int	j;
+
+		for (j = 1; j <= l; ++j) {
+			if (c[j])
+				v ^= ecc->alpha_to[(ecc->index_of[c[j]] +
+						    (unsigned long)j *
+						    (ecc->n - p % ecc->n)) %
+						   ecc->n];
+		}
+
+		if (v == 0) {
+			if (num_err == l)
+				return -1;
+
+			err_pos[num_err++] = p;
+		}
+	}
+
+	if (num_err != l)
+		return -1;
+
+	for (i = 0; i < num_err; ++i) {
+		p = err_pos[i];
+
+		if (p < deg)
+			flip_bit(code, p);
+		else
+			flip_bit(data, p - deg);
+	}
+
+	return num_err;
+}
+/* }}} BCH code */
+
+bool ecc_init(struct ecc *ecc, enum ecc_type type, unsigned int step,
+	      unsigned int strength)
+{
+	bool	rc;
+
+	*ecc = (struct ecc) {
+		.type		= type,
+		.step		= step,
+		.strength	= strength,
+	};
+
+	switch (type) {
+	case ECC_NONE:
+		ecc->strength = 0;
+		rc = true;
+		break;
+	case ECC_HAMMING:
+		rc = hamming_init(ecc);
+		break;
+	case ECC_BCH:
+		rc = bch_init(ecc);
+		break;
+	default:
+		rc = false;
+		break;
+	}
+
+	if (!rc) {
+		fprintf(stderr, "unsupported ECC configuration (step %u, strength %u)\n",
+			step, strength);
+		ecc_free(ecc);
+	}
+
+	return rc;
+}
+
+void ecc_free(struct ecc *ecc)
+{
+	free(ecc->ham_pos);
+	free(ecc->alpha_to);
+	free(ecc->index_of);
+	free(ecc->gen);
+
+	ecc->ham_pos = NULL;
+	ecc->alpha_to = NULL;
+	ecc->index_of = NULL;
+	ecc->gen = NULL;
+}
+
+bool ecc_parse(char const *str, enum ecc_type *type, unsigned int *strength)
+{
+	char	*end;
+
+	if (strcmp(str, "none") == 0) {
+		*type = ECC_NONE;
+		*strength = 0;
+	} else if (strcmp(str, "hamming") == 0) {
+		*type = ECC_HAMMING;
+		*strength = 1;
+	} else if (strncmp(str, "bch", 3) == 0) {
+		*type = ECC_BCH;
+		*strength = strtoul(str + 3, &end, 10);
+		if (*end || *strength == 0)
+			return false;
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+void ecc_calculate(struct ecc const *ecc, void const *data, void *code)
+{
+	switch (ecc->type) {
+	case ECC_NONE:		break;
+	case ECC_HAMMING:	hamming_calculate(ecc, data, code); break;
+	case ECC_BCH:		bch_calculate(ecc, data, code); break;
+	}
+}
+
+int ecc_correct(struct ecc const *ecc, void *data, void *code)
+{
+	switch (ecc->type) {
+	case ECC_NONE:		return 0;
+	case ECC_HAMMING:	return hamming_correct(ecc, data, code);
+	case ECC_BCH:		return bch_correct(ecc, data, code);
+	}
+
+	return -1;
+}
@@ -0,0 +1,68 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_TESTSUITE_SRC_ECC_H
+#define H_ENSC_TESTSUITE_SRC_ECC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+enum ecc_type {
+	ECC_NONE,
+	ECC_HAMMING,		/* extended Hamming code; corrects 1 bit */
+	ECC_BCH,		/* binary BCH code */
+};
+
+/* Software ECC for a single step of 'step' data bytes.  The ECC of a
+ * step occupies 'bytes' bytes. */
+struct ecc {
+	enum ecc_type		type;
+	unsigned int		step;
+	unsigned int		strength;
+	unsigned int		bytes;
+
+	/* Hamming: number of parity bits; BCH: degree of the generator
+	 * polynomial */
+	unsigned int		num_parity;
+
+	/* Hamming: codeword position of every data bit */
+	uint16_t		*ham_pos;
+
+	/* BCH over GF(2^m) with n = 2^m - 1 */
+	unsigned int		m;
+	unsigned int		n;
+	uint16_t		*alpha_to;
+	uint16_t		*index_of;
+	uint64_t		*gen;	/* without the x^num_parity term */
+	unsigned int		gen_words;
+};
+
+/* 'strength' is ignored for ECC_HAMMING and ECC_NONE */
+bool ecc_init(struct ecc *ecc, enum ecc_type type, unsigned int step,
+	      unsigned int strength);
+void ecc_free(struct ecc *ecc);
+
+/* parses 'none', 'hamming' or 'bch<strength>' */
+bool ecc_parse(char const *str, enum ecc_type *type, unsigned int *strength);
+
+void ecc_calculate(struct ecc const *ecc, void const *data, void *code);
+
+/* Corrects 'data' and 'code' in place; returns the number of corrected
+ * bits or -1 when the errors can not be corrected.  Both buffers are
+ * left untouched in the latter case. */
+int ecc_correct(struct ecc const *ecc, void *data, void *code);
+
+#endif	/* H_ENSC_TESTSUITE_SRC_ECC_H */
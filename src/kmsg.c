@@ -0,0 +1,137 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "kmsg.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "util.h"
+
+/* a record is limited to 1024 bytes of text plus its prefix and
+ * dictionary in the kernel */
+#define KMSG_RECORD_SIZE	8192
+
+static struct {
+	char const	*pattern;
+	unsigned int	flag;
+} const		KMSG_PATTERNS[] = {
+	{ "Oops",			KMSG_FLAG_OOPS },
+	{ "BUG: ",			KMSG_FLAG_OOPS },
+	{ "Kernel panic",		KMSG_FLAG_OOPS },
+	{ "general protection fault",	KMSG_FLAG_OOPS },
+	{ "Unable to handle kernel",	KMSG_FLAG_OOPS },
+	{ "WARNING: ",			KMSG_FLAG_WARN },
+};
+
+void kmsg_open(struct kmsg *kmsg)
+{
+	*kmsg = (struct kmsg) { .fd = -1 };
+
+	kmsg->fd = open("/dev/kmsg", O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (kmsg->fd < 0) {
+		fprintf(stderr, "open(/dev/kmsg): %s\n", strerror(errno));
+		return;
+	}
+
+	/* start with the next message */
+	if (lseek(kmsg->fd, 0, SEEK_END) < 0) {
+		perror("lseek(/dev/kmsg)");
+		xclose(kmsg->fd);
+		kmsg->fd = -1;
+	}
+}
+
+void kmsg_close(struct kmsg *kmsg)
+{
+	if (kmsg->fd >= 0)
+		close(kmsg->fd);
+
+	kmsg->fd = -1;
+	strbuf_free(&kmsg->text);
+}
+
+static void kmsg_add_record(struct kmsg *kmsg, char *rec)
+{
+	unsigned int		prio;
+	unsigned long long	ts_us;
+	char			*msg = strchr(rec, ';');
+	char			*eol;
+	size_t			i;
+
+	/* <prio>,<seq>,<ts_us>,<flags>[,...];<text>\n[ <key>=<val>\n]... */
+	if (!msg || sscanf(rec, "%u,%*u,%llu", &prio, &ts_us) != 2)
+		return;
+
+	++msg;
+	eol = strchr(msg, '\n');
+	if (eol)
+		*eol = '\0';
+
+	++kmsg->num_lines;
+	if (LOG_PRI(prio) <= LOG_ERR)
+		++kmsg->num_errors;
+
+	for (i = 0; i < ARRAY_SIZE(KMSG_PATTERNS); ++i) {
+		if (strstr(msg, KMSG_PATTERNS[i].pattern))
+			kmsg->flags |= KMSG_PATTERNS[i].flag;
+	}
+
+	if (kmsg->text.len + strlen(msg) + 32 > KMSG_MAX_TEXT) {
+		++kmsg->num_truncated;
+		return;
+	}
+
+	strbuf_printf(&kmsg->text, "<%u>[%5llu.%06llu] %s\n", LOG_PRI(prio),
+		      ts_us / 1000000u, ts_us % 1000000u, msg);
+}
+
+void kmsg_read(struct kmsg *kmsg)
+{
+	char		rec[KMSG_RECORD_SIZE];
+
+	if (kmsg->fd < 0)
+		return;
+
+	for (;;) {
+		/* every read() returns exactly one record */
+		ssize_t	l = read(kmsg->fd, rec, sizeof rec - 1);
+
+		if (l < 0 && errno == EINTR)
+			continue;
+		else if (l < 0 && errno == EPIPE) {
+			/* the ring buffer wrapped around */
+			++kmsg->num_lost;
+			continue;
+		} else if (l < 0 && errno == EAGAIN) {
+			break;
+		} else if (l <= 0) {
+			if (l < 0)
+				perror("read(/dev/kmsg)");
+			close(kmsg->fd);
+			kmsg->fd = -1;
+			break;
+		}
+
+		rec[l] = '\0';
+		kmsg_add_record(kmsg, rec);
+	}
+}
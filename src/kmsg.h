@@ -0,0 +1,59 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_TESTSUITE_SRC_KMSG_H
+#define H_ENSC_TESTSUITE_SRC_KMSG_H
+
+#include <stdbool.h>
+
+#include "strbuf.h"
+
+/* upper limit of kernel log text kept per test */
+#define KMSG_MAX_TEXT		(64 * 1024)
+
+enum {
+	KMSG_FLAG_OOPS		= (1u << 0),	/* oops, BUG or panic */
+	KMSG_FLAG_WARN		= (1u << 1),	/* WARN_ON() backtrace */
+};
+
+/* Collects the kernel messages which are logged while a test runs.
+ * Messages are attributed by time only; with parallel tests, every
+ * running test sees all messages. */
+struct kmsg {
+	int			fd;
+
+	struct strbuf		text;
+	unsigned int		num_lines;
+	unsigned int		num_errors;	/* level <= LOG_ERR */
+	unsigned int		num_truncated;
+	unsigned int		num_lost;	/* overwritten in the ring */
+	unsigned int		flags;
+};
+
+/* Opens /dev/kmsg and skips existing messages; 'kmsg' is inactive
+ * (fd == -1) when the log can not be read */
+void kmsg_open(struct kmsg *kmsg);
+void kmsg_close(struct kmsg *kmsg);
+
+/* reads all pending messages without blocking */
+void kmsg_read(struct kmsg *kmsg);
+
+static inline int kmsg_fd(struct kmsg const *kmsg)
+{
+	return kmsg->fd;
+}
+
+#endif	/* H_ENSC_TESTSUITE_SRC_KMSG_H */
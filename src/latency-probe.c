@@ -0,0 +1,538 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Timer wakeup latency probe.  One thread per selected CPU sleeps until
+ * absolute, periodic deadlines and records how late it was woken up.
+ * Every thread owns its histogram; they are merged after the threads
+ * have been joined so that the measuring loop does not share any cache
+ * lines. */
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+
+#include "lathist.h"
+#include "util.h"
+
+/* {{{ cli options */
+#define CMD_HELP		0x8000
+#define CMD_VERSION		0x8001
+#define CMD_INTERVAL		0x8002
+#define CMD_DURATION		0x8003
+#define CMD_LOOPS		0x8004
+#define CMD_CPUS		0x8005
+#define CMD_AFFINITY		0x8006
+#define CMD_PRIORITY		0x8007
+#define CMD_CLOCK		0x8008
+#define CMD_MLOCK		0x8009
+#define CMD_HISTOGRAM		0x800a
+#define CMD_MAX			0x800b
+#define CMD_MAX_P99		0x800c
+#define CMD_QUIET		0x800d
+
+static struct option const	CMDLINE_OPTIONS[] = {
+  { "help",        no_argument,        0, CMD_HELP },
+  { "version",     no_argument,        0, CMD_VERSION },
+  { "interval",    required_argument,  0, CMD_INTERVAL },
+  { "duration",    required_argument,  0, CMD_DURATION },
+  { "loops",       required_argument,  0, CMD_LOOPS },
+  { "cpus",        required_argument,  0, CMD_CPUS },
+  { "affinity",    no_argument,        0, CMD_AFFINITY },
+  { "priority",    required_argument,  0, CMD_PRIORITY },
+  { "clock",       required_argument,  0, CMD_CLOCK },
+  { "mlock",       no_argument,        0, CMD_MLOCK },
+  { "histogram",   no_argument,        0, CMD_HISTOGRAM },
+  { "max",         required_argument,  0, CMD_MAX },
+  { "max-p99",     required_argument,  0, CMD_MAX_P99 },
+  { "quiet",       no_argument,        0, CMD_QUIET },
+  { 0,0,0,0 }
+};
+
+enum wait_method {
+	WAIT_NANOSLEEP,
+	WAIT_TIMERFD,
+};
+
+struct cmdline_options {
+	unsigned int		interval_us;
+	double			duration;	/* seconds */
+	unsigned long		loops;		/* 0 means use 'duration' */
+	cpu_set_t		cpus;
+	bool			affinity;
+	int			priority;	/* SCHED_FIFO when > 0 */
+	enum wait_method	method;
+	bool			mlock;
+	bool			histogram;
+	bool			quiet;
+	double			max_us;		/* 0 means no limit */
+	double			max_p99_us;	/* 0 means no limit */
+};
+/* }}} cli options */
+
+/* releases the threads once all of them were created */
+struct start_gate {
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	enum {
+		GATE_CLOSED,
+		GATE_OPEN,
+		GATE_ABORT,
+	}			state;
+};
+
+struct probe_thread {
+	pthread_t		thread;
+	unsigned int		cpu;
+	struct cmdline_options const	*opts;
+	struct start_gate	*gate;
+
+	/* written by the thread only; read after pthread_join() */
+	struct lat_hist		hist;
+	unsigned long		num_overruns;
+	int			err;		/* errno of a failed syscall */
+	char const		*err_fn;
+} __attribute__((__aligned__(64)));
+
+static volatile sig_atomic_t	g_do_stop;
+
+static void show_help(void) __attribute__((__noreturn__));
+static void show_help(void)
+{
+	printf("Usage: latency-probe [--interval <us>] [--duration <s>|--loops <num>]\n"
+	       "         [--cpus <list>] [--affinity] [--priority <prio>]\n"
+	       "         [--clock nanosleep|timerfd] [--mlock] [--histogram]\n"
+	       "         [--max <us>] [--max-p99 <us>] [--quiet]\n"
+	       "\n"
+	       "Starts one thread per CPU in <list> (default: all usable CPUs) which\n"
+	       "wakes up every <interval> us (default 1000) and measures how late the\n"
+	       "wakeup happened.  <list> must only contain usable CPUs, i.e. online\n"
+	       "CPUs in the affinity mask.  '--priority' runs the threads with\n"
+	       "SCHED_FIFO and '--affinity' pins them to their CPU.  Exit status is 1\n"
+	       "when a limit was exceeded.\n");
+	exit(0);
+}
+
+static void show_version(void) __attribute__((__noreturn__));
+static void show_version(void)
+{
+	/* \todo */
+	exit(0);
+}
+
+static void handle_stop(int sig)
+{
+	g_do_stop = 1;
+}
+
+static void ns_to_timespec(struct timespec *ts, uint64_t ns)
+{
+	ts->tv_sec  = ns / 1000000000ull;
+	ts->tv_nsec = ns % 1000000000ull;
+}
+
+static bool wait_until(struct probe_thread *t, int tfd, uint64_t deadline)
+{
+	struct timespec		ts;
+	int			rc;
+
+	ns_to_timespec(&ts, deadline);
+
+	switch (t->opts->method) {
+	case WAIT_NANOSLEEP:
+		rc = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+		if (rc != 0 && rc != EINTR) {
+			t->err = rc;
+			t->err_fn = "clock_nanosleep()";
+			return false;
+		}
+		break;
+
+	case WAIT_TIMERFD: {
+		struct itimerspec const	tm = { .it_value = ts };
+		uint64_t		cnt;
+
+		if (timerfd_settime(tfd, TFD_TIMER_ABSTIME, &tm, NULL) < 0) {
+			t->err = errno;
+			t->err_fn = "timerfd_settime()";
+			return false;
+		}
+
+		if (read(tfd, &cnt, sizeof cnt) < 0 && errno != EINTR) {
+			t->err = errno;
+			t->err_fn = "read(<timerfd>)";
+			return false;
+		}
+		break;
+	}
+	}
+
+	return true;
+}
+
+static void *probe_thread_fn(void *t_)
+{
+	struct probe_thread		*t = t_;
+	struct cmdline_options const	*opts = t->opts;
+	uint64_t			interval = opts->interval_us * 1000ull;
+	uint64_t			end;
+	uint64_t			next;
+	unsigned long			num = 0;
+	int				tfd = -1;
+	bool				is_aborted;
+
+	if (opts->method == WAIT_TIMERFD) {
+		tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+		if (tfd < 0) {
+			t->err = errno;
+			t->err_fn = "timerfd_create()";
+		}
+	}
+
+	pthread_mutex_lock(&t->gate->lock);
+	while (t->gate->state == GATE_CLOSED)
+		pthread_cond_wait(&t->gate->cond, &t->gate->lock);
+	is_aborted = t->gate->state == GATE_ABORT;
+	pthread_mutex_unlock(&t->gate->lock);
+
+	if (t->err || is_aborted)
+		goto out;
+
+	next = monotonic_ns() + interval;
+	end  = next + (uint64_t)(opts->duration * 1e9);
+
+	while (!g_do_stop) {
+		uint64_t	now;
+
+		if (opts->loops ? num >= opts->loops : next > end)
+			break;
+
+		if (!wait_until(t, tfd, next))
+			break;
+
+		now = monotonic_ns();
+		if (now < next)
+			/* interrupted by a signal */
+			continue;
+
+		lat_hist_add(&t->hist, now - next);
+		++num;
+
+		next += interval;
+
+		/* skip the periods which were missed completely instead of
+		 * reporting them as a burst of late wakeups */
+		if (now >= next) {
+			uint64_t	missed = (now - next) / interval + 1;
+
+			t->num_overruns += missed;
+			next += missed * interval;
+		}
+	}
+
+out:
+	xclose(tfd);
+
+	return NULL;
+}
+
+static void print_hist(char const *name, struct lat_hist const *h,
+		       unsigned long num_overruns)
+{
+	printf("%-6s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %8lu\n",
+	       name, (unsigned long long)h->count,
+	       h->count ? h->min / 1e3 : 0.,
+	       h->count ? (double)h->sum / h->count / 1e3 : 0.,
+	       lat_hist_percentile(h, 50) / 1e3,
+	       lat_hist_percentile(h, 99) / 1e3,
+	       lat_hist_percentile(h, 99.9) / 1e3,
+	       h->max / 1e3, num_overruns);
+}
+
+static bool parse_cpus(char const *str, cpu_set_t *set)
+{
+	char	*tmp = strdup(str);
+	char	*ptr = tmp;
+	char	*tok;
+	bool	rc = false;
+
+	CPU_ZERO(set);
+
+	while (ptr && (tok = strsep(&ptr, ",")) != NULL) {
+		char		*end;
+		unsigned long	a = strtoul(tok, &end, 10);
+		unsigned long	b = a;
+
+		if (end != tok && *end == '-')
+			b = strtoul(end + 1, &end, 10);
+
+		if (end == tok || *end != '\0' || b < a || b >= CPU_SETSIZE) {
+			fprintf(stderr, "invalid cpu list '%s'\n", str);
+			goto out;
+		}
+
+		for (; a <= b; ++a)
+			CPU_SET(a, set);
+	}
+
+	rc = true;
+
+out:
+	free(tmp);
+	return rc;
+}
+
+static bool start_thread(struct probe_thread *t)
+{
+	pthread_attr_t	attr;
+	int		rc;
+
+	pthread_attr_init(&attr);
+
+	if (t->opts->affinity) {
+		cpu_set_t	set;
+
+		CPU_ZERO(&set);
+		CPU_SET(t->cpu, &set);
+		pthread_attr_setaffinity_np(&attr, sizeof set, &set);
+	}
+
+	if (t->opts->priority > 0) {
+		struct sched_param	param = {
+			.sched_priority	= t->opts->priority,
+		};
+
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+		pthread_attr_setschedparam(&attr, &param);
+	}
+
+	rc = pthread_create(&t->thread, &attr, probe_thread_fn, t);
+	pthread_attr_destroy(&attr);
+
+	if (rc != 0) {
+		fprintf(stderr, "pthread_create(<cpu %u>): %s\n", t->cpu,
+			strerror(rc));
+		return false;
+	}
+
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	struct cmdline_options	opts = {
+		.interval_us	= 1000,
+		.duration	= 10,
+		.method		= WAIT_NANOSLEEP,
+	};
+	struct sigaction const	sa = { .sa_handler = handle_stop };
+	bool			have_cpus = false;
+	cpu_set_t		allowed;
+	struct probe_thread	*threads = NULL;
+	struct start_gate	gate = {
+		.lock	= PTHREAD_MUTEX_INITIALIZER,
+		.cond	= PTHREAD_COND_INITIALIZER,
+		.state	= GATE_CLOSED,
+	};
+	struct lat_hist		*total = NULL;
+	unsigned long		num_overruns = 0;
+	unsigned int		num_threads = 0;
+	unsigned int		num_started = 0;
+	unsigned int		cpu;
+	unsigned int		i;
+	int			rc = EX_OSERR;
+
+	while (1) {
+		int	c = getopt_long(argc, argv, "", CMDLINE_OPTIONS, 0);
+
+		if (c==-1)
+			break;
+
+		switch (c) {
+		case CMD_HELP		:  show_help();
+		case CMD_VERSION	:  show_version();
+		case CMD_INTERVAL	:  opts.interval_us = atoi(optarg); break;
+		case CMD_DURATION	:  opts.duration = atof(optarg); break;
+		case CMD_LOOPS		:  opts.loops = strtoul(optarg, NULL, 0); break;
+		case CMD_AFFINITY	:  opts.affinity = true; break;
+		case CMD_PRIORITY	:  opts.priority = atoi(optarg); break;
+		case CMD_MLOCK		:  opts.mlock = true; break;
+		case CMD_HISTOGRAM	:  opts.histogram = true; break;
+		case CMD_MAX		:  opts.max_us = atof(optarg); break;
+		case CMD_MAX_P99	:  opts.max_p99_us = atof(optarg); break;
+		case CMD_QUIET		:  opts.quiet = true; break;
+
+		case CMD_CPUS:
+			if (!parse_cpus(optarg, &opts.cpus))
+				return EX_USAGE;
+			have_cpus = true;
+			break;
+
+		case CMD_CLOCK:
+			if (strcmp(optarg, "nanosleep") == 0)
+				opts.method = WAIT_NANOSLEEP;
+			else if (strcmp(optarg, "timerfd") == 0)
+				opts.method = WAIT_TIMERFD;
+			else
+				goto bad_arg;
+			break;
+
+		default:
+		bad_arg:
+			fprintf(stderr, "Try '--help' for more information\n");
+			return EX_USAGE;
+		}
+	}
+
+	if (optind != argc || opts.interval_us == 0 ||
+	    (opts.loops == 0 && opts.duration <= 0)) {
+		fprintf(stderr, "bad arguments; try '--help' for more information\n");
+		return EX_USAGE;
+	}
+
+	if (sched_getaffinity(0, sizeof allowed, &allowed) < 0) {
+		perror("sched_getaffinity()");
+		return EX_OSERR;
+	}
+
+	if (!have_cpus)
+		opts.cpus = allowed;
+
+	/* offline CPUs and CPUs outside of the affinity mask would fail
+	 * later with an obscure EINVAL from pthread_create() */
+	for (cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+		if (CPU_ISSET(cpu, &opts.cpus) && !CPU_ISSET(cpu, &allowed)) {
+			fprintf(stderr, "cpu %u is offline or not in the affinity mask of this process\n",
+				cpu);
+			return EX_USAGE;
+		}
+	}
+
+	num_threads = CPU_COUNT(&opts.cpus);
+	if (num_threads == 0) {
+		fprintf(stderr, "no cpus selected\n");
+		return EX_USAGE;
+	}
+
+	if (opts.mlock && mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+		perror("mlockall()");
+		return EX_OSERR;
+	}
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	threads = calloc(num_threads, sizeof threads[0]);
+	total   = malloc(sizeof *total);
+	if (!threads || !total) {
+		fprintf(stderr, "out of memory\n");
+		goto out;
+	}
+
+	for (cpu = 0, i = 0; i < num_threads; ++cpu) {
+		struct probe_thread	*t;
+
+		if (!CPU_ISSET(cpu, &opts.cpus))
+			continue;
+
+		t = &threads[i++];
+		t->cpu     = cpu;
+		t->opts    = &opts;
+		t->gate    = &gate;
+		lat_hist_init(&t->hist);
+	}
+
+	for (i = 0; i < num_threads; ++i) {
+		if (!start_thread(&threads[i]))
+			break;
+
+		++num_started;
+	}
+
+	pthread_mutex_lock(&gate.lock);
+	gate.state = num_started == num_threads ? GATE_OPEN : GATE_ABORT;
+	pthread_cond_broadcast(&gate.cond);
+	pthread_mutex_unlock(&gate.lock);
+
+	lat_hist_init(total);
+	rc = num_started == num_threads ? EX_OK : EX_OSERR;
+
+	if (!opts.quiet && rc == EX_OK)
+		printf("%-6s %10s %10s %10s %10s %10s %10s %10s %8s\n", "cpu",
+		       "wakeups", "min[us]", "avg[us]", "p50[us]", "p99[us]",
+		       "p999[us]", "max[us]", "overrun");
+
+	for (i = 0; i < num_started; ++i) {
+		struct probe_thread	*t = &threads[i];
+		char			name[16];
+
+		pthread_join(t->thread, NULL);
+
+		if (t->err) {
+			fprintf(stderr, "cpu %u: %s: %s\n", t->cpu, t->err_fn,
+				strerror(t->err));
+			rc = EX_OSERR;
+			continue;
+		}
+
+		lat_hist_merge(total, &t->hist);
+		num_overruns += t->num_overruns;
+
+		if (opts.quiet || rc != EX_OK)
+			continue;
+
+		sprintf(name, "%u", t->cpu);
+		print_hist(name, &t->hist, t->num_overruns);
+	}
+
+	if (rc != EX_OK)
+		goto out;
+
+	print_hist("all", total, num_overruns);
+
+	if (opts.histogram)
+		lat_hist_print(total, stdout, "    ");
+
+	if (opts.max_us > 0 && total->max / 1e3 > opts.max_us) {
+		fprintf(stderr, "max latency %.1f us exceeds %.1f us\n",
+			total->max / 1e3, opts.max_us);
+		rc = 1;
+	}
+
+	if (opts.max_p99_us > 0 &&
+	    lat_hist_percentile(total, 99) / 1e3 > opts.max_p99_us) {
+		fprintf(stderr, "p99 latency %.1f us exceeds %.1f us\n",
+			lat_hist_percentile(total, 99) / 1e3, opts.max_p99_us);
+		rc = 1;
+	}
+
+out:
+	free(total);
+	free(threads);
+
+	return rc;
+}
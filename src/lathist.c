@@ -0,0 +1,125 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lathist.h"
+
+#include <string.h>
+
+static unsigned int lat_hist_index(uint64_t v)
+{
+	unsigned int	shift;
+
+	if (v < LAT_HIST_SUB)
+		return v;
+
+	shift = 63 - __builtin_clzll(v) - LAT_HIST_SUB_BITS;
+
+	return ((shift + 1) * LAT_HIST_SUB +
+		((v >> shift) & (LAT_HIST_SUB - 1)));
+}
+
+static uint64_t lat_hist_lower(unsigned int idx)
+{
+	unsigned int	shift;
+
+	if (idx < LAT_HIST_SUB)
+		return idx;
+
+	shift = idx / LAT_HIST_SUB - 1;
+
+	return (uint64_t)(LAT_HIST_SUB + idx % LAT_HIST_SUB) << shift;
+}
+
+static uint64_t lat_hist_upper(unsigned int idx)
+{
+	if (idx < LAT_HIST_SUB)
+		return idx;
+
+	return lat_hist_lower(idx) + (1ull << (idx / LAT_HIST_SUB - 1)) - 1;
+}
+
+void lat_hist_init(struct lat_hist *h)
+{
+	memset(h, 0, sizeof *h);
+	h->min = UINT64_MAX;
+}
+
+void lat_hist_add(struct lat_hist *h, uint64_t ns)
+{
+	++h->buckets[lat_hist_index(ns)];
+	++h->count;
+	h->sum += ns;
+
+	if (ns < h->min)
+		h->min = ns;
+	if (ns > h->max)
+		h->max = ns;
+}
+
+void lat_hist_merge(struct lat_hist *dst, struct lat_hist const *src)
+{
+	unsigned int	i;
+
+	for (i = 0; i < LAT_HIST_BUCKETS; ++i)
+		dst->buckets[i] += src->buckets[i];
+
+	dst->count += src->count;
+	dst->sum   += src->sum;
+
+	if (src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+}
+
+uint64_t lat_hist_percentile(struct lat_hist const *h, double p)
+{
+	uint64_t	rank;
+	uint64_t	cnt = 0;
+	unsigned int	i;
+
+	if (h->count == 0)
+		return 0;
+
+	rank = p / 100.0 * h->count + 0.5;
+	if (rank < 1)
+		rank = 1;
+	if (rank > h->count)
+		rank = h->count;
+
+	for (i = 0; i < LAT_HIST_BUCKETS; ++i) {
+		cnt += h->buckets[i];
+		if (cnt >= rank)
+			break;
+	}
+
+	/* the bucket bound can exceed the largest recorded value */
+	return lat_hist_upper(i) < h->max ? lat_hist_upper(i) : h->max;
+}
+
+void lat_hist_print(struct lat_hist const *h, FILE *f, char const *prefix)
+{
+	unsigned int	i;
+
+	for (i = 0; i < LAT_HIST_BUCKETS; ++i) {
+		if (h->buckets[i] == 0)
+			continue;
+
+		fprintf(f, "%s%10.3f - %10.3f %10llu\n", prefix,
+			lat_hist_lower(i) / 1e3, lat_hist_upper(i) / 1e3,
+			(unsigned long long)h->buckets[i]);
+	}
+}
@@ -0,0 +1,54 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_TESTSUITE_SRC_LATHIST_H
+#define H_ENSC_TESTSUITE_SRC_LATHIST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Log-bucketed histogram for latencies in ns.  Every power of two is
+ * split into 2^LAT_HIST_SUB_BITS linear buckets, so that reported
+ * percentiles are at most 1/16 above the exact value; values below
+ * 2^LAT_HIST_SUB_BITS are exact. */
+#define LAT_HIST_SUB_BITS	4
+#define LAT_HIST_SUB		(1u << LAT_HIST_SUB_BITS)
+#define LAT_HIST_BUCKETS	((64 - LAT_HIST_SUB_BITS + 1) * LAT_HIST_SUB)
+
+struct lat_hist {
+	uint64_t	count;
+	uint64_t	sum;
+	uint64_t	min;
+	uint64_t	max;
+	uint64_t	buckets[LAT_HIST_BUCKETS];
+};
+
+void lat_hist_init(struct lat_hist *h);
+void lat_hist_add(struct lat_hist *h, uint64_t ns);
+
+/* adds all values of 'src' to 'dst' */
+void lat_hist_merge(struct lat_hist *dst, struct lat_hist const *src);
+
+/* returns the upper bound of the bucket holding the 'p'th percentile
+ * (0 < p <= 100); 0 for empty histograms */
+uint64_t lat_hist_percentile(struct lat_hist const *h, double p);
+
+/* prints the non-empty buckets as '<lower>-<upper> <count>' lines with
+ * values in us */
+void lat_hist_print(struct lat_hist const *h, FILE *f, char const *prefix);
+
+#endif	/* H_ENSC_TESTSUITE_SRC_LATHIST_H */
@@ -0,0 +1,962 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Memory bandwidth and latency benchmark.  The bandwidth is measured
+ * with the STREAM copy/scale/add/triad kernels on three arrays of
+ * doubles, the latency by chasing a random cyclic chain of pointers
+ * (one per cache line) in working sets of increasing size.  Results can
+ * be checked against limits so that boards with misconfigured memory
+ * controllers or caches fail a test. */
+
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#  include <immintrin.h>
+#  define HAVE_STREAM_X86	1
+#endif
+
+#include "util.h"
+
+/* the scalar kernels must stay scalar to be a reference for the SIMD
+ * ones */
+#if defined(__GNUC__) && !defined(__clang__)
+#  define NO_VECTORIZE	__attribute__((__optimize__("no-tree-vectorize")))
+#else
+#  define NO_VECTORIZE
+#endif
+
+/* {{{ cli options */
+#define CMD_HELP		0x8000
+#define CMD_VERSION		0x8001
+#define CMD_SIZE		0x8002
+#define CMD_REPEAT		0x8003
+#define CMD_THREADS		0x8004
+#define CMD_AFFINITY		0x8005
+#define CMD_IMPL		0x8006
+#define CMD_RUN			0x8007
+#define CMD_LAT_MIN		0x8008
+#define CMD_LAT_MAX		0x8009
+#define CMD_MIN			0x800a
+#define CMD_MAX_LATENCY		0x800b
+
+static struct option const	CMDLINE_OPTIONS[] = {
+  { "help",        no_argument,        0, CMD_HELP },
+  { "version",     no_argument,        0, CMD_VERSION },
+  { "size",        required_argument,  0, CMD_SIZE },
+  { "repeat",      required_argument,  0, CMD_REPEAT },
+  { "threads",     required_argument,  0, CMD_THREADS },
+  { "affinity",    no_argument,        0, CMD_AFFINITY },
+  { "impl",        required_argument,  0, CMD_IMPL },
+  { "run",         required_argument,  0, CMD_RUN },
+  { "lat-min",     required_argument,  0, CMD_LAT_MIN },
+  { "lat-max",     required_argument,  0, CMD_LAT_MAX },
+  { "min",         required_argument,  0, CMD_MIN },
+  { "max-latency", required_argument,  0, CMD_MAX_LATENCY },
+  { 0,0,0,0 }
+};
+
+enum {
+	KERNEL_COPY,
+	KERNEL_SCALE,
+	KERNEL_ADD,
+	KERNEL_TRIAD,
+	NUM_KERNELS,
+};
+
+#define MAX_LAT_LIMITS		16
+
+struct lat_limit {
+	unsigned long long	size;
+	double			max_ns;
+};
+
+struct cmdline_options {
+	unsigned long long	size;		/* bytes per array */
+	unsigned int		repeat;
+	unsigned int		num_threads;	/* 0 means one per CPU */
+	bool			affinity;
+	char const		*impl;		/* NULL means best, "all" */
+	bool			do_stream;
+	bool			do_latency;
+	unsigned long long	lat_min;
+	unsigned long long	lat_max;
+
+	double			min_mbps[NUM_KERNELS];	/* 0 means no limit */
+	struct lat_limit	lat_limits[MAX_LAT_LIMITS];
+	unsigned int		num_lat_limits;
+};
+/* }}} cli options */
+
+#define STREAM_SCALAR		3.0
+#define CACHE_LINE_SZ		64
+
+typedef void (*stream_fn)(double *restrict dst, double const *restrict x,
+			  double const *restrict y, size_t cnt);
+
+struct stream_impl {
+	char const	*name;
+	stream_fn	fn[NUM_KERNELS];
+};
+
+static char const * const	KERNEL_NAMES[NUM_KERNELS] = {
+	[KERNEL_COPY]	= "copy",
+	[KERNEL_SCALE]	= "scale",
+	[KERNEL_ADD]	= "add",
+	[KERNEL_TRIAD]	= "triad",
+};
+
+/* arrays touched per element; STREAM counts the bytes of all of them */
+static unsigned int const	KERNEL_ARRAYS[NUM_KERNELS] = {
+	[KERNEL_COPY]	= 2,
+	[KERNEL_SCALE]	= 2,
+	[KERNEL_ADD]	= 3,
+	[KERNEL_TRIAD]	= 3,
+};
+
+static void show_help(void) __attribute__((__noreturn__));
+static void show_help(void)
+{
+	printf("Usage: mem-bench [--size <bytes>] [--repeat <num>] [--threads <num>]\n"
+	       "         [--affinity] [--impl <name>|all] [--run stream,latency]\n"
+	       "         [--lat-min <bytes>] [--lat-max <bytes>]\n"
+	       "         [--min <kernel>=<MB/s>]* [--max-latency <bytes>=<ns>]*\n"
+	       "\n"
+	       "<kernel> is one of copy, scale, add or triad.  '--threads 0' starts\n"
+	       "one thread per CPU.  Sizes accept k, M and G suffixes.  Exit status\n"
+	       "is 1 when a limit was violated; bandwidth limits are checked against\n"
+	       "the best implementation.\n");
+	exit(0);
+}
+
+static void show_version(void) __attribute__((__noreturn__));
+static void show_version(void)
+{
+	/* \todo */
+	exit(0);
+}
+
+/* {{{ STREAM kernels */
+/* copy: dst = x; scale: dst = s * x; add: dst = x + y; triad: dst = x + s * y */
+NO_VECTORIZE
+static void copy_scalar(double *restrict dst, double const *restrict x,
+			double const *restrict y, size_t cnt)
+{
+	size_t	i;
+
+	for (i = 0; i < cnt; ++i)
+		dst[i] = x[i];
+}
+
+NO_VECTORIZE
+static void scale_scalar(double *restrict dst, double const *restrict x,
+			 double const *restrict y, size_t cnt)
+{
+	size_t	i;
+
+	for (i = 0; i < cnt; ++i)
+		dst[i] = STREAM_SCALAR * x[i];
+}
+
+NO_VECTORIZE
+static void add_scalar(double *restrict dst, double const *restrict x,
+		       double const *restrict y, size_t cnt)
+{
+	size_t	i;
+
+	for (i = 0; i < cnt; ++i)
+		dst[i] = x[i] + y[i];
+}
+
+NO_VECTORIZE
+static void triad_scalar(double *restrict dst, double const *restrict x,
+			 double const *restrict y, size_t cnt)
+{
+	size_t	i;
+
+	for (i = 0; i < cnt; ++i)
+		dst[i] = x[i] + STREAM_SCALAR * y[i];
+}
+
+/* The SIMD kernels require 'cnt' to be a multiple of 8 and the arrays
+ * to be aligned to CACHE_LINE_SZ; the caller guarantees both. */
+#ifdef HAVE_STREAM_X86
+__attribute__((__target__("sse2")))
+static void copy_sse2(double *restrict dst, double const *restrict x,
+		      double const *restrict y, size_t cnt)
+{
+	size_t	i;
+
+	for (i = 0; i < cnt; i += 4) {
+		_mm_store_pd(dst + i,     _mm_load_pd(x + i));
+		_mm_store_pd(dst + i + 2, _mm_load_pd(x + i + 2));
+	}
+}
+
+__attribute__((__target__("sse2")))
+static void scale_sse2(double *restrict dst, double const *restrict x,
+		       double const *restrict y, size_t cnt)
+{
+	__m128d	s = _mm_set1_pd(STREAM_SCALAR);
+	size_t	i;
+
+	for (i = 0; i < cnt; i += 4) {
+		_mm_store_pd(dst + i,     _mm_mul_pd(s, _mm_load_pd(x + i)));
+		_mm_store_pd(dst + i + 2, _mm_mul_pd(s, _mm_load_pd(x + i + 2)));
+	}
+}
+
+__attribute__((__target__("sse2")))
+static void add_sse2(double *restrict dst, double const *restrict x,
+		     double const *restrict y, size_t cnt)
+{
+	size_t	i;
+
+	for (i = 0; i < cnt; i += 4) {
+		_mm_store_pd(dst + i,
+			     _mm_add_pd(_mm_load_pd(x + i), _mm_load_pd(y + i)));
+		_mm_store_pd(dst + i + 2,
+			     _mm_add_pd(_mm_load_pd(x + i + 2), _mm_load_pd(y + i + 2)));
+	}
+}
+
+__attribute__((__target__("sse2")))
+static void triad_sse2(double *restrict dst, double const *restrict x,
+		       double const *restrict y, size_t cnt)
+{
+	__m128d	s = _mm_set1_pd(STREAM_SCALAR);
+	size_t	i;
+
+	for (i = 0; i < cnt; i += 4) {
+		_mm_store_pd(dst + i,
+			     _mm_add_pd(_mm_load_pd(x + i),
+					_mm_mul_pd(s, _mm_load_pd(y + i))));
+		_mm_store_pd(dst + i + 2,
+			     _mm_add_pd(_mm_load_pd(x + i + 2),
+					_mm_mul_pd(s, _mm_load_pd(y + i + 2))));
+	}
+}
+
+__attribute__((__target__("avx2")))
+static void copy_avx2(double *restrict dst, double const *restrict x,
+		      double const *restrict y, size_t cnt)
+{
+	size_t	i;
+
+	for (i = 0; i < cnt; i += 8) {
+		_mm256_store_pd(dst + i,     _mm256_load_pd(x + i));
+		_mm256_store_pd(dst + i + 4, _mm256_load_pd(x + i + 4));
+	}
+}
+
+__attribute__((__target__("avx2")))
+static void scale_avx2(double *restrict dst, double const *restrict x,
+		       double const *restrict y, size_t cnt)
+{
+	__m256d	s = _mm256_set1_pd(STREAM_SCALAR);
+	size_t	i;
+
+	for (i = 0; i < cnt; i += 8) {
+		_mm256_store_pd(dst + i,     _mm256_mul_pd(s, _mm256_load_pd(x + i)));
+		_mm256_store_pd(dst + i + 4, _mm256_mul_pd(s, _mm256_load_pd(x + i + 4)));
+	}
+}
+
+__attribute__((__target__("avx2")))
+static void add_avx2(double *restrict dst, double const *restrict x,
+		     double const *restrict y, size_t cnt)
+{
+	size_t	i;
+
+	for (i = 0; i < cnt; i += 8) {
+		_mm256_store_pd(dst + i,
+				_mm256_add_pd(_mm256_load_pd(x + i),
+					      _mm256_load_pd(y + i)));
+		_mm256_store_pd(dst + i + 4,
+				_mm256_add_pd(_mm256_load_pd(x + i + 4),
+					      _mm256_load_pd(y + i + 4)));
+	}
+}
+
+/* no FMA; the result must be bit identical to the scalar kernel */
+__attribute__((__target__("avx2")))
+static void triad_avx2(double *restrict dst, double const *restrict x,
+		       double const *restrict y, size_t cnt)
+{
+	__m256d	s = _mm256_set1_pd(STREAM_SCALAR);
+	size_t	i;
+
+	for (i = 0; i < cnt; i += 8) {
+		_mm256_store_pd(dst + i,
+				_mm256_add_pd(_mm256_load_pd(x + i),
+					      _mm256_mul_pd(s, _mm256_load_pd(y + i))));
+		_mm256_store_pd(dst + i + 4,
+				_mm256_add_pd(_mm256_load_pd(x + i + 4),
+					      _mm256_mul_pd(s, _mm256_load_pd(y + i + 4))));
+	}
+}
+#endif	/* HAVE_STREAM_X86 */
+
+/* ordered by preference */
+static struct stream_impl const	STREAM_IMPLS[] = {
+#ifdef HAVE_STREAM_X86
+	{ "avx2",   { copy_avx2,   scale_avx2,   add_avx2,   triad_avx2 } },
+	{ "sse2",   { copy_sse2,   scale_sse2,   add_sse2,   triad_sse2 } },
+#endif
+	{ "scalar", { copy_scalar, scale_scalar, add_scalar, triad_scalar } },
+};
+
+static bool stream_is_supported(struct stream_impl const *impl)
+{
+#ifdef HAVE_STREAM_X86
+	__builtin_cpu_init();
+
+	if (strcmp(impl->name, "avx2") == 0)
+		return __builtin_cpu_supports("avx2");
+	if (strcmp(impl->name, "sse2") == 0)
+		return __builtin_cpu_supports("sse2");
+#endif
+
+	return true;
+}
+/* }}} STREAM kernels */
+
+/* {{{ STREAM driver */
+struct stream_ctx {
+	struct cmdline_options const	*opts;
+	double			*a;
+	double			*b;
+	double			*c;
+	size_t			cnt;		/* elements per array */
+
+	pthread_barrier_t	barrier;
+	struct stream_impl const	*impl;
+	int			kernel;		/* -1 terminates the workers */
+};
+
+struct stream_worker {
+	pthread_t		thread;
+	struct stream_ctx	*ctx;
+	size_t			start;
+	size_t			cnt;
+};
+
+static void stream_run_kernel(struct stream_ctx const *ctx,
+			      struct stream_impl const *impl, int kernel,
+			      size_t start, size_t cnt)
+{
+	double	*a = ctx->a + start;
+	double	*b = ctx->b + start;
+	double	*c = ctx->c + start;
+
+	switch (kernel) {
+	case KERNEL_COPY:	impl->fn[kernel](c, a, NULL, cnt); break;
+	case KERNEL_SCALE:	impl->fn[kernel](b, c, NULL, cnt); break;
+	case KERNEL_ADD:	impl->fn[kernel](c, a, b, cnt); break;
+	case KERNEL_TRIAD:	impl->fn[kernel](a, b, c, cnt); break;
+	}
+}
+
+/* Workers wait at the barrier for the next kernel, run it on their
+ * slice and meet again at the barrier; the main thread measures the
+ * time between both barriers. */
+static void *stream_worker_fn(void *w_)
+{
+	struct stream_worker	*w = w_;
+	struct stream_ctx	*ctx = w->ctx;
+	size_t			i;
+
+	/* first touch; places the pages near the CPU using them */
+	for (i = w->start; i < w->start + w->cnt; ++i) {
+		ctx->a[i] = 1.0;
+		ctx->b[i] = 2.0;
+		ctx->c[i] = 0.0;
+	}
+
+	for (;;) {
+		pthread_barrier_wait(&ctx->barrier);
+
+		if (ctx->kernel < 0)
+			break;
+
+		stream_run_kernel(ctx, ctx->impl, ctx->kernel, w->start, w->cnt);
+		pthread_barrier_wait(&ctx->barrier);
+	}
+
+	return NULL;
+}
+
+/* checks the arrays against the values of the scalar recurrence
+ * after 'num_rounds' rounds of all kernels; the exact comparison
+ * relies on '-ffp-contract=off' (see Makefile) */
+static bool stream_verify(struct stream_ctx const *ctx, unsigned int num_rounds)
+{
+	double		a = 1.0;
+	double		b = 2.0;
+	double		c = 0.0;
+	unsigned int	i;
+	size_t		j;
+
+	for (i = 0; i < num_rounds; ++i) {
+		c = a;
+		b = STREAM_SCALAR * c;
+		c = a + b;
+		a = b + STREAM_SCALAR * c;
+	}
+
+	for (j = 0; j < ctx->cnt; ++j) {
+		if (ctx->a[j] != a || ctx->b[j] != b || ctx->c[j] != c) {
+			fprintf(stderr, "STREAM arrays corrupted at element %zu\n", j);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool cpu_nth(cpu_set_t const *set, unsigned int n, unsigned int *cpu)
+{
+	unsigned int	i;
+
+	for (i = 0; i < CPU_SETSIZE; ++i) {
+		if (!CPU_ISSET(i, set))
+			continue;
+
+		if (n-- == 0) {
+			*cpu = i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static int run_stream(struct cmdline_options const *opts,
+		      unsigned int num_threads, cpu_set_t const *cpus,
+		      double best_mbps[NUM_KERNELS])
+{
+	struct stream_ctx	ctx = { .opts = opts, .kernel = -1 };
+	struct stream_worker	*workers = NULL;
+	unsigned int		num_started = 0;
+	unsigned int		num_rounds = 0;
+	unsigned int		i;
+	int			rc = EX_OSERR;
+
+	/* whole cache lines per array and thread */
+	ctx.cnt = opts->size / sizeof(double);
+	ctx.cnt -= ctx.cnt % (num_threads * 8);
+	if (ctx.cnt == 0) {
+		fprintf(stderr, "array size too small\n");
+		return EX_USAGE;
+	}
+
+	if (posix_memalign((void **)&ctx.a, CACHE_LINE_SZ, ctx.cnt * sizeof(double)) ||
+	    posix_memalign((void **)&ctx.b, CACHE_LINE_SZ, ctx.cnt * sizeof(double)) ||
+	    posix_memalign((void **)&ctx.c, CACHE_LINE_SZ, ctx.cnt * sizeof(double))) {
+		fprintf(stderr, "failed to allocate 3 x %zu bytes\n",
+			ctx.cnt * sizeof(double));
+		goto out;
+	}
+
+	workers = calloc(num_threads, sizeof workers[0]);
+	if (!workers) {
+		fprintf(stderr, "out of memory\n");
+		goto out;
+	}
+
+	pthread_barrier_init(&ctx.barrier, NULL, num_threads + 1);
+
+	for (i = 0; i < num_threads; ++i) {
+		struct stream_worker	*w = &workers[i];
+		pthread_attr_t		attr;
+		unsigned int		cpu;
+		int			err;
+
+		w->ctx   = &ctx;
+		w->cnt   = ctx.cnt / num_threads;
+		w->start = i * w->cnt;
+
+		pthread_attr_init(&attr);
+
+		if (opts->affinity && cpu_nth(cpus, i % CPU_COUNT(cpus), &cpu)) {
+			cpu_set_t	set;
+
+			CPU_ZERO(&set);
+			CPU_SET(cpu, &set);
+			pthread_attr_setaffinity_np(&attr, sizeof set, &set);
+		}
+
+		err = pthread_create(&w->thread, &attr, stream_worker_fn, w);
+		pthread_attr_destroy(&attr);
+
+		if (err != 0) {
+			fprintf(stderr, "pthread_create(): %s\n", strerror(err));
+			/* can not continue; the barrier waits for all */
+			exit(EX_OSERR);
+		}
+
+		++num_started;
+	}
+
+	printf("STREAM: 3 x %zu MiB arrays, %u thread(s), best of %u\n",
+	       ctx.cnt * sizeof(double) >> 20, num_threads, opts->repeat);
+	printf("%-8s %-6s %12s %10s %10s %10s\n", "impl", "kernel", "best[MB/s]",
+	       "avg[ms]", "min[ms]", "max[ms]");
+
+	rc = EX_OK;
+
+	for (i = 0; i < ARRAY_SIZE(STREAM_IMPLS) && rc == EX_OK; ++i) {
+		struct stream_impl const	*impl = &STREAM_IMPLS[i];
+		uint64_t	t_min[NUM_KERNELS];
+		uint64_t	t_max[NUM_KERNELS] = { 0 };
+		uint64_t	t_sum[NUM_KERNELS] = { 0 };
+		unsigned int	r;
+		int		k;
+
+		if (opts->impl && strcmp(opts->impl, "all") != 0 &&
+		    strcmp(opts->impl, impl->name) != 0)
+			continue;
+
+		if (!stream_is_supported(impl)) {
+			if (opts->impl && strcmp(opts->impl, "all") != 0) {
+				fprintf(stderr, "%s: not supported by this CPU\n",
+					impl->name);
+				rc = EX_UNAVAILABLE;
+			}
+			continue;
+		}
+
+		ctx.impl = impl;
+
+		/* the first round warms up and is not counted, like in
+		 * STREAM */
+		for (r = 0; r <= opts->repeat; ++r) {
+			for (k = 0; k < NUM_KERNELS; ++k) {
+				uint64_t	t0;
+				uint64_t	dt;
+
+				ctx.kernel = k;
+				t0 = monotonic_ns();
+				pthread_barrier_wait(&ctx.barrier);
+				pthread_barrier_wait(&ctx.barrier);
+				dt = monotonic_ns() - t0;
+
+				if (r == 0)
+					continue;
+
+				if (r == 1 || dt < t_min[k])
+					t_min[k] = dt;
+				if (dt > t_max[k])
+					t_max[k] = dt;
+				t_sum[k] += dt;
+			}
+
+			++num_rounds;
+		}
+
+		for (k = 0; k < NUM_KERNELS; ++k) {
+			double	mbps = ((double)KERNEL_ARRAYS[k] * ctx.cnt * sizeof(double) /
+					(t_min[k] / 1e9) / 1e6);
+
+			printf("%-8s %-6s %12.1f %10.3f %10.3f %10.3f\n",
+			       impl->name, KERNEL_NAMES[k], mbps,
+			       t_sum[k] / 1e6 / opts->repeat, t_min[k] / 1e6,
+			       t_max[k] / 1e6);
+
+			if (mbps > best_mbps[k])
+				best_mbps[k] = mbps;
+		}
+
+		/* all threads are waiting at the barrier, so reading the
+		 * arrays is safe */
+		if (!stream_verify(&ctx, num_rounds))
+			rc = EX_SOFTWARE;
+
+		if (!opts->impl)
+			/* only the best implementation */
+			break;
+	}
+
+	ctx.kernel = -1;
+	pthread_barrier_wait(&ctx.barrier);
+
+	for (i = 0; i < num_started; ++i)
+		pthread_join(workers[i].thread, NULL);
+
+	pthread_barrier_destroy(&ctx.barrier);
+
+out:
+	free(workers);
+	free(ctx.c);
+	free(ctx.b);
+	free(ctx.a);
+
+	return rc;
+}
+/* }}} STREAM driver */
+
+/* {{{ pointer chasing */
+static uint64_t xorshift64(uint64_t *x)
+{
+	*x ^= *x << 13;
+	*x ^= *x >> 7;
+	*x ^= *x << 17;
+
+	return *x;
+}
+
+/* links the first 'num' cache lines of 'buf' into a single random cycle
+ * (Sattolo's algorithm) so that hardware prefetchers can not predict
+ * the next access */
+static void chase_build(unsigned char *buf, size_t num, uint32_t *order,
+			uint64_t *seed)
+{
+	size_t	i;
+
+	for (i = 0; i < num; ++i)
+		order[i] = i;
+
+	for (i = num - 1; i > 0; --i) {
+		size_t		j = xorshift64(seed) % i;
+		uint32_t	tmp = order[i];
+
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	for (i = 0; i < num; ++i) {
+		void	**p = (void **)(buf + (size_t)order[i] * CACHE_LINE_SZ);
+
+		*p = buf + (size_t)order[(i + 1) % num] * CACHE_LINE_SZ;
+	}
+}
+
+static void *chase(void *p, size_t steps)
+{
+	for (; steps >= 8; steps -= 8) {
+		p = *(void **)p; p = *(void **)p;
+		p = *(void **)p; p = *(void **)p;
+		p = *(void **)p; p = *(void **)p;
+		p = *(void **)p; p = *(void **)p;
+	}
+
+	while (steps-- > 0)
+		p = *(void **)p;
+
+	return p;
+}
+
+static int cmp_ull(void const *a_, void const *b_)
+{
+	unsigned long long const	*a = a_;
+	unsigned long long const	*b = b_;
+
+	return *a < *b ? -1 : *a > *b;
+}
+
+static void format_size(char *buf, size_t len, unsigned long long size)
+{
+	if (size >= (1ull << 20) && size % (1ull << 20) == 0)
+		snprintf(buf, len, "%llu MiB", size >> 20);
+	else if (size >= 1024 && size % 1024 == 0)
+		snprintf(buf, len, "%llu KiB", size >> 10);
+	else
+		snprintf(buf, len, "%llu B", size);
+}
+
+static int run_latency(struct cmdline_options const *opts, bool *is_failed)
+{
+	unsigned long long	sizes[64 + MAX_LAT_LIMITS];
+	size_t			num_sizes = 0;
+	unsigned long long	max_size = 0;
+	unsigned char		*buf = NULL;
+	uint32_t		*order = NULL;
+	uint64_t		seed = 0x9e3779b97f4a7c15ull;
+	void * volatile		sink;
+	unsigned long long	s;
+	size_t			i;
+	unsigned int		j;
+	int			rc = EX_OSERR;
+
+	for (s = opts->lat_min; s <= opts->lat_max && num_sizes < 64; s *= 2)
+		sizes[num_sizes++] = s;
+
+	for (j = 0; j < opts->num_lat_limits; ++j)
+		sizes[num_sizes++] = opts->lat_limits[j].size;
+
+	qsort(sizes, num_sizes, sizeof sizes[0], cmp_ull);
+
+	for (i = 0; i < num_sizes; ++i) {
+		if (sizes[i] < 2 * CACHE_LINE_SZ ||
+		    sizes[i] / CACHE_LINE_SZ > UINT32_MAX) {
+			fprintf(stderr, "unsupported working set size %llu\n",
+				sizes[i]);
+			return EX_USAGE;
+		}
+
+		if (sizes[i] > max_size)
+			max_size = sizes[i];
+	}
+
+	if (posix_memalign((void **)&buf, 4096, max_size) != 0 ||
+	    !(order = malloc(max_size / CACHE_LINE_SZ * sizeof order[0]))) {
+		fprintf(stderr, "failed to allocate %llu bytes\n", max_size);
+		goto out;
+	}
+
+	/* populate the pages before measuring */
+	memset(buf, 0, max_size);
+
+	printf("latency: random pointer chasing, %u byte stride\n",
+	       CACHE_LINE_SZ);
+	printf("%-10s %10s\n", "size", "ns/load");
+
+	for (i = 0; i < num_sizes; ++i) {
+		size_t		num = sizes[i] / CACHE_LINE_SZ;
+		size_t		steps = num * 2 < (1u << 20) ? (1u << 20) : num * 2;
+		char		size_str[32];
+		uint64_t	t0;
+		double		ns;
+
+		if (i > 0 && sizes[i] == sizes[i - 1])
+			continue;
+
+		chase_build(buf, num, order, &seed);
+
+		/* one round through the chain loads the caches and TLBs */
+		sink = chase(buf, num);
+
+		t0 = monotonic_ns();
+		sink = chase(sink, steps);
+		ns = (double)(monotonic_ns() - t0) / steps;
+
+		format_size(size_str, sizeof size_str, sizes[i]);
+		printf("%-10s %10.2f\n", size_str, ns);
+
+		for (j = 0; j < opts->num_lat_limits; ++j) {
+			struct lat_limit const	*l = &opts->lat_limits[j];
+
+			if (l->size != sizes[i] || ns <= l->max_ns)
+				continue;
+
+			fprintf(stderr, "latency at %s: %.2f ns exceeds %.2f ns\n",
+				size_str, ns, l->max_ns);
+			*is_failed = true;
+		}
+	}
+
+	(void)sink;
+	rc = EX_OK;
+
+out:
+	free(order);
+	free(buf);
+
+	return rc;
+}
+/* }}} pointer chasing */
+
+static bool parse_size(char const *str, unsigned long long *res)
+{
+	char	*end;
+
+	*res = strtoull(str, &end, 0);
+
+	switch (*end) {
+	case 'k': case 'K':	*res <<= 10; ++end; break;
+	case 'm': case 'M':	*res <<= 20; ++end; break;
+	case 'g': case 'G':	*res <<= 30; ++end; break;
+	}
+
+	if (*str == '\0' || *end != '\0') {
+		fprintf(stderr, "invalid size '%s'\n", str);
+		return false;
+	}
+
+	return true;
+}
+
+static bool parse_min(char const *str, struct cmdline_options *opts)
+{
+	char const	*sep = strchr(str, '=');
+	unsigned int	k;
+
+	for (k = 0; sep && k < NUM_KERNELS; ++k) {
+		if (strlen(KERNEL_NAMES[k]) == (size_t)(sep - str) &&
+		    strncmp(str, KERNEL_NAMES[k], sep - str) == 0) {
+			opts->min_mbps[k] = atof(sep + 1);
+			return true;
+		}
+	}
+
+	fprintf(stderr, "invalid bandwidth limit '%s'\n", str);
+	return false;
+}
+
+static bool parse_lat_limit(char const *str, struct cmdline_options *opts)
+{
+	char const		*sep = strchr(str, '=');
+	struct lat_limit	*l;
+	char			tmp[32];
+
+	if (!sep || (size_t)(sep - str) >= sizeof tmp ||
+	    opts->num_lat_limits >= MAX_LAT_LIMITS) {
+		fprintf(stderr, "invalid latency limit '%s'\n", str);
+		return false;
+	}
+
+	memcpy(tmp, str, sep - str);
+	tmp[sep - str] = '\0';
+
+	l = &opts->lat_limits[opts->num_lat_limits];
+	if (!parse_size(tmp, &l->size))
+		return false;
+
+	l->max_ns = atof(sep + 1);
+	++opts->num_lat_limits;
+
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	struct cmdline_options	opts = {
+		.size		= 32ull << 20,
+		.repeat		= 5,
+		.num_threads	= 1,
+		.do_stream	= true,
+		.do_latency	= true,
+		.lat_min	= 4ull << 10,
+		.lat_max	= 64ull << 20,
+	};
+	double			best_mbps[NUM_KERNELS] = { 0 };
+	bool			is_failed = false;
+	cpu_set_t		cpus;
+	unsigned int		num_threads;
+	unsigned int		k;
+	int			rc = EX_OK;
+
+	while (1) {
+		int	c = getopt_long(argc, argv, "", CMDLINE_OPTIONS, 0);
+
+		if (c==-1)
+			break;
+
+		switch (c) {
+		case CMD_HELP		:  show_help();
+		case CMD_VERSION	:  show_version();
+		case CMD_REPEAT		:  opts.repeat = atoi(optarg); break;
+		case CMD_THREADS	:  opts.num_threads = atoi(optarg); break;
+		case CMD_AFFINITY	:  opts.affinity = true; break;
+		case CMD_IMPL		:  opts.impl = optarg; break;
+
+		case CMD_SIZE:
+			if (!parse_size(optarg, &opts.size))
+				return EX_USAGE;
+			break;
+
+		case CMD_LAT_MIN:
+			if (!parse_size(optarg, &opts.lat_min))
+				return EX_USAGE;
+			break;
+
+		case CMD_LAT_MAX:
+			if (!parse_size(optarg, &opts.lat_max))
+				return EX_USAGE;
+			break;
+
+		case CMD_MIN:
+			if (!parse_min(optarg, &opts))
+				return EX_USAGE;
+			break;
+
+		case CMD_MAX_LATENCY:
+			if (!parse_lat_limit(optarg, &opts))
+				return EX_USAGE;
+			break;
+
+		case CMD_RUN:
+			opts.do_stream  = strstr(optarg, "stream") != NULL;
+			opts.do_latency = strstr(optarg, "latency") != NULL;
+			if (!opts.do_stream && !opts.do_latency)
+				goto bad_arg;
+			break;
+
+		default:
+		bad_arg:
+			fprintf(stderr, "Try '--help' for more information\n");
+			return EX_USAGE;
+		}
+	}
+
+	if (optind != argc || opts.repeat == 0 || opts.lat_min == 0) {
+		fprintf(stderr, "bad arguments; try '--help' for more information\n");
+		return EX_USAGE;
+	}
+
+	if (opts.impl && strcmp(opts.impl, "all") != 0) {
+		for (k = 0; k < ARRAY_SIZE(STREAM_IMPLS); ++k) {
+			if (strcmp(opts.impl, STREAM_IMPLS[k].name) == 0)
+				break;
+		}
+
+		if (k == ARRAY_SIZE(STREAM_IMPLS)) {
+			fprintf(stderr, "unknown implementation '%s'\n", opts.impl);
+			return EX_USAGE;
+		}
+	}
+
+	if (sched_getaffinity(0, sizeof cpus, &cpus) < 0) {
+		perror("sched_getaffinity()");
+		return EX_OSERR;
+	}
+
+	num_threads = opts.num_threads ? opts.num_threads : CPU_COUNT(&cpus);
+
+	if (opts.do_stream) {
+		rc = run_stream(&opts, num_threads, &cpus, best_mbps);
+		if (rc != EX_OK)
+			return rc;
+
+		for (k = 0; k < NUM_KERNELS; ++k) {
+			if (opts.min_mbps[k] == 0 || best_mbps[k] >= opts.min_mbps[k])
+				continue;
+
+			fprintf(stderr, "%s bandwidth %.1f MB/s below %.1f MB/s\n",
+				KERNEL_NAMES[k], best_mbps[k], opts.min_mbps[k]);
+			is_failed = true;
+		}
+	}
+
+	if (opts.do_latency) {
+		if (opts.do_stream)
+			printf("\n");
+
+		rc = run_latency(&opts, &is_failed);
+		if (rc != EX_OK)
+			return rc;
+	}
+
+	return is_failed ? 1 : EX_OK;
+}
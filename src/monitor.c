@@ -0,0 +1,442 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "monitor.h"
+
+#include <assert.h>
+#include <endian.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "util.h"
+
+/* minimum distance between two MONITOR_EV_OUTPUT records */
+#define MONITOR_OUTPUT_INTERVAL_NS	(100 * 1000000ull)
+
+static int monitor_connect(char const *path, int type)
+{
+	struct sockaddr_un	addr = { .sun_family = AF_UNIX };
+	int			fd;
+
+	if (strlen(path) >= sizeof addr.sun_path) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, type | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (fd < 0)
+		return -1;
+
+	if (connect(fd, (void *)&addr, sizeof addr) < 0) {
+		int	err = errno;
+
+		close(fd);
+		errno = err;
+		return -1;
+	}
+
+	return fd;
+}
+
+/* Opens the event stream; a missing socket or a fifo without reader are
+ * not errors but leave the monitor inactive so that all the emit
+ * functions are noops. */
+void monitor_open(struct monitor *mon, char const *path)
+{
+	struct stat	st;
+
+	*mon = (struct monitor) {
+		.fd		= -1,
+	};
+
+	if (!path || stat(path, &st) < 0)
+		return;
+
+	if (S_ISFIFO(st.st_mode)) {
+		mon->fd = open(path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+		if (mon->fd < 0 && errno != ENXIO)
+			fprintf(stderr, "open(%s): %s\n", path, strerror(errno));
+	} else if (S_ISSOCK(st.st_mode)) {
+		mon->fd = monitor_connect(path, SOCK_SEQPACKET);
+		if (mon->fd < 0 && errno == EPROTOTYPE)
+			mon->fd = monitor_connect(path, SOCK_STREAM);
+
+		mon->is_socket = mon->fd >= 0;
+	}
+}
+
+static bool monitor_flush(struct monitor *mon);
+
+void monitor_close(struct monitor *mon)
+{
+	/* last chance for a pending record tail; do not wait for it */
+	if (monitor_is_active(mon))
+		monitor_flush(mon);
+
+	xclose(mon->fd);
+	mon->fd = -1;
+}
+
+int monitor_ctl_fd(struct monitor const *mon)
+{
+	return (monitor_is_active(mon) && mon->is_socket) ? mon->fd : -1;
+}
+
+/* Marks the monitor as dead; the fd stays open until monitor_close()
+ * because it might still be registered in the epoll set. */
+static void monitor_kill(struct monitor *mon)
+{
+	if (mon->is_socket)
+		shutdown(mon->fd, SHUT_RDWR);
+
+	mon->is_dead = true;
+}
+
+/* tries to send the pending tail of a partially written record; returns
+ * true when nothing is pending anymore */
+static bool monitor_flush(struct monitor *mon)
+{
+	ssize_t	l;
+
+	if (mon->out_len == 0)
+		return true;
+
+	l = send(mon->fd, mon->out_buf, mon->out_len,
+		 MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (l < 0) {
+		if (errno != EAGAIN && errno != EINTR)
+			monitor_kill(mon);
+		return false;
+	}
+
+	memmove(mon->out_buf, mon->out_buf + l, mon->out_len - l);
+	mon->out_len -= l;
+
+	return mon->out_len == 0;
+}
+
+static void monitor_send(struct monitor *mon, enum monitor_record type,
+			 void const *payload, size_t len)
+{
+	unsigned char		buf[MONITOR_MAX_RECORD];
+	struct monitor_hdr	hdr;
+	ssize_t			l;
+
+	if (!monitor_is_active(mon))
+		return;
+
+	if (!monitor_flush(mon)) {
+		/* the client still did not take the previous record */
+		if (monitor_is_active(mon))
+			++mon->num_dropped;
+		return;
+	}
+
+	if (len > sizeof buf - sizeof hdr)
+		len = sizeof buf - sizeof hdr;
+
+	hdr = (struct monitor_hdr) {
+		.len	= htole16(sizeof hdr + len),
+		.type	= type,
+		.seq	= htole32(mon->seq++),
+		.ts_ns	= htole64(monotonic_ns()),
+	};
+
+	memcpy(buf, &hdr, sizeof hdr);
+	memcpy(buf + sizeof hdr, payload, len);
+	len += sizeof hdr;
+
+	if (mon->is_socket)
+		l = send(mon->fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+	else
+		l = write(mon->fd, buf, len);
+
+	if (l == (ssize_t)len)
+		;			/* noop */
+	else if (l < 0 && (errno == EAGAIN || errno == EINTR))
+		/* slow client; drop the record instead of stalling the
+		 * test */
+		++mon->num_dropped;
+	else if (l < 0)
+		monitor_kill(mon);
+	else {
+		/* partial write on a stream socket; the tail is sent before
+		 * the next record to keep the framing intact */
+		mon->out_len = len - l;
+		memcpy(mon->out_buf, buf + l, mon->out_len);
+	}
+}
+
+static void monitor_handle_ctl(struct monitor *mon,
+			       struct monitor_hdr const *hdr,
+			       void const *payload, size_t len)
+{
+	uint32_t	v;
+
+	switch (hdr->type) {
+	case MONITOR_CTL_CANCEL:
+		mon->req_cancel = true;
+		break;
+
+	case MONITOR_CTL_SAMPLE:
+		mon->req_sample = true;
+		break;
+
+	case MONITOR_CTL_EXTEND:
+		if (len < sizeof v)
+			break;
+
+		memcpy(&v, payload, sizeof v);
+		mon->req_extend += le32toh(v);
+		break;
+
+	default:
+		/* ignore unknown records */
+		break;
+	}
+}
+
+/* Reads the available control data and handles the complete records;
+ * an incomplete record of a stream socket is kept in 'in_buf' until the
+ * rest arrives. */
+void monitor_handle_input(struct monitor *mon)
+{
+	struct monitor_hdr	hdr;
+	ssize_t			l;
+	size_t			rec_len;
+
+	if (!monitor_is_active(mon))
+		return;
+
+	l = recv(mon->fd, mon->in_buf + mon->in_len,
+		 sizeof mon->in_buf - mon->in_len, MSG_DONTWAIT);
+	if (l == 0) {
+		monitor_kill(mon);
+		return;
+	} else if (l < 0) {
+		if (errno != EAGAIN && errno != EINTR)
+			monitor_kill(mon);
+		return;
+	}
+
+	mon->in_len += l;
+
+	while (mon->in_len >= sizeof hdr) {
+		memcpy(&hdr, mon->in_buf, sizeof hdr);
+
+		rec_len = le16toh(hdr.len);
+		if (rec_len < sizeof hdr || rec_len > sizeof mon->in_buf) {
+			fprintf(stderr, "monitor: bad control record length %zu\n",
+				rec_len);
+			monitor_kill(mon);
+			return;
+		}
+
+		if (mon->in_len < rec_len)
+			break;
+
+		monitor_handle_ctl(mon, &hdr, mon->in_buf + sizeof hdr,
+				   rec_len - sizeof hdr);
+
+		memmove(mon->in_buf, mon->in_buf + rec_len, mon->in_len - rec_len);
+		mon->in_len -= rec_len;
+	}
+}
+
+void monitor_emit_start(struct monitor *mon, pid_t pid, char const *id)
+{
+	unsigned char	buf[MONITOR_MAX_RECORD - sizeof(struct monitor_hdr)];
+	uint32_t	v = htole32(pid);
+	size_t		id_len = id ? strlen(id) : 0;
+
+	if (!monitor_is_active(mon))
+		return;
+
+	if (id_len > sizeof buf - sizeof v)
+		id_len = sizeof buf - sizeof v;
+
+	memcpy(buf, &v, sizeof v);
+	memcpy(buf + sizeof v, id, id_len);
+
+	monitor_send(mon, MONITOR_EV_START, buf, sizeof v + id_len);
+}
+
+void monitor_emit_status(struct monitor *mon, enum monitor_status status,
+			 uint32_t arg)
+{
+	struct {
+		uint8_t		status;
+		uint8_t		_pad[3];
+		uint32_t	arg;
+	} __attribute__((__packed__))	rec = {
+		.status	= status,
+		.arg	= htole32(arg),
+	};
+
+	monitor_send(mon, MONITOR_EV_STATUS, &rec, sizeof rec);
+}
+
+void monitor_emit_output(struct monitor *mon, bool force,
+			 unsigned int const chunks[2],
+			 uint64_t const bytes[2])
+{
+	struct {
+		uint32_t	chunks[2];
+		uint64_t	bytes[2];
+	} __attribute__((__packed__))	rec;
+	uint64_t			now;
+
+	if (!monitor_is_active(mon))
+		return;
+
+	now = monotonic_ns();
+	if (!force && now - mon->last_output_ns < MONITOR_OUTPUT_INTERVAL_NS)
+		return;
+
+	mon->last_output_ns = now;
+
+	rec.chunks[0] = htole32(chunks[0]);
+	rec.chunks[1] = htole32(chunks[1]);
+	rec.bytes[0]  = htole64(bytes[0]);
+	rec.bytes[1]  = htole64(bytes[1]);
+
+	monitor_send(mon, MONITOR_EV_OUTPUT, &rec, sizeof rec);
+}
+
+static uint64_t tv_to_us(struct timeval const *tv)
+{
+	return (uint64_t)tv->tv_sec * 1000000u + tv->tv_usec;
+}
+
+void monitor_emit_rusage(struct monitor *mon, struct rusage const *ru)
+{
+	struct monitor_resource	rec = {
+		.utime_us	= htole64(tv_to_us(&ru->ru_utime)),
+		.stime_us	= htole64(tv_to_us(&ru->ru_stime)),
+		.maxrss_kb	= htole64(ru->ru_maxrss),
+		.minflt		= htole64(ru->ru_minflt),
+		.majflt		= htole64(ru->ru_majflt),
+		.nvcsw		= htole64(ru->ru_nvcsw),
+		.nivcsw		= htole64(ru->ru_nivcsw),
+	};
+
+	monitor_send(mon, MONITOR_EV_RESOURCE, &rec, sizeof rec);
+}
+
+/* returns the peak RSS (VmHWM) in KiB or 0 when it is not available */
+static uint64_t read_proc_hwm(pid_t pid)
+{
+	char		fname[sizeof("/proc/%d/status") + 3 * sizeof(int)];
+	char		buf[2048];
+	char const	*p;
+	int		fd;
+	ssize_t		l;
+
+	sprintf(fname, "/proc/%d/status", pid);
+	fd = open(fname, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+
+	l = read(fd, buf, sizeof buf - 1);
+	close(fd);
+
+	if (l <= 0)
+		return 0;
+
+	buf[l] = '\0';
+
+	p = strstr(buf, "\nVmHWM:");
+	if (!p)
+		return 0;
+
+	return strtoull(p + sizeof("\nVmHWM:") - 1, NULL, 10);
+}
+
+/* Samples the resource usage of a still running process from
+ * /proc/<pid>/stat and /proc/<pid>/status; fields which are not
+ * available there are left zero. */
+void monitor_emit_sample(struct monitor *mon, pid_t pid)
+{
+	char			fname[sizeof("/proc/%d/stat") + 3 * sizeof(int)];
+	char			buf[1024];
+	char const		*p;
+	int			fd;
+	ssize_t			l;
+	unsigned long		minflt, majflt, utime, stime;
+	long			rss;
+	long			tck = sysconf(_SC_CLK_TCK);
+	long			pgsz = sysconf(_SC_PAGESIZE);
+	struct monitor_resource	rec = { 0 };
+
+	if (!monitor_is_active(mon))
+		return;
+
+	sprintf(fname, "/proc/%d/stat", pid);
+	fd = open(fname, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	l = read(fd, buf, sizeof buf - 1);
+	close(fd);
+
+	if (l <= 0)
+		return;
+
+	buf[l] = '\0';
+
+	/* skip 'pid (comm)' which might contain spaces */
+	p = strrchr(buf, ')');
+	if (!p ||
+	    sscanf(p + 2,
+		   "%*c %*d %*d %*d %*d %*d %*u %lu %*u %lu %*u %lu %lu "
+		   "%*d %*d %*d %*d %*d %*d %*u %*u %ld",
+		   &minflt, &majflt, &utime, &stime, &rss) != 5)
+		return;
+
+	rec.utime_us  = htole64((uint64_t)utime * 1000000u / tck);
+	rec.stime_us  = htole64((uint64_t)stime * 1000000u / tck);
+	rec.maxrss_kb = htole64(read_proc_hwm(pid));
+	rec.rss_kb    = htole64((uint64_t)rss * pgsz / 1024);
+	rec.minflt    = htole64(minflt);
+	rec.majflt    = htole64(majflt);
+
+	monitor_send(mon, MONITOR_EV_RESOURCE, &rec, sizeof rec);
+}
+
+void monitor_emit_end(struct monitor *mon, enum monitor_result result,
+		      int exit_status, uint64_t wall_ns)
+{
+	struct {
+		uint8_t		result;
+		uint8_t		_pad[3];
+		int32_t		exit_status;
+		uint64_t	wall_ns;
+	} __attribute__((__packed__))	rec = {
+		.result		= result,
+		.exit_status	= htole32(exit_status),
+		.wall_ns	= htole64(wall_ns),
+	};
+
+	monitor_send(mon, MONITOR_EV_END, &rec, sizeof rec);
+}
@@ -0,0 +1,133 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_TESTSUITE_SRC_MONITOR_H
+#define H_ENSC_TESTSUITE_SRC_MONITOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+/* Wire format of the event stream.  Every record starts with a
+ * 'struct monitor_hdr' followed by 'len - sizeof(struct monitor_hdr)'
+ * bytes of payload.  All integers are little endian; 'ts_ns' is
+ * CLOCK_MONOTONIC.
+ *
+ * Records with a type >= MONITOR_CTL_CANCEL are sent by the client on a
+ * socket to control the running test. */
+struct monitor_hdr {
+	uint16_t		len;
+	uint8_t			type;
+	uint8_t			_rsrv;
+	uint32_t		seq;
+	uint64_t		ts_ns;
+} __attribute__((__packed__));
+
+enum monitor_record {
+	MONITOR_EV_START = 1,	/* u32 pid, char id[] */
+	MONITOR_EV_STATUS,	/* u8 status, u8[3] pad, u32 arg */
+	MONITOR_EV_OUTPUT,	/* u32 chunks[2], u64 bytes[2] */
+	MONITOR_EV_RESOURCE,	/* struct monitor_resource */
+	MONITOR_EV_END,		/* u8 result, u8[3] pad, i32 exit_status,
+				 * u64 wall_ns */
+
+	MONITOR_CTL_CANCEL = 0x80, /* no payload */
+	MONITOR_CTL_EXTEND,	/* u32 seconds */
+	MONITOR_CTL_SAMPLE,	/* no payload; answered by MONITOR_EV_RESOURCE */
+};
+
+enum monitor_status {
+	MONITOR_STATUS_SKIPPED,
+	MONITOR_STATUS_SPAWNED,
+	MONITOR_STATUS_TIMEOUT,
+	MONITOR_STATUS_EXITED,
+	MONITOR_STATUS_CANCELLED,
+	MONITOR_STATUS_EXTENDED,
+};
+
+enum monitor_result {
+	MONITOR_RESULT_OK,
+	MONITOR_RESULT_FAIL,
+	MONITOR_RESULT_SKIPPED,
+};
+
+/* 'rss_kb' is the current resident set size of a running process and
+ * zero in the final record sent after the process exited */
+struct monitor_resource {
+	uint64_t		utime_us;
+	uint64_t		stime_us;
+	uint64_t		maxrss_kb;
+	uint64_t		minflt;
+	uint64_t		majflt;
+	uint64_t		nvcsw;
+	uint64_t		nivcsw;
+	uint64_t		rss_kb;
+} __attribute__((__packed__));
+
+/* records are limited to this size; this keeps them atomic on fifos */
+#define MONITOR_MAX_RECORD	256
+
+struct monitor {
+	int			fd;
+	bool			is_socket;
+	bool			is_dead;
+
+	uint32_t		seq;
+	unsigned long		num_dropped;
+
+	/* control requests received from the client; consumed by the
+	 * caller */
+	bool			req_cancel;
+	bool			req_sample;
+	unsigned int		req_extend;
+
+	uint64_t		last_output_ns;
+
+	/* partially received control record of a stream socket */
+	unsigned char		in_buf[MONITOR_MAX_RECORD];
+	size_t			in_len;
+
+	/* unsent tail of a record which was written partially; new
+	 * records are dropped until it has been sent */
+	unsigned char		out_buf[MONITOR_MAX_RECORD];
+	size_t			out_len;
+};
+
+static inline bool monitor_is_active(struct monitor const *mon)
+{
+	return mon->fd >= 0 && !mon->is_dead;
+}
+
+void monitor_open(struct monitor *mon, char const *path);
+void monitor_close(struct monitor *mon);
+
+/* returns the fd which must be watched for control records or -1 */
+int monitor_ctl_fd(struct monitor const *mon);
+void monitor_handle_input(struct monitor *mon);
+
+void monitor_emit_start(struct monitor *mon, pid_t pid, char const *id);
+void monitor_emit_status(struct monitor *mon, enum monitor_status status,
+			 uint32_t arg);
+void monitor_emit_output(struct monitor *mon, bool force,
+			 unsigned int const chunks[2],
+			 uint64_t const bytes[2]);
+void monitor_emit_rusage(struct monitor *mon, struct rusage const *ru);
+void monitor_emit_sample(struct monitor *mon, pid_t pid);
+void monitor_emit_end(struct monitor *mon, enum monitor_result result,
+		      int exit_status, uint64_t wall_ns);
+
+#endif	/* H_ENSC_TESTSUITE_SRC_MONITOR_H */
@@ -0,0 +1,260 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mtd.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <sys/types.h>
+
+#include "nandsim.h"
+
+static struct mtd_ops const	MTD_DEV_OPS;
+
+static bool mtd_dev_open(struct mtd_dev *mtd, char const *path, int flags)
+{
+	*mtd = (struct mtd_dev) {
+		.path	= path,
+		.fd	= open(path, flags | O_CLOEXEC),
+		.file_mode = MTD_FILE_MODE_NORMAL,
+	};
+
+	if (mtd->fd < 0) {
+		fprintf(stderr, "open(%s): %s\n", path, strerror(errno));
+		return false;
+	}
+
+	if (ioctl(mtd->fd, MEMGETINFO, &mtd->info) < 0) {
+		fprintf(stderr, "ioctl(%s, MEMGETINFO): %s\n", path,
+			strerror(errno));
+		close(mtd->fd);
+		mtd->fd = -1;
+		return false;
+	}
+
+	mtd->ops = &MTD_DEV_OPS;
+	return true;
+}
+
+static void mtd_dev_close(struct mtd_dev *mtd)
+{
+	close(mtd->fd);
+}
+
+static bool mtd_dev_get_ecc_stats(struct mtd_dev const *mtd,
+				  struct mtd_ecc_stats *st)
+{
+	if (ioctl(mtd->fd, ECCGETSTATS, st) < 0) {
+		fprintf(stderr, "ioctl(%s, ECCGETSTATS): %s\n", mtd->path,
+			strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+static int mtd_dev_is_bad(struct mtd_dev const *mtd, unsigned int block)
+{
+	loff_t	ofs = (loff_t)block * mtd->info.erasesize;
+	int	rc = ioctl(mtd->fd, MEMGETBADBLOCK, &ofs);
+
+	if (rc < 0 && errno == EOPNOTSUPP)
+		/* NOR flash */
+		rc = 0;
+	else if (rc < 0)
+		fprintf(stderr, "ioctl(%s, MEMGETBADBLOCK, %u): %s\n",
+			mtd->path, block, strerror(errno));
+
+	return rc < 0 ? -1 : rc > 0;
+}
+
+static bool mtd_dev_erase(struct mtd_dev *mtd, unsigned int block,
+			  unsigned int cnt)
+{
+	struct erase_info_user64	ei = {
+		.start	= (uint64_t)block * mtd->info.erasesize,
+		.length	= (uint64_t)cnt * mtd->info.erasesize,
+	};
+
+	if (ioctl(mtd->fd, MEMERASE64, &ei) < 0) {
+		fprintf(stderr, "ioctl(%s, MEMERASE64, %u+%u): %s\n",
+			mtd->path, block, cnt, strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+static bool mtd_dev_write_pages(struct mtd_dev *mtd, unsigned int page,
+				unsigned int cnt, void const *data,
+				void const *oob, enum mtd_io_mode mode)
+{
+	struct mtd_write_req	req = {
+		.start		= (uint64_t)page * mtd->info.writesize,
+		.len		= (uint64_t)cnt * mtd->info.writesize,
+		.ooblen		= oob ? (uint64_t)cnt * mtd->info.oobsize : 0,
+		.usr_data	= (uintptr_t)data,
+		.usr_oob	= (uintptr_t)oob,
+		.mode		= (mode == MTD_IO_RAW ?
+				   MTD_OPS_RAW : MTD_OPS_PLACE_OOB),
+	};
+
+	if (ioctl(mtd->fd, MEMWRITE, &req) < 0) {
+		fprintf(stderr, "ioctl(%s, MEMWRITE, %u+%u): %s\n",
+			mtd->path, page, cnt, strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+static bool mtd_set_file_mode(struct mtd_dev *mtd, int mode)
+{
+	if (mtd->file_mode == mode)
+		return true;
+
+	if (ioctl(mtd->fd, MTDFILEMODE, mode) < 0) {
+		fprintf(stderr, "ioctl(%s, MTDFILEMODE, %d): %s\n",
+			mtd->path, mode, strerror(errno));
+		return false;
+	}
+
+	mtd->file_mode = mode;
+	return true;
+}
+
+/* Data are read with pread() which reports corrected and uncorrectable
+ * errors only through ECCGETSTATS; OOB is read page-wise because
+ * MEMREADOOB64 does not cross page boundaries. */
+static bool mtd_dev_read_pages(struct mtd_dev *mtd, unsigned int page,
+			       unsigned int cnt, void *data, void *oob,
+			       enum mtd_io_mode mode)
+{
+	size_t		len = (size_t)cnt * mtd->info.writesize;
+	off_t		ofs = (off_t)page * mtd->info.writesize;
+	unsigned char	*ptr = data;
+	unsigned int	i;
+
+	if (!mtd_set_file_mode(mtd, (mode == MTD_IO_RAW ?
+				     MTD_FILE_MODE_RAW : MTD_FILE_MODE_NORMAL)))
+		return false;
+
+	while (data && len > 0) {
+		ssize_t	l = pread(mtd->fd, ptr, len, ofs);
+
+		if (l < 0 && errno == EINTR)
+			continue;
+
+		if (l <= 0) {
+			fprintf(stderr, "pread(%s, %u+%u): %s\n", mtd->path,
+				page, cnt, l < 0 ? strerror(errno) : "EOF");
+			return false;
+		}
+
+		ptr += l;
+		ofs += l;
+		len -= l;
+	}
+
+	for (i = 0; oob && i < cnt; ++i) {
+		struct mtd_oob_buf64	ob = {
+			.start	 = (uint64_t)(page + i) * mtd->info.writesize,
+			.length	 = mtd->info.oobsize,
+			.usr_ptr = (uintptr_t)oob + i * mtd->info.oobsize,
+		};
+
+		if (ioctl(mtd->fd, MEMREADOOB64, &ob) < 0) {
+			fprintf(stderr, "ioctl(%s, MEMREADOOB64, %u): %s\n",
+				mtd->path, page + i, strerror(errno));
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static struct mtd_ops const	MTD_DEV_OPS = {
+	.close		= mtd_dev_close,
+	.is_bad		= mtd_dev_is_bad,
+	.erase		= mtd_dev_erase,
+	.write_pages	= mtd_dev_write_pages,
+	.read_pages	= mtd_dev_read_pages,
+	.get_ecc_stats	= mtd_dev_get_ecc_stats,
+};
+
+bool mtd_open(struct mtd_dev *mtd, char const *path, int flags)
+{
+	if (strncmp(path, NANDSIM_PREFIX, strlen(NANDSIM_PREFIX)) == 0)
+		return nandsim_open(mtd, path, flags);
+
+	return mtd_dev_open(mtd, path, flags);
+}
+
+void mtd_close(struct mtd_dev *mtd)
+{
+	if (mtd->ops)
+		mtd->ops->close(mtd);
+
+	mtd->ops = NULL;
+	mtd->fd = -1;
+}
+
+int mtd_is_bad(struct mtd_dev const *mtd, unsigned int block)
+{
+	return mtd->ops->is_bad(mtd, block);
+}
+
+bool mtd_erase(struct mtd_dev *mtd, unsigned int block, unsigned int cnt)
+{
+	return mtd->ops->erase(mtd, block, cnt);
+}
+
+bool mtd_write_pages(struct mtd_dev *mtd, unsigned int page,
+		     unsigned int cnt, void const *data, void const *oob,
+		     enum mtd_io_mode mode)
+{
+	return mtd->ops->write_pages(mtd, page, cnt, data, oob, mode);
+}
+
+bool mtd_read_pages(struct mtd_dev *mtd, unsigned int page,
+		    unsigned int cnt, void *data, void *oob,
+		    enum mtd_io_mode mode)
+{
+	return mtd->ops->read_pages(mtd, page, cnt, data, oob, mode);
+}
+
+bool mtd_get_ecc_stats(struct mtd_dev const *mtd, struct mtd_ecc_stats *st)
+{
+	return mtd->ops->get_ecc_stats(mtd, st);
+}
+
+void mtd_ecc_stats_delta(struct mtd_ecc_stats *res,
+			 struct mtd_ecc_stats const *after,
+			 struct mtd_ecc_stats const *before)
+{
+	/* the counters are free running; unsigned arithmetic handles
+	 * wrap arounds */
+	res->corrected = after->corrected - before->corrected;
+	res->failed    = after->failed    - before->failed;
+	res->badblocks = after->badblocks - before->badblocks;
+	res->bbtblocks = after->bbtblocks - before->bbtblocks;
+}
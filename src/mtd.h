@@ -0,0 +1,102 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_TESTSUITE_SRC_MTD_H
+#define H_ENSC_TESTSUITE_SRC_MTD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <mtd/mtd-user.h>
+
+enum mtd_io_mode {
+	MTD_IO_ECC,		/* data are corrected by the ECC */
+	MTD_IO_RAW,		/* data and OOB are transferred as-is */
+};
+
+struct mtd_dev;
+
+/* backend of a 'struct mtd_dev'; see mtd_xxx() below for the semantics */
+struct mtd_ops {
+	void	(*close)(struct mtd_dev *mtd);
+	int	(*is_bad)(struct mtd_dev const *mtd, unsigned int block);
+	bool	(*erase)(struct mtd_dev *mtd, unsigned int block,
+			 unsigned int cnt);
+	bool	(*write_pages)(struct mtd_dev *mtd, unsigned int page,
+			       unsigned int cnt, void const *data,
+			       void const *oob, enum mtd_io_mode mode);
+	bool	(*read_pages)(struct mtd_dev *mtd, unsigned int page,
+			      unsigned int cnt, void *data, void *oob,
+			      enum mtd_io_mode mode);
+	bool	(*get_ecc_stats)(struct mtd_dev const *mtd,
+				 struct mtd_ecc_stats *st);
+};
+
+struct mtd_dev {
+	char const		*path;
+	int			fd;
+	struct mtd_info_user	info;
+
+	/* MTD_FILE_MODE_xxx of 'fd' */
+	int			file_mode;
+
+	struct mtd_ops const	*ops;
+	void			*priv;
+};
+
+/* 'path' is a MTD character device or a 'nandsim:' specification (see
+ * nandsim.h) */
+bool mtd_open(struct mtd_dev *mtd, char const *path, int flags);
+void mtd_close(struct mtd_dev *mtd);
+
+static inline bool mtd_is_open(struct mtd_dev const *mtd)
+{
+	return mtd->ops != NULL;
+}
+
+static inline unsigned int mtd_pages_per_block(struct mtd_dev const *mtd)
+{
+	return mtd->info.erasesize / mtd->info.writesize;
+}
+
+static inline unsigned int mtd_num_blocks(struct mtd_dev const *mtd)
+{
+	return mtd->info.size / mtd->info.erasesize;
+}
+
+/* returns 1 for bad blocks, 0 for good ones and -1 on errors */
+int mtd_is_bad(struct mtd_dev const *mtd, unsigned int block);
+bool mtd_erase(struct mtd_dev *mtd, unsigned int block, unsigned int cnt);
+
+/* Transfer 'cnt' consecutive pages starting at 'page' with a single
+ * request where possible.  'oob' holds 'cnt * oobsize' bytes and can be
+ * NULL when the OOB area is not needed; for writes in MTD_IO_ECC mode,
+ * the ECC bytes are generated by the driver. */
+bool mtd_write_pages(struct mtd_dev *mtd, unsigned int page,
+		     unsigned int cnt, void const *data, void const *oob,
+		     enum mtd_io_mode mode);
+bool mtd_read_pages(struct mtd_dev *mtd, unsigned int page,
+		    unsigned int cnt, void *data, void *oob,
+		    enum mtd_io_mode mode);
+
+bool mtd_get_ecc_stats(struct mtd_dev const *mtd, struct mtd_ecc_stats *st);
+
+/* 'res' = 'after' - 'before' */
+void mtd_ecc_stats_delta(struct mtd_ecc_stats *res,
+			 struct mtd_ecc_stats const *after,
+			 struct mtd_ecc_stats const *before);
+
+#endif	/* H_ENSC_TESTSUITE_SRC_MTD_H */
@@ -0,0 +1,637 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Compares two NAND dumps bit by bit and reports the bitflips per page,
+ * per ECC step and in the OOB area.  Both images consist of pages with
+ * 'page' data bytes followed by 'oob' OOB bytes (the nanddump --oob
+ * format); the ECC bytes of the steps are expected at the end of the OOB
+ * area.  nandsim images are detected and their geometry is used.
+ *
+ * Regular files are mmap()ed; other files (e.g. '-' for stdin) are read
+ * sequentially. */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "bitdiff.h"
+#include "ecc.h"
+#include "nandsim.h"
+#include "util.h"
+
+/* {{{ cli options */
+#define CMD_HELP		0x8000
+#define CMD_VERSION		0x8001
+#define CMD_PAGE		0x8002
+#define CMD_OOB			0x8003
+#define CMD_STEP		0x8004
+#define CMD_ECC			0x8005
+#define CMD_ECC_BYTES		0x8006
+#define CMD_LIMIT		0x8007
+#define CMD_QUIET		0x8008
+#define CMD_IMPL		0x8009
+
+static struct option const	CMDLINE_OPTIONS[] = {
+  { "help",        no_argument,        0, CMD_HELP },
+  { "version",     no_argument,        0, CMD_VERSION },
+  { "page",        required_argument,  0, CMD_PAGE },
+  { "oob",         required_argument,  0, CMD_OOB },
+  { "step",        required_argument,  0, CMD_STEP },
+  { "ecc",         required_argument,  0, CMD_ECC },
+  { "ecc-bytes",   required_argument,  0, CMD_ECC_BYTES },
+  { "limit",       required_argument,  0, CMD_LIMIT },
+  { "quiet",       no_argument,        0, CMD_QUIET },
+  { "impl",        required_argument,  0, CMD_IMPL },
+  { 0,0,0,0 }
+};
+
+struct cmdline_options {
+	int		writesize;
+	int		oobsize;
+	int		step;
+	char const	*ecc;
+	int		ecc_bytes;
+	int		limit;
+	bool		quiet;
+};
+/* }}} cli options */
+
+/* steps with more bitflips are counted in the last bucket */
+#define HISTOGRAM_SIZE		65
+
+/* pages read at once from non-mmap()able sources */
+#define STREAM_PAGES		256
+
+#define POPULATE_WINDOW		(8u << 20)
+
+#ifndef MADV_POPULATE_READ
+#  define MADV_POPULATE_READ	22
+#endif
+
+struct layout {
+	unsigned int	writesize;
+	unsigned int	oobsize;
+	unsigned int	step;
+	unsigned int	num_steps;
+	unsigned int	ecc_bytes;	/* per step */
+	unsigned int	ecc_ofs;	/* within OOB */
+	size_t		offset;		/* of the first page */
+};
+
+struct source {
+	char const		*name;
+	int			fd;
+
+	unsigned char const	*map;
+	size_t			map_size;
+	size_t			populated;
+
+	unsigned char		*buf;
+	size_t			buf_len;
+
+	size_t			pos;
+	bool			is_eof;
+	/* bytes of an incomplete page at EOF */
+	size_t			tail;
+};
+
+struct stats {
+	unsigned long		num_pages;
+	unsigned long		num_diff_pages;
+
+	unsigned long long	data_flips;
+	unsigned long long	ecc_flips;
+	unsigned long long	oob_flips;	/* outside of the ECC bytes */
+
+	unsigned int		max_flips;	/* per step */
+	unsigned long		max_page;
+	unsigned int		max_step;
+	unsigned long		num_over_limit;
+
+	unsigned long		histogram[HISTOGRAM_SIZE];
+};
+
+static void show_help(void) __attribute__((__noreturn__));
+static void show_help(void)
+{
+	printf("Usage: nand-bitdiff [--page <bytes>] [--oob <bytes>] [--step <bytes>]\n"
+	       "         [--ecc <none|hamming|bch<n>>] [--ecc-bytes <bytes>] [--limit <bitflips>]\n"
+	       "         [--quiet] [--impl <avx2|ssse3|scalar>] <image> <image>\n"
+	       "\n"
+	       "Exits with 0 when the images are identical (or no ECC step exceeds the\n"
+	       "--limit), with 1 when they differ and with a sysexits code on errors.\n");
+	exit(0);
+}
+
+static void show_version(void) __attribute__((__noreturn__));
+static void show_version(void)
+{
+	/* \todo */
+	exit(0);
+}
+
+static bool source_open(struct source *src, char const *name)
+{
+	struct stat	st;
+
+	*src = (struct source) {
+		.name	= name,
+		.fd	= -1,
+	};
+
+	if (strcmp(name, "-") == 0)
+		src->fd = dup(STDIN_FILENO);
+	else
+		src->fd = open(name, O_RDONLY | O_CLOEXEC);
+
+	if (src->fd < 0 || fstat(src->fd, &st) < 0) {
+		fprintf(stderr, "open(%s): %s\n", name, strerror(errno));
+		return false;
+	}
+
+	if (S_ISREG(st.st_mode) && st.st_size > 0) {
+		void	*map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED,
+				    src->fd, 0);
+
+		if (map != MAP_FAILED) {
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			src->map = map;
+			src->map_size = st.st_size;
+		}
+	}
+
+	return true;
+}
+
+static void source_close(struct source *src)
+{
+	if (src->map)
+		munmap((void *)src->map, src->map_size);
+
+	free(src->buf);
+	xclose(src->fd);
+}
+
+static ssize_t read_full(int fd, void *buf, size_t len)
+{
+	size_t	total = 0;
+
+	while (total < len) {
+		ssize_t	l = read(fd, buf + total, len - total);
+
+		if (l < 0 && errno == EINTR)
+			continue;
+		if (l < 0)
+			return -1;
+		if (l == 0)
+			break;
+
+		total += l;
+	}
+
+	return total;
+}
+
+/* Faulting in the mapping page by page is much slower than the
+ * comparison; prefault the next window in one syscall instead. */
+static void source_populate(struct source *src)
+{
+	size_t	len = src->map_size - src->populated;
+
+	if (len > POPULATE_WINDOW)
+		len = POPULATE_WINDOW;
+
+	/* MADV_POPULATE_READ requires Linux 5.14; older kernels just fault
+	 * in the pages on access */
+	madvise((void *)src->map + src->populated, len, MADV_POPULATE_READ);
+	src->populated += len;
+}
+
+/* Returns a pointer to the next 'len' bytes or NULL on EOF and errors.
+ * For streams, 'len' must not change between calls. */
+static unsigned char const *source_next(struct source *src, size_t len)
+{
+	unsigned char const	*res;
+
+	if (src->map) {
+		if (src->map_size - src->pos < len) {
+			src->is_eof = true;
+			src->tail = src->map_size - src->pos;
+			return NULL;
+		}
+
+		if (src->pos >= src->populated)
+			source_populate(src);
+
+		res = src->map + src->pos;
+		src->pos += len;
+		return res;
+	}
+
+	if (!src->buf) {
+		src->buf = malloc(len * STREAM_PAGES);
+		if (!src->buf)
+			return NULL;
+	}
+
+	/* read_full() returns less than 'len * STREAM_PAGES' only at EOF;
+	 * a remainder is an incomplete page then */
+	if (src->pos < src->buf_len && src->pos + len > src->buf_len) {
+		src->is_eof = true;
+		src->tail = src->buf_len - src->pos;
+		return NULL;
+	}
+
+	if (src->pos + len > src->buf_len) {
+		ssize_t	l = read_full(src->fd, src->buf, len * STREAM_PAGES);
+
+		if (l < 0) {
+			fprintf(stderr, "read(%s): %s\n", src->name,
+				strerror(errno));
+			return NULL;
+		}
+
+		src->buf_len = l;
+		src->pos = 0;
+	}
+
+	if (src->pos + len > src->buf_len) {
+		src->is_eof = true;
+		src->tail = src->buf_len;
+		return NULL;
+	}
+
+	res = src->buf + src->pos;
+	src->pos += len;
+	return res;
+}
+
+static bool source_skip(struct source *src, size_t len)
+{
+	unsigned char	tmp[512];
+
+	if (src->map) {
+		if (len > src->map_size)
+			return false;
+		src->pos = len;
+		return true;
+	}
+
+	while (len > 0) {
+		size_t	l = len < sizeof tmp ? len : sizeof tmp;
+
+		if (read_full(src->fd, tmp, l) != (ssize_t)l)
+			return false;
+
+		len -= l;
+	}
+
+	return true;
+}
+
+/* takes the geometry from the header when both images are nandsim
+ * images */
+static bool layout_from_nandsim(struct layout *layout,
+				struct source const *a, struct source const *b)
+{
+	struct nandsim_hdr const	*hdr;
+	struct ecc			ecc;
+
+	if (!a->map || !b->map ||
+	    a->map_size < NANDSIM_HDR_SIZE || b->map_size < NANDSIM_HDR_SIZE ||
+	    memcmp(a->map, NANDSIM_MAGIC, 8) != 0 ||
+	    memcmp(b->map, NANDSIM_MAGIC, 8) != 0)
+		return false;
+
+	hdr = (void const *)a->map;
+
+	if (!ecc_init(&ecc, hdr->ecc_type, hdr->ecc_step, hdr->ecc_strength))
+		return false;
+
+	*layout = (struct layout) {
+		.writesize	= hdr->writesize,
+		.oobsize	= hdr->oobsize,
+		.step		= hdr->ecc_step,
+		.ecc_bytes	= ecc.bytes,
+		.offset		= NANDSIM_HDR_SIZE,
+	};
+
+	ecc_free(&ecc);
+
+	return true;
+}
+
+/* the geometry of both nandsim images must be the same; the ECC
+ * counters may differ */
+static bool nandsim_hdr_match(struct source const *a, struct source const *b)
+{
+	struct nandsim_hdr const	*ha = (void const *)a->map;
+	struct nandsim_hdr const	*hb = (void const *)b->map;
+	struct {
+		char const	*name;
+		uint32_t	va;
+		uint32_t	vb;
+	} const				fields[] = {
+		{ "writesize",       ha->writesize,       hb->writesize },
+		{ "oobsize",         ha->oobsize,         hb->oobsize },
+		{ "pages_per_block", ha->pages_per_block, hb->pages_per_block },
+		{ "num_blocks",      ha->num_blocks,      hb->num_blocks },
+		{ "ecc_type",        ha->ecc_type,        hb->ecc_type },
+		{ "ecc_strength",    ha->ecc_strength,    hb->ecc_strength },
+		{ "ecc_step",        ha->ecc_step,        hb->ecc_step },
+	};
+	bool				rc = true;
+	size_t				i;
+
+	for (i = 0; i < ARRAY_SIZE(fields); ++i) {
+		if (fields[i].va == fields[i].vb)
+			continue;
+
+		fprintf(stderr, "nandsim headers differ in %s: %u (%s) != %u (%s)\n",
+			fields[i].name, fields[i].va, a->name,
+			fields[i].vb, b->name);
+		rc = false;
+	}
+
+	return rc;
+}
+
+static bool layout_from_opts(struct layout *layout,
+			     struct cmdline_options const *opts)
+{
+	if (opts->writesize >= 0)
+		layout->writesize = opts->writesize;
+	if (opts->oobsize >= 0)
+		layout->oobsize = opts->oobsize;
+	if (opts->step >= 0)
+		layout->step = opts->step;
+
+	if (opts->ecc) {
+		enum ecc_type	type;
+		unsigned int	strength;
+		struct ecc	ecc;
+
+		if (!ecc_parse(opts->ecc, &type, &strength) ||
+		    !ecc_init(&ecc, type, layout->step, strength))
+			return false;
+
+		layout->ecc_bytes = ecc.bytes;
+		ecc_free(&ecc);
+	}
+
+	if (opts->ecc_bytes >= 0)
+		layout->ecc_bytes = opts->ecc_bytes;
+
+	if (layout->writesize == 0 || layout->step == 0 ||
+	    layout->writesize % layout->step != 0) {
+		fprintf(stderr, "page size must be a multiple of the step size\n");
+		return false;
+	}
+
+	layout->num_steps = layout->writesize / layout->step;
+
+	if (layout->num_steps * layout->ecc_bytes > layout->oobsize) {
+		fprintf(stderr, "ECC bytes do not fit into the OOB area\n");
+		return false;
+	}
+
+	layout->ecc_ofs = layout->oobsize - layout->num_steps * layout->ecc_bytes;
+
+	return true;
+}
+
+static void compare_page(struct stats *st, struct layout const *layout,
+			 int limit, bool quiet,
+			 unsigned char const *a, unsigned char const *b)
+{
+	unsigned char const	*oob_a = a + layout->writesize;
+	unsigned char const	*oob_b = b + layout->writesize;
+	unsigned int		flips[layout->num_steps];
+	unsigned int		total = 0;
+	unsigned int		oob;
+	unsigned int		s;
+
+	for (s = 0; s < layout->num_steps; ++s) {
+		size_t	ecc_pos = layout->ecc_ofs + s * layout->ecc_bytes;
+		size_t	data = bitdiff(a + s * layout->step, b + s * layout->step,
+				       layout->step);
+		size_t	ecc = bitdiff(oob_a + ecc_pos, oob_b + ecc_pos,
+				      layout->ecc_bytes);
+
+		st->data_flips += data;
+		st->ecc_flips  += ecc;
+
+		flips[s] = data + ecc;
+		total   += flips[s];
+
+		++st->histogram[flips[s] < HISTOGRAM_SIZE ?
+				flips[s] : HISTOGRAM_SIZE - 1];
+
+		if (flips[s] > st->max_flips) {
+			st->max_flips = flips[s];
+			st->max_page  = st->num_pages;
+			st->max_step  = s;
+		}
+
+		if (limit >= 0 && flips[s] > (unsigned int)limit)
+			++st->num_over_limit;
+	}
+
+	oob = bitdiff(oob_a, oob_b, layout->ecc_ofs);
+	st->oob_flips += oob;
+	total += oob;
+
+	if (total > 0) {
+		++st->num_diff_pages;
+
+		if (!quiet) {
+			printf("page %lu: %u bitflips; steps", st->num_pages, total);
+			for (s = 0; s < layout->num_steps; ++s)
+				printf(" %u", flips[s]);
+			printf("; oob %u\n", oob);
+		}
+	}
+
+	++st->num_pages;
+}
+
+static void print_stats(struct stats const *st, struct layout const *layout,
+			uint64_t duration_ns)
+{
+	double		mib = ((double)st->num_pages *
+			       (layout->writesize + layout->oobsize) / (1 << 20));
+	unsigned int	i;
+
+	printf("pages: %lu compared, %lu differ\n",
+	       st->num_pages, st->num_diff_pages);
+	printf("bitflips: %llu in data, %llu in ECC bytes, %llu in free OOB\n",
+	       st->data_flips, st->ecc_flips, st->oob_flips);
+
+	if (st->max_flips > 0)
+		printf("max per step: %u (page %lu, step %u)\n",
+		       st->max_flips, st->max_page, st->max_step);
+
+	printf("histogram (bitflips per ECC step):\n");
+	for (i = 0; i < HISTOGRAM_SIZE; ++i) {
+		if (st->histogram[i] == 0)
+			continue;
+
+		printf("  %2u%s: %lu\n", i, i == HISTOGRAM_SIZE - 1 ? "+" : " ",
+		       st->histogram[i]);
+	}
+
+	printf("throughput: %.1f MiB/s (%s)\n",
+	       mib / (duration_ns / 1e9 + 1e-9), bitdiff_impl());
+}
+
+int main(int argc, char *argv[])
+{
+	struct cmdline_options	opts = {
+		.writesize	= -1,
+		.oobsize	= -1,
+		.step		= -1,
+		.ecc_bytes	= -1,
+		.limit		= -1,
+	};
+	struct layout		layout = {
+		.writesize	= 2048,
+		.oobsize	= 64,
+		.step		= 512,
+	};
+	struct source		src[2] = {
+		[0] = { .fd = -1 },
+		[1] = { .fd = -1 },
+	};
+	struct stats		st = { .num_pages = 0 };
+	unsigned char const	*a;
+	unsigned char const	*b;
+	bool			is_truncated;
+	size_t			page_size;
+	size_t			i;
+	uint64_t		t0;
+	int			rc = EX_SOFTWARE;
+
+	while (1) {
+		int	c = getopt_long(argc, argv, "", CMDLINE_OPTIONS, 0);
+
+		if (c==-1)
+			break;
+
+		switch (c) {
+		case CMD_HELP		:  show_help();
+		case CMD_VERSION	:  show_version();
+		case CMD_PAGE		:  opts.writesize = atoi(optarg); break;
+		case CMD_OOB		:  opts.oobsize = atoi(optarg); break;
+		case CMD_STEP		:  opts.step = atoi(optarg); break;
+		case CMD_ECC		:  opts.ecc = optarg; break;
+		case CMD_ECC_BYTES	:  opts.ecc_bytes = atoi(optarg); break;
+		case CMD_LIMIT		:  opts.limit = atoi(optarg); break;
+		case CMD_QUIET		:  opts.quiet = true; break;
+		case CMD_IMPL:
+			if (!bitdiff_select(optarg)) {
+				fprintf(stderr, "bitdiff implementation '%s' not supported\n",
+					optarg);
+				return EX_UNAVAILABLE;
+			}
+			break;
+		default:
+			fprintf(stderr, "Try '--help' for more information\n");
+			return EX_USAGE;
+		}
+	}
+
+	if (optind + 2 != argc) {
+		fprintf(stderr, "expected two images\n");
+		return EX_USAGE;
+	}
+
+	if (!source_open(&src[0], argv[optind]) ||
+	    !source_open(&src[1], argv[optind + 1])) {
+		rc = EX_NOINPUT;
+		goto out;
+	}
+
+	if (layout_from_nandsim(&layout, &src[0], &src[1]) &&
+	    !nandsim_hdr_match(&src[0], &src[1])) {
+		rc = EX_DATAERR;
+		goto out;
+	}
+
+	if (!layout_from_opts(&layout, &opts)) {
+		rc = EX_USAGE;
+		goto out;
+	}
+
+	if (!source_skip(&src[0], layout.offset) ||
+	    !source_skip(&src[1], layout.offset)) {
+		fprintf(stderr, "failed to skip image headers\n");
+		rc = EX_DATAERR;
+		goto out;
+	}
+
+	page_size = layout.writesize + layout.oobsize;
+	t0 = monotonic_ns();
+
+	for (;;) {
+		a = source_next(&src[0], page_size);
+		b = source_next(&src[1], page_size);
+
+		if (!a || !b)
+			break;
+
+		compare_page(&st, &layout, opts.limit, opts.quiet, a, b);
+	}
+
+	if ((!a && !src[0].is_eof) || (!b && !src[1].is_eof)) {
+		rc = EX_IOERR;
+		goto out;
+	}
+
+	is_truncated = src[0].is_eof != src[1].is_eof;
+	if (is_truncated)
+		fprintf(stderr, "EOF on %s after %lu pages\n",
+			src[src[0].is_eof ? 0 : 1].name, st.num_pages);
+
+	for (i = 0; i < ARRAY_SIZE(src); ++i) {
+		if (src[i].tail == 0)
+			continue;
+
+		fprintf(stderr, "%s: incomplete page of %zu bytes after %lu pages\n",
+			src[i].name, src[i].tail, st.num_pages);
+		is_truncated = true;
+	}
+
+	print_stats(&st, &layout, monotonic_ns() - t0);
+
+	if (opts.limit < 0)
+		rc = (is_truncated || st.num_diff_pages > 0) ? 1 : 0;
+	else
+		rc = (is_truncated || st.num_over_limit > 0) ? 1 : 0;
+
+out:
+	source_close(&src[1]);
+	source_close(&src[0]);
+
+	return rc;
+}
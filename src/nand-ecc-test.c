@@ -0,0 +1,1051 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Writes pages with an increasing number of bit errors in raw mode and
+ * checks whether the ECC corrects them on read back.  Page 0 of the test
+ * area holds the reference data; page 'i' contains the first 'i' bit
+ * errors of the 'pos:bit' list.
+ *
+ * With '--sweep', the error patterns are generated instead: every bit of
+ * an ECC step and of the OOB area, and random k-bit combinations up to
+ * '--max-errors'.  The patterns are written one eraseblock at a time and
+ * the blocks are distributed over '--jobs' worker processes.  The result
+ * is a matrix which shows for which number of errors the correction
+ * breaks down. */
+
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/wait.h>
+
+#include "bitdiff.h"
+#include "mtd.h"
+#include "util.h"
+
+/* {{{ cli options */
+#define CMD_HELP		0x8000
+#define CMD_VERSION		0x8001
+#define CMD_BLOCK		0x8002
+#define CMD_SWEEP		0x8003
+#define CMD_STEP		0x8004
+#define CMD_MAX_ERRORS		0x8005
+#define CMD_SAMPLES		0x8006
+#define CMD_BLOCKS		0x8007
+#define CMD_JOBS		0x8008
+#define CMD_SEED		0x8009
+#define CMD_STRENGTH		0x800a
+
+static struct option const	CMDLINE_OPTIONS[] = {
+  { "help",        no_argument,        0, CMD_HELP },
+  { "version",     no_argument,        0, CMD_VERSION },
+  { "block",       required_argument,  0, CMD_BLOCK },
+  { "sweep",       no_argument,        0, CMD_SWEEP },
+  { "step",        required_argument,  0, CMD_STEP },
+  { "max-errors",  required_argument,  0, CMD_MAX_ERRORS },
+  { "samples",     required_argument,  0, CMD_SAMPLES },
+  { "blocks",      required_argument,  0, CMD_BLOCKS },
+  { "jobs",        required_argument,  0, CMD_JOBS },
+  { "seed",        required_argument,  0, CMD_SEED },
+  { "strength",    required_argument,  0, CMD_STRENGTH },
+  { 0,0,0,0 }
+};
+
+struct cmdline_options {
+	unsigned int	block;
+
+	/* sweep mode */
+	bool		sweep;
+	unsigned int	step;
+	unsigned int	max_errors;
+	unsigned int	samples;
+	unsigned int	blocks;		/* 0 means all */
+	unsigned int	jobs;
+	unsigned long	seed;
+	bool		has_seed;
+	int		strength;	/* -1 when unknown */
+};
+/* }}} cli options */
+
+/* limits of the sweep options; the bit positions of a pattern are kept
+ * on the stack */
+#define SWEEP_MAX_ERRORS	64
+#define SWEEP_MAX_SAMPLES	(1u << 20)
+#define SWEEP_MAX_JOBS		256
+#define SWEEP_MAX_STRENGTH	SWEEP_MAX_ERRORS
+
+/* the positions used when not enough are given on the command line */
+static char const * const	DEFAULT_BITPOS[] = {
+	"0:0", "1:1", "2:2", "3:3", "4:4", "5:5", "6:6", "7:7", "8:0", "9:1",
+};
+
+struct bitpos {
+	unsigned int	pos;	/* byte offset within data + OOB */
+	unsigned int	bit;
+};
+
+/* a set of pages with separate data and OOB buffers, as used by
+ * MEMWRITE */
+struct page_buf {
+	unsigned char	*data;
+	unsigned char	*oob;
+};
+
+static void show_help(void) __attribute__((__noreturn__));
+static void show_help(void)
+{
+	printf("Usage: nand-ecc-test [--block <eraseblock>] [--seed <num>] <mtd-device>\n"
+	       "         [<errors> [<pos>:<bit>]*]\n"
+	       "       nand-ecc-test --sweep [--block <eraseblock>] [--blocks <num>] [--jobs <num>]\n"
+	       "         [--step <bytes>] [--max-errors <k>] [--samples <num>] [--seed <num>]\n"
+	       "         [--strength <bits>] <mtd-device>\n"
+	       "\n"
+	       "In sweep mode, '--block' holds the reference page and the patterns are\n"
+	       "written to the following '--blocks' good eraseblocks.  With '--strength',\n"
+	       "the exit code is non-zero when a pattern with at most that many errors\n"
+	       "is not corrected.  An explicit '--seed' makes the sample page\n"
+	       "reproducible; it is random otherwise.\n");
+	exit(0);
+}
+
+static void show_version(void) __attribute__((__noreturn__));
+static void show_version(void)
+{
+	/* \todo */
+	exit(0);
+}
+
+static bool parse_ulong(char const *opt, char const *str,
+			unsigned long min, unsigned long max, unsigned long *res)
+{
+	char		*end;
+
+	errno = 0;
+	*res = strtoul(str, &end, 0);
+
+	if (*str == '\0' || *str == '-' || *end != '\0' || errno != 0 ||
+	    *res < min || *res > max) {
+		fprintf(stderr, "invalid %s '%s'; must be between %lu and %lu\n",
+			opt, str, min, max);
+		return false;
+	}
+
+	return true;
+}
+
+static bool parse_uint(char const *opt, char const *str,
+		       unsigned int min, unsigned int max, unsigned int *res)
+{
+	unsigned long	v;
+
+	if (!parse_ulong(opt, str, min, max, &v))
+		return false;
+
+	*res = v;
+	return true;
+}
+
+static bool parse_bitpos(struct bitpos *bp, char const *str,
+			 struct mtd_info_user const *info)
+{
+	char	*end;
+
+	bp->pos = strtoul(str, &end, 0);
+	if (*end == ':')
+		bp->bit = strtoul(end + 1, &end, 0);
+
+	if (*end != '\0' || str[0] == ':' ||
+	    bp->pos >= info->writesize + info->oobsize || bp->bit > 7) {
+		fprintf(stderr, "invalid bit position '%s'\n", str);
+		return false;
+	}
+
+	return true;
+}
+
+static bool page_buf_alloc(struct page_buf *buf, unsigned int cnt,
+			   struct mtd_info_user const *info)
+{
+	buf->data = calloc(cnt, info->writesize);
+	buf->oob  = calloc(cnt, info->oobsize);
+
+	if (!buf->data || !buf->oob) {
+		fprintf(stderr, "failed to allocate %u pages\n", cnt);
+		return false;
+	}
+
+	return true;
+}
+
+static void page_buf_free(struct page_buf *buf)
+{
+	free(buf->data);
+	free(buf->oob);
+}
+
+static void page_copy(struct page_buf *dst, unsigned int dst_idx,
+		      struct page_buf const *src, unsigned int src_idx,
+		      struct mtd_info_user const *info)
+{
+	memcpy(dst->data + dst_idx * info->writesize,
+	       src->data + src_idx * info->writesize, info->writesize);
+	memcpy(dst->oob + dst_idx * info->oobsize,
+	       src->oob + src_idx * info->oobsize, info->oobsize);
+}
+
+static void page_toggle_bit(struct page_buf *buf, unsigned int idx,
+			    struct bitpos const *bp,
+			    struct mtd_info_user const *info)
+{
+	unsigned char	*p;
+
+	if (bp->pos < info->writesize)
+		p = buf->data + idx * info->writesize + bp->pos;
+	else
+		p = buf->oob + idx * info->oobsize + bp->pos - info->writesize;
+
+	*p ^= 1u << bp->bit;
+}
+
+static unsigned int page_bitflips(struct page_buf const *a, unsigned int a_idx,
+				  struct page_buf const *b, unsigned int b_idx,
+				  struct mtd_info_user const *info)
+{
+	return (bitdiff(a->data + a_idx * info->writesize,
+			       b->data + b_idx * info->writesize,
+			       info->writesize) +
+		bitdiff(a->oob + a_idx * info->oobsize,
+			       b->oob + b_idx * info->oobsize,
+			       info->oobsize));
+}
+
+static bool result(bool ok)
+{
+	printf(ok ? " OK\n" : " FAIL\n");
+	return ok;
+}
+
+static bool fill_random(void *buf, size_t len)
+{
+	unsigned char	*p = buf;
+
+	while (len > 0) {
+		ssize_t	l = getrandom(p, len, 0);
+
+		if (l < 0 && errno == EINTR)
+			continue;
+		if (l < 0) {
+			perror("getrandom()");
+			return false;
+		}
+
+		p   += l;
+		len -= l;
+	}
+
+	return true;
+}
+
+/* some drivers return stale data on the first read after a raw
+ * write; nand-crc-test did a dummy read for this reason too.  When
+ * 'ecc' is given, it receives the ECC statistics of the second read
+ * only. */
+static bool read_page(struct mtd_dev *mtd, unsigned int page,
+		      struct page_buf *buf, unsigned int idx,
+		      enum mtd_io_mode mode, struct mtd_ecc_stats *ecc)
+{
+	struct mtd_info_user const	*info = &mtd->info;
+	unsigned char			*data = buf->data + idx * info->writesize;
+	unsigned char			*oob = buf->oob + idx * info->oobsize;
+	struct mtd_ecc_stats		before;
+	struct mtd_ecc_stats		after;
+
+	if (!mtd_read_pages(mtd, page, 1, data, oob, mode))
+		return false;
+
+	if (ecc && !mtd_get_ecc_stats(mtd, &before))
+		return false;
+
+	if (!mtd_read_pages(mtd, page, 1, data, oob, mode))
+		return false;
+
+	if (ecc) {
+		if (!mtd_get_ecc_stats(mtd, &after))
+			return false;
+
+		mtd_ecc_stats_delta(ecc, &after, &before);
+	}
+
+	return true;
+}
+
+/* the sample page; taken from the xorshift64 sequence of '--seed' when
+ * it was given so that ECC bytes can be compared with known values */
+static bool fill_sample(void *buf, size_t len,
+			struct cmdline_options const *opts)
+{
+	unsigned char	*p = buf;
+	uint64_t	rng = opts->seed ? opts->seed : 1;
+	size_t		i;
+
+	if (!opts->has_seed)
+		return fill_random(buf, len);
+
+	for (i = 0; i < len; ++i) {
+		if (i % 8 == 0) {
+			rng ^= rng << 13;
+			rng ^= rng >> 7;
+			rng ^= rng << 17;
+		}
+
+		p[i] = rng >> (8 * (i % 8));
+	}
+
+	return true;
+}
+
+/* ref[0] receives the sample data, ref[1] the raw page as written by
+ * the driver including its ECC bytes */
+static bool write_reference(struct mtd_dev *mtd,
+			    struct cmdline_options const *opts,
+			    unsigned int block, unsigned int num_blocks,
+			    struct page_buf *ref)
+{
+	struct mtd_info_user const	*info = &mtd->info;
+	unsigned int			page = block * mtd_pages_per_block(mtd);
+
+	printf("creating sample page...");
+	if (!result(fill_sample(ref->data, info->writesize, opts)))
+		return false;
+
+	printf("erasing flash...");
+	if (!result(mtd_erase(mtd, block, num_blocks)))
+		return false;
+
+	printf("writing sample page...");
+	if (!result(mtd_write_pages(mtd, page, 1, ref->data, NULL,
+				    MTD_IO_ECC)))
+		return false;
+
+	printf("dumping first page...");
+	if (!result(read_page(mtd, page, ref, 1, MTD_IO_RAW, NULL)))
+		return false;
+
+	printf("comparing first page...");
+	return result(memcmp(ref->data, ref->data + info->writesize,
+			     info->writesize) == 0);
+}
+
+/* {{{ sweep mode */
+
+/* OOB bytes holding the bad block marker; flipping them would mark the
+ * eraseblock as bad */
+#define SWEEP_BBM_BYTES		2
+
+enum sweep_class {
+	SWEEP_DATA,		/* bits within the data of an ECC step */
+	SWEEP_OOB,		/* bits within the OOB area */
+	SWEEP_MIXED,		/* data bits plus one OOB bit */
+};
+
+static char const * const	SWEEP_CLASS_NAMES[] = {
+	[SWEEP_DATA]	= "data",
+	[SWEEP_OOB]	= "oob",
+	[SWEEP_MIXED]	= "data+oob",
+};
+
+enum sweep_status {
+	SWEEP_PENDING,
+	SWEEP_OK,		/* data read back correctly */
+	SWEEP_DETECTED,		/* wrong data; the ECC reported a failure */
+	SWEEP_SILENT,		/* wrong data; no ECC failure reported */
+	SWEEP_IOERR,
+};
+
+/* a run of patterns with the same class and number of errors */
+struct sweep_row {
+	enum sweep_class	cls;
+	unsigned int		k;
+	unsigned int		first;
+	unsigned int		cnt;
+};
+
+struct sweep {
+	struct mtd_info_user const	*info;
+	struct page_buf const		*ref;
+
+	struct bitpos			*bits;
+	unsigned int			num_bits;
+	unsigned int			*pattern_ofs;	/* into 'bits' */
+	unsigned int			num_patterns;
+
+	struct sweep_row		*rows;
+	unsigned int			num_rows;
+
+	/* shared with the workers */
+	uint8_t				*status;
+
+	unsigned int			*blocks;
+	unsigned int			num_blocks;
+	unsigned int			jobs;
+
+	uint64_t			rng;
+};
+
+static uint64_t sweep_rand(struct sweep *sw)
+{
+	/* xorshift64 */
+	sw->rng ^= sw->rng << 13;
+	sw->rng ^= sw->rng >> 7;
+	sw->rng ^= sw->rng << 17;
+
+	return sw->rng;
+}
+
+static bool sweep_add_pattern(struct sweep *sw, enum sweep_class cls,
+			      unsigned int k, struct bitpos const *bits)
+{
+	struct sweep_row	*row = sw->num_rows ? &sw->rows[sw->num_rows - 1] : NULL;
+	void			*tmp;
+
+	if (!row || row->cls != cls || row->k != k) {
+		tmp = realloc(sw->rows, (sw->num_rows + 1) * sizeof sw->rows[0]);
+		if (!tmp)
+			return false;
+
+		sw->rows = tmp;
+		row = &sw->rows[sw->num_rows++];
+		*row = (struct sweep_row) {
+			.cls	= cls,
+			.k	= k,
+			.first	= sw->num_patterns,
+		};
+	}
+
+	tmp = realloc(sw->bits, (sw->num_bits + k) * sizeof sw->bits[0]);
+	if (!tmp)
+		return false;
+	sw->bits = tmp;
+
+	tmp = realloc(sw->pattern_ofs,
+		      (sw->num_patterns + 2) * sizeof sw->pattern_ofs[0]);
+	if (!tmp)
+		return false;
+	sw->pattern_ofs = tmp;
+
+	memcpy(&sw->bits[sw->num_bits], bits, k * sizeof bits[0]);
+
+	sw->pattern_ofs[sw->num_patterns]   = sw->num_bits;
+	sw->num_bits += k;
+	sw->pattern_ofs[sw->num_patterns + 1] = sw->num_bits;
+
+	++sw->num_patterns;
+	++row->cnt;
+
+	return true;
+}
+
+/* fills 'bits' with 'cnt' distinct random bits of [ofs, ofs + len);
+ * 'cnt' must not exceed the 'len * 8' bits of the range */
+static void sweep_random_bits(struct sweep *sw, struct bitpos *bits,
+			      unsigned int cnt, unsigned int ofs,
+			      unsigned int len)
+{
+	unsigned int	i;
+	unsigned int	j;
+
+	for (i = 0; i < cnt; ++i) {
+		unsigned int	n;
+
+	again:
+		n = sweep_rand(sw) % (len * 8);
+		bits[i] = (struct bitpos) {
+			.pos	= ofs + n / 8,
+			.bit	= n % 8,
+		};
+
+		for (j = 0; j < i; ++j) {
+			if (bits[j].pos == bits[i].pos &&
+			    bits[j].bit == bits[i].bit)
+				goto again;
+		}
+	}
+}
+
+static bool sweep_generate(struct sweep *sw,
+			   struct cmdline_options const *opts)
+{
+	struct mtd_info_user const	*info = sw->info;
+	unsigned int			num_steps = info->writesize / opts->step;
+	struct bitpos			bits[opts->max_errors];
+	unsigned int			k;
+	unsigned int			i;
+
+	/* every single bit of the first ECC step and of the OOB area */
+	for (i = 0; i < opts->step * 8; ++i) {
+		bits[0] = (struct bitpos) { i / 8, i % 8 };
+		if (!sweep_add_pattern(sw, SWEEP_DATA, 1, bits))
+			return false;
+	}
+
+	for (i = SWEEP_BBM_BYTES * 8; i < info->oobsize * 8; ++i) {
+		bits[0] = (struct bitpos) { info->writesize + i / 8, i % 8 };
+		if (!sweep_add_pattern(sw, SWEEP_OOB, 1, bits))
+			return false;
+	}
+
+	/* random combinations within a random ECC step */
+	for (k = 2; k <= opts->max_errors; ++k) {
+		for (i = 0; i < opts->samples; ++i) {
+			unsigned int	step = sweep_rand(sw) % num_steps;
+
+			sweep_random_bits(sw, bits, k, step * opts->step,
+					  opts->step);
+			if (!sweep_add_pattern(sw, SWEEP_DATA, k, bits))
+				return false;
+		}
+	}
+
+	for (k = 2; k <= opts->max_errors; ++k) {
+		for (i = 0; i < opts->samples; ++i) {
+			unsigned int	step = sweep_rand(sw) % num_steps;
+
+			sweep_random_bits(sw, bits, k - 1, step * opts->step,
+					  opts->step);
+			sweep_random_bits(sw, &bits[k - 1], 1,
+					  info->writesize + SWEEP_BBM_BYTES,
+					  info->oobsize - SWEEP_BBM_BYTES);
+			if (!sweep_add_pattern(sw, SWEEP_MIXED, k, bits))
+				return false;
+		}
+	}
+
+	return true;
+}
+
+/* writes the patterns [first, first + cnt) into 'block' and checks
+ * them */
+static void sweep_batch(struct mtd_dev *mtd, struct sweep *sw,
+			unsigned int block, unsigned int first,
+			unsigned int cnt, struct page_buf *err,
+			struct page_buf *rd)
+{
+	struct mtd_info_user const	*info = &mtd->info;
+	unsigned int			page = block * mtd_pages_per_block(mtd);
+	unsigned int			i;
+	unsigned int			j;
+
+	for (i = 0; i < cnt; ++i) {
+		unsigned int	p = first + i;
+
+		page_copy(err, i, sw->ref, 1, info);
+
+		for (j = sw->pattern_ofs[p]; j < sw->pattern_ofs[p + 1]; ++j)
+			page_toggle_bit(err, i, &sw->bits[j], info);
+	}
+
+	if (!mtd_erase(mtd, block, 1) ||
+	    !mtd_write_pages(mtd, page, cnt, err->data, err->oob, MTD_IO_RAW)) {
+		memset(&sw->status[first], SWEEP_IOERR, cnt);
+		return;
+	}
+
+	for (i = 0; i < cnt; ++i) {
+		struct mtd_ecc_stats	delta;
+		enum sweep_status	st;
+
+		if (!read_page(mtd, page + i, rd, 0, MTD_IO_ECC, &delta))
+			st = SWEEP_IOERR;
+		else if (bitdiff(rd->data, sw->ref->data, info->writesize) == 0)
+			st = SWEEP_OK;
+		else
+			st = delta.failed > 0 ? SWEEP_DETECTED : SWEEP_SILENT;
+
+		sw->status[first + i] = st;
+	}
+}
+
+/* processes every 'jobs'th batch, starting with 'job', on the blocks
+ * owned by this job */
+static bool sweep_worker(struct mtd_dev *mtd, struct sweep *sw,
+			 unsigned int job)
+{
+	struct mtd_info_user const	*info = &mtd->info;
+	unsigned int			ppb = mtd_pages_per_block(mtd);
+	unsigned int			num_batches = (sw->num_patterns + ppb - 1) / ppb;
+	struct page_buf			err = { NULL, NULL };
+	struct page_buf			rd = { NULL, NULL };
+	unsigned int			blk = job;
+	unsigned int			b;
+	bool				rc = false;
+
+	if (!page_buf_alloc(&err, ppb, info) ||
+	    !page_buf_alloc(&rd, 1, info))
+		goto out;
+
+	for (b = job; b < num_batches; b += sw->jobs) {
+		unsigned int	first = b * ppb;
+		unsigned int	cnt = sw->num_patterns - first;
+
+		if (cnt > ppb)
+			cnt = ppb;
+
+		sweep_batch(mtd, sw, sw->blocks[blk], first, cnt, &err, &rd);
+
+		blk += sw->jobs;
+		if (blk >= sw->num_blocks)
+			blk = job;
+	}
+
+	rc = true;
+
+out:
+	page_buf_free(&rd);
+	page_buf_free(&err);
+
+	return rc;
+}
+
+static bool sweep_run(struct mtd_dev *mtd, struct sweep *sw)
+{
+	pid_t		pids[sw->jobs];
+	unsigned int	i;
+	bool		rc = true;
+
+	if (sw->jobs == 1)
+		return sweep_worker(mtd, sw, 0);
+
+	fflush(stdout);
+	fflush(stderr);
+
+	for (i = 0; i < sw->jobs; ++i) {
+		pids[i] = fork();
+
+		if (pids[i] < 0) {
+			perror("fork()");
+			rc = false;
+			break;
+		}
+
+		if (pids[i] == 0) {
+			struct mtd_dev	priv;
+			bool		ok;
+
+			/* the file mode of a MTD device is shared through
+			 * its file description; use an own one */
+			if (!mtd_open(&priv, mtd->path, O_RDWR))
+				_exit(1);
+
+			ok = sweep_worker(&priv, sw, i);
+			mtd_close(&priv);
+			_exit(ok ? 0 : 1);
+		}
+	}
+
+	while (i-- > 0) {
+		int	st;
+
+		while (waitpid(pids[i], &st, 0) < 0 && errno == EINTR)
+			;
+
+		if (!WIFEXITED(st) || WEXITSTATUS(st) != 0)
+			rc = false;
+	}
+
+	return rc;
+}
+
+static void sweep_print_bits(struct sweep const *sw, unsigned int pattern)
+{
+	unsigned int	j;
+
+	for (j = sw->pattern_ofs[pattern]; j < sw->pattern_ofs[pattern + 1]; ++j)
+		printf("%s%u:%u", j == sw->pattern_ofs[pattern] ? "" : "+",
+		       sw->bits[j].pos, sw->bits[j].bit);
+}
+
+/* prints the matrix; returns the number of failed patterns with at most
+ * 'strength' errors */
+static unsigned int sweep_report(struct sweep const *sw, int strength)
+{
+	unsigned int	num_bad = 0;
+	unsigned int	r;
+
+	printf("\n%-9s %3s %8s %8s %8s %8s %8s %8s\n", "class", "k",
+	       "patterns", "ok", "fail", "detected", "silent", "ioerr");
+
+	for (r = 0; r < sw->num_rows; ++r) {
+		struct sweep_row const	*row = &sw->rows[r];
+		unsigned int		cnt[SWEEP_IOERR + 1] = { 0 };
+		unsigned int		num_shown = 0;
+		unsigned int		i;
+
+		for (i = row->first; i < row->first + row->cnt; ++i)
+			++cnt[sw->status[i]];
+
+		printf("%-9s %3u %8u %8u %8u", SWEEP_CLASS_NAMES[row->cls],
+		       row->k, row->cnt, cnt[SWEEP_OK],
+		       cnt[SWEEP_DETECTED] + cnt[SWEEP_SILENT]);
+
+		/* ECC statistics can not be attributed to single pages
+		 * when other jobs access the device concurrently */
+		if (sw->jobs == 1)
+			printf(" %8u %8u", cnt[SWEEP_DETECTED], cnt[SWEEP_SILENT]);
+		else
+			printf(" %8s %8s", "-", "-");
+
+		printf(" %8u\n", cnt[SWEEP_IOERR] + cnt[SWEEP_PENDING]);
+
+		if (strength >= 0 && row->k <= (unsigned int)strength)
+			num_bad += row->cnt - cnt[SWEEP_OK];
+
+		/* show where single bit errors are not corrected */
+		for (i = row->first; row->k == 1 && i < row->first + row->cnt; ++i) {
+			if (sw->status[i] == SWEEP_OK)
+				continue;
+
+			if (num_shown == 0)
+				printf("    failing:");
+
+			if (num_shown++ < 16) {
+				printf(" ");
+				sweep_print_bits(sw, i);
+			}
+		}
+
+		if (num_shown > 16)
+			printf(" ... (%u more)", num_shown - 16);
+		if (num_shown > 0)
+			printf("\n");
+	}
+
+	return num_bad;
+}
+
+static int run_sweep(struct mtd_dev *mtd, struct cmdline_options const *opts)
+{
+	struct mtd_info_user const	*info = &mtd->info;
+	struct page_buf			ref = { NULL, NULL };
+	struct sweep			sw = {
+		.info	= info,
+		.ref	= &ref,
+		.rng	= opts->seed ? opts->seed : 1,
+		.status	= MAP_FAILED,
+	};
+	unsigned int			i;
+	int				rc = EX_SOFTWARE;
+
+	if (opts->step == 0 || info->writesize % opts->step != 0 ||
+	    opts->max_errors == 0 || info->oobsize <= SWEEP_BBM_BYTES) {
+		fprintf(stderr, "invalid ECC step size or number of errors\n");
+		return EX_USAGE;
+	}
+
+	/* the k bits of a pattern are distinct bits of one ECC step */
+	if (opts->max_errors > opts->step * 8) {
+		fprintf(stderr,
+			"'--max-errors' %u exceeds the %u bits of an ECC step\n",
+			opts->max_errors, opts->step * 8);
+		return EX_USAGE;
+	}
+
+	sw.blocks = calloc(mtd_num_blocks(mtd), sizeof sw.blocks[0]);
+	if (!sw.blocks || !page_buf_alloc(&ref, 2, info))
+		goto out;
+
+	/* the patterns go into the good blocks after the reference block */
+	for (i = opts->block + 1; i < mtd_num_blocks(mtd); ++i) {
+		int	bad;
+
+		if (opts->blocks && sw.num_blocks == opts->blocks)
+			break;
+
+		bad = mtd_is_bad(mtd, i);
+		if (bad < 0) {
+			rc = EX_IOERR;
+			goto out;
+		} else if (!bad) {
+			sw.blocks[sw.num_blocks++] = i;
+		}
+	}
+
+	if (sw.num_blocks == 0) {
+		fprintf(stderr, "%s: no good eraseblocks for the patterns\n",
+			mtd->path);
+		rc = EX_UNAVAILABLE;
+		goto out;
+	}
+
+	sw.jobs = opts->jobs;
+	if (sw.jobs == 0)
+		sw.jobs = 1;
+	if (sw.jobs > sw.num_blocks)
+		sw.jobs = sw.num_blocks;
+
+	if (!sweep_generate(&sw, opts))
+		goto out;
+
+	sw.status = mmap(NULL, sw.num_patterns, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (sw.status == MAP_FAILED) {
+		perror("mmap()");
+		goto out;
+	}
+
+	rc = EX_IOERR;
+
+	if (!write_reference(mtd, opts, opts->block, 1, &ref))
+		goto out;
+
+	printf("sweeping %u patterns over %u eraseblocks with %u jobs...",
+	       sw.num_patterns, sw.num_blocks, sw.jobs);
+	if (!result(sweep_run(mtd, &sw)))
+		goto out;
+
+	i = sweep_report(&sw, opts->strength);
+	rc = i > 0xff ? 0xff : i;
+
+out:
+	if (sw.status != MAP_FAILED)
+		munmap(sw.status, sw.num_patterns);
+
+	page_buf_free(&ref);
+	free(sw.rows);
+	free(sw.pattern_ofs);
+	free(sw.bits);
+	free(sw.blocks);
+
+	return rc;
+}
+/* }}} sweep mode */
+
+int main(int argc, char *argv[])
+{
+	struct cmdline_options		opts = {
+		.block = 0,
+		.step = 512,
+		.max_errors = 8,
+		.samples = 64,
+		.jobs = 1,
+		.seed = 1,
+		.strength = -1,
+	};
+	struct mtd_dev			mtd;
+	struct mtd_info_user const	*info = &mtd.info;
+	struct bitpos			*bitpos = NULL;
+	struct page_buf			ref = { NULL, NULL };
+	struct page_buf			err = { NULL, NULL };
+	struct page_buf			rd = { NULL, NULL };
+	struct mtd_ecc_stats		*ecc = NULL;
+	unsigned int			num_errors = 10;
+	unsigned int			num_bitpos;
+	unsigned int			first_page;
+	unsigned int			num_blocks;
+	unsigned int			num_failed = 0;
+	unsigned int			strength;
+	unsigned int			i;
+	int				rc = EX_SOFTWARE;
+	bool				ok = true;
+
+	while (1) {
+		int	c = getopt_long(argc, argv, "", CMDLINE_OPTIONS, 0);
+
+		if (c==-1)
+			break;
+
+		switch (c) {
+		case CMD_HELP		:  show_help();
+		case CMD_VERSION	:  show_version();
+		case CMD_BLOCK		:
+			ok = parse_uint("block", optarg, 0, UINT_MAX, &opts.block);
+			break;
+		case CMD_SWEEP		:  opts.sweep = true; break;
+		case CMD_STEP		:
+			ok = parse_uint("step", optarg, 1, UINT_MAX, &opts.step);
+			break;
+		case CMD_MAX_ERRORS	:
+			ok = parse_uint("max-errors", optarg, 1,
+					SWEEP_MAX_ERRORS, &opts.max_errors);
+			break;
+		case CMD_SAMPLES	:
+			ok = parse_uint("samples", optarg, 1,
+					SWEEP_MAX_SAMPLES, &opts.samples);
+			break;
+		case CMD_BLOCKS		:
+			ok = parse_uint("blocks", optarg, 0, UINT_MAX, &opts.blocks);
+			break;
+		case CMD_JOBS		:
+			ok = parse_uint("jobs", optarg, 1, SWEEP_MAX_JOBS, &opts.jobs);
+			break;
+		case CMD_SEED		:
+			ok = parse_ulong("seed", optarg, 0, ULONG_MAX, &opts.seed);
+			opts.has_seed = true;
+			break;
+		case CMD_STRENGTH	:
+			ok = parse_uint("strength", optarg, 0,
+					SWEEP_MAX_STRENGTH, &strength);
+			opts.strength = strength;
+			break;
+		default:
+			fprintf(stderr, "Try '--help' for more information\n");
+			return EX_USAGE;
+		}
+
+		if (!ok)
+			return EX_USAGE;
+	}
+
+	if (optind >= argc) {
+		fprintf(stderr, "missing MTD device\n");
+		return EX_USAGE;
+	}
+
+	if (!mtd_open(&mtd, argv[optind], O_RDWR))
+		return EX_NOINPUT;
+
+	if (opts.sweep) {
+		rc = run_sweep(&mtd, &opts);
+		goto out;
+	}
+
+	if (optind + 1 < argc &&
+	    !parse_uint("number of errors", argv[optind + 1], 1, UINT_MAX,
+			&num_errors)) {
+		rc = EX_USAGE;
+		goto out;
+	}
+
+	/* user supplied positions come before the default ones */
+	num_bitpos = argc - optind - 2;
+	if (optind + 2 > argc)
+		num_bitpos = 0;
+
+	bitpos = calloc(num_bitpos + ARRAY_SIZE(DEFAULT_BITPOS), sizeof *bitpos);
+	if (!bitpos)
+		goto out;
+
+	for (i = 0; i < num_bitpos; ++i) {
+		if (!parse_bitpos(&bitpos[i], argv[optind + 2 + i], info)) {
+			rc = EX_USAGE;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < ARRAY_SIZE(DEFAULT_BITPOS); ++i)
+		parse_bitpos(&bitpos[num_bitpos++], DEFAULT_BITPOS[i], info);
+
+	if (num_errors == 0 || num_errors > num_bitpos) {
+		fprintf(stderr, "number of errors must be between 1 and %u\n",
+			num_bitpos);
+		rc = EX_USAGE;
+		goto out;
+	}
+
+	first_page = opts.block * mtd_pages_per_block(&mtd);
+	num_blocks = (num_errors + 1 + mtd_pages_per_block(&mtd) - 1) /
+		mtd_pages_per_block(&mtd);
+
+	if (opts.block + num_blocks > mtd_num_blocks(&mtd)) {
+		fprintf(stderr, "%s: test area exceeds the device\n", mtd.path);
+		rc = EX_USAGE;
+		goto out;
+	}
+
+	for (i = 0; i < num_blocks; ++i) {
+		int	bad = mtd_is_bad(&mtd, opts.block + i);
+
+		if (bad < 0) {
+			rc = EX_IOERR;
+			goto out;
+		} else if (bad) {
+			fprintf(stderr, "%s: eraseblock %u is bad; use --block\n",
+				mtd.path, opts.block + i);
+			rc = EX_UNAVAILABLE;
+			goto out;
+		}
+	}
+
+	ecc = calloc(num_errors, sizeof *ecc);
+	if (!ecc ||
+	    !page_buf_alloc(&ref, 2, info) ||
+	    !page_buf_alloc(&err, num_errors, info) ||
+	    !page_buf_alloc(&rd, num_errors, info))
+		goto out;
+
+	rc = EX_IOERR;
+
+	if (!write_reference(&mtd, &opts, opts.block, num_blocks, &ref))
+		goto out;
+
+	printf("preparing bit error pages...");
+	for (i = 0; i < num_errors; ++i) {
+		printf(" %u(%u:%u)", i + 1, bitpos[i].pos, bitpos[i].bit);
+
+		if (i == 0)
+			page_copy(&err, 0, &ref, 1, info);
+		else
+			page_copy(&err, i, &err, i - 1, info);
+
+		page_toggle_bit(&err, i, &bitpos[i], info);
+	}
+	result(true);
+
+	/* all error pages are consecutive; write them at once */
+	printf("writing bit error pages...");
+	if (!result(mtd_write_pages(&mtd, first_page + 1, num_errors,
+				    err.data, err.oob, MTD_IO_RAW)))
+		goto out;
+
+	printf("reading back pages...\n");
+	for (i = 0; i < num_errors; ++i) {
+		printf("  #%u", i + 1);
+
+		if (!result(read_page(&mtd, first_page + 1 + i, &rd, i,
+				      MTD_IO_ECC, &ecc[i])))
+			goto out;
+	}
+
+	printf("checking read pages...\n");
+	for (i = 0; i < num_errors; ++i) {
+		unsigned int	flips = page_bitflips(&rd, i, &ref, 1, info);
+
+		printf("  #%u (corrected %u, failed %u, %u bitflips left)",
+		       i + 1, ecc[i].corrected, ecc[i].failed, flips);
+
+		if (!result(flips == 0))
+			++num_failed;
+	}
+
+	rc = num_failed > 0xff ? 0xff : num_failed;
+
+out:
+	page_buf_free(&rd);
+	page_buf_free(&err);
+	page_buf_free(&ref);
+	free(ecc);
+	free(bitpos);
+	mtd_close(&mtd);
+
+	return rc;
+}
@@ -0,0 +1,611 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nandsim.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ecc.h"
+#include "mtd.h"
+
+struct nandsim {
+	struct nandsim_hdr	*hdr;
+	unsigned char		*pages;
+	size_t			map_size;
+	bool			is_writable;
+	bool			is_mapped_rw;	/* counters can be updated */
+
+	struct ecc		ecc;
+	unsigned int		ecc_steps;
+	unsigned int		ecc_ofs;	/* within OOB */
+
+	uint32_t		flip_thresh;	/* rate * 2^32 */
+	uint64_t		rng;
+
+	unsigned char		*page_buf;
+	char			*spec;
+};
+
+struct nandsim_cfg {
+	char const		*image;
+
+	unsigned int		writesize;
+	unsigned int		oobsize;
+	unsigned int		pages_per_block;
+	unsigned int		num_blocks;
+	unsigned int		ecc_step;
+	enum ecc_type		ecc_type;
+	unsigned int		ecc_strength;
+
+	char const		*bad;
+	double			flip_rate;
+	uint64_t		seed;
+};
+
+static struct mtd_ops const	NANDSIM_OPS;
+
+static inline struct nandsim *to_sim(struct mtd_dev const *mtd)
+{
+	return mtd->priv;
+}
+
+static inline size_t nandsim_page_size(struct nandsim_hdr const *hdr)
+{
+	return hdr->writesize + hdr->oobsize;
+}
+
+static unsigned char *nandsim_page(struct nandsim const *sim,
+				   unsigned int page)
+{
+	return sim->pages + (size_t)page * nandsim_page_size(sim->hdr);
+}
+
+/* {{{ specification parser */
+static bool nandsim_parse_uint(char const *key, char const *val,
+			       unsigned int *res)
+{
+	char	*end;
+
+	*res = strtoul(val, &end, 0);
+	if (*val == '\0' || *end != '\0') {
+		fprintf(stderr, "nandsim: bad value '%s' for '%s'\n", val, key);
+		return false;
+	}
+
+	return true;
+}
+
+static bool nandsim_parse(struct nandsim_cfg *cfg, char *spec)
+{
+	char	*opts = strchr(spec, ':');
+	char	*tok;
+
+	*cfg = (struct nandsim_cfg) {
+		.image		= spec,
+		.writesize	= 2048,
+		.oobsize	= 64,
+		.pages_per_block = 64,
+		.num_blocks	= 64,
+		.ecc_step	= 512,
+		.ecc_type	= ECC_BCH,
+		.ecc_strength	= 4,
+		.seed		= 1,
+	};
+
+	if (opts)
+		*opts++ = '\0';
+
+	while (opts && (tok = strsep(&opts, ",")) != NULL) {
+		char	*val = strchr(tok, '=');
+		bool	ok;
+
+		if (*tok == '\0')
+			continue;
+
+		if (!val) {
+			fprintf(stderr, "nandsim: missing value for '%s'\n", tok);
+			return false;
+		}
+
+		*val++ = '\0';
+
+		if (strcmp(tok, "page") == 0)
+			ok = nandsim_parse_uint(tok, val, &cfg->writesize);
+		else if (strcmp(tok, "oob") == 0)
+			ok = nandsim_parse_uint(tok, val, &cfg->oobsize);
+		else if (strcmp(tok, "ppb") == 0)
+			ok = nandsim_parse_uint(tok, val, &cfg->pages_per_block);
+		else if (strcmp(tok, "blocks") == 0)
+			ok = nandsim_parse_uint(tok, val, &cfg->num_blocks);
+		else if (strcmp(tok, "step") == 0)
+			ok = nandsim_parse_uint(tok, val, &cfg->ecc_step);
+		else if (strcmp(tok, "ecc") == 0)
+			ok = ecc_parse(val, &cfg->ecc_type, &cfg->ecc_strength);
+		else if (strcmp(tok, "bad") == 0)
+			ok = (cfg->bad = val, true);
+		else if (strcmp(tok, "flips") == 0)
+			ok = (cfg->flip_rate = strtod(val, NULL)) >= 0;
+		else if (strcmp(tok, "seed") == 0)
+			ok = (cfg->seed = strtoull(val, NULL, 0), true);
+		else {
+			fprintf(stderr, "nandsim: unknown option '%s'\n", tok);
+			ok = false;
+		}
+
+		if (!ok)
+			return false;
+	}
+
+	return true;
+}
+/* }}} specification parser */
+
+static bool nandsim_create(int fd, struct nandsim_cfg const *cfg)
+{
+	struct nandsim_hdr	hdr = {
+		.magic		= NANDSIM_MAGIC,
+		.writesize	= cfg->writesize,
+		.oobsize	= cfg->oobsize,
+		.pages_per_block = cfg->pages_per_block,
+		.num_blocks	= cfg->num_blocks,
+		.ecc_type	= cfg->ecc_type,
+		.ecc_strength	= cfg->ecc_strength,
+		.ecc_step	= cfg->ecc_step,
+	};
+	size_t			size = ((size_t)cfg->num_blocks *
+					cfg->pages_per_block *
+					nandsim_page_size(&hdr));
+	unsigned char		*map;
+
+	if (cfg->writesize == 0 || cfg->pages_per_block == 0 ||
+	    cfg->num_blocks == 0 || cfg->ecc_step == 0 ||
+	    cfg->writesize % cfg->ecc_step != 0) {
+		fprintf(stderr, "nandsim: invalid geometry\n");
+		return false;
+	}
+
+	if (ftruncate(fd, NANDSIM_HDR_SIZE + size) < 0) {
+		perror("nandsim: ftruncate()");
+		return false;
+	}
+
+	map = mmap(NULL, NANDSIM_HDR_SIZE + size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		perror("nandsim: mmap()");
+		return false;
+	}
+
+	/* a new chip is erased; the header is written last so that an
+	 * interrupted creation is detected */
+	memset(map + NANDSIM_HDR_SIZE, 0xff, size);
+	memcpy(map, &hdr, sizeof hdr);
+	munmap(map, NANDSIM_HDR_SIZE + size);
+
+	return true;
+}
+
+static bool nandsim_mark_bad(struct nandsim *sim, char const *list)
+{
+	char	*tmp = strdupa(list);
+	char	*tok;
+
+	while ((tok = strsep(&tmp, "+")) != NULL) {
+		unsigned int	block;
+
+		if (!nandsim_parse_uint("bad", tok, &block))
+			return false;
+
+		if (block >= sim->hdr->num_blocks || !sim->is_writable) {
+			fprintf(stderr, "nandsim: can not mark block %u as bad\n",
+				block);
+			return false;
+		}
+
+		nandsim_page(sim, block * sim->hdr->pages_per_block)
+			[sim->hdr->writesize] = 0x00;
+	}
+
+	return true;
+}
+
+static bool nandsim_setup(struct mtd_dev *mtd, struct nandsim *sim,
+			  struct nandsim_cfg const *cfg, int flags)
+{
+	struct nandsim_hdr	hdr;
+	struct stat		st;
+	int			prot = PROT_READ;
+
+	bool			want_write = (flags & O_ACCMODE) != O_RDONLY;
+
+	/* the ECC counters are updated by reads too; images are created
+	 * only when opened for writing so that readers (e.g. 'runtest
+	 * --mtd') do not leave empty chips behind on typos */
+	mtd->fd = open(cfg->image,
+		       O_RDWR | O_CLOEXEC | (want_write ? O_CREAT : 0), 0666);
+	sim->is_writable = mtd->fd >= 0 && want_write;
+
+	if (mtd->fd < 0 && errno == EACCES)
+		mtd->fd = open(cfg->image, O_RDONLY | O_CLOEXEC);
+
+	if (mtd->fd < 0) {
+		fprintf(stderr, "open(%s): %s\n", cfg->image, strerror(errno));
+		return false;
+	}
+
+	if (fstat(mtd->fd, &st) < 0) {
+		perror("nandsim: fstat()");
+		return false;
+	}
+
+	if (st.st_size == 0 && sim->is_writable &&
+	    !nandsim_create(mtd->fd, cfg))
+		return false;
+
+	if (pread(mtd->fd, &hdr, sizeof hdr, 0) != sizeof hdr ||
+	    memcmp(hdr.magic, NANDSIM_MAGIC, sizeof hdr.magic) != 0) {
+		fprintf(stderr, "%s: not a nandsim image\n", cfg->image);
+		return false;
+	}
+
+	sim->map_size = (NANDSIM_HDR_SIZE + (size_t)hdr.num_blocks *
+			 hdr.pages_per_block * nandsim_page_size(&hdr));
+
+	if (fstat(mtd->fd, &st) < 0 || (size_t)st.st_size != sim->map_size) {
+		fprintf(stderr, "%s: image size does not match its geometry\n",
+			cfg->image);
+		return false;
+	}
+
+	sim->is_mapped_rw = (fcntl(mtd->fd, F_GETFL) & O_ACCMODE) == O_RDWR;
+	if (sim->is_mapped_rw)
+		prot |= PROT_WRITE;
+
+	sim->hdr = mmap(NULL, sim->map_size, prot, MAP_SHARED, mtd->fd, 0);
+	if (sim->hdr == MAP_FAILED) {
+		sim->hdr = NULL;
+		perror("nandsim: mmap()");
+		return false;
+	}
+
+	sim->pages = (unsigned char *)sim->hdr + NANDSIM_HDR_SIZE;
+
+	if (!ecc_init(&sim->ecc, hdr.ecc_type, hdr.ecc_step, hdr.ecc_strength))
+		return false;
+
+	sim->ecc_steps = hdr.writesize / hdr.ecc_step;
+	if (sim->ecc_steps * sim->ecc.bytes + 2 > hdr.oobsize) {
+		fprintf(stderr, "%s: ECC does not fit into OOB\n", cfg->image);
+		return false;
+	}
+
+	sim->ecc_ofs = hdr.oobsize - sim->ecc_steps * sim->ecc.bytes;
+
+	sim->page_buf = malloc(nandsim_page_size(&hdr));
+	if (!sim->page_buf)
+		return false;
+
+	if (cfg->bad && !nandsim_mark_bad(sim, cfg->bad))
+		return false;
+
+	if (cfg->flip_rate >= 1)
+		sim->flip_thresh = UINT32_MAX;
+	else
+		sim->flip_thresh = cfg->flip_rate * 4294967296.0;
+
+	sim->rng = cfg->seed | 1;
+
+	mtd->info = (struct mtd_info_user) {
+		.type		= MTD_NANDFLASH,
+		.flags		= MTD_CAP_NANDFLASH,
+		.size		= hdr.num_blocks * hdr.pages_per_block * hdr.writesize,
+		.erasesize	= hdr.pages_per_block * hdr.writesize,
+		.writesize	= hdr.writesize,
+		.oobsize	= hdr.oobsize,
+	};
+
+	return true;
+}
+
+static void nandsim_close(struct mtd_dev *mtd)
+{
+	struct nandsim	*sim = to_sim(mtd);
+
+	if (sim->hdr)
+		munmap(sim->hdr, sim->map_size);
+
+	if (mtd->fd >= 0)
+		close(mtd->fd);
+
+	ecc_free(&sim->ecc);
+	free(sim->page_buf);
+	free(sim->spec);
+	free(sim);
+
+	mtd->priv = NULL;
+}
+
+bool nandsim_open(struct mtd_dev *mtd, char const *spec, int flags)
+{
+	struct nandsim		*sim = calloc(1, sizeof *sim);
+	struct nandsim_cfg	cfg;
+
+	*mtd = (struct mtd_dev) {
+		.path	= spec,
+		.fd	= -1,
+		.priv	= sim,
+	};
+
+	if (!sim)
+		return false;
+
+	sim->spec = strdup(spec + strlen(NANDSIM_PREFIX));
+
+	if (!sim->spec || !nandsim_parse(&cfg, sim->spec) ||
+	    !nandsim_setup(mtd, sim, &cfg, flags)) {
+		nandsim_close(mtd);
+		mtd->fd = -1;
+		return false;
+	}
+
+	mtd->ops = &NANDSIM_OPS;
+	return true;
+}
+
+static bool nandsim_check(struct mtd_dev const *mtd, char const *op,
+			  unsigned int page, unsigned int cnt, bool is_write)
+{
+	struct nandsim const	*sim = to_sim(mtd);
+	struct nandsim_hdr const *hdr = sim->hdr;
+
+	if (page + cnt < page ||
+	    page + cnt > hdr->num_blocks * hdr->pages_per_block) {
+		fprintf(stderr, "%s: %s beyond end of device\n", mtd->path, op);
+		return false;
+	}
+
+	if (is_write && !sim->is_writable) {
+		fprintf(stderr, "%s: %s on read-only device\n", mtd->path, op);
+		return false;
+	}
+
+	return true;
+}
+
+static int nandsim_is_bad(struct mtd_dev const *mtd, unsigned int block)
+{
+	struct nandsim const	*sim = to_sim(mtd);
+	unsigned int		page = block * sim->hdr->pages_per_block;
+
+	if (!nandsim_check(mtd, "MEMGETBADBLOCK", page, 1, false))
+		return -1;
+
+	return nandsim_page(sim, page)[sim->hdr->writesize] != 0xff;
+}
+
+static bool nandsim_erase(struct mtd_dev *mtd, unsigned int block,
+			  unsigned int cnt)
+{
+	struct nandsim const	*sim = to_sim(mtd);
+	unsigned int		ppb = sim->hdr->pages_per_block;
+	unsigned int		i;
+
+	if (!nandsim_check(mtd, "MEMERASE64", block * ppb, cnt * ppb, true))
+		return false;
+
+	for (i = 0; i < cnt; ++i) {
+		if (nandsim_is_bad(mtd, block + i)) {
+			fprintf(stderr, "%s: erasing bad block %u\n",
+				mtd->path, block + i);
+			return false;
+		}
+
+		memset(nandsim_page(sim, (block + i) * ppb), 0xff,
+		       ppb * nandsim_page_size(sim->hdr));
+	}
+
+	return true;
+}
+
+static bool nandsim_write_pages(struct mtd_dev *mtd, unsigned int page,
+				unsigned int cnt, void const *data,
+				void const *oob, enum mtd_io_mode mode)
+{
+	struct nandsim		*sim = to_sim(mtd);
+	unsigned int		ws = sim->hdr->writesize;
+	unsigned int		oobs = sim->hdr->oobsize;
+	unsigned char		*buf = sim->page_buf;
+	unsigned int		i;
+
+	if (!nandsim_check(mtd, "MEMWRITE", page, cnt, true))
+		return false;
+
+	for (i = 0; i < cnt; ++i) {
+		unsigned char	*dst = nandsim_page(sim, page + i);
+		unsigned int	s;
+		size_t		j;
+
+		if (nandsim_is_bad(mtd, (page + i) / sim->hdr->pages_per_block)) {
+			fprintf(stderr, "%s: writing to bad block\n", mtd->path);
+			return false;
+		}
+
+		memcpy(buf, (unsigned char const *)data + (size_t)i * ws, ws);
+
+		if (oob)
+			memcpy(buf + ws, (unsigned char const *)oob + (size_t)i * oobs,
+			       oobs);
+		else
+			memset(buf + ws, 0xff, oobs);
+
+		for (s = 0; mode == MTD_IO_ECC && s < sim->ecc_steps; ++s)
+			ecc_calculate(&sim->ecc, buf + s * sim->ecc.step,
+				      buf + ws + sim->ecc_ofs + s * sim->ecc.bytes);
+
+		/* programming can only clear bits */
+		for (j = 0; j < ws + oobs; ++j)
+			dst[j] &= buf[j];
+	}
+
+	return true;
+}
+
+static uint32_t nandsim_rand(struct nandsim *sim)
+{
+	/* xorshift64* */
+	sim->rng ^= sim->rng >> 12;
+	sim->rng ^= sim->rng << 25;
+	sim->rng ^= sim->rng >> 27;
+
+	return (sim->rng * 2685821657736338717ull) >> 32;
+}
+
+static void nandsim_inject_flips(struct nandsim *sim, unsigned char *buf,
+				 size_t len)
+{
+	size_t		i;
+
+	for (i = 0; i < len * 8; ++i) {
+		if (nandsim_rand(sim) < sim->flip_thresh)
+			buf[i / 8] ^= 1u << (i % 8);
+	}
+}
+
+static unsigned int count_zero_bits(unsigned char const *buf, size_t len)
+{
+	unsigned int	cnt = 0;
+
+	while (len-- > 0)
+		cnt += 8 - __builtin_popcount(*buf++);
+
+	return cnt;
+}
+
+/* corrects the page in 'buf' and updates the ECC statistics */
+static void nandsim_correct(struct nandsim *sim, unsigned char *buf)
+{
+	struct ecc const	*ecc = &sim->ecc;
+	unsigned int		corrected = 0;
+	unsigned int		failed = 0;
+	unsigned int		s;
+
+	if (ecc->type == ECC_NONE)
+		return;
+
+	for (s = 0; s < sim->ecc_steps; ++s) {
+		unsigned char	*data = buf + s * ecc->step;
+		unsigned char	*code = (buf + sim->hdr->writesize +
+					 sim->ecc_ofs + s * ecc->bytes);
+		unsigned int	zeros;
+		int		rc;
+
+		/* erased steps do not carry a valid ECC; bitflips in them
+		 * are corrected up to the ECC strength */
+		zeros = (count_zero_bits(data, ecc->step) +
+			 count_zero_bits(code, ecc->bytes));
+		if (zeros <= ecc->strength) {
+			memset(data, 0xff, ecc->step);
+			memset(code, 0xff, ecc->bytes);
+			corrected += zeros;
+			continue;
+		}
+
+		rc = ecc_correct(ecc, data, code);
+		if (rc < 0)
+			++failed;
+		else
+			corrected += rc;
+	}
+
+	if (!sim->is_mapped_rw)
+		return;
+
+	/* the header is shared with other processes */
+	if (corrected)
+		__atomic_add_fetch(&sim->hdr->corrected, corrected,
+				   __ATOMIC_RELAXED);
+	if (failed)
+		__atomic_add_fetch(&sim->hdr->failed, failed,
+				   __ATOMIC_RELAXED);
+}
+
+static bool nandsim_read_pages(struct mtd_dev *mtd, unsigned int page,
+			       unsigned int cnt, void *data, void *oob,
+			       enum mtd_io_mode mode)
+{
+	struct nandsim		*sim = to_sim(mtd);
+	unsigned int		ws = sim->hdr->writesize;
+	unsigned int		oobs = sim->hdr->oobsize;
+	unsigned char		*buf = sim->page_buf;
+	unsigned int		i;
+
+	if (!nandsim_check(mtd, "read", page, cnt, false))
+		return false;
+
+	for (i = 0; i < cnt; ++i) {
+		memcpy(buf, nandsim_page(sim, page + i), ws + oobs);
+
+		if (sim->flip_thresh > 0)
+			nandsim_inject_flips(sim, buf, ws + oobs);
+
+		if (mode == MTD_IO_ECC)
+			nandsim_correct(sim, buf);
+
+		if (data)
+			memcpy((unsigned char *)data + (size_t)i * ws, buf, ws);
+		if (oob)
+			memcpy((unsigned char *)oob + (size_t)i * oobs, buf + ws,
+			       oobs);
+	}
+
+	return true;
+}
+
+static bool nandsim_get_ecc_stats(struct mtd_dev const *mtd,
+				  struct mtd_ecc_stats *st)
+{
+	struct nandsim const	*sim = to_sim(mtd);
+	unsigned int		i;
+
+	*st = (struct mtd_ecc_stats) {
+		.corrected	= __atomic_load_n(&sim->hdr->corrected,
+						  __ATOMIC_RELAXED),
+		.failed		= __atomic_load_n(&sim->hdr->failed,
+						  __ATOMIC_RELAXED),
+	};
+
+	for (i = 0; i < sim->hdr->num_blocks; ++i)
+		st->badblocks += nandsim_is_bad(mtd, i) > 0;
+
+	return true;
+}
+
+static struct mtd_ops const	NANDSIM_OPS = {
+	.close		= nandsim_close,
+	.is_bad		= nandsim_is_bad,
+	.erase		= nandsim_erase,
+	.write_pages	= nandsim_write_pages,
+	.read_pages	= nandsim_read_pages,
+	.get_ecc_stats	= nandsim_get_ecc_stats,
+};
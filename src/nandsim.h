@@ -0,0 +1,77 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_TESTSUITE_SRC_NANDSIM_H
+#define H_ENSC_TESTSUITE_SRC_NANDSIM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct mtd_dev;
+
+/* File backed NAND simulator which is accessed through the mtd_xxx()
+ * functions.  The specification is
+ *
+ *   nandsim:<image>[:<option>[,<option>]*]
+ *
+ * The image is created when it does not exist and the device is opened
+ * for writing.  Options which are used only when the image is created:
+ *
+ *   page=<bytes>	page size (2048)
+ *   oob=<bytes>	OOB size (64)
+ *   ppb=<pages>	pages per eraseblock (64)
+ *   blocks=<num>	number of eraseblocks (64)
+ *   ecc=<ecc>		'none', 'hamming' or 'bch<strength>' (bch4)
+ *   step=<bytes>	ECC step size (512)
+ *
+ * Options for every open:
+ *
+ *   bad=<b>[+<b>]*	marks eraseblocks as bad
+ *   flips=<rate>	probability of a bitflip per bit and read
+ *   seed=<num>		seed for the bitflip generator
+ *
+ * The image contains a 'struct nandsim_hdr' followed by the pages; each
+ * page consists of the data and the OOB area.  The first two OOB bytes
+ * are the bad block marker and the ECC bytes are at the end of the OOB
+ * area.  Programming can only clear bits like on real NAND, and the
+ * ECCGETSTATS counters are kept in the image so that all users of an
+ * image see the same values. */
+
+#define NANDSIM_PREFIX		"nandsim:"
+
+#define NANDSIM_MAGIC		"NANDSIM1"
+#define NANDSIM_HDR_SIZE	4096
+
+struct nandsim_hdr {
+	char			magic[8];
+
+	uint32_t		writesize;
+	uint32_t		oobsize;
+	uint32_t		pages_per_block;
+	uint32_t		num_blocks;
+
+	uint32_t		ecc_type;	/* enum ecc_type */
+	uint32_t		ecc_strength;
+	uint32_t		ecc_step;
+	uint32_t		_rsrv;
+
+	uint32_t		corrected;
+	uint32_t		failed;
+};
+
+bool nandsim_open(struct mtd_dev *mtd, char const *spec, int flags);
+
+#endif	/* H_ENSC_TESTSUITE_SRC_NANDSIM_H */
@@ -0,0 +1,132 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "perfcnt.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "util.h"
+
+static struct {
+	char const	*name;
+	uint32_t	type;
+	uint64_t	config;
+	bool		needs_kernel;
+} const		PERFCNT_EVENTS[PERFCNT_NUM] = {
+	[PERFCNT_CYCLES] = {
+		"cycles",
+		PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	[PERFCNT_INSTRUCTIONS] = {
+		"instructions",
+		PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	[PERFCNT_CACHE_MISSES] = {
+		"cache_misses",
+		PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+	[PERFCNT_BRANCH_MISSES] = {
+		"branch_misses",
+		PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	[PERFCNT_CONTEXT_SWITCHES] = {
+		"context_switches",
+		PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES,
+		/* context switches happen in kernel mode only */
+		.needs_kernel = true },
+	[PERFCNT_PAGE_FAULTS] = {
+		"page_faults",
+		PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+};
+
+static int perf_event_open(struct perf_event_attr *attr, pid_t pid, int cpu,
+			   int group_fd, unsigned long flags)
+{
+	return syscall(SYS_perf_event_open, attr, pid, cpu, group_fd, flags);
+}
+
+void perfcnt_open(struct perfcnt *cnt)
+{
+	size_t		i;
+
+	for (i = 0; i < PERFCNT_NUM; ++i) {
+		struct perf_event_attr	attr = {
+			.size		= sizeof attr,
+			.type		= PERFCNT_EVENTS[i].type,
+			.config		= PERFCNT_EVENTS[i].config,
+			.read_format	= (PERF_FORMAT_TOTAL_TIME_ENABLED |
+					   PERF_FORMAT_TOTAL_TIME_RUNNING),
+			.disabled	= 1,
+			.inherit	= 1,
+			.enable_on_exec	= 1,
+			.exclude_hv	= 1,
+		};
+
+		/* groups can not be read with 'inherit'; open the counters
+		 * independently */
+		cnt->fd[i] = perf_event_open(&attr, 0, -1, -1,
+					     PERF_FLAG_FD_CLOEXEC);
+
+		if (cnt->fd[i] < 0 && errno == EACCES &&
+		    !PERFCNT_EVENTS[i].needs_kernel) {
+			/* perf_event_paranoid=2 allows user space counting
+			 * only */
+			attr.exclude_kernel = 1;
+			cnt->fd[i] = perf_event_open(&attr, 0, -1, -1,
+						     PERF_FLAG_FD_CLOEXEC);
+		}
+
+		cnt->value[i] = 0;
+		cnt->is_valid[i] = false;
+	}
+}
+
+void perfcnt_read(struct perfcnt *cnt)
+{
+	size_t		i;
+
+	for (i = 0; i < PERFCNT_NUM; ++i) {
+		uint64_t	v[3];	/* value, enabled, running */
+
+		if (cnt->fd[i] < 0)
+			continue;
+
+		if (read(cnt->fd[i], v, sizeof v) != sizeof v)
+			continue;
+
+		/* scale when the PMU was multiplexed between events */
+		if (v[2] > 0 && v[2] < v[1])
+			v[0] = (double)v[0] * v[1] / v[2];
+
+		cnt->value[i] = v[0];
+		cnt->is_valid[i] = true;
+	}
+}
+
+void perfcnt_close(struct perfcnt *cnt)
+{
+	size_t		i;
+
+	for (i = 0; i < PERFCNT_NUM; ++i) {
+		xclose(cnt->fd[i]);
+		cnt->fd[i] = -1;
+	}
+}
+
+char const *perfcnt_name(enum perfcnt_id id)
+{
+	return PERFCNT_EVENTS[id].name;
+}
@@ -0,0 +1,51 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_TESTSUITE_SRC_PERFCNT_H
+#define H_ENSC_TESTSUITE_SRC_PERFCNT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+enum perfcnt_id {
+	PERFCNT_CYCLES,
+	PERFCNT_INSTRUCTIONS,
+	PERFCNT_CACHE_MISSES,
+	PERFCNT_BRANCH_MISSES,
+	PERFCNT_CONTEXT_SWITCHES,
+	PERFCNT_PAGE_FAULTS,
+
+	PERFCNT_NUM,
+};
+
+struct perfcnt {
+	int			fd[PERFCNT_NUM];
+	uint64_t		value[PERFCNT_NUM];
+	bool			is_valid[PERFCNT_NUM];
+};
+
+/* Opens the counters on the calling process with 'inherit' and
+ * 'enable_on_exec' set; they start counting when a child forked
+ * afterwards calls exec() and the values of exited children are
+ * accumulated.  Counters which can not be opened (missing PMU,
+ * perf_event_paranoid) are silently marked as invalid. */
+void perfcnt_open(struct perfcnt *cnt);
+void perfcnt_read(struct perfcnt *cnt);
+void perfcnt_close(struct perfcnt *cnt);
+
+char const *perfcnt_name(enum perfcnt_id id);
+
+#endif	/* H_ENSC_TESTSUITE_SRC_PERFCNT_H */
@@ -14,14 +14,26 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/* Writes a string to a character device and reads the answer.  With
+ * '--bench', round trips over a loopback are timed instead. */
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
 #include <string.h>
 #include <sysexits.h>
+#include <termios.h>
 #include <unistd.h>
 #include <fcntl.h>
 
+#include <sys/wait.h>
+
+#include "lathist.h"
+#include "util.h"
+
 static int read_all(int fd, void *data, size_t len)
 {
 	char		*ptr = data;
@@ -44,41 +56,684 @@ static int read_all(int fd, void *data, size_t len)
 	return len;
 }
 
-int main(int argc, char *argv[])
+/* {{{ cli options */
+#define CMD_HELP		0x8000
+#define CMD_VERSION		0x8001
+#define CMD_BENCH		0x8002
+#define CMD_SELF_TEST		0x8003
+#define CMD_ITERATIONS		0x8004
+#define CMD_WARMUP		0x8005
+#define CMD_SIZE		0x8006
+#define CMD_TIMEOUT		0x8007
+#define CMD_HISTOGRAM		0x8008
+#define CMD_MAX_P99		0x8009
+#define CMD_STREAM		0x800a
+#define CMD_CHUNK		0x800b
+#define CMD_SEED		0x800c
+
+static struct option const	CMDLINE_OPTIONS[] = {
+  { "help",        no_argument,        0, CMD_HELP },
+  { "version",     no_argument,        0, CMD_VERSION },
+  { "bench",       no_argument,        0, CMD_BENCH },
+  { "self-test",   no_argument,        0, CMD_SELF_TEST },
+  { "iterations",  required_argument,  0, CMD_ITERATIONS },
+  { "warmup",      required_argument,  0, CMD_WARMUP },
+  { "size",        required_argument,  0, CMD_SIZE },
+  { "timeout",     required_argument,  0, CMD_TIMEOUT },
+  { "histogram",   no_argument,        0, CMD_HISTOGRAM },
+  { "max-p99",     required_argument,  0, CMD_MAX_P99 },
+  { "stream",      required_argument,  0, CMD_STREAM },
+  { "chunk",       required_argument,  0, CMD_CHUNK },
+  { "seed",        required_argument,  0, CMD_SEED },
+  { 0,0,0,0 }
+};
+
+struct cmdline_options {
+	bool		self_test;
+	unsigned int	iterations;
+	unsigned int	warmup;
+	char const	*sizes;
+	unsigned int	timeout_ms;
+	bool		histogram;
+	double		max_p99_us;	/* 0 means no limit */
+
+	/* stream mode */
+	unsigned long long	stream_bytes;
+	size_t		chunk;
+	uint64_t	seed;
+};
+/* }}} cli options */
+
+static void show_help(void) __attribute__((__noreturn__));
+static void show_help(void)
+{
+	printf("Usage: read-write <device> <data> <read-len>\n"
+	       "       read-write --bench [--iterations <num>] [--warmup <num>]\n"
+	       "         [--size <bytes>[,<bytes>]*] [--timeout <ms>] [--histogram]\n"
+	       "         [--max-p99 <us>] <device>|--self-test\n"
+	       "       read-write --stream <bytes> [--chunk <bytes>] [--seed <num>]\n"
+	       "         [--timeout <ms>] <device>|--self-test\n"
+	       "\n"
+	       "The benchmark writes the payload and waits until the same data were\n"
+	       "read back; the device must be a loopback (e.g. a UART with RX and TX\n"
+	       "connected).  '--self-test' uses a pty pair with an echo process.\n"
+	       "The stream mode sends a generated pattern while it verifies the data\n"
+	       "read back, with buffers of '--chunk' bytes.\n");
+	exit(0);
+}
+
+static void show_version(void) __attribute__((__noreturn__));
+static void show_version(void)
+{
+	/* \todo */
+	exit(0);
+}
+
+/* copies everything read from 'fd' back; used as the remote side of the
+ * self-test */
+static void run_echo(int fd) __attribute__((__noreturn__));
+static void run_echo(int fd)
+{
+	char	buf[4096];
+
+	for (;;) {
+		ssize_t	l = read(fd, buf, sizeof buf);
+
+		if (l < 0 && errno == EINTR)
+			continue;
+		if (l <= 0)
+			/* EIO when the slave side has been closed */
+			_exit(0);
+
+		if (!write_all(fd, buf, l))
+			_exit(1);
+	}
+}
+
+static int open_self_test(pid_t *echo_pid)
+{
+	int	master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+	int	fd = -1;
+
+	if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0) {
+		perror("posix_openpt()");
+		goto err;
+	}
+
+	fd = open(ptsname(master), O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if (fd < 0) {
+		perror("open(<pts>)");
+		goto err;
+	}
+
+	*echo_pid = fork();
+	if (*echo_pid < 0) {
+		perror("fork()");
+		goto err;
+	}
+
+	if (*echo_pid == 0) {
+		close(fd);
+		run_echo(master);
+	}
+
+	close(master);
+	return fd;
+
+err:
+	xclose(fd);
+	xclose(master);
+	return -1;
+}
+
+/* the loopback device of the benchmark and stream modes */
+struct device {
+	int		fd;
+	pid_t		echo_pid;	/* -1 unless '--self-test' */
+
+	bool		is_tty;
+	struct termios	tios_orig;
+};
+
+static bool device_open(struct device *dev, char const *path,
+			bool self_test)
+{
+	*dev = (struct device) {
+		.fd		= -1,
+		.echo_pid	= -1,
+	};
+
+	if (self_test)
+		dev->fd = open_self_test(&dev->echo_pid);
+	else
+		dev->fd = open(path, O_RDWR | O_NOCTTY | O_CLOEXEC);
+
+	if (dev->fd < 0) {
+		if (!self_test)
+			fprintf(stderr, "open(%s): %s\n", path, strerror(errno));
+		return false;
+	}
+
+	if (fcntl(dev->fd, F_SETFL, fcntl(dev->fd, F_GETFL) | O_NONBLOCK) < 0) {
+		perror("fcntl(O_NONBLOCK)");
+		return false;
+	}
+
+	/* the line discipline must not echo or translate the payload */
+	dev->is_tty = tcgetattr(dev->fd, &dev->tios_orig) == 0;
+	if (dev->is_tty) {
+		struct termios	tios = dev->tios_orig;
+
+		cfmakeraw(&tios);
+		tcsetattr(dev->fd, TCSANOW, &tios);
+		tcflush(dev->fd, TCIOFLUSH);
+	}
+
+	return true;
+}
+
+static void device_close(struct device *dev)
+{
+	if (dev->is_tty)
+		tcsetattr(dev->fd, TCSANOW, &dev->tios_orig);
+
+	xclose(dev->fd);
+
+	if (dev->echo_pid > 0) {
+		kill(dev->echo_pid, SIGTERM);
+		waitpid(dev->echo_pid, NULL, 0);
+	}
+}
+
+/* transfers 'len' bytes in both directions; the write is interleaved
+ * with the reads so that payloads larger than the device buffers do
+ * not deadlock */
+static bool round_trip(int fd, void const *tx, void *rx, size_t len,
+		       int timeout_ms)
+{
+	size_t	tx_pos = 0;
+	size_t	rx_pos = 0;
+
+	while (rx_pos < len) {
+		struct pollfd	pfd = {
+			.fd	= fd,
+			.events	= POLLIN | (tx_pos < len ? POLLOUT : 0),
+		};
+		int		rc = poll(&pfd, 1, timeout_ms);
+		ssize_t		l;
+
+		if (rc < 0 && errno == EINTR)
+			continue;
+
+		if (rc < 0) {
+			perror("poll()");
+			return false;
+		}
+
+		if (rc == 0) {
+			fprintf(stderr, "timeout after %zu/%zu bytes sent, %zu received\n",
+				tx_pos, len, rx_pos);
+			return false;
+		}
+
+		if (pfd.revents & POLLOUT) {
+			l = write(fd, tx + tx_pos, len - tx_pos);
+			if (l < 0 && errno != EAGAIN && errno != EINTR) {
+				perror("write()");
+				return false;
+			}
+			if (l > 0)
+				tx_pos += l;
+		}
+
+		if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+			l = read(fd, rx + rx_pos, len - rx_pos);
+			if (l < 0 && errno != EAGAIN && errno != EINTR) {
+				perror("read()");
+				return false;
+			}
+			if (l == 0) {
+				fprintf(stderr, "unexpected EOF\n");
+				return false;
+			}
+			if (l > 0)
+				rx_pos += l;
+		}
+	}
+
+	return true;
+}
+
+static bool bench_size(int fd, size_t size, struct cmdline_options const *opts)
+{
+	unsigned char	*tx = malloc(size);
+	unsigned char	*rx = malloc(size);
+	struct lat_hist	*hist = malloc(sizeof *hist);
+	uint64_t	t_total = 0;
+	unsigned int	i;
+	bool		rc = false;
+
+	if (!tx || !rx || !hist) {
+		fprintf(stderr, "failed to allocate buffers\n");
+		goto out;
+	}
+
+	lat_hist_init(hist);
+
+	for (i = 0; i < opts->warmup + opts->iterations; ++i) {
+		uint64_t	t0;
+		uint64_t	dt;
+		size_t		j;
+
+		/* a different pattern per iteration detects stale data */
+		for (j = 0; j < size; ++j)
+			tx[j] = i + j * 7;
+
+		t0 = monotonic_ns();
+		if (!round_trip(fd, tx, rx, size, opts->timeout_ms))
+			goto out;
+		dt = monotonic_ns() - t0;
+
+		if (memcmp(tx, rx, size) != 0) {
+			fprintf(stderr, "data mismatch in iteration %u\n", i);
+			goto out;
+		}
+
+		if (i < opts->warmup)
+			continue;
+
+		lat_hist_add(hist, dt);
+		t_total += dt;
+	}
+
+	printf("%8zu %8u %10.1f %10.1f %10.1f %10.1f %10.1f %10.3f\n",
+	       size, opts->iterations,
+	       hist->min / 1e3,
+	       lat_hist_percentile(hist, 50) / 1e3,
+	       lat_hist_percentile(hist, 99) / 1e3,
+	       lat_hist_percentile(hist, 99.9) / 1e3,
+	       hist->max / 1e3,
+	       (double)size * opts->iterations / (1 << 20) /
+	       (t_total / 1e9 + 1e-9));
+
+	if (opts->histogram)
+		lat_hist_print(hist, stdout, "    ");
+
+	rc = true;
+
+	if (opts->max_p99_us > 0 &&
+	    lat_hist_percentile(hist, 99) / 1e3 > opts->max_p99_us) {
+		fprintf(stderr, "p99 latency of %zu byte round trips exceeds %.1f us\n",
+			size, opts->max_p99_us);
+		rc = false;
+	}
+
+out:
+	free(hist);
+	free(rx);
+	free(tx);
+
+	return rc;
+}
+
+static int run_bench(char const *path, struct cmdline_options const *opts)
 {
-	int	fd = open(argv[1], O_RDWR|O_NOCTTY);
+	struct device	dev;
+	char		*sizes = NULL;
+	char		*ptr;
+	char		*tok;
+	int		rc = EX_OK;
+
+	if (!device_open(&dev, path, opts->self_test)) {
+		rc = EX_OSERR;
+		goto out;
+	}
+
+	printf("%8s %8s %10s %10s %10s %10s %10s %10s\n", "size", "iter",
+	       "min[us]", "p50[us]", "p99[us]", "p999[us]", "max[us]", "MiB/s");
+
+	sizes = strdup(opts->sizes);
+	ptr = sizes;
+	while (ptr && (tok = strsep(&ptr, ",")) != NULL) {
+		size_t	size = strtoul(tok, NULL, 0);
+
+		if (size == 0) {
+			fprintf(stderr, "invalid payload size '%s'\n", tok);
+			rc = EX_USAGE;
+			break;
+		}
+
+		if (!bench_size(dev.fd, size, opts)) {
+			rc = EX_IOERR;
+			break;
+		}
+	}
+
+out:
+	free(sizes);
+	device_close(&dev);
+
+	return rc;
+}
+
+/* {{{ stream mode */
+static uint64_t splitmix64(uint64_t x)
+{
+	x += 0x9e3779b97f4a7c15ull;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+
+	return x ^ (x >> 31);
+}
+
+/* The stream byte at offset 'ofs' depends only on the seed and the
+ * offset, so that both directions can generate it independently. */
+static void stream_pattern(unsigned char *buf, uint64_t ofs, size_t len,
+			   uint64_t seed)
+{
+	while (len > 0) {
+		uint64_t	v = splitmix64(seed ^ (ofs / 8));
+		unsigned int	i;
+
+		for (i = ofs % 8; i < 8 && len > 0; ++i, --len, ++ofs)
+			*buf++ = v >> (i * 8);
+	}
+}
+
+struct stream_state {
+	uint64_t	total;
+	uint64_t	tx_pos;
+	uint64_t	rx_pos;
+
+	/* 'tx_buf' holds the stream at [tx_buf_ofs, tx_buf_ofs + tx_buf_len) */
+	unsigned char	*tx_buf;
+	uint64_t	tx_buf_ofs;
+	size_t		tx_buf_len;
+
+	unsigned char	*rx_buf;
+	unsigned char	*rx_expect;
+
+	uint64_t	num_mismatch;
+	uint64_t	first_mismatch;
+};
+
+static bool stream_write(int fd, struct stream_state *st, size_t chunk,
+			 uint64_t seed)
+{
+	ssize_t		l;
+
+	if (st->tx_pos == st->tx_buf_ofs + st->tx_buf_len) {
+		st->tx_buf_ofs = st->tx_pos;
+		st->tx_buf_len = chunk;
+		if (st->total - st->tx_pos < chunk)
+			st->tx_buf_len = st->total - st->tx_pos;
+
+		stream_pattern(st->tx_buf, st->tx_buf_ofs, st->tx_buf_len, seed);
+	}
+
+	l = write(fd, st->tx_buf + (st->tx_pos - st->tx_buf_ofs),
+		  st->tx_buf_ofs + st->tx_buf_len - st->tx_pos);
+	if (l < 0 && errno != EAGAIN && errno != EINTR) {
+		perror("write()");
+		return false;
+	}
+
+	if (l > 0)
+		st->tx_pos += l;
+
+	return true;
+}
+
+static bool stream_read(int fd, struct stream_state *st, size_t chunk,
+			uint64_t seed)
+{
+	size_t		len = chunk;
+	ssize_t		l;
+	size_t		i;
+
+	if (st->total - st->rx_pos < len)
+		len = st->total - st->rx_pos;
+
+	l = read(fd, st->rx_buf, len);
+	if (l < 0 && (errno == EAGAIN || errno == EINTR))
+		return true;
+
+	if (l < 0) {
+		perror("read()");
+		return false;
+	}
+
+	if (l == 0) {
+		fprintf(stderr, "unexpected EOF\n");
+		return false;
+	}
+
+	stream_pattern(st->rx_expect, st->rx_pos, l, seed);
+
+	if (memcmp(st->rx_buf, st->rx_expect, l) != 0) {
+		for (i = 0; i < (size_t)l; ++i) {
+			if (st->rx_buf[i] == st->rx_expect[i])
+				continue;
+
+			if (st->num_mismatch++ == 0)
+				st->first_mismatch = st->rx_pos + i;
+		}
+	}
+
+	st->rx_pos += l;
+
+	return true;
+}
+
+static int run_stream(char const *path, struct cmdline_options const *opts)
+{
+	struct device		dev;
+	struct stream_state	st = {
+		.total		= opts->stream_bytes,
+	};
+	size_t			chunk = opts->chunk;
+	uint64_t		t0;
+	double			dt;
+	int			rc = EX_IOERR;
+
+	st.tx_buf    = malloc(chunk);
+	st.rx_buf    = malloc(chunk);
+	st.rx_expect = malloc(chunk);
+
+	if (!st.tx_buf || !st.rx_buf || !st.rx_expect) {
+		fprintf(stderr, "failed to allocate buffers\n");
+		rc = EX_OSERR;
+		goto out;
+	}
+
+	if (!device_open(&dev, path, opts->self_test)) {
+		rc = EX_OSERR;
+		goto out_close;
+	}
+
+	t0 = monotonic_ns();
+
+	while (st.rx_pos < st.total) {
+		struct pollfd	pfd = {
+			.fd	= dev.fd,
+			.events	= POLLIN | (st.tx_pos < st.total ? POLLOUT : 0),
+		};
+		int		prc = poll(&pfd, 1, opts->timeout_ms);
+
+		if (prc < 0 && errno == EINTR)
+			continue;
+
+		if (prc < 0) {
+			perror("poll()");
+			goto out_close;
+		}
+
+		if (prc == 0) {
+			fprintf(stderr, "timeout after %llu bytes sent, %llu received\n",
+				(unsigned long long)st.tx_pos,
+				(unsigned long long)st.rx_pos);
+			goto out_close;
+		}
+
+		if ((pfd.revents & POLLOUT) &&
+		    !stream_write(dev.fd, &st, chunk, opts->seed))
+			goto out_close;
+
+		if ((pfd.revents & (POLLIN | POLLHUP | POLLERR)) &&
+		    !stream_read(dev.fd, &st, chunk, opts->seed))
+			goto out_close;
+	}
+
+	dt = (monotonic_ns() - t0) / 1e9;
+
+	printf("%llu bytes in %.3f s: %.3f MiB/s in each direction\n",
+	       (unsigned long long)st.total, dt,
+	       st.total / (1024.0 * 1024.0) / (dt + 1e-9));
+
+	if (st.num_mismatch > 0) {
+		printf("%llu bytes differ; first mismatch at offset %llu\n",
+		       (unsigned long long)st.num_mismatch,
+		       (unsigned long long)st.first_mismatch);
+		rc = EX_DATAERR;
+	} else {
+		rc = EX_OK;
+	}
+
+out_close:
+	device_close(&dev);
+
+out:
+	free(st.rx_expect);
+	free(st.rx_buf);
+	free(st.tx_buf);
+
+	return rc;
+}
+/* }}} stream mode */
+
+static int bench_main(int argc, char *argv[])
+{
+	struct cmdline_options	opts = {
+		.iterations	= 1000,
+		.warmup		= 10,
+		.sizes		= "1,64,1024",
+		.timeout_ms	= 1000,
+		.chunk		= 64 * 1024,
+		.seed		= 1,
+	};
+	bool			is_bench = false;
+
+	while (1) {
+		int	c = getopt_long(argc, argv, "", CMDLINE_OPTIONS, 0);
+
+		if (c==-1)
+			break;
+
+		switch (c) {
+		case CMD_HELP		:  show_help();
+		case CMD_VERSION	:  show_version();
+		case CMD_BENCH		:  is_bench = true; break;
+		case CMD_SELF_TEST	:  opts.self_test = true; break;
+		case CMD_ITERATIONS	:  opts.iterations = atoi(optarg); break;
+		case CMD_WARMUP		:  opts.warmup = atoi(optarg); break;
+		case CMD_SIZE		:  opts.sizes = optarg; break;
+		case CMD_TIMEOUT	:  opts.timeout_ms = atoi(optarg); break;
+		case CMD_HISTOGRAM	:  opts.histogram = true; break;
+		case CMD_MAX_P99	:  opts.max_p99_us = atof(optarg); break;
+		case CMD_STREAM		:  opts.stream_bytes = strtoull(optarg, NULL, 0); break;
+		case CMD_CHUNK		:  opts.chunk = strtoul(optarg, NULL, 0); break;
+		case CMD_SEED		:  opts.seed = strtoull(optarg, NULL, 0); break;
+		default:
+			fprintf(stderr, "Try '--help' for more information\n");
+			return EX_USAGE;
+		}
+	}
+
+	if (is_bench == (opts.stream_bytes > 0)) {
+		fprintf(stderr, "either '--bench' or '--stream' is required\n");
+		return EX_USAGE;
+	}
+
+	if (opts.iterations == 0 || opts.chunk == 0 ||
+	    (opts.self_test ? optind != argc : optind + 1 != argc)) {
+		fprintf(stderr, "expected a device or '--self-test'\n");
+		return EX_USAGE;
+	}
+
+	if (opts.stream_bytes > 0)
+		return run_stream(opts.self_test ? NULL : argv[optind], &opts);
+
+	return run_bench(opts.self_test ? NULL : argv[optind], &opts);
+}
+
+static int classic_main(int argc, char *argv[])
+{
+	int	fd;
 	ssize_t	l;
-	size_t	rd_len = atoi(argv[3]);
-	char	buf[rd_len];
+	size_t	rd_len;
+	char	*buf;
+	int	rc = EX_IOERR;
+
+	if (argc != 4) {
+		fprintf(stderr, "Try '--help' for more information\n");
+		return EX_USAGE;
+	}
 
+	/* 'rd_len' is user controlled; do not place it on the stack */
+	rd_len = strtoul(argv[3], NULL, 0);
+	buf = malloc(rd_len + 1);
+	if (!buf) {
+		fprintf(stderr, "failed to allocate %zu bytes\n", rd_len);
+		return EX_OSERR;
+	}
+
+	fd = open(argv[1], O_RDWR|O_NOCTTY);
 	if (fd < 0) {
 		perror("open()");
-		return EX_OSERR;
+		rc = EX_OSERR;
+		goto out;
 	}
 
 	l = write(fd, argv[2], strlen(argv[2]));
 	if (l < 0) {
 		perror("write()");
-		return EX_OSERR;
+		rc = EX_OSERR;
+		goto out;
 	}
 
-	if (l != strlen(argv[2])) {
+	if ((size_t)l != strlen(argv[2])) {
 		fprintf(stderr, "failed to write all data (%zu vs. %zu)\n",
 			l, strlen(argv[2]));
-		return EX_IOERR;
+		goto out;
 	}
 
 	if (read_all(fd, buf, rd_len) != 0) {
 		perror("read()");
-		return EX_IOERR;
+		goto out;
 	}
 
-	if (l != rd_len) {
+	if ((size_t)l != rd_len) {
 		fprintf(stderr, "not all data read (%zu vs. %zu)\n",
 			l, rd_len);
-		return EX_IOERR;
+		goto out;
 	}
 
 	printf("%.*s\n", (int)l, buf);
-	return EX_OK;
+	rc = EX_OK;
+
+out:
+	xclose(fd);
+	free(buf);
+
+	return rc;
+}
+
+int main(int argc, char *argv[])
+{
+	/* the data argument of the classic invocation may start with '-';
+	 * only a leading long option selects the new interface */
+	if (argc > 1 && strncmp(argv[1], "--", 2) == 0)
+		return bench_main(argc, argv);
+
+	return classic_main(argc, argv);
 }
@@ -0,0 +1,175 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "remote.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "util.h"
+
+/* the channel number is local to the connection to the mux */
+#define REMOTE_CHAN		0
+
+bool remote_open(struct remote *r, char const *path)
+{
+	struct sockaddr_un	addr = { .sun_family = AF_UNIX };
+
+	r->fd = -1;
+	agent_rdbuf_init(&r->rdbuf);
+
+	if (strlen(path) >= sizeof addr.sun_path) {
+		fprintf(stderr, "socket path '%s' too long\n", path);
+		return false;
+	}
+
+	strcpy(addr.sun_path, path);
+
+	r->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (r->fd < 0) {
+		perror("socket()");
+		return false;
+	}
+
+	if (connect(r->fd, (void *)&addr, sizeof addr) < 0) {
+		fprintf(stderr, "connect(%s): %s\n", path, strerror(errno));
+		remote_close(r);
+		return false;
+	}
+
+	return true;
+}
+
+void remote_close(struct remote *r)
+{
+	xclose(r->fd);
+	r->fd = -1;
+	agent_rdbuf_free(&r->rdbuf);
+}
+
+static char *read_file(char const *fname, size_t *len)
+{
+	struct stat	st;
+	char		*buf = NULL;
+	int		fd = open(fname, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		fprintf(stderr, "open(%s): %s\n", fname, strerror(errno));
+		return NULL;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		perror("fstat()");
+		goto out;
+	}
+
+	buf = malloc(st.st_size + 1);
+	if (!buf)
+		goto out;
+
+	*len = 0;
+	while (*len < (size_t)st.st_size) {
+		ssize_t	l = read(fd, buf + *len, st.st_size - *len);
+
+		if (l < 0 && errno == EINTR)
+			continue;
+		else if (l <= 0) {
+			fprintf(stderr, "read(%s): %s\n", fname,
+				l < 0 ? strerror(errno) : "short read");
+			free(buf);
+			buf = NULL;
+			goto out;
+		}
+
+		*len += l;
+	}
+
+out:
+	close(fd);
+	return buf;
+}
+
+bool remote_spawn(struct remote *r, unsigned int timeout, bool is_inline,
+		  int argc, char *argv[])
+{
+	struct agent_spawn	spawn;
+	void const		*parts[2 + argc];
+	size_t			lens[2 + argc];
+	size_t			total;
+	char			*script = NULL;
+	size_t			script_len = 0;
+	int			i;
+	bool			rc;
+
+	if (argc < 1)
+		return false;
+
+	if (is_inline) {
+		script = read_file(argv[0], &script_len);
+		if (!script)
+			return false;
+	}
+
+	spawn = (struct agent_spawn) {
+		.timeout	= htole32(timeout),
+		.script_len	= htole32(script_len),
+		.argc		= htole32(argc),
+	};
+
+	parts[0] = &spawn;
+	lens[0]  = sizeof spawn;
+	parts[1] = script;
+	lens[1]  = script_len;
+	total = lens[0] + lens[1];
+
+	for (i = 0; i < argc; ++i) {
+		parts[i + 2] = argv[i];
+		lens[i + 2]  = strlen(argv[i]) + 1;
+		total += lens[i + 2];
+	}
+
+	if (total > AGENT_MAX_PAYLOAD) {
+		fprintf(stderr, "test too large for remote execution\n");
+		rc = false;
+	} else {
+		rc = agent_sendv(r->fd, AGENT_FRAME_SPAWN, REMOTE_CHAN,
+				 parts, lens, argc + 2);
+	}
+
+	free(script);
+	return rc;
+}
+
+bool remote_kill(struct remote *r, int sig)
+{
+	uint32_t	v = htole32(sig);
+
+	return agent_send(r->fd, AGENT_FRAME_KILL, REMOTE_CHAN, &v, sizeof v);
+}
+
+bool remote_extend(struct remote *r, unsigned int secs)
+{
+	uint32_t	v = htole32(secs);
+
+	return agent_send(r->fd, AGENT_FRAME_EXTEND, REMOTE_CHAN, &v, sizeof v);
+}
@@ -0,0 +1,40 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_TESTSUITE_SRC_REMOTE_H
+#define H_ENSC_TESTSUITE_SRC_REMOTE_H
+
+#include <stdbool.h>
+
+#include "agent-proto.h"
+
+/* client side of the 'runtest-agent --mux' socket */
+struct remote {
+	int			fd;
+	struct agent_rdbuf	rdbuf;
+};
+
+bool remote_open(struct remote *r, char const *path);
+void remote_close(struct remote *r);
+
+/* when 'is_inline' is set, the content of argv[0] is sent to the target
+ * and executed there */
+bool remote_spawn(struct remote *r, unsigned int timeout, bool is_inline,
+		  int argc, char *argv[]);
+bool remote_kill(struct remote *r, int sig);
+bool remote_extend(struct remote *r, unsigned int secs);
+
+#endif	/* H_ENSC_TESTSUITE_SRC_REMOTE_H */
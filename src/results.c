@@ -0,0 +1,273 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "results.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+
+#include <sys/wait.h>
+
+#include "strbuf.h"
+
+static double tv_to_sec(struct timeval const *tv)
+{
+	return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+static char const *result_status_str(enum result_status status)
+{
+	switch (status) {
+	case RESULT_STATUS_OK:		return "OK";
+	case RESULT_STATUS_FAIL:	return "FAIL";
+	case RESULT_STATUS_SKIPPED:	return "SKIPPED";
+	}
+
+	return "UNKNOWN";
+}
+
+bool results_write_jsonl(char const *fname, struct result_record const *res)
+{
+	struct strbuf		buf = { .data = NULL };
+	struct rusage const	*ru = &res->rusage;
+	bool			rc;
+
+	strbuf_printf(&buf, "{\"id\":");
+	strbuf_json_str(&buf, res->id);
+	strbuf_printf(&buf, ",\"category\":");
+	strbuf_json_str(&buf, res->category);
+	strbuf_printf(&buf, ",\"status\":\"%s\"",
+		      result_status_str(res->status));
+	strbuf_printf(&buf, ",\"skip_reason\":");
+	strbuf_json_str(&buf, res->skip_reason);
+	strbuf_printf(&buf, ",\"fail_reason\":");
+	strbuf_json_str(&buf, res->fail_reason);
+	strbuf_printf(&buf, ",\"wall_s\":%.6f", res->wall_ns / 1e9);
+
+	if (res->is_run) {
+		int	st = res->exit_status;
+
+		if (WIFEXITED(st))
+			strbuf_printf(&buf, ",\"exit_code\":%d,\"exit_signal\":null",
+				      WEXITSTATUS(st));
+		else if (WIFSIGNALED(st))
+			strbuf_printf(&buf, ",\"exit_code\":null,\"exit_signal\":%d",
+				      WTERMSIG(st));
+
+		strbuf_printf(&buf,
+			      ",\"utime_s\":%.6f,\"stime_s\":%.6f"
+			      ",\"maxrss_kb\":%ld"
+			      ",\"majflt\":%ld,\"minflt\":%ld"
+			      ",\"nvcsw\":%ld,\"nivcsw\":%ld"
+			      ",\"inblock\":%ld,\"oublock\":%ld",
+			      tv_to_sec(&ru->ru_utime), tv_to_sec(&ru->ru_stime),
+			      ru->ru_maxrss,
+			      ru->ru_majflt, ru->ru_minflt,
+			      ru->ru_nvcsw, ru->ru_nivcsw,
+			      ru->ru_inblock, ru->ru_oublock);
+	}
+
+	strbuf_printf(&buf,
+		      ",\"runner\":{\"utime_s\":%.6f,\"stime_s\":%.6f"
+		      ",\"maxrss_kb\":%ld}",
+		      tv_to_sec(&res->runner_rusage.ru_utime),
+		      tv_to_sec(&res->runner_rusage.ru_stime),
+		      res->runner_rusage.ru_maxrss);
+
+	if (res->is_run && res->perf) {
+		size_t	i;
+
+		strbuf_printf(&buf, ",\"perf\":{");
+		for (i = 0; i < PERFCNT_NUM; ++i) {
+			strbuf_printf(&buf, "%s\"%s\":", i > 0 ? "," : "",
+				      perfcnt_name(i));
+
+			if (res->perf->is_valid[i])
+				strbuf_printf(&buf, "%" PRIu64,
+					      res->perf->value[i]);
+			else
+				strbuf_printf(&buf, "null");
+		}
+		strbuf_printf(&buf, "}");
+	}
+
+	if (res->is_run && res->baseline) {
+		struct baseline_entry const	*b = res->baseline;
+
+		strbuf_printf(&buf,
+			      ",\"baseline\":{\"wall_ms\":%.3f,\"cpu_ms\":%.3f"
+			      ",\"maxrss_kb\":%ld,\"slow\":%s,\"bloated\":%s}",
+			      b->wall_ms, b->cpu_ms, b->maxrss_kb,
+			      (res->baseline_flags & BASELINE_SLOW) ? "true" : "false",
+			      (res->baseline_flags & BASELINE_BLOATED) ? "true" : "false");
+	}
+
+	if (res->is_run && res->kmsg) {
+		struct kmsg const	*k = res->kmsg;
+
+		strbuf_printf(&buf,
+			      ",\"kmsg\":{\"lines\":%u,\"errors\":%u"
+			      ",\"truncated\":%u,\"lost\":%u"
+			      ",\"oops\":%s,\"warn\":%s,\"text\":",
+			      k->num_lines, k->num_errors,
+			      k->num_truncated, k->num_lost,
+			      (k->flags & KMSG_FLAG_OOPS) ? "true" : "false",
+			      (k->flags & KMSG_FLAG_WARN) ? "true" : "false");
+		strbuf_json_str(&buf, k->text.data ? k->text.data : "");
+		strbuf_printf(&buf, "}");
+	}
+
+	if (res->is_run && res->num_mtd > 0) {
+		size_t	i;
+
+		strbuf_printf(&buf, ",\"mtd\":[");
+		for (i = 0; i < res->num_mtd; ++i) {
+			struct result_mtd const	*m = &res->mtd[i];
+
+			strbuf_printf(&buf, "%s{\"dev\":", i > 0 ? "," : "");
+			strbuf_json_str(&buf, m->dev);
+			strbuf_printf(&buf,
+				      ",\"corrected\":%u,\"failed\":%u"
+				      ",\"badblocks\":%u,\"bbtblocks\":%u}",
+				      m->delta.corrected, m->delta.failed,
+				      m->delta.badblocks, m->delta.bbtblocks);
+		}
+		strbuf_printf(&buf, "]");
+	}
+
+	strbuf_printf(&buf, "}\n");
+
+	rc = strbuf_append_to(&buf, fname);
+	strbuf_free(&buf);
+
+	return rc;
+}
+
+static void junit_property(struct strbuf *buf, char const *name, long value)
+{
+	strbuf_printf(buf, "      <property name=\"%s\" value=\"%ld\"/>\n",
+		      name, value);
+}
+
+static void junit_mtd_property(struct strbuf *buf, char const *name,
+			       char const *dev, unsigned int value)
+{
+	strbuf_printf(buf, "      <property name=\"ecc_%s:", name);
+	strbuf_xml_str(buf, dev);
+	strbuf_printf(buf, "\" value=\"%u\"/>\n", value);
+}
+
+bool results_write_junit(char const *fname, struct result_record const *res)
+{
+	struct strbuf		buf = { .data = NULL };
+	struct rusage const	*ru = &res->rusage;
+	bool			rc;
+	size_t			i;
+
+	strbuf_printf(&buf, "  <testcase classname=\"");
+	strbuf_xml_str(&buf, res->category ? res->category : "misc");
+	strbuf_printf(&buf, "\" name=\"");
+	strbuf_xml_str(&buf, res->id);
+	strbuf_printf(&buf, "\" time=\"%.6f\">\n", res->wall_ns / 1e9);
+
+	if (res->is_run) {
+		strbuf_printf(&buf, "    <properties>\n");
+		junit_property(&buf, "utime_us",
+			       ru->ru_utime.tv_sec * 1000000l + ru->ru_utime.tv_usec);
+		junit_property(&buf, "stime_us",
+			       ru->ru_stime.tv_sec * 1000000l + ru->ru_stime.tv_usec);
+		junit_property(&buf, "maxrss_kb", ru->ru_maxrss);
+		junit_property(&buf, "majflt", ru->ru_majflt);
+		junit_property(&buf, "minflt", ru->ru_minflt);
+		junit_property(&buf, "nvcsw", ru->ru_nvcsw);
+		junit_property(&buf, "nivcsw", ru->ru_nivcsw);
+		junit_property(&buf, "inblock", ru->ru_inblock);
+		junit_property(&buf, "oublock", ru->ru_oublock);
+
+		for (i = 0; res->perf && i < PERFCNT_NUM; ++i) {
+			if (!res->perf->is_valid[i])
+				continue;
+
+			strbuf_printf(&buf,
+				      "      <property name=\"perf_%s\" value=\"%" PRIu64 "\"/>\n",
+				      perfcnt_name(i), res->perf->value[i]);
+		}
+
+		if (res->baseline_flags & BASELINE_SLOW)
+			strbuf_printf(&buf, "      <property name=\"baseline\" value=\"SLOW\"/>\n");
+		if (res->baseline_flags & BASELINE_BLOATED)
+			strbuf_printf(&buf, "      <property name=\"baseline\" value=\"BLOATED\"/>\n");
+
+		if (res->kmsg) {
+			junit_property(&buf, "kmsg_lines", res->kmsg->num_lines);
+			junit_property(&buf, "kmsg_errors", res->kmsg->num_errors);
+		}
+
+		for (i = 0; i < res->num_mtd; ++i) {
+			struct result_mtd const	*m = &res->mtd[i];
+
+			junit_mtd_property(&buf, "corrected", m->dev,
+					   m->delta.corrected);
+			junit_mtd_property(&buf, "failed", m->dev,
+					   m->delta.failed);
+			junit_mtd_property(&buf, "badblocks", m->dev,
+					   m->delta.badblocks);
+		}
+
+		strbuf_printf(&buf, "    </properties>\n");
+	}
+
+	switch (res->status) {
+	case RESULT_STATUS_OK:
+		break;
+
+	case RESULT_STATUS_SKIPPED:
+		strbuf_printf(&buf, "    <skipped message=\"");
+		strbuf_xml_str(&buf, res->skip_reason);
+		strbuf_printf(&buf, "\"/>\n");
+		break;
+
+	case RESULT_STATUS_FAIL:
+		if (!res->is_run) {
+			strbuf_printf(&buf, "    <error message=\"could not run test\"/>\n");
+		} else if (res->fail_reason) {
+			strbuf_printf(&buf, "    <failure message=\"");
+			strbuf_xml_str(&buf, res->fail_reason);
+			strbuf_printf(&buf, "\"/>\n");
+		} else if (WIFSIGNALED(res->exit_status)) {
+			strbuf_printf(&buf, "    <failure message=\"killed by signal %d\"/>\n",
+				      WTERMSIG(res->exit_status));
+		} else {
+			strbuf_printf(&buf, "    <failure message=\"unexpected exit code %d\"/>\n",
+				      WEXITSTATUS(res->exit_status));
+		}
+		break;
+	}
+
+	if (res->is_run && res->kmsg && res->kmsg->text.len > 0) {
+		strbuf_printf(&buf, "    <system-err>");
+		strbuf_xml_str(&buf, res->kmsg->text.data);
+		strbuf_printf(&buf, "</system-err>\n");
+	}
+
+	strbuf_printf(&buf, "  </testcase>\n");
+
+	rc = strbuf_append_to(&buf, fname);
+	strbuf_free(&buf);
+
+	return rc;
+}
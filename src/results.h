@@ -0,0 +1,81 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_TESTSUITE_SRC_RESULTS_H
+#define H_ENSC_TESTSUITE_SRC_RESULTS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/resource.h>
+
+#include "baseline.h"
+#include "kmsg.h"
+#include "mtd.h"
+#include "perfcnt.h"
+
+enum result_status {
+	RESULT_STATUS_OK,
+	RESULT_STATUS_FAIL,
+	RESULT_STATUS_SKIPPED,
+};
+
+struct result_mtd {
+	char const		*dev;
+	struct mtd_ecc_stats	delta;
+};
+
+struct result_record {
+	char const		*id;
+	char const		*category;
+	enum result_status	status;
+	char const		*skip_reason;
+	/* why a test which exited successfully failed (e.g. a '--fail-on'
+	 * rule); NULL when the exit status decides */
+	char const		*fail_reason;
+
+	uint64_t		wall_ns;
+
+	/* the fields below are valid only when 'is_run' is set */
+	bool			is_run;
+	int			exit_status;
+	struct rusage		rusage;
+
+	/* NULL when no performance counters were requested */
+	struct perfcnt const	*perf;
+
+	/* NULL when the test has no baseline */
+	struct baseline_entry const	*baseline;
+	unsigned int		baseline_flags;
+
+	/* NULL when the kernel log was not monitored */
+	struct kmsg const	*kmsg;
+
+	/* ECC statistics of the monitored MTD devices */
+	struct result_mtd const	*mtd;
+	size_t			num_mtd;
+
+	/* resource usage of runtest itself */
+	struct rusage		runner_rusage;
+};
+
+/* Both functions append exactly one record with a single write() to
+ * 'fname' so that concurrently running tests can share the file.  The
+ * JUnit output consists of <testcase/> elements only; the surrounding
+ * <testsuite/> is created by 'runtests'. */
+bool results_write_jsonl(char const *fname, struct result_record const *res);
+bool results_write_junit(char const *fname, struct result_record const *res);
+
+#endif	/* H_ENSC_TESTSUITE_SRC_RESULTS_H */
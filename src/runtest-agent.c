@@ -0,0 +1,1431 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Runs in two modes:
+ *
+ * agent:  'runtest-agent [--device <tty>]' runs on the target and
+ *         executes the tests requested by AGENT_FRAME_SPAWN frames read
+ *         from stdin (or <tty>).  Output and exit status of all tests
+ *         are multiplexed over stdout (or <tty>).
+ *
+ * mux:    'runtest-agent --mux <socket> (--device <tty> | -- <cmd>...)'
+ *         runs on the host.  It accepts 'runtest --remote <socket>'
+ *         clients and forwards their frames over a single connection
+ *         to the agent which is reachable through <tty> or through
+ *         stdin/stdout of <cmd> (e.g. 'ssh target runtest-agent').
+ */
+
+#include <assert.h>
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <termios.h>
+
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "agent-proto.h"
+#include "subprocess.h"
+#include "util.h"
+
+#define CMD_HELP		0x8000
+#define CMD_VERSION		0x8001
+#define CMD_MUX			0x8002
+#define CMD_DEVICE		0x8003
+
+static struct option const	CMDLINE_OPTIONS[] = {
+  { "help",        no_argument,        0, CMD_HELP },
+  { "version",     no_argument,        0, CMD_VERSION },
+  { "mux",         required_argument,  0, CMD_MUX },
+  { "device",      required_argument,  0, CMD_DEVICE },
+  { 0,0,0,0 }
+};
+
+/* grace period between SIGTERM and SIGKILL after a timeout */
+#define AGENT_KILL_GRACE	5
+
+#define MUX_MAX_CHANNELS	1024
+
+/* the agent stops reading test output while more than this is queued
+ * for the host */
+#define AGENT_WRBUF_HIGH	(1024 * 1024)
+
+/* clients which do not read their frames are dropped when more than
+ * this is queued for them */
+#define MUX_CLIENT_MAX_PENDING	(16 * 1024 * 1024)
+
+enum watch_kind {
+	WATCH_TRANSPORT,
+	WATCH_TRANSPORT_OUT,
+	WATCH_SIGNAL,
+	WATCH_LISTEN,
+	WATCH_CLIENT,
+	WATCH_STDOUT,
+	WATCH_STDERR,
+	WATCH_TIMER,
+};
+
+struct watch {
+	enum watch_kind		kind;
+	void			*obj;
+};
+
+struct agent_child {
+	unsigned int		chan;
+	struct subprocess	proc;
+	/* the test runs in its own process group so that a timeout
+	 * reaches its children too; valid after the test was reaped as
+	 * long as one of them lives */
+	pid_t			pgid;
+	int			fd_timer;
+	char			*script;
+
+	bool			is_open[2];
+	bool			is_exited;
+	bool			is_killed;
+	bool			is_killed_hard;
+	bool			is_done;
+	int			exit_status;
+	struct rusage		rusage;
+
+	struct watch		w_out[2];
+	struct watch		w_timer;
+
+	struct agent_child	*next;
+};
+
+struct agent {
+	int			fd_rd;
+	int			fd_wr;
+	int			fd_epoll;
+	int			fd_signal;
+
+	struct agent_rdbuf	rdbuf;
+	struct agent_wrbuf	wrbuf;
+	struct agent_child	*children;
+
+	/* false when 'fd_wr' can not be polled (e.g. a regular file); it
+	 * stays blocking then */
+	bool			is_wr_pollable;
+	bool			is_out_polled;
+	bool			is_throttled;
+
+	struct watch		w_transport;
+	struct watch		w_transport_out;
+	struct watch		w_signal;
+};
+
+static void show_help(void) __attribute__((__noreturn__));
+static void show_help(void)
+{
+	printf("Usage: runtest-agent [--device <tty>]\n"
+	       "       runtest-agent --mux <socket> (--device <tty> | -- <cmd> <args>*)\n");
+	exit(0);
+}
+
+static void show_version(void) __attribute__((__noreturn__));
+static void show_version(void)
+{
+	/* \todo */
+	exit(0);
+}
+
+static int epoll_add(int efd, int fd, struct watch *w)
+{
+	struct epoll_event	ev = {
+		.events		= EPOLLIN,
+		.data.ptr	= w,
+	};
+
+	if (epoll_ctl(efd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		perror("epoll_ctl(EPOLL_CTL_ADD)");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int epoll_mod(int efd, int fd, struct watch *w, uint32_t events)
+{
+	struct epoll_event	ev = {
+		.events		= events,
+		.data.ptr	= w,
+	};
+
+	if (epoll_ctl(efd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+		perror("epoll_ctl(EPOLL_CTL_MOD)");
+		return -1;
+	}
+
+	return 0;
+}
+
+static bool set_nonblock(int fd)
+{
+	int	flags = fcntl(fd, F_GETFL);
+
+	if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+		perror("fcntl(O_NONBLOCK)");
+		return false;
+	}
+
+	return true;
+}
+
+/* input events; EPOLLHUP and EPOLLERR are reported as input so that the
+ * following read() sees the condition */
+static bool is_input_event(struct epoll_event const *ev)
+{
+	return (ev->events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0;
+}
+
+static int open_tty(char const *dev)
+{
+	struct termios	tios;
+	int		fd = open(dev, O_RDWR | O_NOCTTY | O_CLOEXEC);
+
+	if (fd < 0) {
+		fprintf(stderr, "open(%s): %s\n", dev, strerror(errno));
+		return -1;
+	}
+
+	if (tcgetattr(fd, &tios) == 0) {
+		cfmakeraw(&tios);
+		if (tcsetattr(fd, TCSANOW, &tios) < 0)
+			perror("tcsetattr()");
+	}
+
+	return fd;
+}
+
+static int signalfd_create(int sig, ...)
+{
+	sigset_t	mask;
+	va_list		ap;
+	int		fd;
+
+	sigemptyset(&mask);
+
+	va_start(ap, sig);
+	while (sig != 0) {
+		sigaddset(&mask, sig);
+		sig = va_arg(ap, int);
+	}
+	va_end(ap);
+
+	if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0) {
+		perror("sigprocmask()");
+		return -1;
+	}
+
+	fd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+	if (fd < 0)
+		perror("signalfd()");
+
+	return fd;
+}
+
+/* The signalfds block signals and the mux ignores SIGPIPE; neither must
+ * leak into the transport or into the tests. */
+static void reset_signals(void)
+{
+	sigset_t	empty;
+
+	sigemptyset(&empty);
+	sigprocmask(SIG_SETMASK, &empty, NULL);
+	signal(SIGPIPE, SIG_DFL);
+}
+
+/* {{{ agent mode */
+static bool agent_error(struct agent *agent, unsigned int chan,
+			char const *fmt, ...)
+{
+	char			msg[256];
+	va_list			ap;
+	struct agent_exit	ex;
+	struct rusage		ru = { .ru_maxrss = 0 };
+
+	va_start(ap, fmt);
+	vsnprintf(msg, sizeof msg, fmt, ap);
+	va_end(ap);
+
+	agent_exit_pack(&ex, W_EXITCODE(127, 0), &ru);
+
+	return (agent_queue(&agent->wrbuf, AGENT_FRAME_ERROR, chan,
+			    msg, strlen(msg)) &&
+		agent_queue(&agent->wrbuf, AGENT_FRAME_EXIT, chan,
+			    &ex, sizeof ex));
+}
+
+static char *agent_write_script(void const *data, size_t len)
+{
+	char const	*tmpdir = getenv("TMPDIR");
+	char		*fname;
+	int		fd;
+	bool		ok;
+
+	if (!tmpdir)
+		tmpdir = "/tmp";
+
+	if (asprintf(&fname, "%s/runtest-agent.XXXXXX", tmpdir) < 0)
+		return NULL;
+
+	fd = mkostemp(fname, O_CLOEXEC);
+	if (fd < 0) {
+		perror("mkostemp()");
+		free(fname);
+		return NULL;
+	}
+
+	ok = (fchmod(fd, 0700) == 0 && write_all(fd, data, len));
+	close(fd);
+
+	if (!ok) {
+		unlink(fname);
+		free(fname);
+		fname = NULL;
+	}
+
+	return fname;
+}
+
+static void agent_child_free(struct agent *agent, struct agent_child *child)
+{
+	struct agent_child	**p;
+
+	for (p = &agent->children; *p; p = &(*p)->next) {
+		if (*p == child) {
+			*p = child->next;
+			break;
+		}
+	}
+
+	/* epoll registrations are removed implicitly by closing the fds */
+	xclose(child->fd_timer);
+	subprocess_destroy(&child->proc);
+
+	if (child->script) {
+		unlink(child->script);
+		free(child->script);
+	}
+
+	free(child);
+}
+
+static bool agent_child_set_timer(struct agent_child *child,
+				  unsigned int secs)
+{
+	struct itimerspec	tm = {
+		.it_value	= { .tv_sec = secs },
+	};
+
+	return timerfd_settime(child->fd_timer, 0, &tm, NULL) == 0;
+}
+
+/* enables or disables reading the output of 'child' according to the
+ * throttle state */
+static void agent_child_poll(struct agent *agent, struct agent_child *child)
+{
+	unsigned int	i;
+
+	for (i = 0; i < 2; ++i) {
+		if (!child->is_open[i])
+			continue;
+
+		epoll_mod(agent->fd_epoll, child->proc.pipe_std[i + 1].rd,
+			  &child->w_out[i], agent->is_throttled ? 0 : EPOLLIN);
+	}
+}
+
+/* runs in the forked test before exec() */
+static void agent_child_setup(void *priv)
+{
+	(void)priv;
+
+	reset_signals();
+	setpgid(0, 0);
+}
+
+static void agent_child_kill(struct agent_child *child, int sig)
+{
+	if (child->pgid > 0)
+		kill(-child->pgid, sig);
+}
+
+static bool agent_spawn(struct agent *agent, unsigned int chan,
+			void const *payload, size_t len)
+{
+	struct agent_spawn	spawn;
+	struct agent_child	*child = NULL;
+	char const		*p = payload;
+	char const		*end = p + len;
+	unsigned int		argc;
+	unsigned int		i;
+	bool			ok = false;
+
+	if (len < sizeof spawn)
+		return agent_error(agent, chan, "short SPAWN frame");
+
+	memcpy(&spawn, p, sizeof spawn);
+	p += sizeof spawn;
+
+	spawn.timeout    = le32toh(spawn.timeout);
+	spawn.script_len = le32toh(spawn.script_len);
+	argc             = le32toh(spawn.argc);
+
+	if (argc == 0 || argc > len || spawn.script_len > (size_t)(end - p))
+		return agent_error(agent, chan, "bad SPAWN frame");
+
+	{
+		char		*argv[argc + 1];
+		char const	*script = p;
+
+		p += spawn.script_len;
+		for (i = 0; i < argc; ++i) {
+			char const	*e = memchr(p, '\0', end - p);
+
+			if (!e)
+				return agent_error(agent, chan,
+						   "bad argv in SPAWN frame");
+
+			argv[i] = (char *)p;
+			p = e + 1;
+		}
+		argv[argc] = NULL;
+
+		child = calloc(1, sizeof *child);
+		if (!child)
+			return agent_error(agent, chan, "out of memory");
+
+		child->chan = chan;
+		child->fd_timer = -1;
+
+		if (spawn.script_len > 0) {
+			child->script = agent_write_script(script,
+							   spawn.script_len);
+			if (!child->script) {
+				ok = agent_error(agent, chan,
+						 "failed to write script");
+				goto out;
+			}
+
+			argv[0] = child->script;
+		}
+
+		child->fd_timer = timerfd_create(CLOCK_MONOTONIC,
+						 TFD_CLOEXEC | TFD_NONBLOCK);
+		if (child->fd_timer < 0 ||
+		    !agent_child_set_timer(child, spawn.timeout)) {
+			ok = agent_error(agent, chan, "timerfd: %m");
+			goto out;
+		}
+
+		if (!subprocess_init(&child->proc, false)) {
+			ok = agent_error(agent, chan, "subprocess_init failed");
+			goto out;
+		}
+
+		if (!subprocess_spawn(&child->proc, argc, argv,
+				      agent_child_setup, NULL)) {
+			ok = agent_error(agent, chan, "failed to spawn '%s'",
+					 argv[0]);
+			goto out;
+		}
+
+		/* subprocess_spawn() returns after the exec() and thus after
+		 * the setpgid() of agent_child_setup() */
+		child->pgid = child->proc.pid;
+	}
+
+	/* keep the fds away from other tests spawned later */
+	set_cloexec(child->proc.pipe_std[0].wr, true);
+	set_cloexec(child->proc.pipe_std[1].rd, true);
+	set_cloexec(child->proc.pipe_std[2].rd, true);
+
+	child->w_out[0] = (struct watch) { WATCH_STDOUT, child };
+	child->w_out[1] = (struct watch) { WATCH_STDERR, child };
+	child->w_timer  = (struct watch) { WATCH_TIMER,  child };
+
+	if (epoll_add(agent->fd_epoll, child->proc.pipe_std[1].rd,
+		      &child->w_out[0]) < 0 ||
+	    epoll_add(agent->fd_epoll, child->proc.pipe_std[2].rd,
+		      &child->w_out[1]) < 0 ||
+	    epoll_add(agent->fd_epoll, child->fd_timer, &child->w_timer) < 0) {
+		agent_child_kill(child, SIGKILL);
+		ok = agent_error(agent, chan, "epoll failed");
+		goto out;
+	}
+
+	child->is_open[0] = true;
+	child->is_open[1] = true;
+
+	if (agent->is_throttled)
+		agent_child_poll(agent, child);
+
+	child->next = agent->children;
+	agent->children = child;
+	child = NULL;
+	ok = true;
+
+out:
+	if (child) {
+		/* reap a child which was spawned but could not be
+		 * registered */
+		agent_child_free(agent, child);
+	}
+
+	return ok;
+}
+
+static struct agent_child *agent_find_child(struct agent *agent,
+					    unsigned int chan)
+{
+	struct agent_child	*child;
+
+	for (child = agent->children; child; child = child->next) {
+		if (child->chan == chan)
+			return child;
+	}
+
+	return NULL;
+}
+
+static bool agent_handle_frame(struct agent *agent,
+			       struct agent_frame const *frame)
+{
+	struct agent_child	*child;
+	uint32_t		v;
+
+	switch (frame->hdr.type) {
+	case AGENT_FRAME_SPAWN:
+		if (agent_find_child(agent, frame->hdr.chan))
+			return agent_error(agent, frame->hdr.chan,
+					   "channel in use");
+
+		return agent_spawn(agent, frame->hdr.chan, frame->payload,
+				   frame->hdr.len);
+
+	case AGENT_FRAME_KILL:
+	case AGENT_FRAME_EXTEND:
+		child = agent_find_child(agent, frame->hdr.chan);
+		if (!child || frame->hdr.len < sizeof v)
+			break;
+
+		memcpy(&v, frame->payload, sizeof v);
+		v = le32toh(v);
+
+		if (frame->hdr.type == AGENT_FRAME_KILL)
+			agent_child_kill(child, v);
+		else if (!child->is_killed) {
+			struct itimerspec	tm;
+
+			if (timerfd_gettime(child->fd_timer, &tm) == 0) {
+				tm.it_value.tv_sec += v;
+				timerfd_settime(child->fd_timer, 0, &tm, NULL);
+			}
+		}
+		break;
+
+	default:
+		fprintf(stderr, "runtest-agent: unexpected frame type %u\n",
+			frame->hdr.type);
+		break;
+	}
+
+	return true;
+}
+
+static bool agent_child_maybe_finish(struct agent *agent,
+				     struct agent_child *child)
+{
+	struct agent_exit	ex;
+	bool			ok;
+
+	if (child->is_done || !child->is_exited ||
+	    child->is_open[0] || child->is_open[1])
+		return true;
+
+	agent_exit_pack(&ex, child->exit_status, &child->rusage);
+	ok = agent_queue(&agent->wrbuf, AGENT_FRAME_EXIT, child->chan,
+			 &ex, sizeof ex);
+
+	/* freed by agent_sweep() because pending epoll events might still
+	 * reference the child */
+	child->is_done = true;
+
+	return ok;
+}
+
+static void agent_sweep(struct agent *agent)
+{
+	struct agent_child	*child;
+	struct agent_child	*next;
+
+	for (child = agent->children; child; child = next) {
+		next = child->next;
+
+		if (child->is_done)
+			agent_child_free(agent, child);
+	}
+}
+
+static void agent_child_close_output(struct agent_child *child,
+				     unsigned int idx)
+{
+	int		*fd = &child->proc.pipe_std[idx + 1].rd;
+
+	close(*fd);
+	*fd = -1;
+	child->is_open[idx] = false;
+}
+
+static bool agent_handle_output(struct agent *agent,
+				struct agent_child *child, unsigned int idx)
+{
+	int		fd = child->proc.pipe_std[idx + 1].rd;
+	char		buf[16 * 1024];
+	ssize_t		l;
+
+	l = read(fd, buf, sizeof buf);
+	if (l < 0 && (errno == EINTR || errno == EAGAIN))
+		return true;
+
+	if (l > 0)
+		return agent_queue(&agent->wrbuf,
+				   idx == 0 ? AGENT_FRAME_STDOUT : AGENT_FRAME_STDERR,
+				   child->chan, buf, l);
+
+	if (l < 0)
+		perror("read(<child>)");
+
+	agent_child_close_output(child, idx);
+
+	return agent_child_maybe_finish(agent, child);
+}
+
+static bool agent_handle_sigchld(struct agent *agent)
+{
+	struct signalfd_siginfo	info;
+	struct agent_child	*child;
+	bool			ok = true;
+
+	/* drain the signalfd; the actual children are found by polling
+	 * them because several SIGCHLD might have been merged */
+	while (read(agent->fd_signal, &info, sizeof info) == sizeof info)
+		;			/* noop */
+
+	for (child = agent->children; child; child = child->next) {
+		if (child->is_exited)
+			continue;
+
+		if (wait4(child->proc.pid, &child->exit_status, WNOHANG,
+			  &child->rusage) != child->proc.pid)
+			continue;
+
+		child->proc.pid = -1;
+		child->is_exited = true;
+
+		ok = agent_child_maybe_finish(agent, child) && ok;
+	}
+
+	return ok;
+}
+
+/* Terminates the process group of a timed out test: SIGTERM, SIGKILL
+ * after AGENT_KILL_GRACE and, when processes which left the group still
+ * hold the output pipes, closes them after another grace period so that
+ * the EXIT frame is not delayed further. */
+static bool agent_handle_timeout(struct agent *agent,
+				 struct agent_child *child)
+{
+	uint64_t	cnt;
+	unsigned int	i;
+
+	if (read(child->fd_timer, &cnt, sizeof cnt) < 0)
+		return true;
+
+	if (!child->is_killed) {
+		agent_child_kill(child, SIGTERM);
+		child->is_killed = true;
+
+		if (!agent_queuev(&agent->wrbuf, AGENT_FRAME_TIMEOUT,
+				  child->chan, NULL, NULL, 0))
+			return false;
+	} else if (!child->is_killed_hard) {
+		agent_child_kill(child, SIGKILL);
+		child->is_killed_hard = true;
+	} else {
+		for (i = 0; i < 2; ++i) {
+			if (child->is_open[i])
+				agent_child_close_output(child, i);
+		}
+
+		return agent_child_maybe_finish(agent, child);
+	}
+
+	agent_child_set_timer(child, AGENT_KILL_GRACE);
+	return true;
+}
+
+/* Sends the queued frames as far as possible, polls for EPOLLOUT while
+ * frames are pending and stops reading test output while the host
+ * does not keep up.  Returns false when the transport failed. */
+static bool agent_flush(struct agent *agent)
+{
+	struct agent_child	*child;
+	bool			want_out;
+	bool			want_throttle;
+
+	if (!agent_wrbuf_flush(&agent->wrbuf, agent->fd_wr))
+		return false;
+
+	want_out = agent->is_wr_pollable && agent_wrbuf_pending(&agent->wrbuf) > 0;
+	if (want_out != agent->is_out_polled) {
+		int		fd = agent->fd_wr;
+		struct watch	*w = &agent->w_transport_out;
+		uint32_t	events = want_out ? EPOLLOUT : 0;
+
+		if (agent->fd_wr == agent->fd_rd) {
+			w = &agent->w_transport;
+			events |= EPOLLIN;
+		}
+
+		if (epoll_mod(agent->fd_epoll, fd, w, events) < 0)
+			return false;
+
+		agent->is_out_polled = want_out;
+	}
+
+	want_throttle = agent_wrbuf_pending(&agent->wrbuf) > AGENT_WRBUF_HIGH;
+	if (want_throttle != agent->is_throttled) {
+		agent->is_throttled = want_throttle;
+
+		for (child = agent->children; child; child = child->next)
+			agent_child_poll(agent, child);
+	}
+
+	return true;
+}
+
+static void agent_destroy(struct agent *agent)
+{
+	while (agent->children) {
+		struct agent_child	*child = agent->children;
+
+		agent_child_kill(child, SIGKILL);
+		agent_child_free(agent, child);
+	}
+
+	agent_rdbuf_free(&agent->rdbuf);
+	agent_wrbuf_free(&agent->wrbuf);
+	xclose(agent->fd_epoll);
+	xclose(agent->fd_signal);
+}
+
+static int run_agent(int fd_rd, int fd_wr)
+{
+	struct agent	agent = {
+		.fd_rd		= fd_rd,
+		.fd_wr		= fd_wr,
+		.fd_epoll	= -1,
+		.w_transport	= { WATCH_TRANSPORT, NULL },
+		.w_transport_out = { WATCH_TRANSPORT_OUT, NULL },
+		.w_signal	= { WATCH_SIGNAL, NULL },
+	};
+	int		rc = EX_OSERR;
+
+	agent_rdbuf_init(&agent.rdbuf);
+	agent_wrbuf_init(&agent.wrbuf);
+
+	/* subprocess_spawn() blocks SIGCHLD too; doing it here first keeps
+	 * the mask consistent over all children */
+	agent.fd_signal = signalfd_create(SIGCHLD, 0);
+	if (agent.fd_signal < 0)
+		goto out;
+
+	agent.fd_epoll = epoll_create1(EPOLL_CLOEXEC);
+	if (agent.fd_epoll < 0) {
+		perror("epoll_create1()");
+		goto out;
+	}
+
+	if (epoll_add(agent.fd_epoll, fd_rd, &agent.w_transport) < 0 ||
+	    epoll_add(agent.fd_epoll, agent.fd_signal, &agent.w_signal) < 0)
+		goto out;
+
+	if (fd_wr == fd_rd) {
+		agent.is_wr_pollable = true;
+	} else {
+		struct epoll_event	ev = {
+			.events		= 0,
+			.data.ptr	= &agent.w_transport_out,
+		};
+
+		agent.is_wr_pollable =
+			epoll_ctl(agent.fd_epoll, EPOLL_CTL_ADD, fd_wr, &ev) == 0;
+	}
+
+	/* a blocked transport must not stop reading the frames of the
+	 * host; otherwise both sides can wait for each other */
+	if (agent.is_wr_pollable && !set_nonblock(fd_wr))
+		goto out;
+
+	set_cloexec(fd_rd, true);
+	set_cloexec(fd_wr, true);
+
+	for (;;) {
+		struct epoll_event	events[16];
+		int			nfds;
+		int			i;
+
+		nfds = epoll_wait(agent.fd_epoll, events,
+				  ARRAY_SIZE(events), -1);
+		if (nfds < 0 && errno == EINTR)
+			continue;
+		else if (nfds < 0) {
+			perror("epoll_wait()");
+			goto out;
+		}
+
+		for (i = 0; i < nfds; ++i) {
+			struct watch		*w = events[i].data.ptr;
+			struct agent_child	*child = w->obj;
+			struct agent_frame	frame;
+			ssize_t			l;
+			bool			ok = true;
+
+			switch (w->kind) {
+			case WATCH_TRANSPORT_OUT:
+				/* handled by agent_flush() below */
+				break;
+
+			case WATCH_TRANSPORT:
+				if (!is_input_event(&events[i]))
+					break;
+
+				l = agent_rdbuf_fill(&agent.rdbuf, fd_rd);
+				if (l < 0 && errno == EAGAIN)
+					break;
+
+				if (l <= 0) {
+					/* host is gone; agent_destroy() kills
+					 * all remaining tests */
+					rc = l < 0 ? EX_IOERR : EX_OK;
+					goto out;
+				}
+
+				while (ok &&
+				       agent_rdbuf_next(&agent.rdbuf, &frame))
+					ok = agent_handle_frame(&agent, &frame);
+				break;
+
+			case WATCH_SIGNAL:
+				ok = agent_handle_sigchld(&agent);
+				break;
+
+			case WATCH_STDOUT:
+			case WATCH_STDERR:
+				if (child->is_open[w->kind == WATCH_STDERR])
+					ok = agent_handle_output(
+						&agent, child,
+						w->kind == WATCH_STDERR);
+				break;
+
+			case WATCH_TIMER:
+				ok = agent_handle_timeout(&agent, child);
+				break;
+
+			default:
+				abort();
+			}
+
+			if (!ok) {
+				rc = EX_IOERR;
+				goto out;
+			}
+		}
+
+		agent_sweep(&agent);
+
+		if (!agent_flush(&agent)) {
+			rc = EX_IOERR;
+			goto out;
+		}
+	}
+
+out:
+	agent_destroy(&agent);
+	return rc;
+}
+/* }}} agent mode */
+
+/* {{{ mux mode */
+struct mux_client {
+	int			fd;
+	struct agent_rdbuf	rdbuf;
+	struct agent_wrbuf	wrbuf;
+	struct watch		w;
+
+	bool			is_out_polled;
+	/* dropped clients are freed by mux_sweep() after the current
+	 * epoll batch which might still reference them */
+	bool			is_dead;
+	struct mux_client	*next;
+};
+
+struct mux_chan {
+	struct mux_client	*client;
+	unsigned int		client_chan;
+	bool			is_used;
+};
+
+struct mux {
+	int			fd_transport;
+	int			fd_listen;
+	int			fd_epoll;
+	int			fd_signal;
+	pid_t			pid_transport;
+
+	struct agent_rdbuf	rdbuf;
+	struct agent_wrbuf	wrbuf;
+	bool			is_out_polled;
+	struct mux_chan		chans[MUX_MAX_CHANNELS];
+	unsigned int		next_chan;
+	struct mux_client	*clients;
+
+	struct watch		w_transport;
+	struct watch		w_listen;
+	struct watch		w_signal;
+};
+
+static int mux_listen(char const *path)
+{
+	struct sockaddr_un	addr = { .sun_family = AF_UNIX };
+	int			fd;
+
+	if (strlen(path) >= sizeof addr.sun_path) {
+		fprintf(stderr, "socket path '%s' too long\n", path);
+		return -1;
+	}
+
+	strcpy(addr.sun_path, path);
+	unlink(path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		perror("socket()");
+		return -1;
+	}
+
+	if (bind(fd, (void *)&addr, sizeof addr) < 0 || listen(fd, 64) < 0) {
+		fprintf(stderr, "bind/listen(%s): %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static int mux_spawn_transport(struct mux *mux, char *argv[])
+{
+	int	sp[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sp) < 0) {
+		perror("socketpair()");
+		return -1;
+	}
+
+	mux->pid_transport = fork();
+	if (mux->pid_transport < 0) {
+		perror("fork()");
+		close(sp[0]);
+		close(sp[1]);
+		return -1;
+	}
+
+	if (mux->pid_transport == 0) {
+		if (dup2(sp[1], 0) < 0 || dup2(sp[1], 1) < 0)
+			_exit(EX_OSERR);
+
+		reset_signals();
+		execvp(argv[0], argv);
+		fprintf(stderr, "execvp(%s): %s\n", argv[0], strerror(errno));
+		_exit(EX_OSERR);
+	}
+
+	close(sp[1]);
+	return sp[0];
+}
+
+static void mux_drop_client(struct mux *mux, struct mux_client *client)
+{
+	size_t		i;
+	uint32_t	sig = htole32(SIGKILL);
+
+	if (client->is_dead)
+		return;
+
+	for (i = 0; i < ARRAY_SIZE(mux->chans); ++i) {
+		struct mux_chan	*c = &mux->chans[i];
+
+		if (!c->is_used || c->client != client)
+			continue;
+
+		/* the channel is released when the EXIT frame arrives */
+		agent_queue(&mux->wrbuf, AGENT_FRAME_KILL, i,
+			    &sig, sizeof sig);
+		c->client = NULL;
+	}
+
+	/* closing the fd removes it from the epoll set */
+	close(client->fd);
+	client->fd = -1;
+	client->is_dead = true;
+}
+
+static void mux_free_client(struct mux_client *client)
+{
+	xclose(client->fd);
+	agent_rdbuf_free(&client->rdbuf);
+	agent_wrbuf_free(&client->wrbuf);
+	free(client);
+}
+
+static void mux_sweep(struct mux *mux)
+{
+	struct mux_client	**pos = &mux->clients;
+
+	while (*pos) {
+		struct mux_client	*client = *pos;
+
+		if (!client->is_dead) {
+			pos = &client->next;
+			continue;
+		}
+
+		*pos = client->next;
+		mux_free_client(client);
+	}
+}
+
+static bool mux_update_out(struct mux *mux, int fd, struct watch *w,
+			   struct agent_wrbuf const *wrbuf, bool *is_polled)
+{
+	bool	want_out = agent_wrbuf_pending(wrbuf) > 0;
+
+	if (want_out == *is_polled)
+		return true;
+
+	if (epoll_mod(mux->fd_epoll, fd, w,
+		      EPOLLIN | (want_out ? EPOLLOUT : 0)) < 0)
+		return false;
+
+	*is_polled = want_out;
+	return true;
+}
+
+/* Sends the queued frames as far as possible.  Clients which fail are
+ * dropped; returns false when the transport failed. */
+static bool mux_flush(struct mux *mux)
+{
+	struct mux_client	*client;
+
+	for (client = mux->clients; client; client = client->next) {
+		if (client->is_dead)
+			continue;
+
+		if (!agent_wrbuf_flush(&client->wrbuf, client->fd) ||
+		    !mux_update_out(mux, client->fd, &client->w,
+				    &client->wrbuf, &client->is_out_polled))
+			mux_drop_client(mux, client);
+	}
+
+	/* KILL frames of dropped clients are queued for the transport
+	 * above, so it is flushed last */
+	return (agent_wrbuf_flush(&mux->wrbuf, mux->fd_transport) &&
+		mux_update_out(mux, mux->fd_transport, &mux->w_transport,
+			       &mux->wrbuf, &mux->is_out_polled));
+}
+
+static int mux_find_chan(struct mux const *mux,
+			 struct mux_client const *client,
+			 unsigned int client_chan)
+{
+	size_t		i;
+
+	for (i = 0; i < ARRAY_SIZE(mux->chans); ++i) {
+		struct mux_chan const	*c = &mux->chans[i];
+
+		if (c->is_used && c->client == client &&
+		    c->client_chan == client_chan)
+			return i;
+	}
+
+	return -1;
+}
+
+static int mux_alloc_chan(struct mux *mux)
+{
+	size_t		i;
+
+	for (i = 0; i < ARRAY_SIZE(mux->chans); ++i) {
+		unsigned int	idx = (mux->next_chan + i) % MUX_MAX_CHANNELS;
+
+		if (!mux->chans[idx].is_used) {
+			mux->next_chan = idx + 1;
+			return idx;
+		}
+	}
+
+	return -1;
+}
+
+/* returns false when the client must be dropped */
+static bool mux_handle_client(struct mux *mux, struct mux_client *client)
+{
+	struct agent_frame	frame;
+	ssize_t			l;
+
+	l = agent_rdbuf_fill(&client->rdbuf, client->fd);
+	if (l < 0 && errno == EAGAIN)
+		return true;
+
+	if (l <= 0)
+		return false;
+
+	while (agent_rdbuf_next(&client->rdbuf, &frame)) {
+		int	chan = mux_find_chan(mux, client, frame.hdr.chan);
+
+		if (frame.hdr.type == AGENT_FRAME_SPAWN) {
+			if (chan >= 0)
+				/* protocol violation */
+				return false;
+
+			chan = mux_alloc_chan(mux);
+			if (chan < 0) {
+				static char const	msg[] = "too many tests";
+				struct agent_exit	ex;
+				struct rusage		ru = { .ru_maxrss = 0 };
+
+				agent_exit_pack(&ex, W_EXITCODE(127, 0), &ru);
+				if (!agent_queue(&client->wrbuf, AGENT_FRAME_ERROR,
+						 frame.hdr.chan, msg, strlen(msg)) ||
+				    !agent_queue(&client->wrbuf, AGENT_FRAME_EXIT,
+						 frame.hdr.chan, &ex, sizeof ex))
+					return false;
+				continue;
+			}
+
+			mux->chans[chan] = (struct mux_chan) {
+				.client		= client,
+				.client_chan	= frame.hdr.chan,
+				.is_used	= true,
+			};
+		} else if (chan < 0) {
+			/* late KILL for a finished test */
+			continue;
+		}
+
+		if (!agent_queue(&mux->wrbuf, frame.hdr.type, chan,
+				 frame.payload, frame.hdr.len))
+			return false;
+	}
+
+	return true;
+}
+
+static bool mux_handle_transport(struct mux *mux)
+{
+	struct agent_frame	frame;
+	ssize_t			l;
+
+	l = agent_rdbuf_fill(&mux->rdbuf, mux->fd_transport);
+	if (l < 0 && errno == EAGAIN)
+		return true;
+
+	if (l == 0)
+		fprintf(stderr, "runtest-agent: transport closed\n");
+
+	if (l <= 0)
+		return false;
+
+	while (agent_rdbuf_next(&mux->rdbuf, &frame)) {
+		struct mux_chan	*c;
+
+		if (frame.hdr.chan >= MUX_MAX_CHANNELS)
+			continue;
+
+		c = &mux->chans[frame.hdr.chan];
+		if (!c->is_used)
+			continue;
+
+		if (c->client) {
+			struct mux_client	*client = c->client;
+
+			if (!agent_queue(&client->wrbuf, frame.hdr.type,
+					 c->client_chan,
+					 frame.payload, frame.hdr.len)) {
+				mux_drop_client(mux, client);
+			} else if (agent_wrbuf_pending(&client->wrbuf) >
+				   MUX_CLIENT_MAX_PENDING) {
+				fprintf(stderr,
+					"runtest-agent: dropping stalled client\n");
+				mux_drop_client(mux, client);
+			}
+		}
+
+		if (frame.hdr.type == AGENT_FRAME_EXIT)
+			c->is_used = false;
+	}
+
+	return true;
+}
+
+static int run_mux(char const *sock_path, char const *device, char *argv[])
+{
+	struct mux	mux = {
+		.fd_transport	= -1,
+		.fd_listen	= -1,
+		.fd_epoll	= -1,
+		.fd_signal	= -1,
+		.pid_transport	= -1,
+		.w_transport	= { WATCH_TRANSPORT, NULL },
+		.w_listen	= { WATCH_LISTEN, NULL },
+		.w_signal	= { WATCH_SIGNAL, NULL },
+	};
+	int		rc = EX_OSERR;
+	bool		is_done = false;
+
+	agent_rdbuf_init(&mux.rdbuf);
+	agent_wrbuf_init(&mux.wrbuf);
+	signal(SIGPIPE, SIG_IGN);
+
+	mux.fd_signal = signalfd_create(SIGTERM, SIGINT, SIGHUP, 0);
+	if (mux.fd_signal < 0)
+		goto out;
+
+	if (device)
+		mux.fd_transport = open_tty(device);
+	else
+		mux.fd_transport = mux_spawn_transport(&mux, argv);
+
+	if (mux.fd_transport < 0 || !set_nonblock(mux.fd_transport))
+		goto out;
+
+	mux.fd_listen = mux_listen(sock_path);
+	if (mux.fd_listen < 0)
+		goto out;
+
+	mux.fd_epoll = epoll_create1(EPOLL_CLOEXEC);
+	if (mux.fd_epoll < 0) {
+		perror("epoll_create1()");
+		goto out;
+	}
+
+	if (epoll_add(mux.fd_epoll, mux.fd_transport, &mux.w_transport) < 0 ||
+	    epoll_add(mux.fd_epoll, mux.fd_listen, &mux.w_listen) < 0 ||
+	    epoll_add(mux.fd_epoll, mux.fd_signal, &mux.w_signal) < 0)
+		goto out;
+
+	while (!is_done) {
+		struct epoll_event	events[16];
+		int			nfds;
+		int			i;
+
+		nfds = epoll_wait(mux.fd_epoll, events, ARRAY_SIZE(events), -1);
+		if (nfds < 0 && errno == EINTR)
+			continue;
+		else if (nfds < 0) {
+			perror("epoll_wait()");
+			goto out;
+		}
+
+		for (i = 0; i < nfds && !is_done; ++i) {
+			struct watch		*w = events[i].data.ptr;
+			struct mux_client	*client;
+			int			fd;
+
+			switch (w->kind) {
+			case WATCH_TRANSPORT:
+				if (!is_input_event(&events[i]))
+					break;
+
+				if (!mux_handle_transport(&mux)) {
+					rc = EX_IOERR;
+					goto out;
+				}
+				break;
+
+			case WATCH_SIGNAL:
+				is_done = true;
+				break;
+
+			case WATCH_LISTEN:
+				fd = accept4(mux.fd_listen, NULL, NULL,
+					     SOCK_CLOEXEC | SOCK_NONBLOCK);
+				if (fd < 0) {
+					perror("accept4()");
+					break;
+				}
+
+				client = calloc(1, sizeof *client);
+				if (!client) {
+					close(fd);
+					break;
+				}
+
+				client->fd = fd;
+				client->w = (struct watch) { WATCH_CLIENT, client };
+				agent_rdbuf_init(&client->rdbuf);
+				agent_wrbuf_init(&client->wrbuf);
+
+				client->next = mux.clients;
+				mux.clients = client;
+
+				if (epoll_add(mux.fd_epoll, fd, &client->w) < 0)
+					mux_drop_client(&mux, client);
+				break;
+
+			case WATCH_CLIENT:
+				client = w->obj;
+				if (client->is_dead || !is_input_event(&events[i]))
+					break;
+
+				if (!mux_handle_client(&mux, client))
+					mux_drop_client(&mux, client);
+				break;
+
+			default:
+				abort();
+			}
+		}
+
+		if (!mux_flush(&mux)) {
+			rc = EX_IOERR;
+			goto out;
+		}
+
+		mux_sweep(&mux);
+	}
+
+	rc = EX_OK;
+
+out:
+	if (mux.fd_listen >= 0)
+		unlink(sock_path);
+
+	while (mux.clients) {
+		struct mux_client	*client = mux.clients;
+
+		mux.clients = client->next;
+		mux_free_client(client);
+	}
+
+	xclose(mux.fd_listen);
+	xclose(mux.fd_transport);
+	xclose(mux.fd_epoll);
+	xclose(mux.fd_signal);
+	agent_rdbuf_free(&mux.rdbuf);
+	agent_wrbuf_free(&mux.wrbuf);
+
+	if (mux.pid_transport > 0)
+		waitpid(mux.pid_transport, NULL, 0);
+
+	return rc;
+}
+/* }}} mux mode */
+
+/* make sibling programs like 'check-file' available to the tests */
+static void setup_path(void)
+{
+	char		exe[PATH_MAX];
+	ssize_t		l = readlink("/proc/self/exe", exe, sizeof exe - 1);
+	char const	*path = getenv("PATH");
+	char		*new_path;
+
+	if (l < 0)
+		return;
+
+	exe[l] = '\0';
+
+	if (asprintf(&new_path, "%s%s%s", dirname(exe),
+		     path ? ":" : "", path ? path : "") < 0)
+		return;
+
+	setenv("PATH", new_path, 1);
+	free(new_path);
+}
+
+int main(int argc, char *argv[])
+{
+	char const	*mux_socket = NULL;
+	char const	*device = NULL;
+	int		fd;
+	int		rc;
+
+	while (1) {
+		int	c = getopt_long(argc, argv, "+", CMDLINE_OPTIONS, 0);
+
+		if (c==-1)
+			break;
+
+		switch (c) {
+		case CMD_HELP		:  show_help();
+		case CMD_VERSION	:  show_version();
+		case CMD_MUX		:  mux_socket = optarg; break;
+		case CMD_DEVICE		:  device = optarg; break;
+		default:
+			fprintf(stderr, "Try '--help' for more information\n");
+			return EX_USAGE;
+		}
+	}
+
+	if (mux_socket) {
+		if (!device && optind == argc) {
+			fprintf(stderr, "--mux requires --device or a command\n");
+			return EX_USAGE;
+		}
+
+		return run_mux(mux_socket, device, &argv[optind]);
+	}
+
+	setup_path();
+
+	if (!device)
+		return run_agent(STDIN_FILENO, STDOUT_FILENO);
+
+	fd = open_tty(device);
+	if (fd < 0)
+		return EX_OSERR;
+
+	rc = run_agent(fd, fd);
+	close(fd);
+
+	return rc;
+}
@@ -15,19 +15,35 @@
  */
 
 
+#include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
 
 #include <unistd.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <poll.h>
 #include <sysexits.h>
 
 #include <sys/sendfile.h>
-
+#include <sys/wait.h>
+
+#include "baseline.h"
+#include "kmsg.h"
+#include "monitor.h"
+#include "mtd.h"
+#include "perfcnt.h"
+#include "remote.h"
+#include "results.h"
 #include "subprocess.h"
+#include "trace.h"
 #include "util.h"
 
 /* {{{ cli options */
+#define RUNTEST_MAX_MTD		8
+
 #define CMD_HELP		0x8000
 #define CMD_VERSION		0x8001
 #define CMD_SKIP		's'	/* 0x8002 */
@@ -36,6 +52,22 @@
 #define CMD_QUIET		'q'	/* 0x8005 */
 #define CMD_ID			0x8006
 #define CMD_TIMEOUT		0x8007
+#define CMD_EVENTS		0x8008
+#define CMD_REMOTE		0x8009
+#define CMD_INLINE		0x800a
+#define CMD_CATEGORY		0x800b
+#define CMD_JSONL		0x800c
+#define CMD_JUNIT		0x800d
+#define CMD_PERF		0x800e
+#define CMD_BASELINE		0x800f
+#define CMD_BASELINE_TOL	0x8010
+#define CMD_BASELINE_STRICT	0x8011
+#define CMD_BASELINE_RECORD	0x8012
+#define CMD_TRACE		0x8013
+#define CMD_TRACE_MARK		0x8014
+#define CMD_KMSG		0x8015
+#define CMD_MTD			0x8016
+#define CMD_FAIL_ON		0x8017
 
 static struct option const	CMDLINE_OPTIONS[] = {
   { "help",        no_argument,        0, CMD_HELP },
@@ -46,6 +78,22 @@ static struct option const	CMDLINE_OPTIONS[] = {
   { "quiet",       no_argument,	       0, CMD_QUIET },
   { "id",          required_argument,  0, CMD_ID },
   { "timeout",    required_argument,   0, CMD_TIMEOUT },
+  { "events",      required_argument,  0, CMD_EVENTS },
+  { "remote",      required_argument,  0, CMD_REMOTE },
+  { "inline",      no_argument,        0, CMD_INLINE },
+  { "category",    required_argument,  0, CMD_CATEGORY },
+  { "jsonl",       required_argument,  0, CMD_JSONL },
+  { "junit",       required_argument,  0, CMD_JUNIT },
+  { "perf",        no_argument,        0, CMD_PERF },
+  { "baseline",    required_argument,  0, CMD_BASELINE },
+  { "baseline-tolerance", required_argument, 0, CMD_BASELINE_TOL },
+  { "baseline-strict", no_argument,    0, CMD_BASELINE_STRICT },
+  { "baseline-record", required_argument, 0, CMD_BASELINE_RECORD },
+  { "trace",       required_argument,  0, CMD_TRACE },
+  { "trace-mark",  required_argument,  0, CMD_TRACE_MARK },
+  { "kmsg",        no_argument,        0, CMD_KMSG },
+  { "mtd",         required_argument,  0, CMD_MTD },
+  { "fail-on",     required_argument,  0, CMD_FAIL_ON },
   { 0,0,0,0 }
 };
 
@@ -54,18 +102,91 @@ struct cmdline_options {
 	bool		is_interactive;
 	bool		is_quiet;
 	bool		is_tty;
+	bool		is_inline;
+	bool		is_perf;
+	bool		is_baseline_strict;
 	char const	*skip_reason;
 	char const	*id;
+	char const	*events;
+	char const	*remote;
+	char const	*category;
+	char const	*jsonl;
+	char const	*junit;
+	char const	*baseline;
+	char const	*baseline_record;
+	char const	*trace;
+	char const	*trace_mark;
+	struct baseline_tolerance	baseline_tol;
+	/* run timeout in seconds for local and remote tests; 0 selects
+	 * SUBPROCESS_DEFAULT_TIMEOUT.  The test gets SIGTERM then and
+	 * SIGKILL after a fixed grace period. */
 	unsigned int	timeout;
+
+	bool		is_kmsg;
+	char const	*mtd[RUNTEST_MAX_MTD];
+	unsigned int	num_mtd;
+	unsigned int	fail_on;	/* HEALTH_xxx */
 };
 /* }}} cli options */
 
+/* hardware health events observed while the test ran; the '--fail-on'
+ * rules select which of them fail the test */
+enum {
+	HEALTH_OOPS		= (1u << 0),
+	HEALTH_WARN		= (1u << 1),
+	HEALTH_ECC		= (1u << 2),	/* uncorrectable ECC errors */
+	HEALTH_BITFLIPS		= (1u << 3),	/* corrected bitflips */
+	HEALTH_BADBLOCKS	= (1u << 4),
+};
+
+static struct {
+	char const	*name;
+	char const	*tag;
+	unsigned int	flag;
+} const			HEALTH_RULES[] = {
+	{ "oops",	"OOPS",		HEALTH_OOPS },
+	{ "warn",	"KWARN",	HEALTH_WARN },
+	{ "ecc",	"ECC",		HEALTH_ECC },
+	{ "bitflips",	"BITFLIPS",	HEALTH_BITFLIPS },
+	{ "badblocks",	"BADBLOCKS",	HEALTH_BADBLOCKS },
+};
+
+/* parses a comma separated list of HEALTH_RULES names */
+static bool parse_fail_on(unsigned int *mask, char const *spec)
+{
+	char	*tmp = strdupa(spec);
+	char	*tok;
+
+	while ((tok = strsep(&tmp, ",")) != NULL) {
+		size_t	i;
+
+		if (!*tok)
+			continue;
+
+		for (i = 0; i < ARRAY_SIZE(HEALTH_RULES); ++i) {
+			if (strcmp(tok, HEALTH_RULES[i].name) == 0)
+				break;
+		}
+
+		if (i == ARRAY_SIZE(HEALTH_RULES)) {
+			fprintf(stderr, "unknown --fail-on rule '%s'\n", tok);
+			return false;
+		}
+
+		*mask |= HEALTH_RULES[i].flag;
+	}
+
+	return true;
+}
+
+static void show_help(void) __attribute__((__noreturn__));
 static void show_help(void)
 {
 	/* \todo */
 	exit(0);
 }
 
+static void show_version(void) __attribute__((__noreturn__));
 static void show_version(void)
 {
 	/* \todo */
@@ -73,88 +194,655 @@ static void show_version(void)
 }
 
 struct runtest_stat {
-	
+	/* index 0 is stdout, 1 is stderr */
+	unsigned int		num_chunks[2];
+	uint64_t		num_bytes[2];
+	bool			no_splice[2];
+
+	uint64_t		wall_ns;
+	bool			is_run;
+	int			exit_status;
+	struct rusage		rusage;
+
+	bool			has_perf;
+	struct perfcnt		perf;
+
+	bool			has_baseline;
+	struct baseline_entry	baseline;
+	unsigned int		baseline_flags;
+
+	bool			has_kmsg;
+	struct kmsg		kmsg;
+	struct result_mtd	mtd[RUNTEST_MAX_MTD];
+	unsigned int		num_mtd;
+	unsigned int		health_flags;
+
+	/* set when a test failed for another reason than its exit
+	 * status: a timeout, a cancel request or a rule */
+	char			fail_reason[128];
+};
+
+struct runtest_ctx {
+	struct subprocess	*proc;
+	struct monitor		*mon;
+	struct runtest_stat	stat;
+	bool			is_cancelled;
+	bool			is_timed_out;
+	bool			is_sample_warned;
 };
 
 static void step(void *priv, unsigned long *flags)
 {
+	struct runtest_ctx	*ctx = priv;
+	struct monitor		*mon = ctx->mon;
+
 	*flags = 0;
 
 	set_bit(SUBPROCESS_CB_FLAG_STDOUT, flags);
 	set_bit(SUBPROCESS_CB_FLAG_STDERR, flags);
+
+	if (mon->req_extend > 0) {
+		if (subprocess_extend_timeout(ctx->proc, mon->req_extend))
+			monitor_emit_status(mon, MONITOR_STATUS_EXTENDED,
+					    mon->req_extend);
+		mon->req_extend = 0;
+	}
+
+	if (mon->req_sample) {
+		monitor_emit_sample(mon, ctx->proc->pid);
+		mon->req_sample = false;
+	}
+
+	if (mon->req_cancel) {
+		monitor_emit_status(mon, MONITOR_STATUS_CANCELLED, 0);
+		ctx->is_cancelled = true;
+		set_bit(SUBPROCESS_CB_FLAG_QUIT, flags);
+	}
+
+	if (monitor_ctl_fd(mon) >= 0)
+		set_bit(SUBPROCESS_CB_FLAG_MONITOR, flags);
+
+	if (ctx->stat.has_kmsg && kmsg_fd(&ctx->stat.kmsg) >= 0)
+		set_bit(SUBPROCESS_CB_FLAG_AUX, flags);
 }
 
-static void handle_io(void *priv, int fd, enum subprocess_cb_source src)
+/* copies available output of the program; splice() is not supported
+ * for all kinds of 'out_fd' (e.g. files opened with O_APPEND) so fall
+ * back to read() + write() in this case */
+static ssize_t forward_output(int fd, int out_fd, bool *no_splice)
 {
+	char		buf[64*1024];
 	ssize_t		l;
 
+	if (!*no_splice) {
+		l = splice(fd, NULL, out_fd, NULL, sizeof buf,
+			   SPLICE_F_NONBLOCK);
+		if (l >= 0 || errno != EINVAL)
+			return l;
+
+		*no_splice = true;
+	}
+
+	l = read(fd, buf, sizeof buf);
+	if (l > 0 && !write_all(out_fd, buf, l))
+		l = -1;
+
+	return l;
+}
+
+static void handle_io(void *priv, int fd, enum subprocess_cb_source src)
+{
+	struct runtest_ctx	*ctx = priv;
+	struct runtest_stat	*stat = &ctx->stat;
+	ssize_t			l;
+	unsigned int		idx;
+
 	switch (src) {
 	case SUBPROCESS_CB_SOURCE_STDOUT:
-		l = splice(fd, NULL, STDOUT_FILENO, NULL, 64*1024,
-			   SPLICE_F_NONBLOCK);
+		idx = 0;
+		l = forward_output(fd, STDOUT_FILENO, &stat->no_splice[idx]);
 		break;
 	case SUBPROCESS_CB_SOURCE_STDERR:
-		l = splice(fd, NULL, STDERR_FILENO, NULL, 64*1024,
-			   SPLICE_F_NONBLOCK);
+		idx = 1;
+		l = forward_output(fd, STDERR_FILENO, &stat->no_splice[idx]);
 		break;
+	case SUBPROCESS_CB_SOURCE_MONITOR:
+		monitor_handle_input(ctx->mon);
+		return;
+	case SUBPROCESS_CB_SOURCE_AUX:
+		kmsg_read(&stat->kmsg);
+		return;
+	case SUBPROCESS_CB_SOURCE_TIMEOUT:
+		monitor_emit_status(ctx->mon, MONITOR_STATUS_TIMEOUT, 0);
+		ctx->is_timed_out = true;
+		return;
 	default:
-		break;
+		return;
 	}
 
-	(void)l;
+	if (l > 0) {
+		++stat->num_chunks[idx];
+		stat->num_bytes[idx] += l;
+
+		monitor_emit_output(ctx->mon, false,
+				    stat->num_chunks, stat->num_bytes);
+	}
 }
 
-static int run_program(struct cmdline_options const *opts,
-		       int argc, char *argv[])
+/* starts the kernel log monitoring and records the ECC counters of the
+ * MTD devices before the test */
+static void health_start(struct cmdline_options const *opts,
+			 struct runtest_stat *stat, struct mtd_dev mtd[],
+			 struct mtd_ecc_stats before[])
+{
+	unsigned int	i;
+
+	if (opts->is_kmsg) {
+		kmsg_open(&stat->kmsg);
+		stat->has_kmsg = kmsg_fd(&stat->kmsg) >= 0;
+	}
+
+	for (i = 0; i < opts->num_mtd; ++i) {
+		if (mtd_open(&mtd[i], opts->mtd[i], O_RDONLY) &&
+		    !mtd_get_ecc_stats(&mtd[i], &before[i]))
+			mtd_close(&mtd[i]);
+	}
+}
+
+static void health_finish(struct cmdline_options const *opts,
+			  struct runtest_stat *stat, struct mtd_dev mtd[],
+			  struct mtd_ecc_stats const before[])
+{
+	unsigned int	i;
+
+	/* messages logged by the last actions of the test */
+	if (stat->has_kmsg)
+		kmsg_read(&stat->kmsg);
+
+	for (i = 0; i < opts->num_mtd; ++i) {
+		struct mtd_ecc_stats	after;
+		struct result_mtd	*res = &stat->mtd[stat->num_mtd];
+
+		if (!mtd_is_open(&mtd[i]))
+			continue;
+
+		if (mtd_get_ecc_stats(&mtd[i], &after)) {
+			res->dev = opts->mtd[i];
+			mtd_ecc_stats_delta(&res->delta, &after, &before[i]);
+			++stat->num_mtd;
+		}
+
+		mtd_close(&mtd[i]);
+	}
+}
+
+static bool run_local(struct cmdline_options const *opts,
+		      struct runtest_ctx *ctx, int argc, char *argv[])
 {
 	struct subprocess_callbacks	cb = {
-		.fd_monitor = -1,
+		.fd_monitor = monitor_ctl_fd(ctx->mon),
+		.fd_aux = -1,
 		.fn_step = step,
 		.fn_handle = handle_io,
+		.priv = ctx,
 	};
 
 	struct subprocess	proc;
-	int			rc;
+	struct perfcnt		*perf = &ctx->stat.perf;
+	struct mtd_dev		mtd[RUNTEST_MAX_MTD];
+	struct mtd_ecc_stats	mtd_before[RUNTEST_MAX_MTD];
+	bool			rc = false;
+	bool			ok;
+	uint64_t		t0;
+	unsigned int		i;
+
+	ctx->proc = &proc;
+
+	health_start(opts, &ctx->stat, mtd, mtd_before);
+	if (ctx->stat.has_kmsg)
+		cb.fd_aux = kmsg_fd(&ctx->stat.kmsg);
 
-	rc = EX_OSERR;
 	if (!subprocess_init(&proc, opts->is_interactive))
 		goto out;
 
-	proc.timeout = opts->timeout;
+	proc.run_timeout = opts->timeout;
+
+	/* the counters are inherited by the child and start with its
+	 * exec() */
+	if (opts->is_perf) {
+		t0 = trace_begin();
+		perfcnt_open(perf);
+		trace_end("perf-open", t0);
+	}
 
+	t0 = trace_begin();
 	if (!subprocess_spawn(&proc, argc, argv, NULL, NULL))
 		goto out;
+	trace_end("spawn", t0);
+
+	monitor_emit_status(ctx->mon, MONITOR_STATUS_SPAWNED, proc.pid);
+
+	t0 = trace_begin();
+	ok = subprocess_run(&proc, &cb);
+
+	/* a timed out or cancelled test has been terminated and reaped by
+	 * subprocess_run(); its exit status and rusage are valid */
+	if (!ok && (!(ctx->is_timed_out || ctx->is_cancelled) ||
+		    proc.pid != -1))
+		goto out;
+	trace_end("run", t0);
+
+	ctx->stat.exit_status = proc.exit_status;
+	ctx->stat.rusage = proc.rusage;
+
+	health_finish(opts, &ctx->stat, mtd, mtd_before);
+
+	if (opts->is_perf) {
+		/* child has been reaped; its counts are accumulated in
+		 * our counters now */
+		perfcnt_read(perf);
+		ctx->stat.has_perf = true;
+	}
+
+	rc = true;
+
+out:
+	if (opts->is_perf)
+		perfcnt_close(perf);
+
+	for (i = 0; i < opts->num_mtd; ++i)
+		mtd_close(&mtd[i]);
+
+	subprocess_destroy(&proc);
+	ctx->proc = NULL;
+
+	return rc;
+}
+
+static bool run_remote_frame(struct runtest_ctx *ctx,
+			     struct agent_frame const *frame, bool *is_exited)
+{
+	struct runtest_stat	*stat = &ctx->stat;
+	unsigned int		idx;
+
+	switch (frame->hdr.type) {
+	case AGENT_FRAME_STDOUT:
+	case AGENT_FRAME_STDERR:
+		idx = frame->hdr.type == AGENT_FRAME_STDERR;
+		if (!write_all(idx ? STDERR_FILENO : STDOUT_FILENO,
+			       frame->payload, frame->hdr.len))
+			return false;
+
+		++stat->num_chunks[idx];
+		stat->num_bytes[idx] += frame->hdr.len;
+
+		monitor_emit_output(ctx->mon, false,
+				    stat->num_chunks, stat->num_bytes);
+		break;
+
+	case AGENT_FRAME_ERROR:
+		fprintf(stderr, "remote error: %.*s\n",
+			(int)frame->hdr.len, frame->payload);
+		break;
+
+	case AGENT_FRAME_TIMEOUT:
+		monitor_emit_status(ctx->mon, MONITOR_STATUS_TIMEOUT, 0);
+		ctx->is_timed_out = true;
+		break;
+
+	case AGENT_FRAME_EXIT:
+		if (frame->hdr.len < sizeof(struct agent_exit))
+			return false;
+
+		agent_exit_unpack((void const *)frame->payload,
+				  &stat->exit_status, &stat->rusage);
+		*is_exited = true;
+		break;
+
+	default:
+		break;
+	}
+
+	return true;
+}
+
+static bool run_remote(struct cmdline_options const *opts,
+		       struct runtest_ctx *ctx, int argc, char *argv[])
+{
+	struct remote		r;
+	struct monitor		*mon = ctx->mon;
+	bool			rc = false;
+	bool			is_exited = false;
+	uint64_t		t0;
+
+	t0 = trace_begin();
+	if (!remote_open(&r, opts->remote))
+		goto out;
+
+	if (!remote_spawn(&r, (opts->timeout > 0 ?
+			       opts->timeout : SUBPROCESS_DEFAULT_TIMEOUT),
+			  opts->is_inline, argc, argv))
+		goto out;
+	trace_end("spawn", t0);
+
+	monitor_emit_status(mon, MONITOR_STATUS_SPAWNED, 0);
+
+	t0 = trace_begin();
 
-	if (!subprocess_run(&proc, &cb))
+	while (!is_exited) {
+		struct pollfd		fds[] = {
+			{ .fd = r.fd, .events = POLLIN },
+			{ .fd = monitor_ctl_fd(mon), .events = POLLIN },
+		};
+		struct agent_frame	frame;
+		ssize_t			l;
+
+		if (poll(fds, ARRAY_SIZE(fds), -1) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			perror("poll()");
+			goto out;
+		}
+
+		if (fds[1].revents) {
+			monitor_handle_input(mon);
+
+			if (mon->req_cancel && !ctx->is_cancelled) {
+				monitor_emit_status(mon, MONITOR_STATUS_CANCELLED, 0);
+				ctx->is_cancelled = true;
+				remote_kill(&r, SIGKILL);
+			}
+
+			if (mon->req_extend > 0) {
+				remote_extend(&r, mon->req_extend);
+				monitor_emit_status(mon, MONITOR_STATUS_EXTENDED,
+						    mon->req_extend);
+				mon->req_extend = 0;
+			}
+
+			/* the agent does not report resource samples;
+			 * main() rejects '--kmsg' and '--mtd' likewise */
+			if (mon->req_sample && !ctx->is_sample_warned) {
+				fprintf(stderr, "runtest: resource samples are "
+					"not supported with '--remote'\n");
+				ctx->is_sample_warned = true;
+			}
+
+			mon->req_sample = false;
+		}
+
+		if (!fds[0].revents)
+			continue;
+
+		l = agent_rdbuf_fill(&r.rdbuf, r.fd);
+		if (l <= 0) {
+			fprintf(stderr, "lost connection to agent\n");
+			goto out;
+		}
+
+		while (!is_exited && agent_rdbuf_next(&r.rdbuf, &frame)) {
+			if (!run_remote_frame(ctx, &frame, &is_exited))
+				goto out;
+		}
+	}
+
+	trace_end("run", t0);
+
+	rc = true;
+
+out:
+	remote_close(&r);
+	return rc;
+}
+
+static int run_program(struct cmdline_options const *opts,
+		       struct runtest_ctx *ctx,
+		       int argc, char *argv[])
+{
+	int			rc;
+	uint64_t		t0 = monotonic_ns();
+	bool			ok;
+
+	if (opts->remote)
+		ok = run_remote(opts, ctx, argc, argv);
+	else
+		ok = run_local(opts, ctx, argc, argv);
+
+	ctx->stat.wall_ns = monotonic_ns() - t0;
+
+	rc = EX_OSERR;
+	if (!ok)
 		goto out;
 
+	ctx->stat.is_run = true;
+
+	monitor_emit_status(ctx->mon, MONITOR_STATUS_EXITED,
+			    ctx->stat.exit_status);
+	monitor_emit_output(ctx->mon, true,
+			    ctx->stat.num_chunks, ctx->stat.num_bytes);
+	monitor_emit_rusage(ctx->mon, &ctx->stat.rusage);
+
 	rc = EX_TEMPFAIL;
 
-	if (!WIFEXITED(proc.exit_status))
+	/* timed out and cancelled tests fail regardless of their exit
+	 * status but keep the collected resource usage */
+	if (ctx->is_timed_out || ctx->is_cancelled) {
+		snprintf(ctx->stat.fail_reason, sizeof ctx->stat.fail_reason,
+			 "%s", ctx->is_timed_out ? "timed out" : "cancelled");
+		goto out;
+	}
+
+	if (!WIFEXITED(ctx->stat.exit_status))
 		goto out;
 
-	if (opts->is_fail && WEXITSTATUS(proc.exit_status) == 0)
+	if (opts->is_fail && WEXITSTATUS(ctx->stat.exit_status) == 0)
 		goto out;
 
-	if (!opts->is_fail && WEXITSTATUS(proc.exit_status) != 0)
+	if (!opts->is_fail && WEXITSTATUS(ctx->stat.exit_status) != 0)
 		goto out;
 
 
 	rc = EX_OK;
 
 out:
-	subprocess_destroy(&proc);
-	
 	return rc;
 }
 
+static void get_measurement(struct runtest_stat const *stat,
+			    struct baseline_entry *cur)
+{
+	struct rusage const	*ru = &stat->rusage;
+
+	cur->wall_ms   = stat->wall_ns / 1e6;
+	cur->cpu_ms    = ((ru->ru_utime.tv_sec + ru->ru_stime.tv_sec) * 1e3 +
+			  (ru->ru_utime.tv_usec + ru->ru_stime.tv_usec) / 1e3);
+	cur->maxrss_kb = ru->ru_maxrss;
+}
+
+/* compares the measured resource usage against the baseline and
+ * records it; returns the new exit code */
+static int handle_baseline(struct cmdline_options const *opts,
+			   struct runtest_stat *stat, int rc)
+{
+	struct baseline_entry	cur;
+
+	if (!stat->is_run)
+		return rc;
+
+	get_measurement(stat, &cur);
+
+	if (opts->baseline_record && rc == EX_OK)
+		baseline_record(opts->baseline_record, opts->id, &cur);
+
+	if (!opts->baseline || !opts->id ||
+	    !baseline_lookup(opts->baseline, opts->id, &stat->baseline))
+		return rc;
+
+	stat->has_baseline = true;
+	stat->baseline_flags = baseline_check(&stat->baseline, &cur,
+					      &opts->baseline_tol);
+
+	if (stat->baseline_flags && opts->is_baseline_strict) {
+		if (rc == EX_OK)
+			snprintf(stat->fail_reason, sizeof stat->fail_reason,
+				 "baseline exceeded:%s%s",
+				 (stat->baseline_flags & BASELINE_SLOW) ?
+				 " slow" : "",
+				 (stat->baseline_flags & BASELINE_BLOATED) ?
+				 " bloated" : "");
+
+		rc = EX_TEMPFAIL;
+	}
+
+	return rc;
+}
+
+/* derives the health events from the kernel log and ECC statistics and
+ * applies the '--fail-on' rules; returns the new exit code */
+static int handle_health(struct cmdline_options const *opts,
+			 struct runtest_stat *stat, int rc)
+{
+	unsigned int	flags = 0;
+	unsigned int	i;
+
+	if (!stat->is_run)
+		return rc;
+
+	if (stat->has_kmsg && (stat->kmsg.flags & KMSG_FLAG_OOPS))
+		flags |= HEALTH_OOPS;
+
+	if (stat->has_kmsg && (stat->kmsg.flags & KMSG_FLAG_WARN))
+		flags |= HEALTH_WARN;
+
+	for (i = 0; i < stat->num_mtd; ++i) {
+		struct mtd_ecc_stats const	*d = &stat->mtd[i].delta;
+
+		if (d->failed > 0)
+			flags |= HEALTH_ECC;
+		if (d->corrected > 0)
+			flags |= HEALTH_BITFLIPS;
+		if (d->badblocks > 0)
+			flags |= HEALTH_BADBLOCKS;
+	}
+
+	stat->health_flags = flags;
+
+	if (!(flags & opts->fail_on))
+		return rc;
+
+	if (rc == EX_OK) {
+		char	*p = stat->fail_reason;
+		char	*end = p + sizeof stat->fail_reason;
+
+		p += snprintf(p, end - p, "'--fail-on' rule matched:");
+		for (i = 0; i < ARRAY_SIZE(HEALTH_RULES) && p < end; ++i) {
+			if (flags & opts->fail_on & HEALTH_RULES[i].flag)
+				p += snprintf(p, end - p, " %s",
+					      HEALTH_RULES[i].name);
+		}
+	}
+
+	rc = EX_TEMPFAIL;
+
+	return rc;
+}
+
+static void print_tags(struct runtest_stat const *stat)
+{
+	char const	*tags[2 + ARRAY_SIZE(HEALTH_RULES)];
+	size_t		num = 0;
+	size_t		i;
+
+	if (stat->baseline_flags & BASELINE_SLOW)
+		tags[num++] = "SLOW";
+	if (stat->baseline_flags & BASELINE_BLOATED)
+		tags[num++] = "BLOATED";
+
+	for (i = 0; i < ARRAY_SIZE(HEALTH_RULES); ++i) {
+		if (stat->health_flags & HEALTH_RULES[i].flag)
+			tags[num++] = HEALTH_RULES[i].tag;
+	}
+
+	for (i = 0; i < num; ++i)
+		printf("%s%s", i == 0 ? " (" : ", ", tags[i]);
+
+	if (num > 0)
+		printf(")");
+}
+
+static void write_results(struct cmdline_options const *opts,
+			  struct runtest_stat const *stat,
+			  enum result_status status)
+{
+	struct result_record	res = {
+		.id		= opts->id,
+		.category	= opts->category,
+		.status		= status,
+		.skip_reason	= opts->skip_reason,
+		.fail_reason	= stat->fail_reason[0] ? stat->fail_reason : NULL,
+		.wall_ns	= stat->wall_ns,
+		.is_run		= stat->is_run,
+		.exit_status	= stat->exit_status,
+		.rusage		= stat->rusage,
+		.perf		= stat->has_perf ? &stat->perf : NULL,
+		.baseline	= stat->has_baseline ? &stat->baseline : NULL,
+		.baseline_flags	= stat->baseline_flags,
+		.kmsg		= stat->has_kmsg ? &stat->kmsg : NULL,
+		.mtd		= stat->mtd,
+		.num_mtd	= stat->num_mtd,
+	};
+
+	getrusage(RUSAGE_SELF, &res.runner_rusage);
+
+	if (opts->jsonl)
+		results_write_jsonl(opts->jsonl, &res);
+
+	if (opts->junit)
+		results_write_junit(opts->junit, &res);
+}
+
+/* helper mode for 'runtests' which marks its own phases in the trace;
+ * 'mark' is 'B:<name>' or 'E:<name>' */
+static int run_trace_mark(char const *fname, char const *mark)
+{
+	if (!fname || (mark[0] != 'B' && mark[0] != 'E') || mark[1] != ':') {
+		fprintf(stderr, "bad trace mark '%s'\n", mark);
+		return EX_USAGE;
+	}
+
+	/* the event belongs to the calling shell */
+	if (!trace_mark(fname, mark[0], mark + 2, getppid()))
+		return EX_IOERR;
+
+	return EX_OK;
+}
+
+static void write_trace(struct cmdline_options const *opts)
+{
+	char		label[128];
+
+	if (!opts->trace)
+		return;
+
+	snprintf(label, sizeof label, "runtest %s", opts->id ? opts->id : "");
+	trace_write(opts->trace, label);
+}
+
 int main(int argc, char *argv[])
 {
 	struct cmdline_options		opts = {
 		.is_interactive	= false,
 		.is_quiet = false,
+		.baseline_tol = BASELINE_TOLERANCE_DEFAULT,
+	};
+	struct monitor			mon;
+	struct runtest_ctx		ctx = {
+		.mon	= &mon,
 	};
 	int				rc;
+	uint64_t			t_main;
+	uint64_t			t0;
 
 	/* cmdline parsing */
 	while (1) {
@@ -172,25 +860,103 @@ int main(int argc, char *argv[])
 		case CMD_QUIET 		:  opts.is_quiet = true; break;
 		case CMD_ID		:  opts.id = optarg; break;
 		case CMD_TIMEOUT	:  opts.timeout = atoi(optarg); break;
+		case CMD_EVENTS		:  opts.events = optarg; break;
+		case CMD_REMOTE		:  opts.remote = optarg; break;
+		case CMD_INLINE		:  opts.is_inline = true; break;
+		case CMD_CATEGORY	:  opts.category = optarg; break;
+		case CMD_JSONL		:  opts.jsonl = optarg; break;
+		case CMD_JUNIT		:  opts.junit = optarg; break;
+		case CMD_PERF		:  opts.is_perf = true; break;
+		case CMD_BASELINE	:  opts.baseline = optarg; break;
+		case CMD_BASELINE_STRICT:  opts.is_baseline_strict = true; break;
+		case CMD_BASELINE_RECORD:  opts.baseline_record = optarg; break;
+		case CMD_TRACE		:  opts.trace = optarg; break;
+		case CMD_TRACE_MARK	:  opts.trace_mark = optarg; break;
+		case CMD_KMSG		:  opts.is_kmsg = true; break;
+		case CMD_MTD		:
+			if (opts.num_mtd == ARRAY_SIZE(opts.mtd)) {
+				fprintf(stderr, "too many MTD devices\n");
+				return EX_USAGE;
+			}
+			opts.mtd[opts.num_mtd++] = optarg;
+			break;
+		case CMD_FAIL_ON	:
+			if (!parse_fail_on(&opts.fail_on, optarg))
+				return EX_USAGE;
+			break;
+		case CMD_BASELINE_TOL	:
+			if (!baseline_parse_tolerance(&opts.baseline_tol, optarg))
+				return EX_USAGE;
+			break;
 		default:
 			fprintf(stderr, "Try '--help' for more information\n");
 			return EX_USAGE;
 		}
 	}
 
+	if (opts.remote && (opts.is_kmsg || opts.num_mtd > 0)) {
+		fprintf(stderr,
+			"'--kmsg' and '--mtd' are not supported with '--remote'\n");
+		return EX_USAGE;
+	}
+
+	if (opts.trace_mark)
+		return run_trace_mark(opts.trace, opts.trace_mark);
+
+	if (opts.trace)
+		trace_enable();
+
+	t_main = trace_begin();
+
+	monitor_open(&mon, opts.events);
+	monitor_emit_start(&mon, getpid(), opts.id);
+
 	if (!opts.is_quiet && opts.id)
 		printf("  Running '%s'...", opts.id);
 
 	if (!opts.is_quiet && opts.skip_reason) {
 		printf(" SKIPPED (%s)\n", opts.skip_reason);
+		monitor_emit_status(&mon, MONITOR_STATUS_SKIPPED, 0);
+		monitor_emit_end(&mon, MONITOR_RESULT_SKIPPED, 0, 0);
+
+		t0 = trace_begin();
+		write_results(&opts, &ctx.stat, RESULT_STATUS_SKIPPED);
+		trace_end("results", t0);
 		rc = EX_OK;
 	} else {
-		rc = run_program(&opts, argc - optind, &argv[optind]);
+		/* flush the 'Running' line before the program writes into
+		 * the same fd */
+		fflush(stdout);
+
+		rc = run_program(&opts, &ctx, argc - optind, &argv[optind]);
+
+		t0 = trace_begin();
+		rc = handle_health(&opts, &ctx.stat, rc);
+		rc = handle_baseline(&opts, &ctx.stat, rc);
+
 		if (rc == EX_OK)
-			printf(" OK\n");
+			printf(" OK");
 		else
-			printf(" FAIL\n");
+			printf(" FAIL");
+
+		print_tags(&ctx.stat);
+		printf("\n");
+
+		monitor_emit_end(&mon,
+				 rc == EX_OK ? MONITOR_RESULT_OK : MONITOR_RESULT_FAIL,
+				 ctx.stat.exit_status, ctx.stat.wall_ns);
+		write_results(&opts, &ctx.stat,
+			      rc == EX_OK ? RESULT_STATUS_OK : RESULT_STATUS_FAIL);
+		trace_end("results", t0);
 	}
 
+	monitor_close(&mon);
+
+	if (ctx.stat.has_kmsg)
+		kmsg_close(&ctx.stat.kmsg);
+
+	trace_end("runtest", t_main);
+	write_trace(&opts);
+
 	return rc;
 }
@@ -0,0 +1,312 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sha256.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#  include <cpuid.h>
+#  include <immintrin.h>
+#  define HAVE_SHA256_SHANI	1
+#endif
+
+#include "util.h"
+
+typedef void (*sha256_blocks_fn)(uint32_t state[8], unsigned char const *data,
+				 size_t num_blocks);
+
+static uint32_t const	K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static inline uint32_t ror32(uint32_t v, unsigned int n)
+{
+	return (v >> n) | (v << (32 - n));
+}
+
+static void sha256_blocks_portable(uint32_t state[8], unsigned char const *data,
+				   size_t num_blocks)
+{
+	while (num_blocks-- > 0) {
+		uint32_t	w[64];
+		uint32_t	s[8];
+		unsigned int	i;
+
+		for (i = 0; i < 16; ++i)
+			w[i] = ((uint32_t)data[i * 4 + 0] << 24 |
+				(uint32_t)data[i * 4 + 1] << 16 |
+				(uint32_t)data[i * 4 + 2] <<  8 |
+				(uint32_t)data[i * 4 + 3]);
+
+		for (i = 16; i < 64; ++i) {
+			uint32_t	s0 = (ror32(w[i - 15], 7) ^
+					      ror32(w[i - 15], 18) ^
+					      (w[i - 15] >> 3));
+			uint32_t	s1 = (ror32(w[i - 2], 17) ^
+					      ror32(w[i - 2], 19) ^
+					      (w[i - 2] >> 10));
+
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+
+		memcpy(s, state, sizeof s);
+
+		for (i = 0; i < 64; ++i) {
+			uint32_t	S1 = ror32(s[4], 6) ^ ror32(s[4], 11) ^ ror32(s[4], 25);
+			uint32_t	ch = (s[4] & s[5]) ^ (~s[4] & s[6]);
+			uint32_t	t1 = s[7] + S1 + ch + K[i] + w[i];
+			uint32_t	S0 = ror32(s[0], 2) ^ ror32(s[0], 13) ^ ror32(s[0], 22);
+			uint32_t	maj = (s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]);
+			uint32_t	t2 = S0 + maj;
+
+			s[7] = s[6];
+			s[6] = s[5];
+			s[5] = s[4];
+			s[4] = s[3] + t1;
+			s[3] = s[2];
+			s[2] = s[1];
+			s[1] = s[0];
+			s[0] = t1 + t2;
+		}
+
+		for (i = 0; i < 8; ++i)
+			state[i] += s[i];
+
+		data += SHA256_BLOCK_SIZE;
+	}
+}
+
+#ifdef HAVE_SHA256_SHANI
+/* The SHA extensions keep the state as ABEF/CDGH and process four
+ * rounds per pair of sha256rnds2.  Message group 'g' (rounds 4g..4g+3)
+ * finishes the schedule of group g+1 and starts the one of group g+3. */
+__attribute__((__target__("sha,sse4.1,ssse3")))
+static void sha256_blocks_shani(uint32_t state[8], unsigned char const *data,
+				size_t num_blocks)
+{
+	__m128i const	bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bull,
+					       0x0405060700010203ull);
+	__m128i		st0;
+	__m128i		st1;
+	__m128i		tmp;
+
+	tmp = _mm_loadu_si128((void const *)&state[0]);
+	st1 = _mm_loadu_si128((void const *)&state[4]);
+
+	tmp = _mm_shuffle_epi32(tmp, 0xb1);		/* CDAB */
+	st1 = _mm_shuffle_epi32(st1, 0x1b);		/* EFGH */
+	st0 = _mm_alignr_epi8(tmp, st1, 8);		/* ABEF */
+	st1 = _mm_blend_epi16(st1, tmp, 0xf0);		/* CDGH */
+
+	while (num_blocks-- > 0) {
+		__m128i		abef = st0;
+		__m128i		cdgh = st1;
+		__m128i		m[4];
+		unsigned int	g;
+
+		for (g = 0; g < 16; ++g) {
+			__m128i	msg;
+
+			if (g < 4)
+				m[g] = _mm_shuffle_epi8(
+					_mm_loadu_si128((void const *)(data + g * 16)),
+					bswap);
+
+			msg = _mm_add_epi32(m[g % 4],
+					    _mm_loadu_si128((void const *)&K[g * 4]));
+			st1 = _mm_sha256rnds2_epu32(st1, st0, msg);
+
+			if (g >= 3 && g <= 14) {
+				tmp = _mm_alignr_epi8(m[g % 4], m[(g + 3) % 4], 4);
+				m[(g + 1) % 4] = _mm_add_epi32(m[(g + 1) % 4], tmp);
+				m[(g + 1) % 4] = _mm_sha256msg2_epu32(m[(g + 1) % 4],
+								      m[g % 4]);
+			}
+
+			msg = _mm_shuffle_epi32(msg, 0x0e);
+			st0 = _mm_sha256rnds2_epu32(st0, st1, msg);
+
+			if (g >= 1 && g <= 12)
+				m[(g + 3) % 4] = _mm_sha256msg1_epu32(m[(g + 3) % 4],
+								      m[g % 4]);
+		}
+
+		st0 = _mm_add_epi32(st0, abef);
+		st1 = _mm_add_epi32(st1, cdgh);
+
+		data += SHA256_BLOCK_SIZE;
+	}
+
+	tmp = _mm_shuffle_epi32(st0, 0x1b);		/* FEBA */
+	st1 = _mm_shuffle_epi32(st1, 0xb1);		/* DCHG */
+	st0 = _mm_blend_epi16(tmp, st1, 0xf0);		/* DCBA */
+	st1 = _mm_alignr_epi8(st1, tmp, 8);		/* HGFE */
+
+	_mm_storeu_si128((void *)&state[0], st0);
+	_mm_storeu_si128((void *)&state[4], st1);
+}
+
+static bool sha256_shani_supported(void)
+{
+	unsigned int	a, b, c, d;
+
+	if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_SSE4_1) ||
+	    !(c & bit_SSSE3))
+		return false;
+
+	return (__get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & bit_SHA));
+}
+#endif	/* HAVE_SHA256_SHANI */
+
+static struct {
+	char const		*name;
+	sha256_blocks_fn	fn;
+	bool			(*is_supported)(void);
+} const				SHA256_IMPLS[] = {
+#ifdef HAVE_SHA256_SHANI
+	{ "sha-ni",	sha256_blocks_shani, sha256_shani_supported },
+#endif
+	{ "portable",	sha256_blocks_portable, NULL },
+};
+
+static unsigned int	sha256_idx = ARRAY_SIZE(SHA256_IMPLS);
+
+bool sha256_select(char const *name)
+{
+	unsigned int	i;
+
+	for (i = 0; i < ARRAY_SIZE(SHA256_IMPLS); ++i) {
+		if (name && strcmp(name, SHA256_IMPLS[i].name) != 0)
+			continue;
+
+		if (!SHA256_IMPLS[i].is_supported ||
+		    SHA256_IMPLS[i].is_supported()) {
+			__atomic_store_n(&sha256_idx, i, __ATOMIC_RELAXED);
+			return true;
+		}
+
+		if (name)
+			break;
+	}
+
+	return false;
+}
+
+static sha256_blocks_fn sha256_blocks(void)
+{
+	unsigned int	idx = __atomic_load_n(&sha256_idx, __ATOMIC_RELAXED);
+
+	/* concurrent first calls select the same implementation */
+	if (__builtin_expect(idx == ARRAY_SIZE(SHA256_IMPLS), 0)) {
+		sha256_select(NULL);
+		idx = __atomic_load_n(&sha256_idx, __ATOMIC_RELAXED);
+	}
+
+	return SHA256_IMPLS[idx].fn;
+}
+
+char const *sha256_impl(void)
+{
+	sha256_blocks();
+
+	return SHA256_IMPLS[sha256_idx].name;
+}
+
+void sha256_init(struct sha256 *ctx)
+{
+	static uint32_t const	H0[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
+
+	memcpy(ctx->state, H0, sizeof H0);
+	ctx->len = 0;
+	ctx->buf_len = 0;
+}
+
+void sha256_update(struct sha256 *ctx, void const *data_, size_t len)
+{
+	unsigned char const	*data = data_;
+	sha256_blocks_fn	blocks = sha256_blocks();
+	size_t			n;
+
+	ctx->len += len;
+
+	if (ctx->buf_len > 0) {
+		n = SHA256_BLOCK_SIZE - ctx->buf_len;
+		if (n > len)
+			n = len;
+
+		memcpy(ctx->buf + ctx->buf_len, data, n);
+		ctx->buf_len += n;
+		data += n;
+		len  -= n;
+
+		if (ctx->buf_len < SHA256_BLOCK_SIZE)
+			return;
+
+		blocks(ctx->state, ctx->buf, 1);
+		ctx->buf_len = 0;
+	}
+
+	n = len / SHA256_BLOCK_SIZE;
+	if (n > 0) {
+		blocks(ctx->state, data, n);
+		data += n * SHA256_BLOCK_SIZE;
+		len  -= n * SHA256_BLOCK_SIZE;
+	}
+
+	memcpy(ctx->buf, data, len);
+	ctx->buf_len = len;
+}
+
+void sha256_final(struct sha256 *ctx, unsigned char digest[SHA256_DIGEST_SIZE])
+{
+	uint64_t	bits = ctx->len * 8;
+	unsigned char	pad[SHA256_BLOCK_SIZE + 8] = { 0x80 };
+	size_t		pad_len;
+	unsigned int	i;
+
+	pad_len = (ctx->buf_len < 56 ? 56 : 120) - ctx->buf_len;
+
+	for (i = 0; i < 8; ++i)
+		pad[pad_len + i] = bits >> (56 - i * 8);
+
+	sha256_update(ctx, pad, pad_len + 8);
+
+	for (i = 0; i < 8; ++i) {
+		digest[i * 4 + 0] = ctx->state[i] >> 24;
+		digest[i * 4 + 1] = ctx->state[i] >> 16;
+		digest[i * 4 + 2] = ctx->state[i] >>  8;
+		digest[i * 4 + 3] = ctx->state[i];
+	}
+}
@@ -0,0 +1,46 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_TESTSUITE_SRC_SHA256_H
+#define H_ENSC_TESTSUITE_SRC_SHA256_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_SIZE	32
+#define SHA256_BLOCK_SIZE	64
+
+struct sha256 {
+	uint32_t	state[8];
+	uint64_t	len;
+	unsigned char	buf[SHA256_BLOCK_SIZE];
+	size_t		buf_len;
+};
+
+void sha256_init(struct sha256 *ctx);
+void sha256_update(struct sha256 *ctx, void const *data, size_t len);
+void sha256_final(struct sha256 *ctx, unsigned char digest[SHA256_DIGEST_SIZE]);
+
+/* Name of the block function ('sha-ni' or 'portable'); it is
+ * selected at the first use according to the CPU features. */
+char const *sha256_impl(void);
+
+/* Forces an implementation; fails when it is unknown or not supported
+ * by the CPU. */
+bool sha256_select(char const *name);
+
+#endif	/* H_ENSC_TESTSUITE_SRC_SHA256_H */
@@ -0,0 +1,146 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "strbuf.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
+void strbuf_printf(struct strbuf *buf, char const *fmt, ...)
+{
+	va_list		ap;
+	int		l;
+
+	if (buf->is_oom)
+		return;
+
+	for (;;) {
+		size_t	avail = buf->alloc - buf->len;
+		char	*tmp;
+
+		va_start(ap, fmt);
+		l = vsnprintf(buf->data + buf->len, avail, fmt, ap);
+		va_end(ap);
+
+		if (l < 0) {
+			buf->is_oom = true;
+			return;
+		}
+
+		if ((size_t)l < avail)
+			break;
+
+		tmp = realloc(buf->data, buf->alloc + l + 256);
+		if (!tmp) {
+			buf->is_oom = true;
+			return;
+		}
+
+		buf->data   = tmp;
+		buf->alloc += l + 256;
+	}
+
+	buf->len += l;
+}
+
+void strbuf_json_str(struct strbuf *buf, char const *str)
+{
+	unsigned char const	*p = (void const *)str;
+
+	if (!str) {
+		strbuf_printf(buf, "null");
+		return;
+	}
+
+	strbuf_printf(buf, "\"");
+	for (; *p; ++p) {
+		switch (*p) {
+		case '"':  strbuf_printf(buf, "\\\""); break;
+		case '\\': strbuf_printf(buf, "\\\\"); break;
+		case '\n': strbuf_printf(buf, "\\n"); break;
+		case '\t': strbuf_printf(buf, "\\t"); break;
+		default:
+			if (*p < 0x20)
+				strbuf_printf(buf, "\\u%04x", *p);
+			else
+				strbuf_printf(buf, "%c", *p);
+		}
+	}
+	strbuf_printf(buf, "\"");
+}
+
+void strbuf_xml_str(struct strbuf *buf, char const *str)
+{
+	unsigned char const	*p = (void const *)str;
+
+	for (; p && *p; ++p) {
+		switch (*p) {
+		case '"':  strbuf_printf(buf, "&quot;"); break;
+		case '&':  strbuf_printf(buf, "&amp;"); break;
+		case '<':  strbuf_printf(buf, "&lt;"); break;
+		case '>':  strbuf_printf(buf, "&gt;"); break;
+		/* escaped so that attribute values keep them */
+		case '\t':
+		case '\n':
+		case '\r':
+			strbuf_printf(buf, "&#%u;", *p);
+			break;
+		default:
+			/* other control characters are not allowed in XML 1.0,
+			 * not even as character references */
+			if (*p < 0x20)
+				strbuf_printf(buf, "\xef\xbf\xbd");
+			else
+				strbuf_printf(buf, "%c", *p);
+		}
+	}
+}
+
+bool strbuf_append_to(struct strbuf *buf, char const *fname)
+{
+	int	fd;
+	bool	rc;
+
+	if (buf->is_oom) {
+		fprintf(stderr, "%s: out of memory\n", fname);
+		return false;
+	}
+
+	fd = open(fname, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+	if (fd < 0) {
+		fprintf(stderr, "open(%s): %s\n", fname, strerror(errno));
+		return false;
+	}
+
+	/* a single write() keeps records from concurrent writers apart */
+	rc = write_all(fd, buf->data, buf->len);
+	close(fd);
+
+	return rc;
+}
+
+void strbuf_free(struct strbuf *buf)
+{
+	free(buf->data);
+	buf->data  = NULL;
+	buf->len   = 0;
+	buf->alloc = 0;
+}
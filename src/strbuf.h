@@ -0,0 +1,42 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_TESTSUITE_SRC_STRBUF_H
+#define H_ENSC_TESTSUITE_SRC_STRBUF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* growing string buffer; allocation errors are sticky and reported by
+ * strbuf_append_to() */
+struct strbuf {
+	char		*data;
+	size_t		len;
+	size_t		alloc;
+	bool		is_oom;
+};
+
+void strbuf_printf(struct strbuf *buf, char const *fmt, ...)
+	__attribute__((__format__(printf, 2, 3)));
+
+void strbuf_json_str(struct strbuf *buf, char const *str);
+void strbuf_xml_str(struct strbuf *buf, char const *str);
+
+/* appends the content with a single write() to 'fname' */
+bool strbuf_append_to(struct strbuf *buf, char const *fname);
+void strbuf_free(struct strbuf *buf);
+
+#endif	/* H_ENSC_TESTSUITE_SRC_STRBUF_H */
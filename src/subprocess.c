@@ -27,6 +27,7 @@
 #include <sys/timerfd.h>
 #include <sys/epoll.h>
 
+#include "trace.h"
 #include "util.h"
 
 bool subprocess_init(struct subprocess *proc, bool is_interactive)
@@ -38,8 +39,10 @@ bool subprocess_init(struct subprocess *proc, bool is_interactive)
 	proc->is_interactive = is_interactive;
 	proc->is_spawned = false;
 	proc->timeout = 5;
+	proc->run_timeout = 0;
 
 	proc->pid = -1;
+	proc->fd_timer = -1;
 	proc->pipe_ctl.rd = -1;
 	proc->pipe_ctl.wr = -1;
 	proc->old_chld_mask = 0;
@@ -183,7 +186,8 @@ static void subprocess_child_terminate(struct subprocess *proc)
 		goto out;
 	}
 
-	if (wait4(proc->pid, NULL, WNOHANG, &proc->rusage) == proc->pid)
+	if (wait4(proc->pid, &proc->exit_status, WNOHANG,
+		  &proc->rusage) == proc->pid)
 		proc->pid = -1;
 	else if (kill(proc->pid, SIGTERM) < 0)
 		perror("kill(<chld>, SIGTERM)");
@@ -205,7 +209,8 @@ static void subprocess_child_terminate(struct subprocess *proc)
 		else if (kill(proc->pid, SIGKILL) < 0)
 			perror("kill(<chld>, SIGKILL)");
 
-		if (wait4(proc->pid, NULL, 0, &proc->rusage) == proc->pid)
+		if (wait4(proc->pid, &proc->exit_status, 0,
+			  &proc->rusage) == proc->pid)
 			proc->pid = -1;
 	}
 
@@ -220,6 +225,7 @@ static bool subprocess_main_start(struct subprocess *proc)
 	bool		rc;
 	char		buf[128];
 	ssize_t		l;
+	uint64_t	t0;
 
 	close(proc->pipe_ctl.wr);
 	proc->pipe_ctl.wr = -1;
@@ -233,7 +239,11 @@ static bool subprocess_main_start(struct subprocess *proc)
 	close(proc->pipe_std[2].wr);
 	proc->pipe_std[2].wr = -1;
 
+	/* returns on exec() of the child which closes the write end */
+	t0 = trace_begin();
 	l = read(proc->pipe_ctl.rd, buf, sizeof buf);
+	trace_end("exec-handshake", t0);
+
 	if (l > 0) {
 		fprintf(stderr, "internal error: %.*s\n", (int)l, buf);
 		rc = false;
@@ -252,6 +262,7 @@ bool subprocess_spawn(struct subprocess *proc, int argc, char *argv[],
 	bool		rc = false;
 	sigset_t	mask;
 	sigset_t	old_mask;
+	uint64_t	t0;
 
 	assert(proc->is_init);
 	assert(!proc->is_spawned);
@@ -267,9 +278,13 @@ bool subprocess_spawn(struct subprocess *proc, int argc, char *argv[],
 
 	proc->old_chld_mask = sigismember(&old_mask, SIGCHLD) ? 1 : -1;
 
+	t0 = trace_begin();
 	proc->pid = fork();
 	proc->is_spawned = proc->pid >= 0;
 
+	if (proc->pid > 0)
+		trace_end("fork", t0);
+
 	if (proc->pid < 0)
 		goto out;
 	else if (proc->pid == 0)
@@ -315,6 +330,13 @@ static bool subprocess_run_fds_init(struct subprocess_run_fds *fds,
 	sigemptyset(&mask);
 	sigaddset(&mask, SIGCHLD);
 
+	/* restored by subprocess_run_fds_destroy(); SIGCHLD stays blocked
+	 * for subprocess_child_terminate() */
+	if (sigprocmask(SIG_BLOCK, &mask, &fds->orig_sigmask) < 0) {
+		perror("sigprocmask(<SIG_BLOCK>, <SIGCHLD>)");
+		goto out;
+	}
+
 	fds->signal = signalfd(-1, &mask, 0);
 	if (fds->signal < 0) {
 		perror("signalfd()");
@@ -462,12 +484,16 @@ bool subprocess_run(struct subprocess *proc,
 	bool		ret 		= false;
 	unsigned long	old_flags	= ~0Lu; /* signals first run */
 	struct subprocess_epoll_fdinfo const	cb_fds[] = {
-		[SUBPROCESS_CB_SOURCE_MONITOR] = { cb->fd_monitor, true},
+		/* the monitor is a control channel; data is sent
+		 * synchronously by the callbacks */
+		[SUBPROCESS_CB_SOURCE_MONITOR] = { cb->fd_monitor, false },
 		[SUBPROCESS_CB_SOURCE_STDIN] =	{ proc->pipe_std[0].wr, true },
 		[SUBPROCESS_CB_SOURCE_STDOUT] =	{ proc->pipe_std[1].rd, false },
 		[SUBPROCESS_CB_SOURCE_STDERR] =	{ proc->pipe_std[2].rd, false },
+		[SUBPROCESS_CB_SOURCE_AUX] =	{ cb->fd_aux, false },
 	};
 	unsigned long	hup_mask = 0;
+	uint64_t	t_reap;
 
 
 	assert(proc->is_init);
@@ -481,19 +507,26 @@ bool subprocess_run(struct subprocess *proc,
 	assert((int)SUBPROCESS_CB_FLAG_STDIN   == (int)SUBPROCESS_CB_SOURCE_STDIN);
 	assert((int)SUBPROCESS_CB_FLAG_STDOUT  == (int)SUBPROCESS_CB_SOURCE_STDOUT);
 	assert((int)SUBPROCESS_CB_FLAG_STDERR  == (int)SUBPROCESS_CB_SOURCE_STDERR);
+	assert((int)SUBPROCESS_CB_FLAG_AUX     == (int)SUBPROCESS_CB_SOURCE_AUX);
 
 	if (cb->fd_monitor != -1)
 		set_bit(SUBPROCESS_CB_SOURCE_MONITOR, &hup_mask);
 
+	if (cb->fd_aux != -1)
+		set_bit(SUBPROCESS_CB_SOURCE_AUX, &hup_mask);
+
 	set_bit(SUBPROCESS_CB_SOURCE_STDIN,  &hup_mask);
 	set_bit(SUBPROCESS_CB_SOURCE_STDOUT, &hup_mask);
 	set_bit(SUBPROCESS_CB_SOURCE_STDERR, &hup_mask);
 
-	/* \todo: allow to customize timeout */
-	if (!subprocess_run_fds_init(&fds, 10))
+	if (!subprocess_run_fds_init(&fds, (proc->run_timeout > 0 ?
+					    proc->run_timeout :
+					    SUBPROCESS_DEFAULT_TIMEOUT)))
 		/* \todo: signal OSERR */
 		goto out;
 
+	proc->fd_timer = fds.timer;
+
 #if 0
 	if (wait4(proc->pid, &proc->exit_status,
 		  WNOHANG, &proc->rusage) == proc->pid) {
@@ -506,9 +539,10 @@ bool subprocess_run(struct subprocess *proc,
 		unsigned long		flags;
 		int			rc = 0;
 		int			nfds;
-		struct epoll_event	events[6];
+		struct epoll_event	events[7];
 		unsigned long		sources_mask;
 		enum subprocess_cb_source	src;
+		uint64_t		t0;
 
 		flags = 0;
 		if (old_flags != ~0Lu)
@@ -519,6 +553,7 @@ bool subprocess_run(struct subprocess *proc,
 			set_bit(SUBPROCESS_CB_SOURCE_STDIN, &flags);
 			set_bit(SUBPROCESS_CB_SOURCE_STDOUT, &flags);
 			set_bit(SUBPROCESS_CB_SOURCE_STDERR, &flags);
+			set_bit(SUBPROCESS_CB_SOURCE_AUX, &flags);
 			old_flags = ~flags;
 		}
 
@@ -528,7 +563,7 @@ bool subprocess_run(struct subprocess *proc,
 			break;
 
 		for (src = SUBPROCESS_CB_SOURCE_MONITOR;
-		     src <= SUBPROCESS_CB_SOURCE_STDERR && rc >= 0;
+		     src <= SUBPROCESS_CB_SOURCE_AUX && rc >= 0;
 		     ++src) {
 			if (cb_fds[src].fd < 0)
 				continue;
@@ -545,7 +580,10 @@ bool subprocess_run(struct subprocess *proc,
 
 		old_flags = flags;
 
+		t0 = trace_begin();
 		nfds = epoll_wait(fds.epoll, events, ARRAY_SIZE(events), -1);
+		trace_end("epoll_wait", t0);
+
 		if (nfds < 0) {
 			perror("epoll_wait()");
 			break;
@@ -567,24 +605,29 @@ bool subprocess_run(struct subprocess *proc,
 				clear_bit(src, &hup_mask);
 		}
 
+		t0 = trace_begin();
 		if (!subprocess_run_exec_cb(cb, sources_mask, cb_fds))
 			ret = true;
+		trace_end("dispatch", t0);
 	}
 
 	if (proc->pid == -1 || !ret)
 		goto out;
 
+	t_reap = trace_begin();
 	if (wait4(proc->pid, &proc->exit_status,
 		  WNOHANG, &proc->rusage) != proc->pid) {
 		ret = false;
 		goto out;
 	}
+	trace_end("reap", t_reap);
 
 	proc->pid = -1;
 		
 		
 
 out:
+	proc->fd_timer = -1;
 	subprocess_run_fds_destroy(&fds);
 
 	if (!ret && proc->pid != -1)
@@ -592,3 +635,30 @@ out:
 
 	return ret;
 }
+
+/* Extends the timeout of a running subprocess_run() by 'secs' seconds */
+bool subprocess_extend_timeout(struct subprocess *proc, unsigned int secs)
+{
+	struct itimerspec	tm;
+
+	if (proc->fd_timer < 0)
+		return false;
+
+	if (timerfd_gettime(proc->fd_timer, &tm) < 0) {
+		perror("timerfd_gettime()");
+		return false;
+	}
+
+	if (tm.it_value.tv_sec == 0 && tm.it_value.tv_nsec == 0)
+		/* timer expired already */
+		return false;
+
+	tm.it_value.tv_sec += secs;
+
+	if (timerfd_settime(proc->fd_timer, 0, &tm, NULL) < 0) {
+		perror("timerfd_settime()");
+		return false;
+	}
+
+	return true;
+}
@@ -24,9 +24,15 @@
 
 #include "pipe.h"
 
+/* seconds after which subprocess_run() gives up */
+#define SUBPROCESS_DEFAULT_TIMEOUT	10
+
 struct subprocess {
 	bool			is_interactive;
 	unsigned int		timeout; /* modify directly! */
+	/* seconds until subprocess_run() terminates the child; 0 selects
+	 * SUBPROCESS_DEFAULT_TIMEOUT */
+	unsigned int		run_timeout;
 
 	pid_t			pid;
 	struct pipe		pipe_ctl;
@@ -35,6 +41,9 @@ struct subprocess {
 	struct rusage		rusage;
 	int			exit_status;
 
+	/* timerfd of the running subprocess_run() loop; -1 else */
+	int			fd_timer;
+
 	sigset_t		old_mask;
 
 	int			old_chld_mask;
@@ -47,6 +56,7 @@ enum subprocess_cb_flags {
 	SUBPROCESS_CB_FLAG_STDIN,
 	SUBPROCESS_CB_FLAG_STDOUT,
 	SUBPROCESS_CB_FLAG_STDERR,
+	SUBPROCESS_CB_FLAG_AUX,
 
 	SUBPROCESS_CB_FLAG_QUIT,
 };
@@ -56,6 +66,7 @@ enum subprocess_cb_source {
 	SUBPROCESS_CB_SOURCE_STDIN,
 	SUBPROCESS_CB_SOURCE_STDOUT,
 	SUBPROCESS_CB_SOURCE_STDERR,
+	SUBPROCESS_CB_SOURCE_AUX,
 
 	SUBPROCESS_CB_SOURCE_TIMEOUT,
 	SUBPROCESS_CB_SOURCE_EXIT,
@@ -67,6 +78,9 @@ typedef void	subprocess_child_cleanup_fn(void *priv);
 
 struct subprocess_callbacks {
 	int			fd_monitor;
+	/* additional input fd (e.g. /dev/kmsg) which is polled while the
+	 * subprocess runs; -1 when unused */
+	int			fd_aux;
 
 	subprocess_cb_step	*fn_step;
 	subprocess_cb_fn	*fn_handle;
@@ -82,4 +96,6 @@ bool subprocess_spawn(struct subprocess *proc, int argc, char *argv[],
 bool subprocess_run(struct subprocess *proc,
 		    struct subprocess_callbacks const *cb);
 
+bool subprocess_extend_timeout(struct subprocess *proc, unsigned int secs);
+
 #endif	/* H_ENSC_TESTSUITE_SRC_SUBPROCESS_H */
@@ -0,0 +1,111 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "trace.h"
+
+#include <unistd.h>
+
+#include "strbuf.h"
+
+struct trace_event {
+	char const	*name;
+	uint64_t	ts_ns;
+	uint64_t	dur_ns;
+};
+
+bool				trace_is_enabled;
+
+static struct trace_event	trace_buf[TRACE_MAX_EVENTS];
+static unsigned int		trace_num;
+static unsigned long		trace_num_dropped;
+
+void trace_enable(void)
+{
+	trace_is_enabled = true;
+}
+
+void trace_record(char const *name, uint64_t t0, uint64_t t1)
+{
+	if (trace_num >= TRACE_MAX_EVENTS) {
+		++trace_num_dropped;
+		return;
+	}
+
+	trace_buf[trace_num++] = (struct trace_event) {
+		.name	= name,
+		.ts_ns	= t0,
+		.dur_ns	= t1 - t0,
+	};
+}
+
+/* the trace format expects microseconds; keep the ns resolution */
+static void trace_printf_us(struct strbuf *buf, char const *key,
+			    uint64_t ns)
+{
+	strbuf_printf(buf, ",\"%s\":%llu.%03u", key,
+		      (unsigned long long)(ns / 1000u),
+		      (unsigned int)(ns % 1000u));
+}
+
+bool trace_write(char const *fname, char const *label)
+{
+	struct strbuf	buf = { .data = NULL };
+	int		pid = getpid();
+	unsigned int	i;
+	bool		rc;
+
+	if (!trace_is_enabled)
+		return true;
+
+	strbuf_printf(&buf, "{\"name\":\"process_name\",\"ph\":\"M\""
+		      ",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":", pid, pid);
+	strbuf_json_str(&buf, label);
+	strbuf_printf(&buf, ",\"dropped\":%lu}},\n", trace_num_dropped);
+
+	for (i = 0; i < trace_num; ++i) {
+		struct trace_event const	*ev = &trace_buf[i];
+
+		strbuf_printf(&buf, "{\"name\":\"%s\",\"ph\":\"X\"", ev->name);
+		trace_printf_us(&buf, "ts", ev->ts_ns);
+		trace_printf_us(&buf, "dur", ev->dur_ns);
+		strbuf_printf(&buf, ",\"pid\":%d,\"tid\":%d},\n", pid, pid);
+	}
+
+	rc = strbuf_append_to(&buf, fname);
+	strbuf_free(&buf);
+
+	trace_num = 0;
+	trace_num_dropped = 0;
+
+	return rc;
+}
+
+bool trace_mark(char const *fname, char ph, char const *name, int pid)
+{
+	struct strbuf	buf = { .data = NULL };
+	bool		rc;
+
+	strbuf_printf(&buf, "{\"name\":");
+	strbuf_json_str(&buf, name);
+	strbuf_printf(&buf, ",\"ph\":\"%c\"", ph);
+	trace_printf_us(&buf, "ts", monotonic_ns());
+	strbuf_printf(&buf, ",\"pid\":%d,\"tid\":%d},\n", pid, pid);
+
+	rc = strbuf_append_to(&buf, fname);
+	strbuf_free(&buf);
+
+	return rc;
+}
@@ -0,0 +1,62 @@
+/*	--*- c -*--
+ * Copyright (C) 2012 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_TESTSUITE_SRC_TRACE_H
+#define H_ENSC_TESTSUITE_SRC_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "util.h"
+
+/* Self tracing of the runner.  Spans are kept in a preallocated buffer
+ * and written as Chrome trace events ("JSON array format") by
+ * trace_write().  Every process appends its events with a single write()
+ * and a trailing ',' so that all runtest instances of a suite can share
+ * one file; 'runtests' adds the opening '[' and the closing ']'.
+ *
+ * When tracing is disabled, trace_begin() and trace_end() cost one
+ * predicted branch on a global flag.  'name' must be a string literal;
+ * it is not copied. */
+
+#define TRACE_MAX_EVENTS	4096
+
+extern bool	trace_is_enabled;
+
+void trace_enable(void);
+void trace_record(char const *name, uint64_t t0, uint64_t t1);
+
+/* 'label' names the process in the trace viewer */
+bool trace_write(char const *fname, char const *label);
+
+/* appends a single 'B' or 'E' event for process 'pid' */
+bool trace_mark(char const *fname, char ph, char const *name, int pid);
+
+static inline uint64_t trace_begin(void)
+{
+	if (__builtin_expect(trace_is_enabled, 0))
+		return monotonic_ns();
+
+	return 0;
+}
+
+static inline void trace_end(char const *name, uint64_t t0)
+{
+	if (__builtin_expect(trace_is_enabled, 0))
+		trace_record(name, t0, monotonic_ns());
+}
+
+#endif	/* H_ENSC_TESTSUITE_SRC_TRACE_H */
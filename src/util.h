@@ -21,6 +21,10 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
 
 #define ARRAY_SIZE(_a)		(sizeof(_a) / sizeof (_a)[0])
 
@@ -60,6 +64,14 @@ static inline bool write_all(int fd, void const *buf, size_t len)
 	return len == 0;
 }
 
+static inline uint64_t monotonic_ns(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
 static inline bool test_bit(unsigned int num, unsigned long const *mask)
 {
 	return (mask[num / (CHAR_BIT * sizeof mask[0])] &
@@ -0,0 +1,10 @@
+RUNTEST = ${pkglibexecdir}/runtest
+PATH := ${pkglibexecdir}:${PATH}
+
+export pkgdatadir pkglibexecdir pkglibdir TMPDIR
+
+test-%:
+	$(RUNTEST) --id "$(ID)" $(RUNTEST_GLOBAL_OPTS) $(RUNTEST_OPTS) $(TESTDIR)/$* || :
+
+category_start-%:
+	@echo "========== $* =========="